@@ -0,0 +1,14 @@
+#!/bin/bash -xe
+
+# setup
+export CXX=${CXX:-"aarch64-linux-gnu-g++"}
+export CXXFLAGS='-O2 -g0 -std=gnu++14 -fno-gnu-keywords'
+export QEMU=${QEMU:-"qemu-aarch64"}
+
+# build
+${CXX} --version
+${CXX} ${CXXFLAGS} -static -Wall -Wextra -Werror  \
+  poseidon/src/fiber_switch_benchmark.cpp -o fiber_switch_benchmark.aarch64
+
+# test
+${QEMU} ./fiber_switch_benchmark.aarch64
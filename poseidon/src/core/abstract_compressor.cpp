@@ -0,0 +1,503 @@
+// This file is part of Poseidon.
+// Copyleft 2020, LH_Mouse. All wrongs reserved.
+
+#include "../precompiled.hpp"
+#include "abstract_compressor.hpp"
+#include "zlib_deflator.hpp"
+#include "../http/option_map.hpp"
+#include "../utils.hpp"
+
+#ifdef POSEIDON_ENABLE_ZSTD
+#  include <zstd.h>
+#endif
+
+#ifdef POSEIDON_ENABLE_BROTLI
+#  include <brotli/encode.h>
+#endif
+
+namespace poseidon {
+namespace {
+
+// These are supported content codings, in descending order of preference.
+constexpr const char* s_content_codings[] =
+  {
+#ifdef POSEIDON_ENABLE_ZSTD
+    "zstd",
+#endif
+#ifdef POSEIDON_ENABLE_BROTLI
+    "br",
+#endif
+    "gzip",
+  };
+
+constexpr size_t s_content_coding_count =
+    sizeof(s_content_codings) / sizeof(*s_content_codings);
+
+class gzip_Compressor
+  final
+  : public Abstract_Compressor
+  {
+  private:
+    zlib_Deflator m_defl;
+
+  public:
+    explicit
+    gzip_Compressor(int level)
+      : m_defl(zlib_Deflator::format_gzip,
+               (level < 0) ? Z_DEFAULT_COMPRESSION : ::rocket::min(level, 9))
+      { }
+
+  private:
+    void
+    do_compressor_reset()
+      override
+      { this->m_defl.reset();  }
+
+    void
+    do_compressor_write(::rocket::linear_buffer& obuf, const char* data, size_t size)
+      override
+      { this->m_defl.write_into(obuf, data, size);  }
+
+    void
+    do_compressor_flush(::rocket::linear_buffer& obuf)
+      override
+      { this->m_defl.flush_into(obuf);  }
+
+    void
+    do_compressor_finish(::rocket::linear_buffer& obuf)
+      override
+      { this->m_defl.finish_into(obuf);  }
+
+  public:
+    ~gzip_Compressor()
+      override;
+
+    const char*
+    content_coding()
+      const noexcept override
+      { return "gzip";  }
+  };
+
+gzip_Compressor::
+~gzip_Compressor()
+  = default;
+
+#ifdef POSEIDON_ENABLE_ZSTD
+
+// Compression contexts are borrowed from this pool, like zlib streams. Each
+// context takes about 1MiB of memory at the default level, so we don't keep
+// too many of them around.
+constexpr size_t s_zstd_pool_capacity = 16;
+
+simple_mutex s_zstd_pool_mutex;
+::ZSTD_CCtx* s_zstd_pool[s_zstd_pool_capacity];
+size_t s_zstd_pool_size;
+
+class zstd_Compressor
+  final
+  : public Abstract_Compressor
+  {
+  private:
+    int m_level;
+    ::ZSTD_CCtx* m_cctx = nullptr;
+
+  public:
+    explicit
+    zstd_Compressor(int level)
+      {
+        // The default level of zstd is fast enough for dynamic content.
+        this->m_level = (level < 0) ? ZSTD_CLEVEL_DEFAULT
+                                    : ::rocket::clamp(level, 1, ::ZSTD_maxCLevel());
+      }
+
+  private:
+    void
+    do_release_cctx()
+      noexcept
+      {
+        auto cctx = ::std::exchange(this->m_cctx, nullptr);
+        if(!cctx)
+          return;
+
+        // Make the context ready for the next user. If it cannot be reset, it
+        // is destroyed instead.
+        if(::ZSTD_isError(::ZSTD_CCtx_reset(cctx, ZSTD_reset_session_and_parameters))) {
+          ::ZSTD_freeCCtx(cctx);
+          return;
+        }
+
+        simple_mutex::unique_lock lock(s_zstd_pool_mutex);
+        if(s_zstd_pool_size >= s_zstd_pool_capacity) {
+          lock.unlock();
+          ::ZSTD_freeCCtx(cctx);
+          return;
+        }
+        s_zstd_pool[s_zstd_pool_size++] = cctx;
+      }
+
+    ::ZSTD_CCtx*
+    do_acquire_cctx()
+      {
+        if(ROCKET_EXPECT(this->m_cctx))
+          return this->m_cctx;
+
+        // Take a context from the pool, or allocate a new one. As parameters
+        // are reset upon release, all contexts in the pool are compatible.
+        simple_mutex::unique_lock lock(s_zstd_pool_mutex);
+        ::ZSTD_CCtx* cctx = nullptr;
+        if(s_zstd_pool_size != 0)
+          cctx = s_zstd_pool[--s_zstd_pool_size];
+        lock.unlock();
+
+        if(!cctx)
+          cctx = ::ZSTD_createCCtx();
+        if(!cctx)
+          POSEIDON_THROW("Could not create zstd compression context");
+
+        ::ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, this->m_level);
+        this->m_cctx = cctx;
+        return cctx;
+      }
+
+    void
+    do_compress(::rocket::linear_buffer& obuf, const char* data, size_t size,
+                ::ZSTD_EndDirective mode)
+      {
+        auto cctx = this->do_acquire_cctx();
+        ::ZSTD_inBuffer in = { data, size, 0 };
+        size_t res;
+        do {
+          size_t navail = obuf.reserve(::ZSTD_CStreamOutSize());
+          ::ZSTD_outBuffer out = { obuf.mut_end(), navail, 0 };
+
+          res = ::ZSTD_compressStream2(cctx, &out, &in, mode);
+          if(::ZSTD_isError(res))
+            POSEIDON_THROW("zstd error: $1\n[`ZSTD_compressStream2()` failed]",
+                           ::ZSTD_getErrorName(res));
+
+          obuf.accept(out.pos);
+        }
+        while((mode == ZSTD_e_continue) ? (in.pos != in.size) : (res != 0));
+      }
+
+    void
+    do_compressor_reset()
+      override
+      { this->do_release_cctx();  }
+
+    void
+    do_compressor_write(::rocket::linear_buffer& obuf, const char* data, size_t size)
+      override
+      { this->do_compress(obuf, data, size, ZSTD_e_continue);  }
+
+    void
+    do_compressor_flush(::rocket::linear_buffer& obuf)
+      override
+      { this->do_compress(obuf, nullptr, 0, ZSTD_e_flush);  }
+
+    void
+    do_compressor_finish(::rocket::linear_buffer& obuf)
+      override
+      { this->do_compress(obuf, nullptr, 0, ZSTD_e_end);  }
+
+  public:
+    ~zstd_Compressor()
+      override;
+
+    const char*
+    content_coding()
+      const noexcept override
+      { return "zstd";  }
+  };
+
+zstd_Compressor::
+~zstd_Compressor()
+  {
+    this->do_release_cctx();
+  }
+
+#endif  // POSEIDON_ENABLE_ZSTD
+
+#ifdef POSEIDON_ENABLE_BROTLI
+
+// Brotli encoders cannot be reset, so a new one is created for each stream.
+// Most of its cost is allocating and faulting in a few large blocks, such as
+// the ring buffer and hash tables, whose sizes only depend on parameters, so
+// these blocks are recycled through this pool instead.
+constexpr size_t s_brotli_pool_capacity = 64;
+
+union Brotli_Block
+  {
+    struct
+      {
+        Brotli_Block* next;
+        size_t size;
+      }
+      hdr;
+
+    ::std::max_align_t align;
+  };
+
+simple_mutex s_brotli_pool_mutex;
+Brotli_Block* s_brotli_pool_head;
+size_t s_brotli_pool_size;
+
+void*
+do_brotli_alloc(void* /*opaque*/, size_t size)
+  {
+    // Search for a block of the same size.
+    simple_mutex::unique_lock lock(s_brotli_pool_mutex);
+    for(auto qnext = &s_brotli_pool_head;  *qnext;  qnext = &((*qnext)->hdr.next)) {
+      auto blk = *qnext;
+      if(blk->hdr.size != size)
+        continue;
+
+      // Remove this block from the pool.
+      *qnext = blk->hdr.next;
+      s_brotli_pool_size--;
+      return blk + 1;
+    }
+    lock.unlock();
+
+    // Allocate a new block. Brotli handles null pointers.
+    auto blk = static_cast<Brotli_Block*>(::malloc(sizeof(Brotli_Block) + size));
+    if(!blk)
+      return nullptr;
+
+    blk->hdr.size = size;
+    return blk + 1;
+  }
+
+void
+do_brotli_free(void* /*opaque*/, void* ptr)
+  {
+    if(!ptr)
+      return;
+
+    auto blk = static_cast<Brotli_Block*>(ptr) - 1;
+    simple_mutex::unique_lock lock(s_brotli_pool_mutex);
+    if(s_brotli_pool_size >= s_brotli_pool_capacity) {
+      lock.unlock();
+      ::free(blk);
+      return;
+    }
+
+    // Insert the block at the beginning.
+    blk->hdr.next = s_brotli_pool_head;
+    s_brotli_pool_head = blk;
+    s_brotli_pool_size++;
+  }
+
+class brotli_Compressor
+  final
+  : public Abstract_Compressor
+  {
+  private:
+    int m_quality;
+    ::BrotliEncoderState* m_state = nullptr;
+
+  public:
+    explicit
+    brotli_Compressor(int level)
+      {
+        // The default quality of brotli (11) is too slow for dynamic content.
+        this->m_quality = (level < 0) ? 5 : ::rocket::min(level, BROTLI_MAX_QUALITY);
+      }
+
+  private:
+    ::BrotliEncoderState*
+    do_acquire_state()
+      {
+        if(ROCKET_EXPECT(this->m_state))
+          return this->m_state;
+
+        // Create an encoder, whose memory is taken from the pool.
+        auto state = ::BrotliEncoderCreateInstance(do_brotli_alloc, do_brotli_free, nullptr);
+        if(!state)
+          POSEIDON_THROW("Could not create brotli encoder");
+
+        ::BrotliEncoderSetParameter(state, BROTLI_PARAM_QUALITY,
+                                    static_cast<uint32_t>(this->m_quality));
+        this->m_state = state;
+        return state;
+      }
+
+    void
+    do_compress(::rocket::linear_buffer& obuf, const char* data, size_t size,
+                ::BrotliEncoderOperation op)
+      {
+        auto state = this->do_acquire_state();
+        auto next_in = reinterpret_cast<const uint8_t*>(data);
+        size_t avail_in = size;
+        do {
+          size_t navail = obuf.reserve(0x4000);
+          auto next_out = reinterpret_cast<uint8_t*>(obuf.mut_end());
+          size_t avail_out = navail;
+
+          if(!::BrotliEncoderCompressStream(state, op, &avail_in, &next_in,
+                                            &avail_out, &next_out, nullptr))
+            POSEIDON_THROW("brotli error\n[`BrotliEncoderCompressStream()` failed]");
+
+          obuf.accept(navail - avail_out);
+        }
+        while((avail_in != 0) || ::BrotliEncoderHasMoreOutput(state) ||
+              ((op == BROTLI_OPERATION_FINISH) && !::BrotliEncoderIsFinished(state)));
+      }
+
+    void
+    do_compressor_reset()
+      override
+      {
+        // Return memory of the encoder to the pool. A new one will be created
+        // when it is used again.
+        auto state = ::std::exchange(this->m_state, nullptr);
+        if(state)
+          ::BrotliEncoderDestroyInstance(state);
+      }
+
+    void
+    do_compressor_write(::rocket::linear_buffer& obuf, const char* data, size_t size)
+      override
+      { this->do_compress(obuf, data, size, BROTLI_OPERATION_PROCESS);  }
+
+    void
+    do_compressor_flush(::rocket::linear_buffer& obuf)
+      override
+      { this->do_compress(obuf, nullptr, 0, BROTLI_OPERATION_FLUSH);  }
+
+    void
+    do_compressor_finish(::rocket::linear_buffer& obuf)
+      override
+      { this->do_compress(obuf, nullptr, 0, BROTLI_OPERATION_FINISH);  }
+
+  public:
+    ~brotli_Compressor()
+      override;
+
+    const char*
+    content_coding()
+      const noexcept override
+      { return "br";  }
+  };
+
+brotli_Compressor::
+~brotli_Compressor()
+  {
+    if(this->m_state)
+      ::BrotliEncoderDestroyInstance(this->m_state);
+  }
+
+#endif  // POSEIDON_ENABLE_BROTLI
+
+bool
+do_coding_equal(const cow_string& str, const char* coding)
+  noexcept
+  {
+    return ::rocket::ascii_ci_equal(str.data(), str.size(),
+                                    coding, ::std::strlen(coding));
+  }
+
+bool
+do_parse_accept_encoding(double* qvalues, const char* const* codings, size_t count,
+                         const cow_string& accept_encoding)
+  {
+    // Get the quality value of each coding. A coding that is not mentioned
+    // explicitly takes the value of `*`, which is zero by default.
+    ::std::fill_n(qvalues, count, -1.0);
+    double qwild = 0;
+
+    try {
+      Option_Map opts;
+      size_t comma = 0;
+      while(comma != accept_encoding.size()) {
+        opts.parse_http_header(&comma, accept_encoding, 1);
+        auto qstr = opts.find_opt(sref(""));  // coding name
+        if(!qstr)
+          continue;
+
+        double qval = 1;
+        auto qq = opts.find_opt(sref("q"));
+        if(qq)
+          qval = ::std::strtod(qq->c_str(), nullptr);
+
+        if(*qstr == "*")
+          qwild = qval;
+
+        for(size_t k = 0;  k != count;  ++k)
+          if(do_coding_equal(*qstr, codings[k]))
+            qvalues[k] = qval;
+      }
+    }
+    catch(exception& stdex) {
+      POSEIDON_LOG_WARN("Invalid `Accept-Encoding` header: $1\n"
+                        "[exception class `$2`]",
+                        stdex.what(), typeid(stdex));
+      return false;
+    }
+
+    for(size_t k = 0;  k != count;  ++k)
+      if(qvalues[k] < 0)
+        qvalues[k] = qwild;
+    return true;
+  }
+
+}  // namespace
+
+Abstract_Compressor::
+~Abstract_Compressor()
+  {
+  }
+
+rcptr<Abstract_Compressor>
+create_compressor(const char* coding, int level)
+  {
+    if(::rocket::ascii_ci_equal(coding, ::std::strlen(coding), "gzip", 4))
+      return ::rocket::make_refcnt<gzip_Compressor>(level);
+
+#ifdef POSEIDON_ENABLE_ZSTD
+    if(::rocket::ascii_ci_equal(coding, ::std::strlen(coding), "zstd", 4))
+      return ::rocket::make_refcnt<zstd_Compressor>(level);
+#endif
+
+#ifdef POSEIDON_ENABLE_BROTLI
+    if(::rocket::ascii_ci_equal(coding, ::std::strlen(coding), "br", 2))
+      return ::rocket::make_refcnt<brotli_Compressor>(level);
+#endif
+
+    // Unsupported.
+    return nullptr;
+  }
+
+const char*
+negotiate_content_coding(const cow_string& accept_encoding)
+  {
+    double qvalues[s_content_coding_count];
+    if(!do_parse_accept_encoding(qvalues, s_content_codings, s_content_coding_count,
+                                 accept_encoding))
+      return nullptr;
+
+    // Pick the coding with the highest quality value. Ties are broken by our
+    // preference.
+    const char* coding = nullptr;
+    double qbest = 0;
+    for(size_t k = 0;  k != s_content_coding_count;  ++k) {
+      if(qvalues[k] <= qbest)
+        continue;
+
+      coding = s_content_codings[k];
+      qbest = qvalues[k];
+    }
+    return coding;
+  }
+
+bool
+content_coding_acceptable(const cow_string& accept_encoding, const char* coding)
+  {
+    double qvalue;
+    if(!do_parse_accept_encoding(&qvalue, &coding, 1, accept_encoding))
+      return false;
+
+    return qvalue > 0;
+  }
+
+}  // namespace poseidon
@@ -0,0 +1,94 @@
+// This file is part of Poseidon.
+// Copyleft 2020, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_CORE_ABSTRACT_COMPRESSOR_HPP_
+#define POSEIDON_CORE_ABSTRACT_COMPRESSOR_HPP_
+
+#include "../fwd.hpp"
+
+namespace poseidon {
+
+class Abstract_Compressor
+  : public ::asteria::Rcfwd<Abstract_Compressor>
+  {
+  protected:
+    explicit
+    Abstract_Compressor()
+      noexcept
+      = default;
+
+  protected:
+    // Resets internal states. Unprocessed data are discarded.
+    virtual
+    void
+    do_compressor_reset()
+      = 0;
+
+    // Compresses some data. Output data are appended to `obuf`.
+    virtual
+    void
+    do_compressor_write(::rocket::linear_buffer& obuf, const char* data, size_t size)
+      = 0;
+
+    // Writes all pending data into `obuf`, so they can be decompressed by
+    // the peer without waiting for more data.
+    virtual
+    void
+    do_compressor_flush(::rocket::linear_buffer& obuf)
+      = 0;
+
+    // Terminates the stream. Output data are appended to `obuf`.
+    virtual
+    void
+    do_compressor_finish(::rocket::linear_buffer& obuf)
+      = 0;
+
+  public:
+    ASTERIA_NONCOPYABLE_DESTRUCTOR(Abstract_Compressor);
+
+    // Gets the name of the HTTP content coding, such as `gzip`.
+    // The returned string shall be a valid HTTP token.
+    virtual
+    const char*
+    content_coding()
+      const noexcept
+      = 0;
+
+    Abstract_Compressor&
+    reset()
+      { return this->do_compressor_reset(), *this;  }
+
+    Abstract_Compressor&
+    write(::rocket::linear_buffer& obuf, const char* data, size_t size)
+      { return this->do_compressor_write(obuf, data, size), *this;  }
+
+    Abstract_Compressor&
+    flush(::rocket::linear_buffer& obuf)
+      { return this->do_compressor_flush(obuf), *this;  }
+
+    Abstract_Compressor&
+    finish(::rocket::linear_buffer& obuf)
+      { return this->do_compressor_finish(obuf), *this;  }
+  };
+
+// Creates a compressor for an HTTP content coding. `gzip` is always available.
+// `zstd` and `br` are available if Poseidon has been configured with zstd and
+// brotli, respectively. If `level` is negative, a default level is used.
+// If `coding` is not supported, a null pointer is returned.
+rcptr<Abstract_Compressor>
+create_compressor(const char* coding, int level = -1);
+
+// Selects the preferred content coding that is supported by both peers,
+// according to the value of an `Accept-Encoding:` header. If no compression
+// should be applied, a null pointer is returned.
+const char*
+negotiate_content_coding(const cow_string& accept_encoding);
+
+// Checks whether a content coding is acceptable according to the value of an
+// `Accept-Encoding:` header, which means its quality value is positive.
+bool
+content_coding_acceptable(const cow_string& accept_encoding, const char* coding);
+
+}  // namespace poseidon
+
+#endif
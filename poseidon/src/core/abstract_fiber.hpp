@@ -7,6 +7,12 @@
 #include "../fwd.hpp"
 #include <ucontext.h>
 
+// Fibers are switched with hand-written assembly on these targets, and with
+// `swapcontext()` otherwise.
+#if !defined(__x86_64__) && !defined(__aarch64__)
+#  define POSEIDON_FIBER_UCONTEXT_  1
+#endif
+
 namespace poseidon {
 
 class Abstract_Fiber
@@ -21,14 +27,19 @@ class Abstract_Fiber
 
     // These are scheduler data.
     uint32_t m_sched_version;
+    bool m_sched_parked;  // in the timer queue
     int64_t m_sched_yield_since;
     int64_t m_sched_yield_timeout;
     const Abstract_Future* m_sched_futp;
 
     Abstract_Fiber* m_sched_ready_next;
-    Abstract_Fiber* m_sched_sleep_next;
 
+    ::stack_t m_sched_stack;
+#ifdef POSEIDON_FIBER_UCONTEXT_
     ::ucontext_t m_sched_uctx[1];
+#else
+    void* m_sched_sp;  // saved by `poseidon_fiber_switch()`
+#endif
 
   protected:
     explicit
@@ -5,12 +5,14 @@
 #include "zlib_deflator.hpp"
 #include "../static/main_config.hpp"
 #include "../core/config_file.hpp"
+#include "../static/fiber_scheduler.hpp"
 #include "../utils.hpp"
 
 namespace poseidon {
+namespace {
 
-zlib_Deflator::
-zlib_Deflator(Format fmt, int level)
+int
+do_resolve_level(int level)
   {
     // If `level` equals `Z_DEFAULT_COMPRESSION` and a default level is
     // specified in 'main.conf', use that default level.
@@ -22,6 +24,33 @@ zlib_Deflator(Format fmt, int level)
       if(qint)
         rlevel = clamp_cast<int>(*qint, 0, 9);
     }
+    return rlevel;
+  }
+
+// This is the maximum size of a deflate dictionary.
+constexpr size_t s_dict_size = 0x8000;
+
+struct Deflated_Block
+  {
+    cow_string data;
+    uint32_t crc;
+  };
+
+void
+do_put_le32(::rocket::linear_buffer& obuf, uint32_t val)
+  {
+    char bytes[4];
+    for(size_t k = 0;  k != 4;  ++k)
+      bytes[k] = static_cast<char>(val >> k * 8);
+    obuf.putn(bytes, 4);
+  }
+
+}  // namespace
+
+zlib_Deflator::
+zlib_Deflator(Format fmt, int level)
+  {
+    int rlevel = do_resolve_level(level);
 
     // Get the `windowBits` argument.
     int wbits;
@@ -43,7 +72,9 @@ zlib_Deflator(Format fmt, int level)
     }
 
     // Construct the stream now.
-    this->do_construct(rlevel, wbits, ::deflateEnd);
+    this->do_construct(rlevel, wbits, ::deflateReset, ::deflateEnd);
+    this->m_fmt = fmt;
+    this->m_level = rlevel;
   }
 
 zlib_Deflator::
@@ -51,22 +82,68 @@ zlib_Deflator::
   {
   }
 
-void
+uint32_t
 zlib_Deflator::
-do_zlib_construct(::z_stream* strm, int level, int wbits)
+do_deflate_block(cow_string& output, const cow_string& input, size_t dict_len,
+                 int level, bool last)
   {
-    int res = ::deflateInit2(strm, level, Z_DEFLATED, wbits, 9, 0);
+    // Initialize a raw deflate stream.
+    ::z_stream strm;
+    strm.next_in = nullptr;
+    strm.avail_in = 0;
+    strm.zalloc = nullptr;
+    strm.zfree = nullptr;
+    strm.opaque = nullptr;
+
+    int res = ::deflateInit2(&strm, level, Z_DEFLATED, -15, 9, 0);
     if(res != Z_OK)
-      this->do_zlib_throw_error("deflateInit2", res);
+      do_zlib_throw_error(&strm, "deflateInit2", res);
+
+    const auto strm_guard = ::rocket::make_unique_handle(&strm, ::deflateEnd);
+
+    // Prime the stream with the end of the previous block.
+    auto bptr = reinterpret_cast<const uint8_t*>(input.data());
+    if(dict_len != 0) {
+      res = ::deflateSetDictionary(&strm, bptr, static_cast<uint32_t>(dict_len));
+      if(res != Z_OK)
+        do_zlib_throw_error(&strm, "deflateSetDictionary", res);
+    }
+
+    // Compress this block. Every block but the last one is terminated with
+    // `Z_SYNC_FLUSH`, which aligns output to a byte boundary, so all blocks
+    // can be concatenated to form a single deflate stream.
+    size_t size = input.size() - dict_len;
+    strm.next_in = bptr + dict_len;
+    strm.avail_in = static_cast<uint32_t>(size);
+
+    ::rocket::linear_buffer obuf;
+    int flush = last ? Z_FINISH : Z_SYNC_FLUSH;
+    size_t nres = static_cast<size_t>(::deflateBound(&strm, static_cast<::uLong>(size))) + 16;
+    do {
+      size_t navail = obuf.reserve(nres);
+      strm.next_out = reinterpret_cast<uint8_t*>(obuf.mut_end());
+      strm.avail_out = static_cast<uint32_t>(navail);
+
+      res = ::deflate(&strm, flush);
+      if(::rocket::is_none_of(res, { Z_OK, Z_STREAM_END, Z_BUF_ERROR }))
+        do_zlib_throw_error(&strm, "deflate", res);
+
+      obuf.accept(navail - strm.avail_out);
+      nres *= 2;
+    }
+    while(last ? (res != Z_STREAM_END) : (strm.avail_out == 0));
+
+    output.append(obuf.data(), obuf.size());
+    return static_cast<uint32_t>(::crc32(0, bptr + dict_len, static_cast<uint32_t>(size)));
   }
 
 void
 zlib_Deflator::
-do_zlib_reset(::z_stream* strm)
+do_zlib_construct(::z_stream* strm, int level, int wbits)
   {
-    int res = ::deflateReset(strm);
+    int res = ::deflateInit2(strm, level, Z_DEFLATED, wbits, 9, 0);
     if(res != Z_OK)
-      this->do_zlib_throw_error("deflateReset", res);
+      this->do_zlib_throw_error(strm, "deflateInit2", res);
   }
 
 void
@@ -75,7 +152,151 @@ do_zlib_write_partial(int& res, ::z_stream* strm, int flush)
   {
     res = ::deflate(strm, flush);
     if(::rocket::is_none_of(res, { Z_OK, Z_STREAM_END, Z_BUF_ERROR }))
-      this->do_zlib_throw_error("deflate", res);
+      this->do_zlib_throw_error(strm, "deflate", res);
+  }
+
+size_t
+zlib_Deflator::
+do_zlib_estimate_output(::z_stream* strm, size_t size)
+  const noexcept
+  {
+    // The output will never exceed the bound that is calculated by zlib.
+    return static_cast<size_t>(::deflateBound(strm, static_cast<::uLong>(size)));
+  }
+
+zlib_Deflator&
+zlib_Deflator::
+reset()
+  {
+    this->do_reset();
+
+    this->m_par_started = false;
+    this->m_par_dict.clear();
+    return *this;
+  }
+
+zlib_Deflator&
+zlib_Deflator::
+write_parallel_into(::rocket::linear_buffer& obuf, const char* data, size_t size,
+                    size_t block_size)
+  {
+    if(this->m_fmt != format_gzip)
+      POSEIDON_THROW("Parallel compression not supported for zlib format `$1`", this->m_fmt);
+
+    if(!this->m_par_started) {
+      // Write the gzip header, which denotes no file name, no modification
+      // time and an unknown operating system.
+      obuf.putn("\x1F\x8B\x08\x00\x00\x00\x00\x00\x00\xFF", 10);
+      this->m_par_started = true;
+      this->m_par_crc = static_cast<uint32_t>(::crc32(0, nullptr, 0));
+      this->m_par_size = 0;
+    }
+
+    if(size == 0)
+      return *this;
+
+    // Blocks shall be larger than the dictionary. The stupid zlib library uses
+    // a 32-bit integer for number of bytes.
+    size_t bsize = ::rocket::clamp(block_size, s_dict_size, 0x1000'0000U);
+    size_t nblocks = (size + bsize - 1) / bsize;
+    int level = this->m_level;
+
+    // If there are multiple blocks and the current thread is running a fiber,
+    // compress them concurrently.
+    bool async = (nblocks > 1) && Fiber_Scheduler::is_in_fiber();
+    ::rocket::cow_vector<futp<Deflated_Block>> futrs;
+    ::rocket::cow_vector<Deflated_Block> blocks;
+    blocks.reserve(nblocks);
+
+    for(size_t k = 0;  k != nblocks;  ++k) {
+      size_t off = k * bsize;
+      size_t len = ::rocket::min(size - off, bsize);
+
+      // Make a copy of input data for each block, including its dictionary,
+      // which may begin in data from previous calls. The copy is owned by the
+      // worker, so it remains valid even if the current fiber is aborted.
+      cow_string input;
+      if(off < s_dict_size) {
+        size_t nprev = ::rocket::min(this->m_par_dict.size(), s_dict_size - off);
+        input.append(this->m_par_dict.data() + this->m_par_dict.size() - nprev, nprev);
+      }
+      size_t ndata = ::rocket::min(off, s_dict_size);
+      input.append(data + off - ndata, ndata + len);
+      size_t dict_len = input.size() - len;
+
+      if(async)
+        futrs.emplace_back(enqueue_async_job(
+            [=] {
+              Deflated_Block blk;
+              blk.crc = do_deflate_block(blk.data, input, dict_len, level, false);
+              return blk;
+            }));
+      else {
+        Deflated_Block blk;
+        blk.crc = do_deflate_block(blk.data, input, dict_len, level, false);
+        blocks.emplace_back(::std::move(blk));
+      }
+    }
+
+    // Wait for all blocks.
+    for(const auto& futr : futrs) {
+      while(futr->state() == future_state_empty)
+        Fiber_Scheduler::yield(futr);
+
+      blocks.emplace_back(futr->value());
+    }
+
+    // Concatenate all blocks and calculate the checksum of all data.
+    for(size_t k = 0;  k != blocks.size();  ++k) {
+      const auto& blk = blocks[k];
+      obuf.putn(blk.data.data(), blk.data.size());
+
+      size_t len = ::rocket::min(size - k * bsize, bsize);
+      this->m_par_crc = static_cast<uint32_t>(::crc32_combine(
+                           this->m_par_crc, blk.crc, static_cast<::z_off_t>(len)));
+    }
+    this->m_par_size += static_cast<uint32_t>(size);
+
+    // Save the end of input, which is the dictionary of the next call.
+    if(size >= s_dict_size)
+      this->m_par_dict.assign(data + size - s_dict_size, s_dict_size);
+    else {
+      this->m_par_dict.append(data, size);
+      if(this->m_par_dict.size() > s_dict_size)
+        this->m_par_dict.erase(0, this->m_par_dict.size() - s_dict_size);
+    }
+    return *this;
+  }
+
+zlib_Deflator&
+zlib_Deflator::
+finish_parallel_into(::rocket::linear_buffer& obuf)
+  {
+    // Write the gzip header if nothing has been written.
+    this->write_parallel_into(obuf, nullptr, 0);
+
+    // Terminate the deflate stream with an empty final block.
+    cow_string output;
+    do_deflate_block(output, cow_string(), 0, this->m_level, true);
+    obuf.putn(output.data(), output.size());
+
+    // Write the gzip trailer.
+    do_put_le32(obuf, this->m_par_crc);
+    do_put_le32(obuf, this->m_par_size);
+
+    this->m_par_started = false;
+    this->m_par_dict.clear();
+    return *this;
+  }
+
+void
+zlib_Deflator::
+gzip_parallel(::rocket::linear_buffer& obuf, const char* data, size_t size,
+              int level, size_t block_size)
+  {
+    zlib_Deflator defl(format_gzip, level);
+    defl.write_parallel_into(obuf, data, size, block_size);
+    defl.finish_parallel_into(obuf);
   }
 
 }  // namespace poseidon
@@ -21,22 +21,41 @@ class zlib_Deflator
         format_gzip     = 2,
       };
 
+  private:
+    Format m_fmt;
+    int m_level;
+
+    // These are states of parallel compression.
+    bool m_par_started = false;
+    uint32_t m_par_crc = 0;
+    uint32_t m_par_size = 0;  // modulo 2^32, as in the gzip trailer
+    cow_string m_par_dict;  // the last 32KiB of input
+
   public:
     explicit
     zlib_Deflator(Format fmt, int level = Z_DEFAULT_COMPRESSION);
 
   private:
+    // Compresses a block of raw deflate data into `output`, and returns the
+    // CRC-32 checksum of input. The first `dict_len` bytes of `input` are used
+    // as the dictionary.
+    static
+    uint32_t
+    do_deflate_block(cow_string& output, const cow_string& input, size_t dict_len,
+                     int level, bool last);
+
     // These are overridden callbacks.
     void
     do_zlib_construct(::z_stream* strm, int level, int wbits)
       final;
 
     void
-    do_zlib_reset(::z_stream* strm)
+    do_zlib_write_partial(int& res, ::z_stream* strm, int flush)
       final;
 
-    void
-    do_zlib_write_partial(int& res, ::z_stream* strm, int flush)
+    size_t
+    do_zlib_estimate_output(::z_stream* strm, size_t size)
+      const noexcept
       final;
 
   public:
@@ -46,26 +65,66 @@ class zlib_Deflator
     using zlib_Stream_Common::output_buffer;
 
     // Resets internal states and clears the output buffer.
-    // Unprocessed data are discarded.
+    // Unprocessed data are discarded. The underlying zlib stream is returned
+    // to a process-wide pool, and another one will be borrowed on demand.
     zlib_Deflator&
-    reset()
-      { return this->do_reset(), *this;  }
+    reset();
 
     // Puts some data for compression/decompression.
     zlib_Deflator&
     write(const char* data, size_t size)
-      { return this->do_write(data, size), *this;  }
+      { return this->do_write(this->output_buffer(), data, size), *this;  }
 
     // Synchronizes output to a byte boundary. This causes 4 extra
     // bytes (00 00 FF FF) to be appended to the output buffer.
     zlib_Deflator&
     flush()
-      { return this->do_flush(), *this;  }
+      { return this->do_flush(this->output_buffer()), *this;  }
 
     // Terminates the stream.
     zlib_Deflator&
     finish()
-      { return this->do_finish(), *this;  }
+      { return this->do_finish(this->output_buffer()), *this;  }
+
+    // These functions are similar to the ones above, but output data are
+    // appended to `obuf` instead of the internal output buffer. This saves
+    // a copy if the caller has a buffer of its own.
+    zlib_Deflator&
+    write_into(::rocket::linear_buffer& obuf, const char* data, size_t size)
+      { return this->do_write(obuf, data, size), *this;  }
+
+    zlib_Deflator&
+    flush_into(::rocket::linear_buffer& obuf)
+      { return this->do_flush(obuf), *this;  }
+
+    zlib_Deflator&
+    finish_into(::rocket::linear_buffer& obuf)
+      { return this->do_finish(obuf), *this;  }
+
+    // Compresses data into `obuf`, like `write_into()`. Input is split into
+    // blocks of `block_size` bytes, which are compressed concurrently by worker
+    // threads. Each block is primed with the last 32KiB of its predecessor, so
+    // the compression ratio is close to that of a single stream. The current
+    // fiber is suspended until all blocks are done. If this function is not
+    // called from a fiber, blocks are compressed serially.
+    // Only `format_gzip` is supported. Parallel compression shall not be mixed
+    // with serial compression in the same stream. Each call terminates its last
+    // block with `Z_SYNC_FLUSH`, so small writes should be buffered.
+    zlib_Deflator&
+    write_parallel_into(::rocket::linear_buffer& obuf, const char* data, size_t size,
+                        size_t block_size = 0x20000);
+
+    // Terminates a stream that has been compressed with `write_parallel_into()`.
+    // The deflator can be reused afterwards.
+    zlib_Deflator&
+    finish_parallel_into(::rocket::linear_buffer& obuf);
+
+    // Compresses `data` into a complete gzip member and appends it to `obuf`,
+    // using `write_parallel_into()` and `finish_parallel_into()`.
+    static
+    void
+    gzip_parallel(::rocket::linear_buffer& obuf, const char* data, size_t size,
+                  int level = Z_DEFAULT_COMPRESSION, size_t block_size = 0x20000);
   };
 
 }  // namespace poseidon
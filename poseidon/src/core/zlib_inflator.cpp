@@ -34,7 +34,7 @@ zlib_Inflator(Format fmt)
     }
 
     // Construct the stream now.
-    this->do_construct(0, wbits, ::inflateEnd);
+    this->do_construct(0, wbits, ::inflateReset, ::inflateEnd);
   }
 
 zlib_Inflator::
@@ -48,25 +48,25 @@ do_zlib_construct(::z_stream* strm, int /*level*/, int wbits)
   {
     int res = ::inflateInit2(strm, wbits);
     if(res != Z_OK)
-      this->do_zlib_throw_error("inflateInit2", res);
+      this->do_zlib_throw_error(strm, "inflateInit2", res);
   }
 
 void
 zlib_Inflator::
-do_zlib_reset(::z_stream* strm)
+do_zlib_write_partial(int& res, ::z_stream* strm, int flush)
   {
-    int res = ::inflateReset(strm);
-    if(res != Z_OK)
-      this->do_zlib_throw_error("inflateReset", res);
+    res = ::inflate(strm, flush);
+    if(::rocket::is_none_of(res, { Z_OK, Z_STREAM_END, Z_BUF_ERROR }))
+      this->do_zlib_throw_error(strm, "inflate", res);
   }
 
-void
+size_t
 zlib_Inflator::
-do_zlib_write_partial(int& res, ::z_stream* strm, int flush)
+do_zlib_estimate_output(::z_stream* /*strm*/, size_t size)
+  const noexcept
   {
-    res = ::inflate(strm, flush);
-    if(::rocket::is_none_of(res, { Z_OK, Z_STREAM_END, Z_BUF_ERROR }))
-      this->do_zlib_throw_error("inflate", res);
+    // Assume a typical compression ratio of text.
+    return size * 4;
   }
 
 }  // namespace poseidon
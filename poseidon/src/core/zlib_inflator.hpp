@@ -33,11 +33,12 @@ class zlib_Inflator
       final;
 
     void
-    do_zlib_reset(::z_stream* strm)
+    do_zlib_write_partial(int& res, ::z_stream* strm, int flush)
       final;
 
-    void
-    do_zlib_write_partial(int& res, ::z_stream* strm, int flush)
+    size_t
+    do_zlib_estimate_output(::z_stream* strm, size_t size)
+      const noexcept
       final;
 
   public:
@@ -47,7 +48,8 @@ class zlib_Inflator
     using zlib_Stream_Common::output_buffer;
 
     // Resets internal states and clears the output buffer.
-    // Unprocessed data are discarded.
+    // Unprocessed data are discarded. The underlying zlib stream is returned
+    // to a process-wide pool, and another one will be borrowed on demand.
     zlib_Inflator&
     reset()
       { return this->do_reset(), *this;  }
@@ -55,18 +57,33 @@ class zlib_Inflator
     // Puts some data for compression/decompression.
     zlib_Inflator&
     write(const char* data, size_t size)
-      { return this->do_write(data, size), *this;  }
+      { return this->do_write(this->output_buffer(), data, size), *this;  }
 
     // Synchronizes output to a byte boundary. This causes 4 extra
     // bytes (00 00 FF FF) to be appended to the output buffer.
     zlib_Inflator&
     flush()
-      { return this->do_flush(), *this;  }
+      { return this->do_flush(this->output_buffer()), *this;  }
 
     // Terminates the stream.
     zlib_Inflator&
     finish()
-      { return this->do_finish(), *this;  }
+      { return this->do_finish(this->output_buffer()), *this;  }
+
+    // These functions are similar to the ones above, but output data are
+    // appended to `obuf` instead of the internal output buffer. This saves
+    // a copy if the caller has a buffer of its own.
+    zlib_Inflator&
+    write_into(::rocket::linear_buffer& obuf, const char* data, size_t size)
+      { return this->do_write(obuf, data, size), *this;  }
+
+    zlib_Inflator&
+    flush_into(::rocket::linear_buffer& obuf)
+      { return this->do_flush(obuf), *this;  }
+
+    zlib_Inflator&
+    finish_into(::rocket::linear_buffer& obuf)
+      { return this->do_finish(obuf), *this;  }
   };
 
 }  // namespace poseidon
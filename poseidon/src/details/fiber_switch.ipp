@@ -0,0 +1,174 @@
+// This file is part of Poseidon.
+// Copyleft 2020, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_DETAILS_FIBER_SWITCH_IPP_
+#define POSEIDON_DETAILS_FIBER_SWITCH_IPP_
+
+// This file defines the functions that switch fibers on x86-64 and AArch64.
+// It depends only on the standard library, so it can also be built into the
+// standalone benchmark 'fiber_switch_benchmark.cpp'. As it contains definitions
+// in assembly, it shall be included by only one translation unit of a binary.
+
+#include <stdint.h>
+#include <algorithm>
+
+extern "C" {
+
+// This function saves callee-saved registers onto the current stack, stores
+// the stack pointer into `*save_sp`, then switches to `load_sp` and restores
+// registers from it. Unlike `swapcontext()`, it makes no system calls, as the
+// signal mask is not saved.
+__attribute__((__visibility__("hidden")))
+void
+poseidon_fiber_switch(void** save_sp, void* load_sp)
+  noexcept;
+
+// This function is where a new fiber starts. It calls the function in the
+// first callee-saved register, with the argument in the second one.
+__attribute__((__visibility__("hidden")))
+void
+poseidon_fiber_trampoline()
+  noexcept;
+
+}  // extern "C"
+
+#if defined(__x86_64__)
+// The frame consists of MXCSR and the x87 control word, R15, R14, R13, R12,
+// RBX, RBP, and the return address, in ascending order of addresses.
+__asm__ (
+  ".text\n"
+  ".p2align 4\n"
+  ".globl poseidon_fiber_switch\n"
+  ".hidden poseidon_fiber_switch\n"
+  ".type poseidon_fiber_switch, @function\n"
+  "poseidon_fiber_switch:\n"
+  "  pushq %rbp\n"
+  "  pushq %rbx\n"
+  "  pushq %r12\n"
+  "  pushq %r13\n"
+  "  pushq %r14\n"
+  "  pushq %r15\n"
+  "  subq $8, %rsp\n"
+  "  stmxcsr (%rsp)\n"
+  "  fnstcw 4(%rsp)\n"
+  "  movq %rsp, (%rdi)\n"
+  "  movq %rsi, %rsp\n"
+  "  ldmxcsr (%rsp)\n"
+  "  fldcw 4(%rsp)\n"
+  "  addq $8, %rsp\n"
+  "  popq %r15\n"
+  "  popq %r14\n"
+  "  popq %r13\n"
+  "  popq %r12\n"
+  "  popq %rbx\n"
+  "  popq %rbp\n"
+  "  retq\n"
+  ".size poseidon_fiber_switch, .-poseidon_fiber_switch\n"
+  "\n"
+  ".p2align 4\n"
+  ".globl poseidon_fiber_trampoline\n"
+  ".hidden poseidon_fiber_trampoline\n"
+  ".type poseidon_fiber_trampoline, @function\n"
+  "poseidon_fiber_trampoline:\n"
+  "  .cfi_startproc\n"
+  "  .cfi_undefined %rip\n"
+  "  movq %r13, %rdi\n"
+  "  callq *%r12\n"
+  "  ud2\n"
+  "  .cfi_endproc\n"
+  ".size poseidon_fiber_trampoline, .-poseidon_fiber_trampoline\n"
+);
+
+#elif defined(__aarch64__)
+// The frame consists of X19-X28, X29 (FP), X30 (LR), and D8-D15, in ascending
+// order of addresses.
+__asm__ (
+  ".text\n"
+  ".p2align 4\n"
+  ".globl poseidon_fiber_switch\n"
+  ".hidden poseidon_fiber_switch\n"
+  ".type poseidon_fiber_switch, %function\n"
+  "poseidon_fiber_switch:\n"
+  "  sub sp, sp, #0xA0\n"
+  "  stp x19, x20, [sp, #0x00]\n"
+  "  stp x21, x22, [sp, #0x10]\n"
+  "  stp x23, x24, [sp, #0x20]\n"
+  "  stp x25, x26, [sp, #0x30]\n"
+  "  stp x27, x28, [sp, #0x40]\n"
+  "  stp x29, x30, [sp, #0x50]\n"
+  "  stp d8, d9, [sp, #0x60]\n"
+  "  stp d10, d11, [sp, #0x70]\n"
+  "  stp d12, d13, [sp, #0x80]\n"
+  "  stp d14, d15, [sp, #0x90]\n"
+  "  mov x9, sp\n"
+  "  str x9, [x0]\n"
+  "  mov sp, x1\n"
+  "  ldp x19, x20, [sp, #0x00]\n"
+  "  ldp x21, x22, [sp, #0x10]\n"
+  "  ldp x23, x24, [sp, #0x20]\n"
+  "  ldp x25, x26, [sp, #0x30]\n"
+  "  ldp x27, x28, [sp, #0x40]\n"
+  "  ldp x29, x30, [sp, #0x50]\n"
+  "  ldp d8, d9, [sp, #0x60]\n"
+  "  ldp d10, d11, [sp, #0x70]\n"
+  "  ldp d12, d13, [sp, #0x80]\n"
+  "  ldp d14, d15, [sp, #0x90]\n"
+  "  add sp, sp, #0xA0\n"
+  "  ret\n"
+  ".size poseidon_fiber_switch, .-poseidon_fiber_switch\n"
+  "\n"
+  ".p2align 4\n"
+  ".globl poseidon_fiber_trampoline\n"
+  ".hidden poseidon_fiber_trampoline\n"
+  ".type poseidon_fiber_trampoline, %function\n"
+  "poseidon_fiber_trampoline:\n"
+  "  .cfi_startproc\n"
+  "  .cfi_undefined x30\n"
+  "  mov x0, x20\n"
+  "  blr x19\n"
+  "  brk #0\n"
+  "  .cfi_endproc\n"
+  ".size poseidon_fiber_trampoline, .-poseidon_fiber_trampoline\n"
+);
+
+#endif
+
+namespace poseidon {
+namespace details_fiber_switch {
+
+// Builds an initial frame at the top of a new stack, as if the fiber had called
+// `poseidon_fiber_switch()` from `poseidon_fiber_trampoline()`, which will call
+// `entry(arg)`. The result shall be passed to `poseidon_fiber_switch()` as
+// `load_sp`. `entry` shall not return.
+inline
+void*
+make_initial_frame(void* stack_top, uintptr_t entry, void* arg)
+  noexcept
+  {
+    uintptr_t top = reinterpret_cast<uintptr_t>(stack_top);
+    auto tramp = reinterpret_cast<uintptr_t>(poseidon_fiber_trampoline);
+
+#if defined(__x86_64__)
+    auto frame = reinterpret_cast<uint64_t*>(top & ~uintptr_t(15)) - 8;
+    frame[0] = 0x0000'037F'0000'1F80;  // default MXCSR and x87 control word
+    frame[1] = 0;  // R15
+    frame[2] = 0;  // R14
+    frame[3] = reinterpret_cast<uintptr_t>(arg);  // R13
+    frame[4] = entry;  // R12
+    frame[5] = 0;  // RBX
+    frame[6] = 0;  // RBP
+    frame[7] = tramp;  // return address
+#else
+    auto frame = reinterpret_cast<uint64_t*>(top & ~uintptr_t(15)) - 20;
+    ::std::fill_n(frame, 20, uint64_t(0));
+    frame[0] = entry;  // X19
+    frame[1] = reinterpret_cast<uintptr_t>(arg);  // X20
+    frame[11] = tramp;  // X30
+#endif
+    return frame;
+  }
+
+}  // namespace details_fiber_switch
+}  // namespace poseidon
+
+#endif
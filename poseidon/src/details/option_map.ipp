@@ -192,6 +192,133 @@ class Bucket
       { return this->mut_range();  }
   };
 
+// This is a small array of buckets that lives inside `Option_Map`, so maps
+// with a few keys (such as most header options) require no allocation. Buckets
+// are kept contiguous and searched linearly by hash. Only buckets in use are
+// copied or moved, so moving a map with few keys is cheap.
+class Inline_Table
+  {
+  private:
+    Bucket m_bkts[8];
+    size_t m_size = 0;
+
+  public:
+    explicit
+    Inline_Table()
+      noexcept
+      = default;
+
+    Inline_Table(const Inline_Table& other)
+      : m_size(other.m_size)
+      {
+        for(size_t k = 0;  k != this->m_size;  ++k)
+          this->m_bkts[k] = other.m_bkts[k];
+      }
+
+    Inline_Table&
+    operator=(const Inline_Table& other)
+      {
+        if(this == &other)
+          return *this;
+
+        for(size_t k = 0;  k != other.m_size;  ++k)
+          this->m_bkts[k] = other.m_bkts[k];
+        for(size_t k = other.m_size;  k < this->m_size;  ++k)
+          this->m_bkts[k].reset();
+        this->m_size = other.m_size;
+        return *this;
+      }
+
+    Inline_Table(Inline_Table&& other)
+      noexcept
+      { this->swap(other);  }
+
+    Inline_Table&
+    operator=(Inline_Table&& other)
+      noexcept
+      {
+        if(this == &other)
+          return *this;
+
+        this->clear();
+        return this->swap(other);
+      }
+
+  public:
+    // This is the maximum number of buckets.
+    static constexpr
+    size_t
+    capacity()
+      noexcept
+      { return 8;  }
+
+    size_t
+    size()
+      const noexcept
+      { return this->m_size;  }
+
+    const Bucket*
+    data()
+      const noexcept
+      { return this->m_bkts;  }
+
+    Bucket*
+    mut_data()
+      noexcept
+      { return this->m_bkts;  }
+
+    Inline_Table&
+    clear()
+      noexcept
+      {
+        for(size_t k = 0;  k != this->m_size;  ++k)
+          this->m_bkts[k].reset();
+        this->m_size = 0;
+        return *this;
+      }
+
+    Inline_Table&
+    swap(Inline_Table& other)
+      noexcept
+      {
+        size_t n = ::std::max(this->m_size, other.m_size);
+        for(size_t k = 0;  k != n;  ++k)
+          ::std::swap(this->m_bkts[k], other.m_bkts[k]);
+        ::std::swap(this->m_size, other.m_size);
+        return *this;
+      }
+
+    // Returns an empty bucket at the end.
+    Bucket&
+    emplace_back()
+      noexcept
+      {
+        ROCKET_ASSERT(this->m_size < this->capacity());
+        return this->m_bkts[this->m_size++];
+      }
+
+    // Removes a bucket by moving the last one into its place.
+    Inline_Table&
+    erase(size_t index)
+      noexcept
+      {
+        ROCKET_ASSERT(index < this->m_size);
+        size_t last = --(this->m_size);
+        if(index != last)
+          this->m_bkts[index] = ::std::move(this->m_bkts[last]);
+        this->m_bkts[last].reset();
+        return *this;
+      }
+  };
+
+// Calculates the case-insensitive hash of a key, which is identical to the
+// one calculated by `ci_hash`. Well-known HTTP header names are looked up in
+// a table of precomputed hashes, which saves hashing them over and over.
+ROCKET_PURE_FUNCTION
+size_t
+key_hash(cow_string::shallow_type key)
+  noexcept;
+
 template<typename valueT, typename bucketT =
                      typename ::rocket::copy_cv<Bucket, valueT>::type>
 class Iterator
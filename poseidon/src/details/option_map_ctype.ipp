@@ -0,0 +1,126 @@
+// This file is part of Poseidon.
+// Copyleft 2020, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_DETAILS_OPTION_MAP_CTYPE_IPP_
+#define POSEIDON_DETAILS_OPTION_MAP_CTYPE_IPP_
+
+// This file defines character classes for `Option_Map`, and functions that scan
+// URL queries with them. It depends only on the standard library, so it can
+// also be built into the standalone benchmark 'option_map_query_benchmark.cpp'.
+
+#include <stdint.h>
+#include <algorithm>
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
+
+namespace poseidon {
+namespace details_option_map {
+
+enum : uint8_t
+  {
+    opt_ctype_control     = 0x01,  // control characters other than TAB
+    opt_ctype_query_safe  = 0x02,  // usable in URL queries unquoted
+    opt_ctype_http_tchar  = 0x04,  // token characters in HTTP headers
+  };
+
+constexpr uint8_t s_opt_ctype_table[128] =
+  {
+    0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+    0x01, 0x00, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+    0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+    0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+    0x00, 0x06, 0x00, 0x04, 0x06, 0x04, 0x04, 0x06,
+    0x02, 0x02, 0x06, 0x04, 0x02, 0x06, 0x06, 0x02,
+    0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06,
+    0x06, 0x06, 0x02, 0x02, 0x00, 0x00, 0x00, 0x02,
+    0x02, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06,
+    0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06,
+    0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06,
+    0x06, 0x06, 0x06, 0x00, 0x00, 0x00, 0x04, 0x06,
+    0x04, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06,
+    0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06,
+    0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06,
+    0x06, 0x06, 0x06, 0x00, 0x04, 0x00, 0x06, 0x01,
+  };
+
+constexpr
+uint8_t
+do_get_opt_ctype(char c)
+  noexcept
+  { return (uint8_t(c) < 128) ? s_opt_ctype_table[uint8_t(c)] : 0;  }
+
+constexpr
+bool
+do_is_opt_ctype(char c, uint8_t mask)
+  noexcept
+  { return do_get_opt_ctype(c) & mask;  }
+
+constexpr char s_xdigits[] = "00112233445566778899AaBbCcDdEeFf";
+
+// Returns a pointer to the first character in `[bp,ep)` that is not safe in a
+// URL query, or `ep` if all of them are safe.
+inline
+const char*
+do_find_query_unsafe(const char* bp, const char* ep)
+  noexcept
+  {
+    // Unsafe characters in ASCII are controls, space, `"#%&+<=>[\]^`{|}` and
+    // DEL. They are detected 16 bytes at a time as ranges, which must match
+    // `s_opt_ctype_table`.
+    const char* p = bp;
+#ifdef __SSE2__
+    auto do_between = [](__m128i x, char lo, char hi) {
+      return _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8(static_cast<char>(lo - 1))),
+                           _mm_cmplt_epi8(x, _mm_set1_epi8(static_cast<char>(hi + 1))));  };
+
+    while(ep - p >= 16) {
+      __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+      // Bytes that are negative as signed integers are not ASCII.
+      __m128i bad = _mm_cmplt_epi8(x, _mm_set1_epi8(0x21));
+      bad = _mm_or_si128(bad, do_between(x, 0x22, 0x23));
+      bad = _mm_or_si128(bad, do_between(x, 0x25, 0x26));
+      bad = _mm_or_si128(bad, _mm_cmpeq_epi8(x, _mm_set1_epi8(0x2B)));
+      bad = _mm_or_si128(bad, do_between(x, 0x3C, 0x3E));
+      bad = _mm_or_si128(bad, do_between(x, 0x5B, 0x5E));
+      bad = _mm_or_si128(bad, _mm_cmpeq_epi8(x, _mm_set1_epi8(0x60)));
+      bad = _mm_or_si128(bad, _mm_cmpgt_epi8(x, _mm_set1_epi8(0x7A)));
+      bad = _mm_andnot_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(0x7E)), bad);
+
+      uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(bad));
+      if(mask != 0)
+        return p + __builtin_ctz(mask);
+      p += 16;
+    }
+#endif
+    return ::std::find_if(p, ep,
+             [&](char ch) { return !do_is_opt_ctype(ch, opt_ctype_query_safe);  });
+  }
+
+// Returns a pointer to the first `+` or `%` in `[bp,ep)`, or `ep` if there is
+// none.
+inline
+const char*
+do_find_query_escape(const char* bp, const char* ep)
+  noexcept
+  {
+    const char* p = bp;
+#ifdef __SSE2__
+    while(ep - p >= 16) {
+      __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+      __m128i esc = _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('+')),
+                                 _mm_cmpeq_epi8(x, _mm_set1_epi8('%')));
+
+      uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(esc));
+      if(mask != 0)
+        return p + __builtin_ctz(mask);
+      p += 16;
+    }
+#endif
+    return ::std::find_if(p, ep, [&](char ch) { return (ch == '+') || (ch == '%');  });
+  }
+
+}  // namespace details_option_map
+}  // namespace poseidon
+
+#endif
@@ -8,42 +8,144 @@
 namespace poseidon {
 namespace details_zlib_stream_common {
 
+struct zlib_State
+  {
+    // This is used to chain idle streams in the pool.
+    zlib_State* next;
+
+    // These are parameters, which identify compatible streams.
+    int level;
+    int wbits;
+    int (*dtor)(::z_stream*);
+
+    // The stream is allocated dynamically as zlib keeps a pointer to it.
+    ::z_stream strm;
+  };
+
+namespace {
+
+// Each deflate state takes about 256KiB of memory, so we don't keep too
+// many of them around.
+constexpr size_t s_pool_capacity = 64;
+
+simple_mutex s_pool_mutex;
+zlib_State* s_pool_head;
+size_t s_pool_size;
+
+void
+do_destroy_state(zlib_State* st)
+  noexcept
+  {
+    (*(st->dtor))(&(st->strm));
+    delete st;
+  }
+
+}  // namespace
+
 zlib_Stream_Common::
 ~zlib_Stream_Common()
   {
-    // Abuse the opaque pointer for the destructor.
-    auto dtor = reinterpret_cast<destructor*>(this->m_strm.opaque);
-    if(dtor)
-      (*dtor)(&(this->m_strm));
+    this->do_release_state();
+  }
+
+void
+zlib_Stream_Common::
+do_release_state()
+  noexcept
+  {
+    auto st = ::std::exchange(this->m_state, nullptr);
+    if(!st)
+      return;
+
+    // Make the stream ready for the next user. If it cannot be reset, it is
+    // destroyed instead.
+    if((*(this->m_reset))(&(st->strm)) != Z_OK)
+      return do_destroy_state(st);
+
+    simple_mutex::unique_lock lock(s_pool_mutex);
+    if(s_pool_size >= s_pool_capacity) {
+      lock.unlock();
+      return do_destroy_state(st);
+    }
+
+    // Insert the stream at the beginning.
+    st->next = s_pool_head;
+    s_pool_head = st;
+    s_pool_size++;
+  }
+
+::z_stream*
+zlib_Stream_Common::
+do_acquire_stream()
+  {
+    if(ROCKET_EXPECT(this->m_state))
+      return &(this->m_state->strm);
+
+    // Check whether we can get a compatible stream from the pool.
+    simple_mutex::unique_lock lock(s_pool_mutex);
+    for(auto qnext = &s_pool_head;  *qnext;  qnext = &((*qnext)->next)) {
+      auto st = *qnext;
+      if((st->dtor != this->m_dtor) || (st->level != this->m_level) ||
+         (st->wbits != this->m_wbits))
+        continue;
+
+      // Remove this stream from the pool.
+      *qnext = st->next;
+      s_pool_size--;
+      this->m_state = st;
+      return &(st->strm);
+    }
+    lock.unlock();
+
+    // Allocate a new stream, if no compatible one has been found.
+    auto st = ::rocket::make_unique<zlib_State>();
+#ifdef ROCKET_DEBUG
+    ::std::memset(&(st->strm), 0xEE, sizeof(st->strm));
+#endif
+    st->next = nullptr;
+    st->level = this->m_level;
+    st->wbits = this->m_wbits;
+    st->dtor = this->m_dtor;
+
+    // Initialize requred fields.
+    st->strm.next_in = nullptr;
+    st->strm.avail_in = 0;
+    st->strm.zalloc = nullptr;
+    st->strm.zfree = nullptr;
+    st->strm.opaque = nullptr;
+    this->do_zlib_construct(&(st->strm), this->m_level, this->m_wbits);
+
+    this->m_state = st.release();
+    return &(this->m_state->strm);
   }
 
 void
 zlib_Stream_Common::
-do_reserve_output_buffer()
+do_reserve_output_buffer(::rocket::linear_buffer& obuf, ::z_stream* strm, size_t size)
   {
     // Ensure there is enough space in the output buffer.
-    size_t navail = this->m_obuf.reserve(64);
-    this->m_strm.next_out = reinterpret_cast<uint8_t*>(this->m_obuf.mut_end());
-    this->m_strm.avail_out = static_cast<uint32_t>(navail);
+    // The stupid zlib library uses a 32-bit integer for number of bytes.
+    size_t navail = obuf.reserve(::rocket::clamp(size, 64U, 0x7FFFFFFFU));
+    strm->next_out = reinterpret_cast<uint8_t*>(obuf.mut_end());
+    strm->avail_out = static_cast<uint32_t>(::rocket::min(navail, 0x7FFFFFFFU));
   }
 
 void
 zlib_Stream_Common::
-do_update_output_buffer()
+do_update_output_buffer(::rocket::linear_buffer& obuf, ::z_stream* strm)
   noexcept
   {
     // Consume output bytes, if any.
-    auto pbase = reinterpret_cast<const uint8_t*>(this->m_obuf.end());
-    this->m_obuf.accept(static_cast<size_t>(this->m_strm.next_out - pbase));
+    auto pbase = reinterpret_cast<const uint8_t*>(obuf.end());
+    obuf.accept(static_cast<size_t>(strm->next_out - pbase));
   }
 
 void
 zlib_Stream_Common::
-do_zlib_throw_error(const char* func, int err)
-  const
+do_zlib_throw_error(const ::z_stream* strm, const char* func, int err)
   {
     // Note this field is always initialized.
-    const char* msg = this->m_strm.msg;
+    const char* msg = strm->msg;
     if(!msg)
       msg = "[no message]";
 
@@ -52,21 +154,13 @@ do_zlib_throw_error(const char* func, int err)
 
 void
 zlib_Stream_Common::
-do_construct(int level, int wbits, destructor* dtor)
+do_construct(int level, int wbits, resetter* reset, destructor* dtor)
   {
-    // Initialize requred fields.
-#ifdef ROCKET_DEBUG
-    ::std::memset(&(this->m_strm), 0xEE, sizeof(this->m_strm));
-#endif
-    this->m_strm.next_in = nullptr;
-    this->m_strm.avail_in = 0;
-    this->m_strm.zalloc = nullptr;
-    this->m_strm.zfree = nullptr;
-
-    // Note exception safety.
-    this->m_strm.opaque = nullptr;
-    this->do_zlib_construct(&(this->m_strm), level, wbits);
-    this->m_strm.opaque = reinterpret_cast<void*>(dtor);
+    // Streams are initialized lazily.
+    this->m_level = level;
+    this->m_wbits = wbits;
+    this->m_reset = reset;
+    this->m_dtor = dtor;
   }
 
 void
@@ -74,67 +168,80 @@ zlib_Stream_Common::
 do_reset()
   {
     // Clear everything.
-    this->do_zlib_reset(&(this->m_strm));
-
-    this->m_strm.next_out = nullptr;
-    this->m_strm.avail_out = 0;
+    this->do_release_state();
     this->m_obuf.clear();
   }
 
 void
 zlib_Stream_Common::
-do_write(const char* data, size_t size)
+do_write(::rocket::linear_buffer& obuf, const char* data, size_t size)
   {
+    auto strm = this->do_acquire_stream();
+
     // Set up the read pointer.
     const auto end_in = reinterpret_cast<const uint8_t*>(data + size);
-    this->m_strm.next_in = end_in - size;
+    strm->next_in = end_in - size;
 
     int res;
     do {
       // The stupid zlib library uses a 32-bit integer for number of bytes.
-      this->m_strm.avail_in = static_cast<uint32_t>(
-                     ::rocket::min(end_in - this->m_strm.next_in, INT_MAX));
+      strm->avail_in = static_cast<uint32_t>(
+                     ::rocket::min(end_in - strm->next_in, INT_MAX));
 
       // Extend the output buffer first so we never get `Z_BUF_ERROR`.
-      this->do_reserve_output_buffer();
-      this->do_zlib_write_partial(res, &(this->m_strm), Z_NO_FLUSH);
-      this->do_update_output_buffer();
+      // Usually all input can be consumed in a single call.
+      size_t nres = this->do_zlib_estimate_output(strm, strm->avail_in);
+      this->do_reserve_output_buffer(obuf, strm, nres);
+      this->do_zlib_write_partial(res, strm, Z_NO_FLUSH);
+      this->do_update_output_buffer(obuf, strm);
     }
     while(res == Z_OK);
   }
 
 void
 zlib_Stream_Common::
-do_flush()
+do_flush(::rocket::linear_buffer& obuf)
   {
+    auto strm = this->do_acquire_stream();
+
     // Put nothing, but force `Z_SYNC_FLUSH`.
-    this->m_strm.next_in = nullptr;
-    this->m_strm.avail_in = 0;
+    strm->next_in = nullptr;
+    strm->avail_in = 0;
 
+    // The amount of pending data is unknown, so grow the buffer
+    // exponentially.
+    size_t nres = this->do_zlib_estimate_output(strm, 0) + 1024;
     int res;
     do {
       // Flush all output data into the output buffer.
-      this->do_reserve_output_buffer();
-      this->do_zlib_write_partial(res, &(this->m_strm), Z_SYNC_FLUSH);
-      this->do_update_output_buffer();
+      this->do_reserve_output_buffer(obuf, strm, nres);
+      this->do_zlib_write_partial(res, strm, Z_SYNC_FLUSH);
+      this->do_update_output_buffer(obuf, strm);
+      nres *= 2;
     }
     while(res == Z_OK);
   }
 
 void
 zlib_Stream_Common::
-do_finish()
+do_finish(::rocket::linear_buffer& obuf)
   {
+    auto strm = this->do_acquire_stream();
+
     // Put nothing, but force `Z_FINISH`.
-    this->m_strm.next_in = nullptr;
-    this->m_strm.avail_in = 0;
+    strm->next_in = nullptr;
+    strm->avail_in = 0;
 
+    // The amount of pending data is unknown, so grow the buffer
+    // exponentially.
+    size_t nres = this->do_zlib_estimate_output(strm, 0) + 1024;
     int res;
     do {
       // Flush all output data into the output buffer.
-      this->do_reserve_output_buffer();
-      this->do_zlib_write_partial(res, &(this->m_strm), Z_FINISH);
-      this->do_update_output_buffer();
+      this->do_reserve_output_buffer(obuf, strm, nres);
+      this->do_zlib_write_partial(res, strm, Z_FINISH);
+      this->do_update_output_buffer(obuf, strm);
+      nres *= 2;
     }
     while(res == Z_OK);
   }
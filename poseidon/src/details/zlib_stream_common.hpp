@@ -11,14 +11,25 @@
 namespace poseidon {
 namespace details_zlib_stream_common {
 
+struct zlib_State;
+
 class zlib_Stream_Common
   : public ::asteria::Rcfwd<zlib_Stream_Common>
   {
   protected:
+    using resetter    = int (::z_stream* strm);
     using destructor  = int (::z_stream* strm);
 
   private:
-    ::z_stream m_strm;
+    // These are parameters of the stream. The stream itself is borrowed from
+    // a process-wide pool when it is first used, and is returned to the pool
+    // upon reset or destruction.
+    int m_level = 0;
+    int m_wbits = 0;
+    resetter* m_reset = nullptr;
+    destructor* m_dtor = nullptr;
+    zlib_State* m_state = nullptr;
+
     ::rocket::linear_buffer m_obuf;
 
   protected:
@@ -29,18 +40,27 @@ class zlib_Stream_Common
   private:
     inline
     void
-    do_reserve_output_buffer();
+    do_release_state()
+      noexcept;
 
     inline
+    ::z_stream*
+    do_acquire_stream();
+
+    static inline
+    void
+    do_reserve_output_buffer(::rocket::linear_buffer& obuf, ::z_stream* strm,
+                             size_t size);
+
+    static inline
     void
-    do_update_output_buffer()
+    do_update_output_buffer(::rocket::linear_buffer& obuf, ::z_stream* strm)
       noexcept;
 
   protected:
-    [[noreturn]]
+    [[noreturn]] static
     void
-    do_zlib_throw_error(const char* func, int err)
-      const;
+    do_zlib_throw_error(const ::z_stream* strm, const char* func, int err);
 
     // These are callback functions.
     virtual
@@ -50,35 +70,43 @@ class zlib_Stream_Common
 
     virtual
     void
-    do_zlib_reset(::z_stream* strm)
+    do_zlib_write_partial(int& res, ::z_stream* strm, int flush)
       = 0;
 
+    // Estimates the number of output bytes that will be produced from `size`
+    // bytes of input. This is used to reserve the output buffer before each
+    // call to `do_zlib_write_partial()`. The result need not be exact.
     virtual
-    void
-    do_zlib_write_partial(int& res, ::z_stream* strm, int flush)
+    size_t
+    do_zlib_estimate_output(::z_stream* strm, size_t size)
+      const noexcept
       = 0;
 
-    // Initializes internal states.
+    // Sets parameters of the stream. Streams with identical parameters are
+    // shared through the pool, so `reset` and `dtor` shall match `level` and
+    // `wbits`.
     void
-    do_construct(int level, int wbits, destructor* dtor);
+    do_construct(int level, int wbits, resetter* reset, destructor* dtor);
 
     // Resets internal states and clears the output buffer.
-    // Unprocessed data are discarded.
+    // Unprocessed data are discarded. The stream is returned to the pool.
     void
     do_reset();
 
     // Puts some data for compression/decompression.
+    // Output data are appended to `obuf`, which may be either the internal
+    // output buffer or one that is provided by the user.
     void
-    do_write(const char* data, size_t size);
+    do_write(::rocket::linear_buffer& obuf, const char* data, size_t size);
 
     // Synchronizes output to a byte boundary. This causes 4 extra
-    // bytes (00 00 FF FF) to be appended to the output buffer.
+    // bytes (00 00 FF FF) to be appended to `obuf`.
     void
-    do_flush();
+    do_flush(::rocket::linear_buffer& obuf);
 
     // Terminates the stream.
     void
-    do_finish();
+    do_finish(::rocket::linear_buffer& obuf);
 
   public:
     ASTERIA_NONCOPYABLE_DESTRUCTOR(zlib_Stream_Common);
@@ -0,0 +1,164 @@
+// This file is part of Poseidon.
+// Copyleft 2020, LH_Mouse. All wrongs reserved.
+
+// This program measures the cost of switching fibers, by switching back and
+// forth between the main thread and a fiber, with `poseidon_fiber_switch()` and
+// with `swapcontext()`. It also checks that callee-saved registers survive the
+// switches, so it is run by `make check`. It depends only on the standard
+// library, and can be cross-compiled, for example with
+//   aarch64-linux-gnu-g++ -std=gnu++14 -O2 -static fiber_switch_benchmark.cpp
+// and run with `qemu-aarch64`.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+
+#if defined(__x86_64__) || defined(__aarch64__)
+#  include "details/fiber_switch.ipp"
+#endif
+
+namespace {
+
+constexpr size_t s_stack_size = 0x40000;
+constexpr uint64_t s_round_trips = 10000000;
+
+double
+do_get_seconds()
+  noexcept
+  {
+    ::timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec) * 1e-9;
+  }
+
+void*
+do_allocate_stack()
+  noexcept
+  {
+    void* base = ::mmap(nullptr, s_stack_size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    return (base == MAP_FAILED) ? nullptr : base;
+  }
+
+void
+do_report(const char* name, uint64_t nswitches, double secs)
+  noexcept
+  {
+    ::printf("%-24s %12llu switches  %8.3f s  %12.0f switches/s  %8.1f ns/switch\n",
+             name, static_cast<unsigned long long>(nswitches), secs,
+             static_cast<double>(nswitches) / secs,
+             secs * 1e9 / static_cast<double>(nswitches));
+  }
+
+#if defined(__x86_64__) || defined(__aarch64__)
+void* s_main_sp;
+void* s_fiber_sp;
+uint64_t s_fiber_count;
+double s_fiber_fsum;
+
+void
+do_fiber_proc(void* /*param*/)
+  noexcept
+  {
+    // These values are kept in callee-saved registers across switches. They
+    // are different from those in the main thread, so if any register is not
+    // restored, one of the results will be wrong.
+    uint64_t count = 0;
+    double fsum = 0.5;
+    for(;;) {
+      count ++;
+      fsum += 0.25;
+      s_fiber_count = count;
+      s_fiber_fsum = fsum;
+      ::poseidon_fiber_switch(&s_fiber_sp, s_main_sp);
+    }
+  }
+
+bool
+do_benchmark_fiber_switch(uint64_t nrounds)
+  {
+    void* stack = do_allocate_stack();
+    if(!stack)
+      return false;
+
+    s_fiber_sp = ::poseidon::details_fiber_switch::make_initial_frame(
+                     static_cast<char*>(stack) + s_stack_size,
+                     reinterpret_cast<uintptr_t>(do_fiber_proc), nullptr);
+
+    uint64_t count = 0;
+    double fsum = 1.0;
+    double start = do_get_seconds();
+    for(uint64_t k = 0;  k != nrounds;  ++k) {
+      ::poseidon_fiber_switch(&s_main_sp, s_fiber_sp);
+      count += 3;
+      fsum *= 1.0000001;
+    }
+    double secs = do_get_seconds() - start;
+    do_report("poseidon_fiber_switch()", nrounds * 2, secs);
+
+    ::munmap(stack, s_stack_size);
+
+    // Check results against those without switches.
+    double fexp = 1.0;
+    for(uint64_t k = 0;  k != nrounds;  ++k)
+      fexp *= 1.0000001;
+
+    bool ok = (count == nrounds * 3) && (fsum == fexp) && (s_fiber_count == nrounds)
+              && (s_fiber_fsum == 0.5 + static_cast<double>(nrounds) * 0.25);
+    if(!ok)
+      ::fprintf(stderr, "Registers were not preserved across fiber switches!\n");
+    return ok;
+  }
+#endif
+
+::ucontext_t s_main_uctx[1];
+::ucontext_t s_fiber_uctx[1];
+
+void
+do_fiber_proc_uctx()
+  noexcept
+  {
+    for(;;)
+      ::swapcontext(s_fiber_uctx, s_main_uctx);
+  }
+
+bool
+do_benchmark_swapcontext(uint64_t nrounds)
+  {
+    void* stack = do_allocate_stack();
+    if(!stack)
+      return false;
+
+    ::getcontext(s_fiber_uctx);
+    s_fiber_uctx->uc_stack.ss_sp = stack;
+    s_fiber_uctx->uc_stack.ss_size = s_stack_size;
+    s_fiber_uctx->uc_link = nullptr;
+    ::makecontext(s_fiber_uctx, do_fiber_proc_uctx, 0);
+
+    double start = do_get_seconds();
+    for(uint64_t k = 0;  k != nrounds;  ++k)
+      ::swapcontext(s_main_uctx, s_fiber_uctx);
+    double secs = do_get_seconds() - start;
+    do_report("swapcontext()", nrounds * 2, secs);
+
+    ::munmap(stack, s_stack_size);
+    return true;
+  }
+
+}  // namespace
+
+int
+main()
+  {
+    bool ok = true;
+#if defined(__x86_64__) || defined(__aarch64__)
+    ok &= do_benchmark_fiber_switch(s_round_trips);
+#else
+    ::printf("poseidon_fiber_switch() not available on this target\n");
+#endif
+    // `swapcontext()` makes a system call each time, so it is run fewer times.
+    ok &= do_benchmark_swapcontext(s_round_trips / 10);
+    return ok ? 0 : 1;
+  }
@@ -0,0 +1,152 @@
+// This file is part of Poseidon.
+// Copyleft 2020, LH_Mouse. All wrongs reserved.
+
+// This program measures how `Fiber_Scheduler::yield()` scales with the number
+// of scheduler threads. Fibers yield without futures, so they only go through
+// run queues. Because `Fiber_Scheduler::modal_loop()` never returns, each number
+// of threads is run in a child process, with its own 'main.conf' in a temporary
+// directory. It also checks that all fibers run to completion, so it is run by
+// `make check`.
+
+#include "precompiled.hpp"
+#include "static/fiber_scheduler.hpp"
+#include "static/main_config.hpp"
+#include "core/abstract_fiber.hpp"
+#include <time.h>
+#include <sys/wait.h>
+
+namespace {
+
+using namespace ::poseidon;
+
+constexpr uint32_t s_fiber_count = 256;
+constexpr uint32_t s_yields_per_fiber = 10000;
+
+double
+do_get_seconds()
+  noexcept
+  {
+    ::timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec) * 1e-9;
+  }
+
+atomic_signal s_exit_sig;
+atomic_relaxed<uint64_t> s_total_yields;
+atomic_acq_rel<uint32_t> s_running_fibers;
+uint32_t s_thread_count;
+double s_start_secs;
+
+class Yield_Fiber
+  : public Abstract_Fiber
+  {
+  protected:
+    void
+    do_execute()
+      override
+      {
+        uint64_t nyields = 0;
+        for(uint32_t k = 0;  k != s_yields_per_fiber;  ++k) {
+          Fiber_Scheduler::yield(nullptr);
+          nyields ++;
+        }
+        s_total_yields.fetch_add(nyields);
+
+        if(s_running_fibers.fetch_sub(1) != 1)
+          return;
+
+        // This is the last fiber. Print results, then tell the scheduler to
+        // exit. As it exits with `quick_exit()`, standard output is flushed
+        // here. The exit status tells whether all yields have been done.
+        double secs = do_get_seconds() - s_start_secs;
+        uint64_t total = s_total_yields.load();
+        ::printf("%2u threads  %4u fibers  %10llu yields  %8.3f s  %12.0f yields/s  %8.1f ns/yield\n",
+                 s_thread_count, s_fiber_count, static_cast<unsigned long long>(total),
+                 secs, static_cast<double>(total) / secs,
+                 secs * 1e9 / static_cast<double>(total));
+        ::fflush(stdout);
+
+        if(total != uint64_t(s_fiber_count) * s_yields_per_fiber) {
+          ::fprintf(stderr, "Some yields were lost: %llu\n",
+                    static_cast<unsigned long long>(total));
+          ::_exit(1);
+        }
+        s_exit_sig.store(SIGTERM);
+      }
+  };
+
+[[noreturn]]
+void
+do_run_child(uint32_t thread_count)
+  {
+    // Write a config file with the number of threads in a temporary directory,
+    // and load it.
+    char dir[] = "/tmp/poseidon-fiber-yield-XXXXXX";
+    if(!::mkdtemp(dir))
+      ::_exit(1);
+
+    cow_string path = format_string("$1/main.conf", dir);
+    ::FILE* fp = ::fopen(path.c_str(), "w");
+    if(!fp)
+      ::_exit(1);
+
+    ::fprintf(fp, "fiber: {\n  thread_count: %u\n  stack_vm_size: 262144\n}\n", thread_count);
+    ::fclose(fp);
+
+    if(::chdir(dir) != 0)
+      ::_exit(1);
+
+    Main_Config::reload();
+    Fiber_Scheduler::reload();
+    ::unlink(path.c_str());
+    ::rmdir(dir);
+
+    // Keep references to fibers, so they are not deleted before they start.
+    ::std::vector<rcptr<Abstract_Fiber>> fibers;
+    s_thread_count = thread_count;
+    s_running_fibers.store(s_fiber_count);
+    for(uint32_t k = 0;  k != s_fiber_count;  ++k)
+      fibers.emplace_back(Fiber_Scheduler::insert(::rocket::make_unique<Yield_Fiber>()));
+
+    s_start_secs = do_get_seconds();
+    Fiber_Scheduler::modal_loop(s_exit_sig);
+  }
+
+bool
+do_benchmark(uint32_t thread_count)
+  {
+    ::fflush(stdout);
+    ::pid_t pid = ::fork();
+    if(pid < 0)
+      return false;
+
+    if(pid == 0) {
+      try {
+        do_run_child(thread_count);
+      }
+      catch(exception& stdex) {
+        ::fprintf(stderr, "%s\n", stdex.what());
+        ::_exit(1);
+      }
+    }
+
+    int status;
+    if(::waitpid(pid, &status, 0) != pid)
+      return false;
+
+    return WIFEXITED(status) && (WEXITSTATUS(status) == 0);
+  }
+
+}  // namespace
+
+int
+main()
+  {
+    static constexpr uint32_t s_thread_counts[] = { 1, 2, 4, 8 };
+    for(uint32_t thread_count : s_thread_counts)
+      if(!do_benchmark(thread_count)) {
+        ::fprintf(stderr, "Fiber scheduler failed with %u threads!\n", thread_count);
+        return 1;
+      }
+    return 0;
+  }
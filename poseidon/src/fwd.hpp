@@ -20,6 +20,7 @@
 #include <vector>
 #include <deque>
 #include <unistd.h>
+#include <sys/uio.h>
 
 namespace poseidon {
 namespace noadl = poseidon;
@@ -142,6 +143,7 @@ template<typename> class Future;
 class LCG48;
 class zlib_Deflator;
 class zlib_Inflator;
+class Abstract_Compressor;
 
 // Socket
 enum IO_Result : uint8_t;
@@ -171,15 +173,30 @@ enum HTTP_Decoder_State : uint8_t;
 enum HTTP_Connection : uint8_t;
 enum WebSocket_Opcode : uint8_t;
 enum WebSocket_Status : uint16_t;
+enum HTTP2_Error : uint32_t;
 
 class URL;
+class URL_View;
 class Option_Map;
+class HTTP_Cached_Response;
+class HTTP_Response_Cache;
+class HTTP_Static_File_Handler;
+class HTTP_Route_Match;
+class HTTP_Router;
+struct HTTP_Client_Response;
+class HTTP_Client_Pool;
+class HTTP_Body_Stream;
 class HTTP_Exception;
 class WebSocket_Exception;
 class Abstract_HTTP_Server_Encoder;
 class Abstract_HTTP_Client_Decoder;
 class Abstract_HTTP_Client_Encoder;
 class Abstract_HTTP_Server_Decoder;
+class HPACK_Decoder;
+class HPACK_Encoder;
+class Abstract_HTTP2_Server;
+class Abstract_HTTP2_TLS_Socket;
+class Abstract_Multipart_Parser;
 
 // Singletons
 class Main_Config;
@@ -188,6 +205,7 @@ class Timer_Driver;
 class Network_Driver;
 class Worker_Pool;
 class Fiber_Scheduler;
+struct Fiber_Stack_Usage;
 
 // Log levels
 // Note each level has a hardcoded name and number.
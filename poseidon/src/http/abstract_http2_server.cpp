@@ -0,0 +1,893 @@
+// This file is part of Poseidon.
+// Copyleft 2020, LH_Mouse. All wrongs reserved.
+
+#include "../precompiled.hpp"
+#include "abstract_http2_server.hpp"
+#include "option_map.hpp"
+#include "enums.hpp"
+#include "http_date.hpp"
+#include "../utils.hpp"
+
+namespace poseidon {
+namespace {
+
+// These are frame types and flags, as defined in
+//   https://tools.ietf.org/html/rfc7540#section-6
+enum : uint8_t
+  {
+    frame_data           = 0x0,
+    frame_headers        = 0x1,
+    frame_priority       = 0x2,
+    frame_rst_stream     = 0x3,
+    frame_settings       = 0x4,
+    frame_push_promise   = 0x5,
+    frame_ping           = 0x6,
+    frame_goaway         = 0x7,
+    frame_window_update  = 0x8,
+    frame_continuation   = 0x9,
+  };
+
+enum : uint8_t
+  {
+    flag_end_stream   = 0x01,
+    flag_ack          = 0x01,
+    flag_end_headers  = 0x04,
+    flag_padded       = 0x08,
+    flag_priority     = 0x20,
+  };
+
+enum : uint16_t
+  {
+    setting_header_table_size       = 0x1,
+    setting_enable_push             = 0x2,
+    setting_max_concurrent_streams  = 0x3,
+    setting_initial_window_size     = 0x4,
+    setting_max_frame_size          = 0x5,
+    setting_max_header_list_size    = 0x6,
+  };
+
+constexpr char s_client_preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+constexpr size_t s_client_preface_size = sizeof(s_client_preface) - 1;
+
+constexpr uint32_t s_max_frame_size = 16384;  // default; not changed
+constexpr uint32_t s_max_concurrent_streams = 100;
+constexpr size_t s_max_header_block_size = 0x100000;
+constexpr size_t s_max_header_list_size = 0x10000;
+constexpr int64_t s_max_window_size = 0x7FFFFFFF;
+constexpr int64_t s_recv_window_size = 65535;  // default; not changed
+
+constexpr const char* s_connection_specific_headers[] =
+  {
+    "Connection",
+    "Keep-Alive",
+    "Proxy-Connection",
+    "Transfer-Encoding",
+    "Upgrade",
+  };
+
+inline
+uint32_t
+do_load_be32(const char* p)
+  noexcept
+  {
+    uint32_t val = 0;
+    for(size_t k = 0;  k != 4;  ++k)
+      val = val << 8 | static_cast<uint8_t>(p[k]);
+    return val;
+  }
+
+inline
+void
+do_store_be32(char* p, uint32_t val)
+  noexcept
+  {
+    for(size_t k = 0;  k != 4;  ++k)
+      p[k] = static_cast<char>(val >> (24 - k * 8));
+  }
+
+bool
+do_is_connection_specific(const cow_string& name)
+  {
+    // These headers are not allowed in HTTP/2. See RFC 7540 section 8.1.2.2.
+    for(const char* str : s_connection_specific_headers)
+      if(ascii_ci_equal(name, sref(str)))
+        return true;
+    return false;
+  }
+
+bool
+do_strip_padding(const char*& data, size_t& size, uint8_t flags)
+  noexcept
+  {
+    if(!(flags & flag_padded))
+      return true;
+
+    if(size == 0)
+      return false;
+
+    size_t npad = static_cast<uint8_t>(*data);
+    if(npad >= size)
+      return false;
+
+    data ++;
+    size -= npad + 1;
+    return true;
+  }
+
+}  // namespace
+
+Abstract_HTTP2_Server::
+~Abstract_HTTP2_Server()
+  {
+  }
+
+void
+Abstract_HTTP2_Server::
+do_send_frame(uint8_t type, uint8_t flags, uint32_t stream, const char* data, size_t size)
+  {
+    ROCKET_ASSERT(size <= 0xFFFFFF);
+
+    // Compose the frame in a single buffer, so it is sent in one go.
+    char head[9];
+    do_store_be32(head, static_cast<uint32_t>(size << 8 | type));
+    head[4] = static_cast<char>(flags);
+    do_store_be32(head + 5, stream);
+
+    auto& fbuf = this->m_wbuf;
+    fbuf.clear();
+    fbuf.reserve(sizeof(head) + size);
+    fbuf.putn(head, sizeof(head));
+    fbuf.putn(data, size);
+
+    this->m_good &= this->do_http2_server_send(fbuf.data(), fbuf.size());
+    fbuf.clear();
+  }
+
+void
+Abstract_HTTP2_Server::
+do_send_window_update(uint32_t stream, uint32_t incr)
+  {
+    char data[4];
+    do_store_be32(data, incr);
+    this->do_send_frame(frame_window_update, 0, stream, data, sizeof(data));
+  }
+
+void
+Abstract_HTTP2_Server::
+do_send_reset(uint32_t stream, HTTP2_Error err)
+  {
+    char data[4];
+    do_store_be32(data, err);
+    this->do_send_frame(frame_rst_stream, 0, stream, data, sizeof(data));
+    this->m_streams.erase(stream);
+  }
+
+void
+Abstract_HTTP2_Server::
+do_release_recv_window(uint32_t stream, size_t size)
+  {
+    // Windows are reopened in large steps, so `WINDOW_UPDATE` is not sent for
+    // every frame. A window can't be reopened beyond its initial size.
+    int64_t incr = static_cast<int64_t>(::rocket::min(size, static_cast<size_t>(s_recv_window_size)));
+    auto& cpend = this->m_recv_pending;
+    cpend = ::rocket::min(cpend + incr, s_recv_window_size - this->m_recv_window);
+    if(cpend >= s_recv_window_size / 2) {
+      this->do_send_window_update(0, static_cast<uint32_t>(cpend));
+      this->m_recv_window += cpend;
+      cpend = 0;
+    }
+
+    // Windows of streams that have been closed by the peer are not reopened.
+    auto it = this->m_streams.find(stream);
+    if((it == this->m_streams.end()) || it->second.remote_closed)
+      return;
+
+    auto& spend = it->second.recv_pending;
+    spend = ::rocket::min(spend + incr, s_recv_window_size - it->second.recv_window);
+    if(spend >= s_recv_window_size / 2) {
+      this->do_send_window_update(stream, static_cast<uint32_t>(spend));
+      it->second.recv_window += spend;
+      spend = 0;
+    }
+  }
+
+void
+Abstract_HTTP2_Server::
+do_reject_request(uint32_t stream, bool end_stream, HTTP_Status stat)
+  {
+    auto& strm = this->m_streams[stream];
+    strm.send_window = this->m_peer_window;
+    strm.recv_window = s_recv_window_size;
+    strm.remote_closed = end_stream;
+
+    // If the request has an entity, the stream is reset after the response,
+    // which tells the client to stop sending the entity.
+    Option_Map resp;
+    resp.set(sref("Content-Length"), sref("0"));
+    this->http2_encode_headers(stream, stat, ::std::move(resp), true);
+    if(this->m_streams.count(stream))
+      this->do_send_reset(stream, http2_error_no_error);
+  }
+
+HTTP2_Error
+Abstract_HTTP2_Server::
+do_process_frame(uint8_t type, uint8_t flags, uint32_t stream, const char* data,
+                 size_t size)
+  {
+    // A header block must not be interleaved with other frames. See RFC 7540
+    // section 6.10.
+    if(this->m_hstream && (type != frame_continuation))
+      return http2_error_protocol_error;
+
+    switch(type) {
+      case frame_data: {
+        if(stream == 0)
+          return http2_error_protocol_error;
+
+        const char* sp = data;
+        size_t n = size;
+        if(!do_strip_padding(sp, n, flags))
+          return http2_error_protocol_error;
+
+        // The whole frame, including padding, counts towards flow control
+        // windows. See RFC 7540 section 6.9.1.
+        if(static_cast<int64_t>(size) > this->m_recv_window)
+          return http2_error_flow_control_error;
+
+        this->m_recv_window -= static_cast<int64_t>(size);
+
+        auto it = this->m_streams.find(stream);
+        if(it == this->m_streams.end()) {
+          if(stream > this->m_last_stream)
+            return http2_error_protocol_error;
+
+          this->do_send_reset(stream, http2_error_stream_closed);
+          this->do_release_recv_window(stream, size);
+          return http2_error_no_error;
+        }
+
+        if(it->second.remote_closed) {
+          this->do_send_reset(stream, http2_error_stream_closed);
+          this->do_http2_server_on_stream_reset(stream, http2_error_stream_closed);
+          this->do_release_recv_window(stream, size);
+          return http2_error_no_error;
+        }
+
+        if(static_cast<int64_t>(size) > it->second.recv_window) {
+          this->do_send_reset(stream, http2_error_flow_control_error);
+          this->do_http2_server_on_stream_reset(stream, http2_error_flow_control_error);
+          this->do_release_recv_window(stream, size);
+          return http2_error_no_error;
+        }
+
+        // Padding is released at once. Data are released when they have been
+        // acknowledged by the consumer.
+        it->second.recv_window -= static_cast<int64_t>(size);
+        if(n != size)
+          this->do_release_recv_window(stream, size - n);
+
+        if(n != 0)
+          this->do_http2_server_on_request_entity(stream, sp, n);
+
+        if(!(flags & flag_end_stream))
+          return http2_error_no_error;
+
+        // The stream may have been closed by the callback.
+        it = this->m_streams.find(stream);
+        if(it != this->m_streams.end()) {
+          it->second.remote_closed = true;
+          if(it->second.local_closed)
+            this->m_streams.erase(it);
+        }
+        this->do_http2_server_on_request_end(stream);
+        return http2_error_no_error;
+      }
+
+      case frame_headers: {
+        if((stream == 0) || !(stream & 1))
+          return http2_error_protocol_error;
+
+        const char* sp = data;
+        size_t n = size;
+        if(!do_strip_padding(sp, n, flags))
+          return http2_error_protocol_error;
+
+        // Priorities are ignored.
+        if(flags & flag_priority) {
+          if(n < 5)
+            return http2_error_protocol_error;
+
+          sp += 5;
+          n -= 5;
+        }
+
+        this->m_hblock.clear();
+        this->m_hblock.putn(sp, n);
+        this->m_hstream = stream;
+        this->m_hend = flags & flag_end_stream;
+
+        if(!(flags & flag_end_headers))
+          return http2_error_no_error;
+
+        return this->do_process_header_block(stream, this->m_hend);
+      }
+
+      case frame_continuation: {
+        if((stream == 0) || (stream != this->m_hstream))
+          return http2_error_protocol_error;
+
+        if(this->m_hblock.size() + size > s_max_header_block_size)
+          return http2_error_enhance_your_calm;
+
+        this->m_hblock.putn(data, size);
+
+        if(!(flags & flag_end_headers))
+          return http2_error_no_error;
+
+        return this->do_process_header_block(stream, this->m_hend);
+      }
+
+      case frame_priority: {
+        if(stream == 0)
+          return http2_error_protocol_error;
+
+        if(size != 5)
+          return http2_error_frame_size_error;
+
+        // Priorities are ignored.
+        return http2_error_no_error;
+      }
+
+      case frame_rst_stream: {
+        if(stream == 0)
+          return http2_error_protocol_error;
+
+        if(size != 4)
+          return http2_error_frame_size_error;
+
+        if(stream > this->m_last_stream)
+          return http2_error_protocol_error;
+
+        auto it = this->m_streams.find(stream);
+        if(it == this->m_streams.end())
+          return http2_error_no_error;
+
+        this->m_streams.erase(it);
+        this->do_http2_server_on_stream_reset(stream,
+                                   static_cast<HTTP2_Error>(do_load_be32(data)));
+        return http2_error_no_error;
+      }
+
+      case frame_settings: {
+        if(stream != 0)
+          return http2_error_protocol_error;
+
+        if(flags & flag_ack)
+          return (size == 0) ? http2_error_no_error : http2_error_frame_size_error;
+
+        if(size % 6 != 0)
+          return http2_error_frame_size_error;
+
+        for(size_t k = 0;  k != size;  k += 6) {
+          uint32_t id = do_load_be32(data + k) >> 16;
+          uint32_t val = do_load_be32(data + k + 2);
+
+          switch(id) {
+            case setting_header_table_size:
+              this->m_henc.set_max_table_size(val);
+              break;
+
+            case setting_enable_push:
+              if(val > 1)
+                return http2_error_protocol_error;
+              break;
+
+            case setting_initial_window_size: {
+              if(val > s_max_window_size)
+                return http2_error_flow_control_error;
+
+              // Adjust all open streams. See RFC 7540 section 6.9.2.
+              int64_t delta = static_cast<int64_t>(val) - this->m_peer_window;
+              for(auto& r : this->m_streams)
+                if((r.second.send_window += delta) > s_max_window_size)
+                  return http2_error_flow_control_error;
+
+              this->m_peer_window = val;
+              break;
+            }
+
+            case setting_max_frame_size:
+              if((val < 16384) || (val > 0xFFFFFF))
+                return http2_error_protocol_error;
+
+              this->m_peer_frame = val;
+              break;
+
+            default:
+              // Unknown settings are ignored.
+              break;
+          }
+        }
+
+        this->do_send_frame(frame_settings, flag_ack, 0, nullptr, 0);
+        this->do_flush_all_streams();
+        return http2_error_no_error;
+      }
+
+      case frame_push_promise:
+        // Clients can't push.
+        return http2_error_protocol_error;
+
+      case frame_ping: {
+        if(stream != 0)
+          return http2_error_protocol_error;
+
+        if(size != 8)
+          return http2_error_frame_size_error;
+
+        if(!(flags & flag_ack))
+          this->do_send_frame(frame_ping, flag_ack, 0, data, size);
+        return http2_error_no_error;
+      }
+
+      case frame_goaway: {
+        if(stream != 0)
+          return http2_error_protocol_error;
+
+        if(size < 8)
+          return http2_error_frame_size_error;
+
+        // The client will not open new streams. Open streams are served as usual.
+        return http2_error_no_error;
+      }
+
+      case frame_window_update: {
+        if(size != 4)
+          return http2_error_frame_size_error;
+
+        uint32_t incr = do_load_be32(data) & 0x7FFFFFFF;
+        if(stream == 0) {
+          if(incr == 0)
+            return http2_error_protocol_error;
+
+          this->m_send_window += incr;
+          if(this->m_send_window > s_max_window_size)
+            return http2_error_flow_control_error;
+
+          this->do_flush_all_streams();
+          return http2_error_no_error;
+        }
+
+        // Frames on closed streams are ignored.
+        auto it = this->m_streams.find(stream);
+        if(it == this->m_streams.end())
+          return http2_error_no_error;
+
+        if(incr == 0) {
+          this->do_send_reset(stream, http2_error_protocol_error);
+          this->do_http2_server_on_stream_reset(stream, http2_error_protocol_error);
+          return http2_error_no_error;
+        }
+
+        it->second.send_window += incr;
+        if(it->second.send_window > s_max_window_size) {
+          this->do_send_reset(stream, http2_error_flow_control_error);
+          this->do_http2_server_on_stream_reset(stream, http2_error_flow_control_error);
+          return http2_error_no_error;
+        }
+
+        this->do_flush_stream(it);
+        return http2_error_no_error;
+      }
+
+      default:
+        // Unknown frames are ignored. See RFC 7540 section 4.1.
+        return http2_error_no_error;
+    }
+  }
+
+HTTP2_Error
+Abstract_HTTP2_Server::
+do_process_header_block(uint32_t stream, bool end_stream)
+  {
+    this->m_hstream = 0;
+
+    // The header block must be decoded even if the stream will be refused, so
+    // the dynamic table is kept in sync.
+    ::std::vector<HPACK_Field> fields;
+    bool complete;
+    try {
+      complete = this->m_hdec.decode(fields, this->m_hblock.data(), this->m_hblock.size());
+      this->m_hblock.clear();
+    }
+    catch(exception& stdex) {
+      this->m_hblock.clear();
+      POSEIDON_LOG_WARN("HTTP/2 header block could not be decoded: $1", stdex);
+      return http2_error_compression_error;
+    }
+
+    auto it = this->m_streams.find(stream);
+    if(it != this->m_streams.end()) {
+      // Trailers are discarded anyway, but they must not be too large, either.
+      if(!complete) {
+        this->do_send_reset(stream, http2_error_enhance_your_calm);
+        this->do_http2_server_on_stream_reset(stream, http2_error_enhance_your_calm);
+        return http2_error_no_error;
+      }
+
+      // This is a trailer section, which must end the stream.
+      if(it->second.remote_closed) {
+        this->do_send_reset(stream, http2_error_stream_closed);
+        this->do_http2_server_on_stream_reset(stream, http2_error_stream_closed);
+        return http2_error_no_error;
+      }
+
+      if(!end_stream) {
+        this->do_send_reset(stream, http2_error_protocol_error);
+        this->do_http2_server_on_stream_reset(stream, http2_error_protocol_error);
+        return http2_error_no_error;
+      }
+
+      it->second.remote_closed = true;
+      if(it->second.local_closed)
+        this->m_streams.erase(it);
+      this->do_http2_server_on_request_end(stream);
+      return http2_error_no_error;
+    }
+
+    // Streams must be opened in ascending order. See RFC 7540 section 5.1.1.
+    if(stream <= this->m_last_stream)
+      return http2_error_protocol_error;
+
+    this->m_last_stream = stream;
+
+    if(this->m_goaway || (this->m_streams.size() >= s_max_concurrent_streams)) {
+      this->do_send_reset(stream, http2_error_refused_stream);
+      return http2_error_no_error;
+    }
+
+    if(!complete) {
+      this->do_reject_request(stream, end_stream, http_status_headers_too_large);
+      return http2_error_no_error;
+    }
+
+    // Get pseudo-header fields, which must precede regular ones. See RFC 7540
+    // section 8.1.2.
+    cow_string method, path, authority;
+    Option_Map headers;
+    bool regular = false;
+    bool malformed = false;
+
+    for(auto& field : fields) {
+      const auto& name = field.first;
+      if(name.empty()) {
+        malformed = true;
+        break;
+      }
+
+      if(name[0] == ':') {
+        cow_string* pseudo = nullptr;
+        if(name == ":method")
+          pseudo = &method;
+        else if(name == ":path")
+          pseudo = &path;
+        else if(name == ":authority")
+          pseudo = &authority;
+        else if(name != ":scheme") {
+          malformed = true;
+          break;
+        }
+
+        if(regular || (pseudo && !pseudo->empty())) {
+          malformed = true;
+          break;
+        }
+
+        if(pseudo)
+          *pseudo = ::std::move(field.second);
+        continue;
+      }
+
+      // Names of regular fields must be lowercase.
+      regular = true;
+      if(::std::any_of(name.begin(), name.end(), [](char ch) { return (ch >= 'A') && (ch <= 'Z');  })
+         || do_is_connection_specific(name)
+         || ((name == "te") && (field.second != "trailers"))) {
+        malformed = true;
+        break;
+      }
+
+      // Crumbled cookies are joined. See RFC 7540 section 8.1.2.5.
+      auto qcookie = (name == "cookie") ? headers.mut_find_opt(sref("cookie")) : nullptr;
+      if(qcookie) {
+        qcookie->append("; ");
+        qcookie->append(field.second);
+        continue;
+      }
+      headers.append(name, ::std::move(field.second));
+    }
+
+    if(malformed || method.empty() || path.empty()) {
+      this->do_send_reset(stream, http2_error_protocol_error);
+      return http2_error_no_error;
+    }
+
+    if(!authority.empty() && !headers.count(sref("host")))
+      headers.set(sref("host"), ::std::move(authority));
+
+    HTTP_Method meth = parse_http_method(method.data(), method.data() + method.size());
+    if(meth == http_method_null) {
+      this->do_reject_request(stream, end_stream, http_status_not_implemented);
+      return http2_error_no_error;
+    }
+
+    auto& strm = this->m_streams[stream];
+    strm.send_window = this->m_peer_window;
+    strm.recv_window = s_recv_window_size;
+    strm.remote_closed = end_stream;
+
+    this->do_http2_server_on_request_headers(stream, meth, ::std::move(path),
+                                             ::std::move(headers));
+    if(end_stream)
+      this->do_http2_server_on_request_end(stream);
+    return http2_error_no_error;
+  }
+
+void
+Abstract_HTTP2_Server::
+do_close_stream_local(::std::map<uint32_t, Stream>::iterator it)
+  {
+    it->second.local_closed = true;
+    if(it->second.remote_closed)
+      this->m_streams.erase(it);
+  }
+
+void
+Abstract_HTTP2_Server::
+do_flush_stream(::std::map<uint32_t, Stream>::iterator it)
+  {
+    auto& strm = it->second;
+    bool ended = false;
+
+    while(strm.data.size() != 0) {
+      // Send as much as both flow control windows allow.
+      int64_t avail = ::rocket::min(this->m_send_window, strm.send_window);
+      avail = ::rocket::min(avail, static_cast<int64_t>(this->m_peer_frame));
+      if(avail <= 0)
+        return;
+
+      size_t n = ::rocket::min(strm.data.size(), static_cast<size_t>(avail));
+      ended = strm.end_pending && (n == strm.data.size());
+      this->do_send_frame(frame_data, ended ? flag_end_stream : 0, it->first,
+                          strm.data.data(), n);
+
+      strm.data.discard(n);
+      this->m_send_window -= static_cast<int64_t>(n);
+      strm.send_window -= static_cast<int64_t>(n);
+    }
+
+    if(!strm.end_pending)
+      return;
+
+    // An empty frame is not subject to flow control.
+    if(!ended)
+      this->do_send_frame(frame_data, flag_end_stream, it->first, nullptr, 0);
+
+    this->do_close_stream_local(it);
+  }
+
+void
+Abstract_HTTP2_Server::
+do_flush_all_streams()
+  {
+    // Streams may be erased while being flushed.
+    auto it = this->m_streams.begin();
+    while(it != this->m_streams.end()) {
+      auto next = ::std::next(it);
+      if(!it->second.local_closed && (it->second.data.size() || it->second.end_pending))
+        this->do_flush_stream(it);
+      it = next;
+    }
+  }
+
+bool
+Abstract_HTTP2_Server::
+do_abort(HTTP2_Error err)
+  {
+    POSEIDON_LOG_WARN("HTTP/2 connection error: $1", static_cast<uint32_t>(err));
+
+    this->http2_encode_goaway(err);
+    this->m_good &= this->do_http2_server_close();
+    this->m_good = false;
+    return false;
+  }
+
+void
+Abstract_HTTP2_Server::
+do_http2_server_on_stream_reset(uint32_t /*stream*/, HTTP2_Error /*err*/)
+  {
+  }
+
+bool
+Abstract_HTTP2_Server::
+http2_decode(const char* data, size_t size)
+  {
+    if(!this->m_good)
+      return false;
+
+    this->m_rbuf.putn(data, size);
+
+    if(!this->m_preface) {
+      // Check the client connection preface. See RFC 7540 section 3.5.
+      size_t n = ::rocket::min(this->m_rbuf.size(), s_client_preface_size);
+      if(::std::memcmp(this->m_rbuf.data(), s_client_preface, n) != 0)
+        return this->do_abort(http2_error_protocol_error);
+
+      if(n != s_client_preface_size)
+        return this->m_good;
+
+      this->m_rbuf.discard(n);
+      this->m_preface = true;
+
+      // Send the server connection preface, which is a `SETTINGS` frame. The
+      // limit of header lists is enforced whether the client honors it or not.
+      char settings[12];
+      do_store_be32(settings, setting_max_concurrent_streams << 16);
+      do_store_be32(settings + 2, s_max_concurrent_streams);
+      do_store_be32(settings + 6, setting_max_header_list_size << 16);
+      do_store_be32(settings + 8, static_cast<uint32_t>(s_max_header_list_size));
+      this->do_send_frame(frame_settings, 0, 0, settings, sizeof(settings));
+      this->m_hdec.set_max_header_list_size(s_max_header_list_size);
+    }
+
+    while(this->m_good && (this->m_rbuf.size() >= 9)) {
+      // Parse the frame header. See RFC 7540 section 4.1.
+      const char* head = this->m_rbuf.data();
+      uint32_t len = do_load_be32(head) >> 8;
+      uint8_t type = static_cast<uint8_t>(head[3]);
+      uint8_t flags = static_cast<uint8_t>(head[4]);
+      uint32_t stream = do_load_be32(head + 5) & 0x7FFFFFFF;
+
+      if(len > s_max_frame_size)
+        return this->do_abort(http2_error_frame_size_error);
+
+      if(this->m_rbuf.size() < 9 + len)
+        break;
+
+      auto err = this->do_process_frame(type, flags, stream, head + 9, len);
+      if(err != http2_error_no_error)
+        return this->do_abort(err);
+
+      this->m_rbuf.discard(9 + len);
+    }
+    return this->m_good;
+  }
+
+bool
+Abstract_HTTP2_Server::
+http2_acknowledge_entity(uint32_t stream, size_t size)
+  {
+    if(!this->m_good)
+      return false;
+
+    this->do_release_recv_window(stream, size);
+    return this->m_good;
+  }
+
+bool
+Abstract_HTTP2_Server::
+http2_encode_headers(uint32_t stream, HTTP_Status stat, Option_Map&& headers,
+                     bool end_stream)
+  {
+    if(!this->m_good)
+      return false;
+
+    auto it = this->m_streams.find(stream);
+    if((it == this->m_streams.end()) || it->second.local_closed)
+      return this->m_good;
+
+    // Encode the header block.
+    linear_buffer hblock;
+    this->m_henc.begin_block(hblock);
+
+    ::rocket::ascii_numput nump;
+    nump.put_DU(stat);
+    this->m_henc.encode_field(hblock, sref(":status"), cow_string(nump.data(), nump.size()));
+
+    // Origin servers are required to send `Date:`. See RFC 7231 section 7.1.1.2.
+    if(!headers.count(sref("Date")))
+      this->m_henc.encode_field(hblock, sref("date"), cow_string(current_http_date(), 29));
+
+    for(const auto& pair : headers)
+      if(!do_is_connection_specific(pair.first))
+        this->m_henc.encode_field(hblock, pair.first, pair.second);
+
+    // Split the header block into a `HEADERS` frame and optional `CONTINUATION`
+    // frames, which must not be interleaved with other frames.
+    const char* sp = hblock.data();
+    size_t rem = hblock.size();
+    uint8_t type = frame_headers;
+    uint8_t flags = end_stream ? flag_end_stream : 0;
+    for(;;) {
+      size_t n = ::rocket::min(rem, static_cast<size_t>(this->m_peer_frame));
+      if(n == rem)
+        flags |= flag_end_headers;
+
+      this->do_send_frame(type, flags, stream, sp, n);
+      sp += n;
+      rem -= n;
+      if(rem == 0)
+        break;
+
+      type = frame_continuation;
+      flags = 0;
+    }
+
+    if(end_stream)
+      this->do_close_stream_local(it);
+    return this->m_good;
+  }
+
+bool
+Abstract_HTTP2_Server::
+http2_encode_entity(uint32_t stream, const char* data, size_t size)
+  {
+    if(!this->m_good)
+      return false;
+
+    auto it = this->m_streams.find(stream);
+    if((it == this->m_streams.end()) || it->second.local_closed || it->second.end_pending)
+      return this->m_good;
+
+    it->second.data.putn(data, size);
+    this->do_flush_stream(it);
+    return this->m_good;
+  }
+
+bool
+Abstract_HTTP2_Server::
+http2_encode_end_of_entity(uint32_t stream)
+  {
+    if(!this->m_good)
+      return false;
+
+    auto it = this->m_streams.find(stream);
+    if((it == this->m_streams.end()) || it->second.local_closed || it->second.end_pending)
+      return this->m_good;
+
+    it->second.end_pending = true;
+    this->do_flush_stream(it);
+    return this->m_good;
+  }
+
+bool
+Abstract_HTTP2_Server::
+http2_encode_reset(uint32_t stream, HTTP2_Error err)
+  {
+    if(!this->m_good)
+      return false;
+
+    if(!this->m_streams.count(stream))
+      return this->m_good;
+
+    this->do_send_reset(stream, err);
+    return this->m_good;
+  }
+
+bool
+Abstract_HTTP2_Server::
+http2_encode_goaway(HTTP2_Error err)
+  {
+    if(!this->m_good)
+      return false;
+
+    char data[8];
+    do_store_be32(data, this->m_last_stream);
+    do_store_be32(data + 4, err);
+    this->do_send_frame(frame_goaway, 0, 0, data, sizeof(data));
+
+    this->m_goaway = true;
+    return this->m_good;
+  }
+
+}  // namespace poseidon
@@ -0,0 +1,207 @@
+// This file is part of Poseidon.
+// Copyleft 2020, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_HTTP_ABSTRACT_HTTP2_SERVER_HPP_
+#define POSEIDON_HTTP_ABSTRACT_HTTP2_SERVER_HPP_
+
+#include "../fwd.hpp"
+#include "hpack.hpp"
+#include <map>
+
+namespace poseidon {
+
+// This class implements the server side of HTTP/2 (RFC 7540), over a connection
+// that has been established with the prior knowledge of HTTP/2, such as a TLS
+// connection on which `h2` has been selected by ALPN. It is not bound to any kind
+// of sockets. Incoming bytes shall be passed to `http2_decode()`, and outgoing
+// bytes are delivered to `do_http2_server_send()`.
+// Requests are presented like HTTP/1.1 ones: `:authority` is converted to `Host`,
+// and crumbled `Cookie` fields are joined. Each request is identified by the ID
+// of its stream, which shall be passed to encoder functions for its response.
+// Flow control windows for received data are reopened with `WINDOW_UPDATE` only
+// after the request entity has been acknowledged with `http2_acknowledge_entity()`,
+// so a client can't send more data than the consumer is able to take. Outgoing
+// data are buffered until the peer opens its flow control windows.
+// This class is not thread-safe.
+class Abstract_HTTP2_Server
+  : public ::asteria::Rcfwd<Abstract_HTTP2_Server>
+  {
+  private:
+    struct Stream
+      {
+        int64_t send_window = 0;
+        int64_t recv_window = 0;
+        int64_t recv_pending = 0;  // consumed but not acknowledged to the peer
+        bool remote_closed = false;
+        bool local_closed = false;
+        bool end_pending = false;  // send `END_STREAM` after `data`
+        linear_buffer data;  // data pending
+      };
+
+    bool m_good = true;
+    bool m_preface = false;  // connection preface received
+    bool m_goaway = false;  // `GOAWAY` sent
+
+    HPACK_Decoder m_hdec;
+    HPACK_Encoder m_henc;
+    linear_buffer m_rbuf;  // incoming frames
+    linear_buffer m_wbuf;  // an outgoing frame
+    linear_buffer m_hblock;  // incomplete header block
+    uint32_t m_hstream = 0;  // stream of `m_hblock`
+    bool m_hend = false;  // `END_STREAM` flag of `m_hblock`
+
+    ::std::map<uint32_t, Stream> m_streams;
+    uint32_t m_last_stream = 0;  // ID of the last stream opened by the peer
+    int64_t m_send_window = 65535;  // connection flow control window
+    int64_t m_recv_window = 65535;
+    int64_t m_recv_pending = 0;
+    uint32_t m_peer_window = 65535;  // `SETTINGS_INITIAL_WINDOW_SIZE`
+    uint32_t m_peer_frame = 16384;  // `SETTINGS_MAX_FRAME_SIZE`
+
+  protected:
+    explicit
+    Abstract_HTTP2_Server()
+      noexcept
+      = default;
+
+  private:
+    void
+    do_send_frame(uint8_t type, uint8_t flags, uint32_t stream, const char* data,
+                  size_t size);
+
+    void
+    do_send_window_update(uint32_t stream, uint32_t incr);
+
+    void
+    do_send_reset(uint32_t stream, HTTP2_Error err);
+
+    void
+    do_release_recv_window(uint32_t stream, size_t size);
+
+    void
+    do_reject_request(uint32_t stream, bool end_stream, HTTP_Status stat);
+
+    HTTP2_Error
+    do_process_frame(uint8_t type, uint8_t flags, uint32_t stream, const char* data,
+                     size_t size);
+
+    HTTP2_Error
+    do_process_header_block(uint32_t stream, bool end_stream);
+
+    void
+    do_close_stream_local(::std::map<uint32_t, Stream>::iterator it);
+
+    void
+    do_flush_stream(::std::map<uint32_t, Stream>::iterator it);
+
+    void
+    do_flush_all_streams();
+
+    bool
+    do_abort(HTTP2_Error err);
+
+  protected:
+    // This function shall deliver all bytes to the other endpoint.
+    virtual
+    bool
+    do_http2_server_send(const char* data, size_t size)
+      = 0;
+
+    // This function shall close the connection.
+    virtual
+    bool
+    do_http2_server_close()
+      = 0;
+
+    // This function is called when the headers of a request have been received.
+    // `target` is the value of the `:path` pseudo-header.
+    virtual
+    void
+    do_http2_server_on_request_headers(uint32_t stream, HTTP_Method meth,
+                                       cow_string&& target, Option_Map&& headers)
+      = 0;
+
+    // This function is called when a chunk of the request entity has been
+    // received. After it has been consumed, `http2_acknowledge_entity()` shall be
+    // called, otherwise the client will stop sending data after 64KiB.
+    virtual
+    void
+    do_http2_server_on_request_entity(uint32_t stream, const char* data, size_t size)
+      = 0;
+
+    // This function is called when the request has been received completely.
+    // Trailers are discarded.
+    virtual
+    void
+    do_http2_server_on_request_end(uint32_t stream)
+      = 0;
+
+    // This function is called when a stream has been reset by the client, or
+    // because of a flow control error. No response shall be sent on this stream
+    // any more.
+    // The default implementation does nothing.
+    virtual
+    void
+    do_http2_server_on_stream_reset(uint32_t stream, HTTP2_Error err);
+
+  public:
+    ASTERIA_NONCOPYABLE_DESTRUCTOR(Abstract_HTTP2_Server);
+
+    // Gets the number of streams that have not been closed.
+    size_t
+    http2_stream_count()
+      const noexcept
+      { return this->m_streams.size();  }
+
+    // Processes incoming data. Callbacks are invoked synchronously.
+    // The server connection preface is sent when the client connection preface
+    // has been received. If a connection error occurs, `GOAWAY` is sent, and the
+    // connection is closed. Requests whose headers are larger than 64KiB after
+    // decompression are responded with `431 Request Header Fields Too Large`.
+    bool
+    http2_decode(const char* data, size_t size);
+
+    // Acknowledges that `size` bytes of the request entity of a stream, which have
+    // been passed to `do_http2_server_on_request_entity()`, have been consumed.
+    // This shall be called even if the stream has been closed or reset, as such
+    // data also count towards the flow control window of the connection.
+    // `WINDOW_UPDATE` is sent when at least half of a window can be reopened.
+    bool
+    http2_acknowledge_entity(uint32_t stream, size_t size);
+
+    // Puts the response headers of a stream.
+    // The `:status` pseudo-header is generated from `stat`. Header names are
+    // converted to lowercase, and headers that are specific to HTTP/1.x, such as
+    // `Connection` and `Transfer-Encoding`, are ignored. If `end_stream` is set,
+    // the response has no entity.
+    // If the stream has been reset or closed, nothing is sent.
+    bool
+    http2_encode_headers(uint32_t stream, HTTP_Status stat, Option_Map&& headers,
+                         bool end_stream);
+
+    // Puts a chunk of the response entity of a stream.
+    // Data are split into `DATA` frames, which may be deferred until the peer
+    // opens flow control windows.
+    // If the stream has been reset or closed, nothing is sent.
+    bool
+    http2_encode_entity(uint32_t stream, const char* data, size_t size);
+
+    // Finishes the response entity of a stream.
+    // If the stream has been reset or closed, nothing is sent.
+    bool
+    http2_encode_end_of_entity(uint32_t stream);
+
+    // Resets a stream with `RST_STREAM`.
+    // If the stream has been reset or closed, nothing is sent.
+    bool
+    http2_encode_reset(uint32_t stream, HTTP2_Error err);
+
+    // Sends `GOAWAY`, after which new streams are refused. Streams that have been
+    // opened are not affected.
+    bool
+    http2_encode_goaway(HTTP2_Error err);
+  };
+
+}  // namespace poseidon
+
+#endif
@@ -0,0 +1,53 @@
+// This file is part of Poseidon.
+// Copyleft 2020, LH_Mouse. All wrongs reserved.
+
+#include "../precompiled.hpp"
+#include "abstract_http2_tls_socket.hpp"
+#include "enums.hpp"
+#include "../utils.hpp"
+
+namespace poseidon {
+
+Abstract_HTTP2_TLS_Socket::
+~Abstract_HTTP2_TLS_Socket()
+  {
+  }
+
+void
+Abstract_HTTP2_TLS_Socket::
+do_socket_on_receive(char* data, size_t size)
+  {
+    recursive_mutex::unique_lock lock(this->m_http2_mutex);
+
+    // The handshake has completed when data arrive, so the protocol is known.
+    if(!this->m_alpn_checked) {
+      auto proto = this->alpn_protocol();
+      if(proto != "h2") {
+        POSEIDON_LOG_WARN("HTTP/2 not selected by ALPN: remote '$1', protocol '$2'",
+                          this->get_remote_address(), proto);
+        this->close();
+        return;
+      }
+      this->m_alpn_checked = true;
+    }
+
+    this->http2_decode(data, size);
+  }
+
+bool
+Abstract_HTTP2_TLS_Socket::
+do_http2_server_send(const char* data, size_t size)
+  {
+    return this->do_socket_send(data, size);
+  }
+
+bool
+Abstract_HTTP2_TLS_Socket::
+do_http2_server_close()
+  {
+    // Pending data, such as `GOAWAY`, are sent before the connection is closed.
+    this->close();
+    return true;
+  }
+
+}  // namespace poseidon
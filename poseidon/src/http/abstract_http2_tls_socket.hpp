@@ -0,0 +1,63 @@
+// This file is part of Poseidon.
+// Copyleft 2020, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_HTTP_ABSTRACT_HTTP2_TLS_SOCKET_HPP_
+#define POSEIDON_HTTP_ABSTRACT_HTTP2_TLS_SOCKET_HPP_
+
+#include "../socket/abstract_tls_socket.hpp"
+#include "abstract_http2_server.hpp"
+
+namespace poseidon {
+
+// This class is an accepted TLS connection that serves HTTP/2.
+// The listening socket shall offer `h2` with `set_alpn_protocols()`. If the
+// client has not selected `h2`, the connection is closed when the first bytes
+// arrive, which is after the handshake has completed.
+// Callbacks of `Abstract_HTTP2_Server` are invoked by the network thread, with
+// the mutex that is returned by `http2_mutex()` locked. As the HTTP/2 server is
+// not thread-safe, other threads shall lock it before calling encoder functions.
+class Abstract_HTTP2_TLS_Socket
+  : public ::asteria::Rcfwd<Abstract_HTTP2_TLS_Socket>,
+    public Abstract_TLS_Socket,
+    public Abstract_HTTP2_Server
+  {
+  private:
+    mutable recursive_mutex m_http2_mutex;
+    bool m_alpn_checked = false;
+
+  protected:
+    // Adopts an accepted socket.
+    explicit
+    Abstract_HTTP2_TLS_Socket(unique_FD&& fd, const OpenSSL_Context& ctx)
+      : Abstract_TLS_Socket(::std::move(fd), ctx)
+      { }
+
+  private:
+    // Checks the ALPN protocol, then passes data to `http2_decode()`.
+    void
+    do_socket_on_receive(char* data, size_t size)
+      final;
+
+    // Calls `do_socket_send()`.
+    bool
+    do_http2_server_send(const char* data, size_t size)
+      final;
+
+    // Calls `close()`.
+    bool
+    do_http2_server_close()
+      final;
+
+  public:
+    ASTERIA_NONCOPYABLE_DESTRUCTOR(Abstract_HTTP2_TLS_Socket);
+
+    // Gets the mutex that protects the HTTP/2 server.
+    recursive_mutex&
+    http2_mutex()
+      const noexcept
+      { return this->m_http2_mutex;  }
+  };
+
+}  // namespace poseidon
+
+#endif
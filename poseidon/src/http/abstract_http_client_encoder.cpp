@@ -7,8 +7,65 @@
 #include "enums.hpp"
 #include "../core/zlib_deflator.hpp"
 #include "../utils.hpp"
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
 
 namespace poseidon {
+namespace {
+
+void
+do_mask_websocket_payload(char* out, const char* data, size_t size, uint32_t mask)
+  noexcept
+  {
+    // Replicate the key, so a whole word of payload can be masked at a time.
+    // As the key is stored byte-wise, this does not depend on the byte order of
+    // the machine. `out` and `data` may be identical.
+    char kbytes[16];
+    for(size_t k = 0;  k != 16;  ++k)
+      kbytes[k] = static_cast<char>(mask >> (24 - k % 4 * 8));
+
+    size_t off = 0;
+#ifdef __SSE2__
+    __m128i kvec = _mm_loadu_si128(reinterpret_cast<const __m128i*>(kbytes));
+    while(size - off >= 16) {
+      __m128i word = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + off));
+      word = _mm_xor_si128(word, kvec);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(out + off), word);
+      off += 16;
+    }
+#endif
+    uint64_t kword;
+    ::std::memcpy(&kword, kbytes, 8);
+    while(size - off >= 8) {
+      uint64_t word;
+      ::std::memcpy(&word, data + off, 8);
+      word ^= kword;
+      ::std::memcpy(out + off, &word, 8);
+      off += 8;
+    }
+
+    // Mask remaining bytes. As `off` is a multiple of four, the key is
+    // still aligned.
+    while(off != size) {
+      out[off] = static_cast<char>(data[off] ^ kbytes[off % 4]);
+      off++;
+    }
+  }
+
+void
+do_append_iovec(::rocket::static_vector<::iovec, 8>& iov, const char* data, size_t size)
+  {
+    if(size == 0)
+      return;
+
+    ::iovec r;
+    r.iov_base = const_cast<char*>(data);
+    r.iov_len = size;
+    iov.push_back(r);
+  }
+
+}  // namespace
 
 Abstract_HTTP_Client_Encoder::
 ~Abstract_HTTP_Client_Encoder()
@@ -34,51 +91,64 @@ do_encode_http_headers(HTTP_Method meth, const cow_string& target, HTTP_Version
       fmt << pair.first << ": " << pair.second << "\r\n";
     fmt << "\r\n";
 
-    // Send encoded data.
-    this->m_good &= this->do_http_client_send(fmt.c_str(), fmt.length());
+    // Defer encoded data until the entity.
+    this->m_cork.clear();
+    this->m_cork.putn(fmt.c_str(), fmt.length());
   }
 
 void
 Abstract_HTTP_Client_Encoder::
-do_encode_http_entity(const char* data, size_t size)
+do_encode_http_entity(const char* data, size_t size, bool last)
   {
-    // Don't send empty chunks.
-    if(size == 0)
-      return;
+    // Gather pending headers, the chunk, and the terminator if this is the last
+    // chunk, so they can be sent in a single call.
+    ::rocket::static_vector<::iovec, 8> iov;
+    do_append_iovec(iov, this->m_cork.data(), this->m_cork.size());
 
-    // For HTTP/1.0, send outgoing data verbatim.
+    ::rocket::ascii_numput nump;
     if(!this->m_chunked) {
-      this->m_good &= this->do_http_client_send(data, size);
-      return;
+      // For HTTP/1.0 or a known length, send outgoing data verbatim.
+      do_append_iovec(iov, data, size);
     }
+    else {
+      // For HTTP/1.1, encode the data as a single chunk.
+      // Don't send empty chunks, which would terminate the entity.
+      if(size != 0) {
+        nump.put_XU(size);
+        do_append_iovec(iov, nump.data() + 2, nump.size() - 2);
+        do_append_iovec(iov, "\r\n", 2);
+        do_append_iovec(iov, data, size);
+        do_append_iovec(iov, "\r\n", 2);
+      }
 
-    // For HTTP/1.1, encode the data as a single chunk.
-    ::rocket::ascii_numput nump;
-    nump.put_XU(size);
+      if(last)
+        do_append_iovec(iov, "0\r\n\r\n", 5);
+    }
 
-    this->m_good &= this->do_http_client_send(nump.data() + 2, nump.size());
-    this->m_good &= this->do_http_client_send("\r\n", 2);
-    this->m_good &= this->do_http_client_send(data, size);
-    this->m_good &= this->do_http_client_send("\r\n", 2);
+    if(iov.empty())
+      return;
+
+    this->m_good &= this->do_http_client_sendv(iov.data(), iov.size());
+    this->m_cork.clear();
   }
 
 void
 Abstract_HTTP_Client_Encoder::
 do_finish_http_message()
   {
-    // Terminate the entity.
-    if(this->m_gzip) {
-      auto defl = unerase_pointer_cast<zlib_Deflator>(this->m_deflator);
-      if(defl) {
-        defl->finish();
-        auto& obuf = defl->output_buffer();
-        this->do_encode_http_entity(obuf.data(), obuf.size());
-        obuf.clear();
-      }
-    }
+    // Terminate the entity. This also sends pending headers.
+    auto defl = unerase_pointer_cast<zlib_Deflator>(this->m_deflator);
+    if(this->m_gzip && defl) {
+      defl->finish();
+      auto& obuf = defl->output_buffer();
+      this->do_encode_http_entity(obuf.data(), obuf.size(), true);
 
-    if(this->m_chunked)
-      this->m_good &= this->do_http_client_send("0\r\n\r\n", 5);
+      // Return the compression state to the pool, as the connection may stay
+      // idle for a long time.
+      defl->reset();
+    }
+    else
+      this->do_encode_http_entity(nullptr, 0, true);
 
     // Update connection state.
     if(!this->m_final) {
@@ -102,7 +172,7 @@ do_finish_http_message()
 
 void
 Abstract_HTTP_Client_Encoder::
-do_encode_websocket_frame(int flags, char* data, size_t size)
+do_encode_websocket_frame(int flags, const char* data, size_t size)
   {
     // Compose the frame header.
     ::rocket::static_vector<char, 14> head;
@@ -124,20 +194,36 @@ do_encode_websocket_frame(int flags, char* data, size_t size)
     while(exlen != 0)
       head.emplace_back(static_cast<uint64_t>(size) >> --exlen * 8);
 
-    // Create a 4-byte mask and mask the payload.
+    // Create a 4-byte mask.
     // Client-to-server messages must be masked according to RFC 6455.
     uint32_t mask = this->m_random.bump();
     exlen = 4;
     while(exlen != 0)
       head.emplace_back(mask >> --exlen * 8);  // mask in big-endian order
 
-    exlen = 0;
-    while(exlen != size)
-      mask = mask << 8 | mask >> 24,
-        data[exlen++] ^= static_cast<char>(mask);
+    // Compose the frame in a single buffer, masking the payload while copying
+    // it, then send it in one go. The buffer is reused for subsequent frames,
+    // so no allocation is needed after the first one.
+    auto& fbuf = this->m_wsframe;
+    fbuf.clear();
+    fbuf.reserve(head.size() + size);
+    fbuf.putn(head.data(), head.size());
+    do_mask_websocket_payload(fbuf.mut_end(), data, size, mask);
+    fbuf.accept(size);
+
+    this->m_good &= this->do_http_client_send(fbuf.data(), fbuf.size());
+    fbuf.clear();
+  }
 
-    this->m_good &= this->do_http_client_send(head.data(), head.size());
-    this->m_good &= this->do_http_client_send(data, size);
+bool
+Abstract_HTTP_Client_Encoder::
+do_http_client_sendv(const ::iovec* iov, size_t count)
+  {
+    bool good = true;
+    for(size_t k = 0;  k != count;  ++k)
+      good &= this->do_http_client_send(static_cast<const char*>(iov[k].iov_base),
+                                        iov[k].iov_len);
+    return good;
   }
 
 bool
@@ -287,7 +373,7 @@ http_encode_entity(const char* data, size_t size)
 
     if(!this->m_gzip) {
       // If compression is not enabled, send outgoing data verbatim.
-      this->do_encode_http_entity(data, size);
+      this->do_encode_http_entity(data, size, false);
     }
     else {
       // Compress outgoing data using GZIP.
@@ -300,7 +386,7 @@ http_encode_entity(const char* data, size_t size)
 
       // Consume all compressed data.
       auto& obuf = defl->output_buffer();
-      this->do_encode_http_entity(obuf.data(), obuf.size());
+      this->do_encode_http_entity(obuf.data(), obuf.size(), false);
       obuf.clear();
     }
     return this->m_good;
@@ -510,15 +596,13 @@ http_encode_websocket_frame(WebSocket_Opcode opcode, const char* data, size_t si
       if(rlen != size)
         POSEIDON_LOG_WARN("Control frame truncated (size `$1`)", size);
 
-      ::rocket::static_vector<char, 125> temp(data, data + rlen);
-      this->do_encode_websocket_frame(opcode, temp.mut_data(), temp.size());
+      this->do_encode_websocket_frame(opcode, data, rlen);
       return this->m_good;
     }
 
-    if(!this->m_gzip) {
+    if(!this->m_ws_pmce) {
       // If compression is not enabled, send outgoing data verbatim.
-      ::rocket::cow_string temp(data, data + size);
-      this->do_encode_websocket_frame(opcode, temp.mut_data(), temp.size());
+      this->do_encode_websocket_frame(opcode, data, size);
       return this->m_good;
     }
 
@@ -528,9 +612,6 @@ http_encode_websocket_frame(WebSocket_Opcode opcode, const char* data, size_t si
       defl = ::rocket::make_refcnt<zlib_Deflator>(zlib_Deflator::format_raw);
       this->m_deflator = defl;
     }
-    else if(this->m_ws_nctxto) {  // `client_no_context_takeover`
-      defl->reset();
-    }
     defl->write(data, size);
 
     // Finish this deflate block. This results in four extra bytes `00 00 FF FF` in
@@ -543,8 +624,14 @@ http_encode_websocket_frame(WebSocket_Opcode opcode, const char* data, size_t si
     size_t rlen = obuf.size() - 4;
     ROCKET_ASSERT(::memcmp(obuf.data() + rlen, "\x00\x00\xFF\xFF", 4) == 0);
 
-    this->do_encode_websocket_frame(opcode | 2, obuf.mut_data(), rlen);
-    obuf.clear();
+    this->do_encode_websocket_frame(opcode | 2, obuf.data(), rlen);
+
+    // Return the compression state to the pool if the context will not be
+    // taken over by the next message.
+    if(this->m_ws_nctxto)  // `client_no_context_takeover`
+      defl->reset();
+    else
+      obuf.clear();
     return this->m_good;
   }
 
@@ -569,7 +656,7 @@ http_encode_websocket_closure(WebSocket_Status stat, const char* data, size_t si
     pbuf.append(data, data + size);
 
     // Send the closure frame and shut the connection down.
-    this->do_encode_websocket_frame(0x80, pbuf.mut_data(), pbuf.size());
+    this->do_encode_websocket_frame(0x80, pbuf.data(), pbuf.size());
     this->m_state = http_encoder_state_closed;
     this->m_good &= this->do_http_client_close();
     return this->m_good;
@@ -33,6 +33,8 @@ class Abstract_HTTP_Client_Encoder
     ::rocket::cow_vector<Pipelined_Request> m_pipeline;
     LCG48 m_random;
     rcfwdp<zlib_Deflator> m_deflator;
+    linear_buffer m_cork;  // headers pending
+    linear_buffer m_wsframe;  // reused for masked WebSocket frames
 
   public:
     explicit
@@ -48,7 +50,7 @@ class Abstract_HTTP_Client_Encoder
 
     inline
     void
-    do_encode_http_entity(const char* data, size_t size);
+    do_encode_http_entity(const char* data, size_t size, bool last);
 
     inline
     void
@@ -56,7 +58,7 @@ class Abstract_HTTP_Client_Encoder
 
     inline
     void
-    do_encode_websocket_frame(int flags, char* data, size_t size);  // data clobbered
+    do_encode_websocket_frame(int flags, const char* data, size_t size);
 
   protected:
     // This function shall deliver all bytes to the other endpoint.
@@ -65,6 +67,14 @@ class Abstract_HTTP_Client_Encoder
     do_http_client_send(const char* data, size_t size)
       = 0;
 
+    // This function shall deliver all bytes in `iov` to the other endpoint, as if
+    // they were concatenated.
+    // The default implementation calls `do_http_client_send()` for each block. It
+    // is recommended to override this function, so all blocks are sent at once.
+    virtual
+    bool
+    do_http_client_sendv(const ::iovec* iov, size_t count);
+
     // This function shall close the connection.
     virtual
     bool
@@ -84,6 +94,8 @@ class Abstract_HTTP_Client_Encoder
     // `http_encoder_state()` must be 'closed' or 'headers'.
     // Unless the request includes a message body (see RFC 7230 section 3.3), the next
     // state will be 'entity'.
+    // When an entity is expected, headers are not sent until the first chunk of the
+    // entity or the end of it, so they can be sent together.
     bool
     http_encode_headers(HTTP_Method meth, const cow_string& target, HTTP_Version ver,
                         Option_Map&& headers);
@@ -91,6 +103,7 @@ class Abstract_HTTP_Client_Encoder
     // Puts a chunk of entity. Note that it is not valid to switch to a new protocol
     // without receipt of a successful response.
     // `http_encoder_state()` must be 'closed' or 'entity'.
+    // An empty chunk sends pending headers, if any, and nothing else.
     bool
     http_encode_entity(const char* data, size_t size);
 
@@ -5,79 +5,229 @@
 #include "abstract_http_server_encoder.hpp"
 #include "option_map.hpp"
 #include "enums.hpp"
+#include "http_date.hpp"
+#include "http_response_cache.hpp"
 #include "../core/zlib_deflator.hpp"
+#include "../core/abstract_compressor.hpp"
 #include "../utils.hpp"
+#include <unistd.h>
 
 namespace poseidon {
+namespace {
 
-Abstract_HTTP_Server_Encoder::
-~Abstract_HTTP_Server_Encoder()
+// Entities are compressed with `gzip` by worker threads if the first write is
+// at least this large. Smaller writes are buffered up to this size.
+constexpr size_t s_gzip_parallel_threshold = 0x100000;  // 1MiB
+
+void
+do_compose_websocket_frame_header(::rocket::static_vector<char, 14>& head, int flags,
+                                  size_t size)
   {
+    head.emplace_back(flags | 1);  // opcode, flags, FIN
+
+    size_t exlen;
+    if(size <= 125) {
+      head.emplace_back(size);  // payload length
+      exlen = 0;
+    }
+    else if(size <= 65535) {
+      head.emplace_back(126);  // payload length
+      exlen = 2;
+    }
+    else {
+      head.emplace_back(127);  // payload length
+      exlen = 8;
+    }
+    while(exlen != 0)
+      head.emplace_back(static_cast<uint64_t>(size) >> --exlen * 8);
   }
 
 void
-Abstract_HTTP_Server_Encoder::
-do_encode_http_headers(HTTP_Version ver, HTTP_Status stat, const Option_Map& headers)
+do_compose_websocket_frame(cow_string& frame, int flags, const char* data, size_t size)
   {
+    ::rocket::static_vector<char, 14> head;
+    do_compose_websocket_frame_header(head, flags, size);
+
+    frame.reserve(head.size() + size);
+    frame.append(head.data(), head.size());
+    frame.append(data, size);
+  }
+
+void
+do_append_iovec(::rocket::static_vector<::iovec, 8>& iov, const char* data, size_t size)
+  {
+    if(size == 0)
+      return;
+
+    ::iovec r;
+    r.iov_base = const_cast<char*>(data);
+    r.iov_len = size;
+    iov.push_back(r);
+  }
+
+size_t
+do_read_file(int fd, int64_t offset, char* data, size_t size)
+  {
+    ::ssize_t nread = ::pread(fd, data, size, offset);
+    if(nread < 0)
+      POSEIDON_THROW("Error reading file\n"
+                     "[`pread()` failed: $1]",
+                     format_errno(errno));
+
+    if(nread == 0)
+      POSEIDON_THROW("File truncated while being sent (offset `$1`)", offset);
+
+    return static_cast<size_t>(nread);
+  }
+
+bool
+do_check_content_length(const Option_Map& headers)
+  {
+    auto qstr = headers.find_opt(sref("Content-Length"));
+    if(!qstr)
+      return false;
+
+    // Parse the value as a signed 64-bit integer.
+    ::rocket::ascii_numget numg;
+    const char* sp = qstr->data();
+    const char* ep = sp + qstr->size();
+    if(!numg.parse_U(sp, ep, 10) || (sp != ep))
+      POSEIDON_THROW("Invalid `Content-Length` value: $1", *qstr);
+
+    uint64_t content_length;
+    if(!numg.cast_U(content_length, 0, INT64_MAX))
+      POSEIDON_THROW("`Content-Length` value out of range: $1", *qstr);
+
+    return true;
+  }
+
+const char*
+do_get_status_line(::rocket::tinyfmt_str& fmt, HTTP_Version ver, HTTP_Status stat)
+  {
+    // Get the status line from the precomputed table. Compose it only if the
+    // version or the status code is unknown.
+    const char* sline = format_http_status_line(ver, stat);
+    if(ROCKET_EXPECT(sline))
+      return sline;
+
     // Send 200 in the case of `http_status_connection_established`.
     HTTP_Status rstat = stat;
     if(stat == http_status_connection_established)
       rstat = http_status_ok;
 
-    // Compose the status line followed by all headers.
-    ::rocket::tinyfmt_str fmt;
     fmt << format_http_version(ver) << ' ' << rstat << ' '
         << describe_http_status(stat) << "\r\n";
+    return fmt.c_str();
+  }
+
+}  // namespace
 
+Abstract_HTTP_Server_Encoder::
+~Abstract_HTTP_Server_Encoder()
+  {
+  }
+
+void
+Abstract_HTTP_Server_Encoder::
+do_encode_http_headers(HTTP_Version ver, HTTP_Status stat, const Option_Map& headers)
+  {
+    // Headers are deferred until the entity.
+    auto& hbuf = this->m_cork;
+    hbuf.clear();
+
+    ::rocket::tinyfmt_str fmt;
+    const char* sline = do_get_status_line(fmt, ver, stat);
+    hbuf.putn(sline, ::std::strlen(sline));
+
+    // Reserve space for all headers, so they can be copied without reallocation.
+    size_t nbytes = 40;  // `Date:` and the final CRLF
     for(const auto& pair : headers)
-      fmt << pair.first << ": " << pair.second << "\r\n";
-    fmt << "\r\n";
+      nbytes += pair.first.size() + pair.second.size() + 4;
+    hbuf.reserve(nbytes);
+
+    // Origin servers are required to send `Date:`. See RFC 7231 section 7.1.1.2.
+    // The value is cached, so no formatting is required most of the time.
+    if(!headers.count(sref("Date"))) {
+      hbuf.putn("Date: ", 6);
+      hbuf.putn(current_http_date(), 29);
+      hbuf.putn("\r\n", 2);
+    }
 
-    // Send encoded data.
-    this->m_good &= this->do_http_server_send(fmt.c_str(), fmt.length());
+    for(const auto& pair : headers) {
+      hbuf.putn(pair.first.data(), pair.first.size());
+      hbuf.putn(": ", 2);
+      hbuf.putn(pair.second.data(), pair.second.size());
+      hbuf.putn("\r\n", 2);
+    }
+    hbuf.putn("\r\n", 2);
   }
 
 void
 Abstract_HTTP_Server_Encoder::
-do_encode_http_entity(const char* data, size_t size)
+do_encode_http_entity(const char* data, size_t size, bool last)
   {
-    // Don't send empty chunks.
-    if(size == 0)
-      return;
+    // Gather pending headers, the chunk, and the terminator if this is the last
+    // chunk, so they can be sent in a single call.
+    ::rocket::static_vector<::iovec, 8> iov;
+    do_append_iovec(iov, this->m_cork.data(), this->m_cork.size());
 
-    // For HTTP/1.0, send outgoing data verbatim.
+    ::rocket::ascii_numput nump;
     if(!this->m_chunked) {
-      this->m_good &= this->do_http_server_send(data, size);
-      return;
+      // For HTTP/1.0 or a known length, send outgoing data verbatim.
+      do_append_iovec(iov, data, size);
     }
+    else {
+      // For HTTP/1.1, encode the data as a single chunk.
+      // Don't send empty chunks, which would terminate the entity.
+      if(size != 0) {
+        nump.put_XU(size);
+        do_append_iovec(iov, nump.data() + 2, nump.size() - 2);
+        do_append_iovec(iov, "\r\n", 2);
+        do_append_iovec(iov, data, size);
+        do_append_iovec(iov, "\r\n", 2);
+      }
 
-    // For HTTP/1.1, encode the data as a single chunk.
-    ::rocket::ascii_numput nump;
-    nump.put_XU(size);
+      if(last)
+        do_append_iovec(iov, "0\r\n\r\n", 5);
+    }
 
-    this->m_good &= this->do_http_server_send(nump.data() + 2, nump.size());
-    this->m_good &= this->do_http_server_send("\r\n", 2);
-    this->m_good &= this->do_http_server_send(data, size);
-    this->m_good &= this->do_http_server_send("\r\n", 2);
+    if(iov.empty())
+      return;
+
+    this->m_good &= this->do_http_server_sendv(iov.data(), iov.size());
+    this->m_cork.clear();
   }
 
 void
 Abstract_HTTP_Server_Encoder::
 do_finish_http_message(HTTP_Encoder_State next)
   {
-    // Terminate the entity.
-    if(this->m_gzip) {
-      auto defl = unerase_pointer_cast<zlib_Deflator>(this->m_deflator);
-      if(defl) {
-        defl->finish();
-        auto& obuf = defl->output_buffer();
-        this->do_encode_http_entity(obuf.data(), obuf.size());
-        obuf.clear();
-      }
+    // Terminate the entity. This also sends pending headers.
+    auto comp = unerase_pointer_cast<Abstract_Compressor>(this->m_compressor);
+    auto defl = unerase_pointer_cast<zlib_Deflator>(this->m_deflator);
+    if(comp) {
+      comp->finish(this->m_zbuf);
+      this->do_encode_http_entity(this->m_zbuf.data(), this->m_zbuf.size(), true);
+      this->m_zbuf.clear();
+      this->m_compressor = nullptr;
     }
+    else if(this->m_gzip && defl) {
+      auto& obuf = defl->output_buffer();
+      if(this->m_gzip_par) {
+        defl->write_parallel_into(obuf, this->m_zbuf.data(), this->m_zbuf.size());
+        defl->finish_parallel_into(obuf);
+        this->m_zbuf.clear();
+      }
+      else
+        defl->finish();
+      this->do_encode_http_entity(obuf.data(), obuf.size(), true);
 
-    if(this->m_chunked)
-      this->m_good &= this->do_http_server_send("0\r\n\r\n", 5);
+      // Return the compression state to the pool, as the connection may stay
+      // idle for a long time.
+      defl->reset();
+    }
+    else
+      this->do_encode_http_entity(nullptr, 0, true);
 
     // Update connection state.
     this->m_state = next;
@@ -95,23 +245,7 @@ do_encode_websocket_frame(int flags, const char* data, size_t size)
   {
     // Compose the frame header.
     ::rocket::static_vector<char, 14> head;
-    head.emplace_back(flags | 1);  // opcode, flags, FIN
-
-    size_t exlen;
-    if(size <= 125) {
-      head.emplace_back(size);  // payload length
-      exlen = 0;
-    }
-    else if(size <= 65535) {
-      head.emplace_back(126);  // payload length
-      exlen = 2;
-    }
-    else {
-      head.emplace_back(127);  // payload length
-      exlen = 8;
-    }
-    while(exlen != 0)
-      head.emplace_back(static_cast<uint64_t>(size) >> --exlen * 8);
+    do_compose_websocket_frame_header(head, flags, size);
 
     this->m_good &= this->do_http_server_send(head.data(), head.size());
     this->m_good &= this->do_http_server_send(data, size);
@@ -119,8 +253,35 @@ do_encode_websocket_frame(int flags, const char* data, size_t size)
 
 bool
 Abstract_HTTP_Server_Encoder::
-http_encode_headers(HTTP_Version ver, HTTP_Status stat, Option_Map&& headers,
-                    HTTP_Method meth, const cow_string& target)
+do_http_server_sendv(const ::iovec* iov, size_t count)
+  {
+    bool good = true;
+    for(size_t k = 0;  k != count;  ++k)
+      good &= this->do_http_server_send(static_cast<const char*>(iov[k].iov_base),
+                                        iov[k].iov_len);
+    return good;
+  }
+
+bool
+Abstract_HTTP_Server_Encoder::
+do_http_server_send_file(int fd, int64_t offset, int64_t size)
+  {
+    ::std::vector<char> buf(0x10000);
+    bool good = true;
+    while(size != 0) {
+      size_t nread = do_read_file(fd, offset,
+                         buf.data(), static_cast<size_t>(::rocket::min(size, 0x10000)));
+      good &= this->do_http_server_send(buf.data(), nread);
+      offset += static_cast<int64_t>(nread);
+      size -= static_cast<int64_t>(nread);
+    }
+    return good;
+  }
+
+bool
+Abstract_HTTP_Server_Encoder::
+do_encode_response_headers(HTTP_Version ver, HTTP_Status stat, Option_Map& headers,
+                           HTTP_Method meth, const cow_string& target, const char* coding)
   {
     if(this->m_state == http_encoder_state_closed)
       return false;
@@ -131,6 +292,10 @@ http_encode_headers(HTTP_Version ver, HTTP_Status stat, Option_Map&& headers,
     this->m_final = false;
     this->m_chunked = false;
     this->m_gzip = false;
+    this->m_gzip_par = false;
+    this->m_gzip_new = true;
+    this->m_compressor = nullptr;
+    this->m_zbuf.clear();
 
     auto defl = unerase_pointer_cast<zlib_Deflator>(this->m_deflator);
     if(defl)
@@ -219,18 +384,36 @@ http_encode_headers(HTTP_Version ver, HTTP_Status stat, Option_Map&& headers,
       // HTTP/1.0 does not support this header.
       headers.erase(sref("Transfer-Encoding"));
     }
-    else {
+    else if(!no_content && (meth != http_method_head)) {
       // Check whether compression can be enabled.
-      auto& trans_enc_str = headers.open(sref("Transfer-Encoding"));
-      this->m_gzip = ascii_ci_has_token(trans_enc_str, sref("gzip"));
+      auto qstr = headers.find_opt(sref("Transfer-Encoding"));
+      this->m_gzip = qstr && ascii_ci_has_token(*qstr, sref("gzip"));
+
+      // Apply the negotiated content coding, unless the user has encoded the
+      // entity already.
+      if(coding && !this->m_gzip && !headers.count(sref("Content-Encoding"))) {
+        auto comp = create_compressor(coding);
+        if(comp) {
+          headers.set(sref("Content-Encoding"), sref(comp->content_coding()));
+          this->m_compressor = comp;
+        }
+      }
 
-      // Rewrite this header.
-      // The `chunked` encoding is enforced for simplicity.
-      this->m_chunked = true;
-      trans_enc_str = sref("chunked");
+      if(!this->m_gzip && !this->m_compressor && do_check_content_length(headers)) {
+        // If the length of the entity is known, send it verbatim.
+        headers.erase(sref("Transfer-Encoding"));
+      }
+      else {
+        // Rewrite this header. `Content-Length` must not be sent with it.
+        // The `chunked` encoding is enforced for simplicity.
+        headers.erase(sref("Content-Length"));
+        auto& trans_enc_str = headers.open(sref("Transfer-Encoding"));
+        this->m_chunked = true;
+        trans_enc_str = sref("chunked");
 
-      if(this->m_gzip)
-        trans_enc_str.insert(0, "gzip, ");
+        if(this->m_gzip)
+          trans_enc_str.insert(0, "gzip, ");
+      }
     }
 
     // Check for upgradable connections.
@@ -295,6 +478,117 @@ http_encode_headers(HTTP_Version ver, HTTP_Status stat, Option_Map&& headers,
     return this->m_good;
   }
 
+bool
+Abstract_HTTP_Server_Encoder::
+http_encode_headers(HTTP_Version ver, HTTP_Status stat, Option_Map&& headers,
+                    HTTP_Method meth, const cow_string& target)
+  {
+    return this->do_encode_response_headers(ver, stat, headers, meth, target, nullptr);
+  }
+
+bool
+Abstract_HTTP_Server_Encoder::
+http_encode_headers(HTTP_Version ver, HTTP_Status stat, Option_Map&& headers,
+                    HTTP_Method meth, const cow_string& target,
+                    const cow_string& accept_encoding)
+  {
+    // The response varies with `Accept-Encoding`, even if it is not compressed.
+    // If the user has supplied a `Vary:` header, the field name is merged into
+    // it, unless it is listed already or the header is `*`.
+    auto vary = headers.mut_range(sref("Vary"));
+    if(vary.first == vary.second)
+      headers.append(sref("Vary"), sref("Accept-Encoding"));
+    else if(::std::none_of(vary.first, vary.second,
+                [](const cow_string& str) { return ascii_ci_has_token(str, sref("*")) ||
+                                                   ascii_ci_has_token(str, sref("Accept-Encoding"));  }))
+      vary.second[-1] += ", Accept-Encoding";
+
+    const char* coding = negotiate_content_coding(accept_encoding);
+    return this->do_encode_response_headers(ver, stat, headers, meth, target, coding);
+  }
+
+bool
+Abstract_HTTP_Server_Encoder::
+http_encode_cached_response(HTTP_Version ver, HTTP_Method meth, const Option_Map& req_headers,
+                            const HTTP_Cached_Response& resp)
+  {
+    if(this->m_state == http_encoder_state_closed)
+      return false;
+
+    if(this->m_state != http_encoder_state_headers)
+      POSEIDON_THROW("HTTP server encoder state error (expecting 'headers')");
+
+    // Check whether the connection should be closed after this response.
+    bool close = ver < http_version_1_1;
+    req_headers.for_each(sref("Connection"),
+        [&](const cow_string& str) {
+          if(ascii_ci_has_token(str, sref("close")))
+            close = true;
+        });
+
+    // If the client has a copy of the entity, send `304 Not Modified`.
+    HTTP_Status stat = resp.status();
+    bool not_modified = false;
+    if((stat == http_status_ok) && ::rocket::is_any_of(meth, {http_method_get, http_method_head}))
+      req_headers.for_each(sref("If-None-Match"),
+          [&](const cow_string& str) {
+            if(etag_list_matches(str, resp.etag()))
+              not_modified = true;
+          });
+
+    if(not_modified)
+      stat = http_status_not_modified;
+
+    // Select the body. Neither compression nor serialization of headers is
+    // required.
+    bool gzip = false;
+    if(!not_modified && resp.has_gzip())
+      req_headers.for_each(sref("Accept-Encoding"),
+          [&](const cow_string& str) {
+            if(content_coding_acceptable(str, "gzip"))
+              gzip = true;
+          });
+
+    ::rocket::tinyfmt_str fmt;
+    const char* sline = do_get_status_line(fmt, ver, stat);
+
+    char date_line[40];
+    ::std::memcpy(date_line, "Date: ", 6);
+    ::std::memcpy(date_line + 6, current_http_date(), 29);
+    ::std::memcpy(date_line + 35, "\r\n", 2);
+
+    // Gather all parts, so they can be sent in a single call.
+    ::rocket::static_vector<::iovec, 8> iov;
+    do_append_iovec(iov, sline, ::std::strlen(sline));
+    do_append_iovec(iov, date_line, 37);
+
+    const auto& etag = resp.etag();
+    if(not_modified) {
+      do_append_iovec(iov, "ETag: ", 6);
+      do_append_iovec(iov, etag.data(), etag.size());
+      do_append_iovec(iov, "\r\n", 2);
+    }
+    else
+      do_append_iovec(iov, resp.head(gzip).data(), resp.head(gzip).size());
+
+    if(close)
+      do_append_iovec(iov, "Connection: close\r\n", 19);
+    do_append_iovec(iov, "\r\n", 2);
+
+    if(!not_modified && (meth != http_method_head))
+      do_append_iovec(iov, resp.body(gzip).data(), resp.body(gzip).size());
+
+    this->m_good &= this->do_http_server_sendv(iov.data(), iov.size());
+    if(!close)
+      return this->m_good;
+
+    // Shut the connection down.
+    this->m_final = true;
+    this->m_state = http_encoder_state_closed;
+    this->m_good &= this->do_http_server_close();
+    return this->m_good;
+  }
+
 bool
 Abstract_HTTP_Server_Encoder::
 http_encode_entity(const char* data, size_t size)
@@ -305,9 +599,16 @@ http_encode_entity(const char* data, size_t size)
     if(this->m_state != http_encoder_state_entity)
       POSEIDON_THROW("HTTP server encoder state error (expecting 'entity')");
 
-    if(!this->m_gzip) {
+    auto comp = unerase_pointer_cast<Abstract_Compressor>(this->m_compressor);
+    if(comp) {
+      // Compress outgoing data using the negotiated content coding.
+      comp->write(this->m_zbuf, data, size);
+      this->do_encode_http_entity(this->m_zbuf.data(), this->m_zbuf.size(), false);
+      this->m_zbuf.clear();
+    }
+    else if(!this->m_gzip) {
       // If compression is not enabled, send outgoing data verbatim.
-      this->do_encode_http_entity(data, size);
+      this->do_encode_http_entity(data, size, false);
     }
     else {
       // Compress outgoing data using GZIP.
@@ -316,16 +617,96 @@ http_encode_entity(const char* data, size_t size)
         defl = ::rocket::make_refcnt<zlib_Deflator>(zlib_Deflator::format_gzip);
         this->m_deflator = defl;
       }
-      defl->write(data, size);
 
-      // Consume all compressed data.
+      // Large entities, such as reports, are compressed by worker threads.
+      // This is decided upon the first write, as a stream that has been
+      // compressed serially cannot be continued in parallel.
+      if(this->m_gzip_new)
+        this->m_gzip_par = size >= s_gzip_parallel_threshold;
+      this->m_gzip_new = false;
+
       auto& obuf = defl->output_buffer();
-      this->do_encode_http_entity(obuf.data(), obuf.size());
+      if(this->m_gzip_par) {
+        // Each call to `write_parallel_into()` terminates a deflate block, so
+        // small writes are buffered.
+        if(this->m_zbuf.size() + size < s_gzip_parallel_threshold) {
+          this->m_zbuf.putn(data, size);
+          return this->m_good;
+        }
+
+        if(this->m_zbuf.empty())
+          defl->write_parallel_into(obuf, data, size);
+        else {
+          this->m_zbuf.putn(data, size);
+          defl->write_parallel_into(obuf, this->m_zbuf.data(), this->m_zbuf.size());
+          this->m_zbuf.clear();
+        }
+      }
+      else
+        defl->write(data, size);
+
+      // Consume all compressed data.
+      this->do_encode_http_entity(obuf.data(), obuf.size(), false);
       obuf.clear();
     }
     return this->m_good;
   }
 
+bool
+Abstract_HTTP_Server_Encoder::
+http_encode_entity_file(int fd, int64_t offset, int64_t size)
+  {
+    if(this->m_state == http_encoder_state_closed)
+      return false;
+
+    if(this->m_state != http_encoder_state_entity)
+      POSEIDON_THROW("HTTP server encoder state error (expecting 'entity')");
+
+    if((offset < 0) || (size < 0))
+      POSEIDON_THROW("Invalid file segment (offset `$1`, size `$2`)", offset, size);
+
+    if(this->m_gzip || this->m_compressor) {
+      // Compression requires data in memory. Large files are read in large
+      // pieces, so they can be compressed by worker threads.
+      int64_t bsize = 0x10000;
+      if(this->m_gzip && (static_cast<uint64_t>(size) >= s_gzip_parallel_threshold))
+        bsize = static_cast<int64_t>(s_gzip_parallel_threshold);
+
+      ::std::vector<char> buf(static_cast<size_t>(bsize));
+      while(size != 0) {
+        size_t nread = do_read_file(fd, offset,
+                           buf.data(), static_cast<size_t>(::rocket::min(size, bsize)));
+        this->http_encode_entity(buf.data(), nread);
+        offset += static_cast<int64_t>(nread);
+        size -= static_cast<int64_t>(nread);
+      }
+      return this->m_good;
+    }
+
+    // Send pending headers and the chunk header, followed by the file.
+    ::rocket::static_vector<::iovec, 8> iov;
+    do_append_iovec(iov, this->m_cork.data(), this->m_cork.size());
+
+    ::rocket::ascii_numput nump;
+    if(this->m_chunked && (size != 0)) {
+      nump.put_XU(static_cast<uint64_t>(size));
+      do_append_iovec(iov, nump.data() + 2, nump.size() - 2);
+      do_append_iovec(iov, "\r\n", 2);
+    }
+
+    if(iov.size())
+      this->m_good &= this->do_http_server_sendv(iov.data(), iov.size());
+    this->m_cork.clear();
+
+    if(size == 0)
+      return this->m_good;
+
+    this->m_good &= this->do_http_server_send_file(fd, offset, size);
+    if(this->m_chunked)
+      this->m_good &= this->do_http_server_send("\r\n", 2);
+    return this->m_good;
+  }
+
 bool
 Abstract_HTTP_Server_Encoder::
 http_encode_end_of_entity()
@@ -406,7 +787,7 @@ http_encode_websocket_frame(WebSocket_Opcode opcode, const char* data, size_t si
       return this->m_good;
     }
 
-    if(!this->m_gzip) {
+    if(!this->m_ws_pmce) {
       // If compression is not enabled, send outgoing data verbatim.
       this->do_encode_websocket_frame(opcode, data, size);
       return this->m_good;
@@ -418,9 +799,6 @@ http_encode_websocket_frame(WebSocket_Opcode opcode, const char* data, size_t si
       defl = ::rocket::make_refcnt<zlib_Deflator>(zlib_Deflator::format_raw);
       this->m_deflator = defl;
     }
-    else if(this->m_ws_nctxto) {  // `server_no_context_takeover`
-      defl->reset();
-    }
     defl->write(data, size);
 
     // Finish this deflate block. This results in four extra bytes `00 00 FF FF` in
@@ -434,7 +812,13 @@ http_encode_websocket_frame(WebSocket_Opcode opcode, const char* data, size_t si
     ROCKET_ASSERT(::memcmp(obuf.data() + rlen, "\x00\x00\xFF\xFF", 4) == 0);
 
     this->do_encode_websocket_frame(opcode | 2, obuf.data(), rlen);
-    obuf.clear();
+
+    // Return the compression state to the pool if the context will not be
+    // taken over by the next message.
+    if(this->m_ws_nctxto)  // `server_no_context_takeover`
+      defl->reset();
+    else
+      obuf.clear();
     return this->m_good;
   }
 
@@ -465,4 +849,70 @@ http_encode_websocket_closure(WebSocket_Status stat, const char* data, size_t si
     return this->m_good;
   }
 
+size_t
+Abstract_HTTP_Server_Encoder::
+http_broadcast_websocket_frame(Abstract_HTTP_Server_Encoder* const* encoders,
+                               size_t count, WebSocket_Opcode opcode,
+                               const char* data, size_t size)
+  {
+    if(opcode == websocket_opcode_continuation)
+      POSEIDON_THROW("WebSocket continuation frames cannot be sent explicitly");
+
+    if(opcode == websocket_opcode_close)
+      POSEIDON_THROW("WebSocket closure frames cannot be broadcast");
+
+    // Control frames are not compressed, and must not be fragmented.
+    bool control = opcode >= websocket_opcode_close;
+    size_t rlen = size;
+    if(control) {
+      rlen = ::std::min<size_t>(size, 125);
+      if(rlen != size)
+        POSEIDON_LOG_WARN("Control frame truncated (size `$1`)", size);
+    }
+
+    // Frames are composed on demand, so each of them is encoded at most once,
+    // no matter how many peers will receive it. As a frame always has a header,
+    // an empty string denotes one that has not been composed yet.
+    cow_string plain_frame;
+    cow_string defl_frame;
+    size_t nsent = 0;
+
+    for(size_t k = 0;  k != count;  ++k) {
+      auto enc = encoders[k];
+      if(!enc || (enc->m_state != http_encoder_state_websocket))
+        continue;
+
+      // Peers that keep their compression context can't share compressed data,
+      // so they receive the uncompressed frame, which is also valid.
+      const cow_string* frame = &plain_frame;
+      if(!control && enc->m_ws_pmce && enc->m_ws_nctxto)
+        frame = &defl_frame;
+
+      if(frame->empty()) {
+        if(frame == &plain_frame) {
+          do_compose_websocket_frame(plain_frame, opcode, data, rlen);
+        }
+        else {
+          // Compress the payload with a fresh context, like
+          // `http_encode_websocket_frame()` does with `server_no_context_takeover`.
+          zlib_Deflator defl(zlib_Deflator::format_raw);
+          defl.write(data, size);
+          defl.flush();
+          auto& obuf = defl.output_buffer();
+
+          ROCKET_ASSERT(obuf.size() >= 4);
+          size_t clen = obuf.size() - 4;
+          ROCKET_ASSERT(::memcmp(obuf.data() + clen, "\x00\x00\xFF\xFF", 4) == 0);
+
+          do_compose_websocket_frame(defl_frame, opcode | 2, obuf.data(), clen);
+        }
+      }
+
+      // Enqueue the same bytes.
+      enc->m_good &= enc->do_http_server_send(frame->data(), frame->size());
+      nsent += enc->m_good;
+    }
+    return nsent;
+  }
+
 }  // namespace poseidon
@@ -18,10 +18,15 @@ class Abstract_HTTP_Server_Encoder
     uint8_t m_final : 1;      // close connection after entity
     uint8_t m_chunked : 1;    // use HTTP/1.1 `chunked` transfer encoding
     uint8_t m_gzip : 1;       // use `gzip` content encoding
+    uint8_t m_gzip_par : 1;   // compress `gzip` data with worker threads
+    uint8_t m_gzip_new : 1;   // no `gzip` data have been written
     uint8_t m_ws_pmce : 1;    // use WebSocket per-message compression extension
     uint8_t m_ws_nctxto : 1;  // has WebSocket `server_no_context_takeover`
 
     rcfwdp<zlib_Deflator> m_deflator;
+    rcfwdp<Abstract_Compressor> m_compressor;  // negotiated content coding
+    linear_buffer m_zbuf;  // compressed data, or input of parallel `gzip`
+    linear_buffer m_cork;  // headers pending
 
   protected:
     explicit
@@ -36,7 +41,7 @@ class Abstract_HTTP_Server_Encoder
 
     inline
     void
-    do_encode_http_entity(const char* data, size_t size);
+    do_encode_http_entity(const char* data, size_t size, bool last);
 
     inline
     void
@@ -46,6 +51,11 @@ class Abstract_HTTP_Server_Encoder
     void
     do_encode_websocket_frame(int flags, const char* data, size_t size);
 
+    bool
+    do_encode_response_headers(HTTP_Version ver, HTTP_Status stat, Option_Map& headers,
+                               HTTP_Method meth, const cow_string& target,
+                               const char* coding);
+
   protected:
     // This function shall deliver all bytes to the other endpoint.
     virtual
@@ -53,6 +63,24 @@ class Abstract_HTTP_Server_Encoder
     do_http_server_send(const char* data, size_t size)
       = 0;
 
+    // This function shall deliver all bytes in `iov` to the other endpoint, as if
+    // they were concatenated.
+    // The default implementation calls `do_http_server_send()` for each block. It
+    // is recommended to override this function, so all blocks are sent at once.
+    virtual
+    bool
+    do_http_server_sendv(const ::iovec* iov, size_t count);
+
+    // This function shall deliver `size` bytes from the file `fd`, starting from
+    // `offset`, to the other endpoint. `fd` may be closed after this function
+    // returns.
+    // The default implementation reads the file and calls `do_http_server_send()`.
+    // It is recommended to override this function to call `do_socket_send_file()`,
+    // so the file can be sent without being read into memory.
+    virtual
+    bool
+    do_http_server_send_file(int fd, int64_t offset, int64_t size);
+
     // This function shall close the connection.
     virtual
     bool
@@ -73,15 +101,51 @@ class Abstract_HTTP_Server_Encoder
     // `meth` and `target` shall be copied from a previous request. Unless the response
     // 'MUST NOT' include a message body (see RFC 7230 section 3.3), the next state will
     // be 'entity'.
+    // If `Content-Length` is specified and compression is not requested, the entity
+    // is sent verbatim, and exactly as many bytes shall be sent. Otherwise, the
+    // `chunked` encoding is used.
+    // When an entity is expected, headers are not sent until the first chunk of the
+    // entity or the end of it, so they can be sent together.
     bool
     http_encode_headers(HTTP_Version ver, HTTP_Status stat, Option_Map&& headers,
                         HTTP_Method meth, const cow_string& target);
 
+    // Puts the HTTP status line and headers, and compresses the entity.
+    // `accept_encoding` shall be copied from the `Accept-Encoding:` header of the
+    // request. The preferred content coding that is supported by both peers is
+    // selected. If the user has not set `Content-Encoding:` and an entity is to be
+    // sent, it will be compressed and sent with the `chunked` encoding.
+    bool
+    http_encode_headers(HTTP_Version ver, HTTP_Status stat, Option_Map&& headers,
+                        HTTP_Method meth, const cow_string& target,
+                        const cow_string& accept_encoding);
+
+    // Sends a complete response from a cache.
+    // `http_encoder_state()` must be 'closed' or 'headers', and will not change unless
+    // the connection is closed.
+    // `meth` and `req_headers` shall be copied from a previous request. If the request
+    // has an `If-None-Match:` header that matches the entity tag of the response, `304
+    // Not Modified` is sent instead. The gzip body is sent if the request accepts it.
+    // No compression or serialization of headers takes place.
+    bool
+    http_encode_cached_response(HTTP_Version ver, HTTP_Method meth,
+                                const Option_Map& req_headers,
+                                const HTTP_Cached_Response& resp);
+
     // Puts a chunk of entity.
     // `http_encoder_state()` must be 'closed' or 'entity'.
+    // An empty chunk sends pending headers, if any, and nothing else.
     bool
     http_encode_entity(const char* data, size_t size);
 
+    // Puts a chunk of entity from a file.
+    // `http_encoder_state()` must be 'closed' or 'entity'.
+    // `size` bytes are sent from the file `fd`, starting from `offset`. If the
+    // entity is to be compressed, the file is read into memory. Otherwise it is
+    // sent by `do_http_server_send_file()`.
+    bool
+    http_encode_entity_file(int fd, int64_t offset, int64_t size);
+
     // Finishes the entity.
     // `http_encoder_state()` must be 'closed' or 'entity'.
     bool
@@ -89,6 +153,8 @@ class Abstract_HTTP_Server_Encoder
 
     // Sends data through this tunnel.
     // `http_encoder_state()` must be 'closed' or 'tunnel'.
+    // If both the client and the target host are connected with plain TCP,
+    // `Abstract_TCP_Socket::link()` relays data without copying them.
     bool
     http_encode_tunnel_data(const char* data, size_t size);
 
@@ -110,6 +176,21 @@ class Abstract_HTTP_Server_Encoder
     // bytes if it is longer.
     bool
     http_encode_websocket_closure(WebSocket_Status stat, const char* data, size_t size);
+
+    // Puts a WebSocket frame to multiple connections.
+    // The frame is encoded only once, and the same bytes are delivered to all encoders
+    // whose `http_encoder_state()` is 'websocket'. Null pointers and encoders in other
+    // states are ignored. If a peer has negotiated the per-message compression
+    // extension with `server_no_context_takeover`, it receives a compressed frame,
+    // which is also shared by all such peers. Other peers receive the uncompressed one.
+    // `opcode` shall specify a valid opcode other than `websocket_opcode_continuation`
+    // and `websocket_opcode_close`.
+    // The number of connections that the frame has been delivered to is returned.
+    static
+    size_t
+    http_broadcast_websocket_frame(Abstract_HTTP_Server_Encoder* const* encoders,
+                                   size_t count, WebSocket_Opcode opcode,
+                                   const char* data, size_t size);
   };
 
 }  // namespace poseidon
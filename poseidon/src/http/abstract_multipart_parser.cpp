@@ -0,0 +1,238 @@
+// This file is part of Poseidon.
+// Copyleft 2020, LH_Mouse. All wrongs reserved.
+
+#include "../precompiled.hpp"
+#include "abstract_multipart_parser.hpp"
+#include "../utils.hpp"
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
+
+namespace poseidon {
+namespace {
+
+// This is the maximum length of all headers of a part, including line breaks.
+constexpr size_t max_part_header_size = 16384;
+
+const char*
+do_find_delimiter(const char* bp, const char* ep, const char* dp, size_t dn)
+  noexcept
+  {
+    // The delimiter is at least 5 bytes long. Its first and last bytes are
+    // compared with 16 candidate positions at a time, and only positions where
+    // both match are compared in full. As the first byte is CR, which is rare in
+    // form data, there are few false positives.
+    const char* p = bp;
+#ifdef __SSE2__
+    __m128i xfirst = _mm_set1_epi8(dp[0]);
+    __m128i xlast = _mm_set1_epi8(dp[dn - 1]);
+
+    while(ep - p >= static_cast<ptrdiff_t>(dn + 15)) {
+      __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+      __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + dn - 1));
+      __m128i cand = _mm_and_si128(_mm_cmpeq_epi8(x, xfirst), _mm_cmpeq_epi8(y, xlast));
+
+      uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(cand));
+      while(mask != 0) {
+        const char* cp = p + __builtin_ctz(mask);
+        if(::std::memcmp(cp + 1, dp + 1, dn - 2) == 0)
+          return cp;
+        mask &= mask - 1;
+      }
+      p += 16;
+    }
+#endif
+    return ::std::search(p, ep, dp, dp + dn);
+  }
+
+const char*
+do_find_crlf(const char* bp, const char* ep)
+  noexcept
+  {
+    static constexpr char s_crlf[] = { '\r', '\n' };
+    return ::std::search(bp, ep, s_crlf, s_crlf + 2);
+  }
+
+}  // namespace
+
+Abstract_Multipart_Parser::
+Abstract_Multipart_Parser(const cow_string& boundary)
+  {
+    // RFC 2046 limits boundaries to 70 characters.
+    if(boundary.empty())
+      POSEIDON_THROW("Empty multipart boundary");
+
+    if(boundary.size() > 70)
+      POSEIDON_THROW("Multipart boundary too long (length `$1` > 70)", boundary.size());
+
+    this->m_delim = sref("\r\n--");
+    this->m_delim += boundary;
+
+    // The first delimiter may appear at the very beginning of the body, where
+    // it is not preceded by a line break. Pretend there is one.
+    this->m_buf.putn("\r\n", 2);
+  }
+
+Abstract_Multipart_Parser::
+~Abstract_Multipart_Parser()
+  {
+  }
+
+void
+Abstract_Multipart_Parser::
+do_parse_header_line(const char* bp, const char* ep)
+  {
+    // Header fields in parts follow RFC 5322. Obsolete line folding is not
+    // supported.
+    auto cp = ::std::find(bp, ep, ':');
+    if(cp == ep)
+      POSEIDON_THROW("Invalid multipart header line (no colon found)");
+
+    auto name = ascii_trim(cow_string(bp, static_cast<size_t>(cp - bp)));
+    if(name.empty())
+      POSEIDON_THROW("Invalid multipart header line (empty name)");
+
+    auto value = ascii_trim(cow_string(cp + 1, static_cast<size_t>(ep - cp - 1)));
+    this->m_headers.append(name, ::std::move(value));
+  }
+
+cow_string
+Abstract_Multipart_Parser::
+parse_boundary(const cow_string& content_type)
+  {
+    Option_Map opts;
+    opts.parse_http_header(nullptr, content_type, 1);
+
+    // The media type is stored with an empty key.
+    auto qtype = opts.find_opt(sref(""));
+    if(!qtype || (qtype->size() <= 10) ||
+       !ascii_ci_equal(cow_string(qtype->data(), 10), sref("multipart/")))
+      POSEIDON_THROW("Content type not multipart: $1", content_type);
+
+    auto qbound = opts.find_opt(sref("boundary"));
+    if(!qbound || qbound->empty())
+      POSEIDON_THROW("No boundary in multipart content type: $1", content_type);
+
+    return *qbound;
+  }
+
+void
+Abstract_Multipart_Parser::
+multipart_parse(const char* data, size_t size)
+  {
+    // The epilogue is discarded.
+    if(this->m_state == parser_state_epilogue)
+      return;
+
+    this->m_buf.putn(data, size);
+
+    const char* dp = this->m_delim.data();
+    size_t dn = this->m_delim.size();
+
+    for(;;) {
+      const char* bp = this->m_buf.data();
+      const char* ep = bp + this->m_buf.size();
+
+      switch(this->m_state) {
+        case parser_state_preamble:
+        case parser_state_data: {
+          // Search for the next delimiter.
+          bool in_part = this->m_state == parser_state_data;
+          auto mp = do_find_delimiter(bp, ep, dp, dn);
+          if(mp == ep) {
+            // Data that can't be the beginning of a delimiter are delivered. The
+            // others are kept until more data arrive.
+            size_t ndata = this->m_buf.size() - ::rocket::min(this->m_buf.size(), dn - 1);
+            if(in_part && (ndata != 0))
+              this->do_multipart_on_part_data(bp, ndata);
+
+            this->m_buf.discard(ndata);
+            return;
+          }
+
+          if(in_part && (mp != bp))
+            this->do_multipart_on_part_data(bp, static_cast<size_t>(mp - bp));
+
+          this->m_buf.discard(static_cast<size_t>(mp - bp) + dn);
+          this->m_state = parser_state_boundary;
+
+          if(in_part)
+            this->do_multipart_on_part_end();
+          break;
+        }
+
+        case parser_state_boundary: {
+          // Check for the close delimiter.
+          if(ep - bp < 2)
+            return;
+
+          if((bp[0] == '-') && (bp[1] == '-')) {
+            this->m_state = parser_state_epilogue;
+            this->m_buf.clear();
+            return;
+          }
+
+          // Skip transport padding, which is followed by a line break.
+          auto lp = do_find_crlf(bp, ep);
+          if(lp == ep) {
+            if(this->m_buf.size() > 1024)
+              POSEIDON_THROW("Invalid multipart delimiter (no line break found)");
+            return;
+          }
+
+          if(!::std::all_of(bp, lp, [](char ch) { return (ch == ' ') || (ch == '\t');  }))
+            POSEIDON_THROW("Invalid multipart delimiter (junk after boundary)");
+
+          this->m_buf.discard(static_cast<size_t>(lp - bp) + 2);
+          this->m_state = parser_state_headers;
+          this->m_headers.clear();
+          this->m_header_size = 0;
+          break;
+        }
+
+        case parser_state_headers: {
+          // Get a line.
+          auto lp = do_find_crlf(bp, ep);
+          if(lp == ep) {
+            if(this->m_header_size + this->m_buf.size() > max_part_header_size)
+              POSEIDON_THROW("Multipart headers too long (limit `$1`)", max_part_header_size);
+            return;
+          }
+
+          size_t nline = static_cast<size_t>(lp - bp) + 2;
+          this->m_header_size += nline;
+          if(this->m_header_size > max_part_header_size)
+            POSEIDON_THROW("Multipart headers too long (limit `$1`)", max_part_header_size);
+
+          if(lp != bp) {
+            this->do_parse_header_line(bp, lp);
+            this->m_buf.discard(nline);
+            break;
+          }
+
+          // An empty line terminates headers. The data follow.
+          this->m_buf.discard(nline);
+          this->m_state = parser_state_data;
+          this->do_multipart_on_part_headers(::std::move(this->m_headers));
+          break;
+        }
+
+        case parser_state_epilogue:
+          this->m_buf.clear();
+          return;
+
+        default:
+          ROCKET_ASSERT(false);
+      }
+    }
+  }
+
+void
+Abstract_Multipart_Parser::
+multipart_finish()
+  {
+    if(this->m_state != parser_state_epilogue)
+      POSEIDON_THROW("Multipart body truncated (no close delimiter found)");
+  }
+
+}  // namespace poseidon
@@ -0,0 +1,98 @@
+// This file is part of Poseidon.
+// Copyleft 2020, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_HTTP_ABSTRACT_MULTIPART_PARSER_HPP_
+#define POSEIDON_HTTP_ABSTRACT_MULTIPART_PARSER_HPP_
+
+#include "../fwd.hpp"
+#include "option_map.hpp"
+
+namespace poseidon {
+
+// This class parses a `multipart/form-data` body (RFC 7578), or any other
+// multipart body (RFC 2046), incrementally. The body may be split into chunks
+// arbitrarily, such as those read from an `HTTP_Body_Stream`. Each part is
+// delivered as its headers, followed by its data in pieces, so a part is never
+// buffered in full. At most the length of the delimiter is kept across chunks.
+// The preamble and the epilogue are discarded.
+// This class is not thread-safe.
+class Abstract_Multipart_Parser
+  : public ::asteria::Rcfwd<Abstract_Multipart_Parser>
+  {
+  private:
+    enum Parser_State : uint8_t
+      {
+        parser_state_preamble  = 0,
+        parser_state_boundary  = 1,  // after a delimiter
+        parser_state_headers   = 2,
+        parser_state_data      = 3,
+        parser_state_epilogue  = 4,
+      };
+
+    cow_string m_delim;  // CR LF, two hyphens, and the boundary
+    Parser_State m_state = parser_state_preamble;
+    linear_buffer m_buf;
+    Option_Map m_headers;  // headers of the current part
+    size_t m_header_size = 0;
+
+  protected:
+    // Creates a parser. `boundary` is the `boundary` parameter of `Content-Type`,
+    // which can be obtained with `parse_boundary()`.
+    // An exception is thrown if `boundary` is empty or longer than 70 bytes.
+    explicit
+    Abstract_Multipart_Parser(const cow_string& boundary);
+
+  private:
+    void
+    do_parse_header_line(const char* bp, const char* ep);
+
+  protected:
+    // This function is called when the headers of a part have been received.
+    virtual
+    void
+    do_multipart_on_part_headers(Option_Map&& headers)
+      = 0;
+
+    // This function is called when a piece of data of the current part has been
+    // received.
+    virtual
+    void
+    do_multipart_on_part_data(const char* data, size_t size)
+      = 0;
+
+    // This function is called when the current part has ended.
+    virtual
+    void
+    do_multipart_on_part_end()
+      = 0;
+
+  public:
+    ASTERIA_NONCOPYABLE_DESTRUCTOR(Abstract_Multipart_Parser);
+
+    // Gets the `boundary` parameter from a `Content-Type` value, such as
+    // `multipart/form-data; boundary=xyz`.
+    // An exception is thrown if the value is not multipart or has no boundary.
+    static
+    cow_string
+    parse_boundary(const cow_string& content_type);
+
+    // Checks whether the close delimiter has been received.
+    bool
+    multipart_complete()
+      const noexcept
+      { return this->m_state == parser_state_epilogue;  }
+
+    // Processes a chunk of the body. Callbacks are invoked synchronously.
+    // An exception is thrown if the body is invalid.
+    void
+    multipart_parse(const char* data, size_t size);
+
+    // Notifies the end of the body.
+    // An exception is thrown if the close delimiter has not been received.
+    void
+    multipart_finish();
+  };
+
+}  // namespace poseidon
+
+#endif
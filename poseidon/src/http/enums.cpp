@@ -34,6 +34,9 @@ format_http_version(HTTP_Version ver)
       case http_version_1_1:
         return "HTTP/1.1";
 
+      case http_version_2_0:
+        return "HTTP/2";
+
       default:
         return "[unknown HTTP version]";
     }
@@ -325,4 +328,87 @@ describe_http_status(HTTP_Status stat)
     }
   }
 
+const char*
+format_http_status_line(HTTP_Version ver, HTTP_Status stat)
+  noexcept
+  {
+    if((ver != http_version_1_0) && (ver != http_version_1_1))
+      return nullptr;
+
+    // Each case yields one of two string literals, both of which are composed
+    // at compile time.
+#define POSEIDON_HTTP_STATUS_LINE_(name, code, desc)  \
+      case http_status_##name:  \
+        return (ver == http_version_1_1)  \
+                 ? "HTTP/1.1 " #code " " desc "\r\n"  \
+                 : "HTTP/1.0 " #code " " desc "\r\n"  // no semicolon
+
+    switch(stat) {
+      POSEIDON_HTTP_STATUS_LINE_(continue, 100, "Continue");
+      POSEIDON_HTTP_STATUS_LINE_(switching_protocol, 101, "Switching Protocol");
+      POSEIDON_HTTP_STATUS_LINE_(processing, 102, "Processing");
+      POSEIDON_HTTP_STATUS_LINE_(early_hints, 103, "Early Hints");
+      POSEIDON_HTTP_STATUS_LINE_(ok, 200, "OK");
+      POSEIDON_HTTP_STATUS_LINE_(created, 201, "Created");
+      POSEIDON_HTTP_STATUS_LINE_(accepted, 202, "Accepted");
+      POSEIDON_HTTP_STATUS_LINE_(nonauthoritative, 203, "Non-authoritative Information");
+      POSEIDON_HTTP_STATUS_LINE_(no_content, 204, "No Content");
+      POSEIDON_HTTP_STATUS_LINE_(reset_content, 205, "Reset Content");
+      POSEIDON_HTTP_STATUS_LINE_(partial_content, 206, "Partial Content");
+      POSEIDON_HTTP_STATUS_LINE_(multistatus, 207, "Multi-status");
+      POSEIDON_HTTP_STATUS_LINE_(already_reported, 208, "Already Reported");
+      POSEIDON_HTTP_STATUS_LINE_(im_used, 226, "IM Used");
+      POSEIDON_HTTP_STATUS_LINE_(connection_established, 200, "Connection Established");
+      POSEIDON_HTTP_STATUS_LINE_(multiple_choice, 300, "Multiple Choice");
+      POSEIDON_HTTP_STATUS_LINE_(moved_permanently, 301, "Moved Permanently");
+      POSEIDON_HTTP_STATUS_LINE_(found, 302, "Found");
+      POSEIDON_HTTP_STATUS_LINE_(see_other, 303, "See Other");
+      POSEIDON_HTTP_STATUS_LINE_(not_modified, 304, "Not Modified");
+      POSEIDON_HTTP_STATUS_LINE_(use_proxy, 305, "Use Proxy");
+      POSEIDON_HTTP_STATUS_LINE_(temporary_redirect, 307, "Temporary Redirect");
+      POSEIDON_HTTP_STATUS_LINE_(permanent_redirect, 308, "Permanent Redirect");
+      POSEIDON_HTTP_STATUS_LINE_(bad_request, 400, "Bad Request");
+      POSEIDON_HTTP_STATUS_LINE_(unauthorized, 401, "Unauthorized");
+      POSEIDON_HTTP_STATUS_LINE_(forbidden, 403, "Forbidden");
+      POSEIDON_HTTP_STATUS_LINE_(not_found, 404, "Not Found");
+      POSEIDON_HTTP_STATUS_LINE_(method_not_allowed, 405, "Method Not Allowed");
+      POSEIDON_HTTP_STATUS_LINE_(not_acceptable, 406, "Not Acceptable");
+      POSEIDON_HTTP_STATUS_LINE_(proxy_unauthorized, 407, "Proxy Authentication Required");
+      POSEIDON_HTTP_STATUS_LINE_(request_timeout, 408, "Request Timeout");
+      POSEIDON_HTTP_STATUS_LINE_(conflict, 409, "Conflict");
+      POSEIDON_HTTP_STATUS_LINE_(gone, 410, "Gone");
+      POSEIDON_HTTP_STATUS_LINE_(length_required, 411, "Length Required");
+      POSEIDON_HTTP_STATUS_LINE_(precondition_failed, 412, "Precondition Failed");
+      POSEIDON_HTTP_STATUS_LINE_(payload_too_large, 413, "Payload Too Large");
+      POSEIDON_HTTP_STATUS_LINE_(uri_too_long, 414, "URI Too Long");
+      POSEIDON_HTTP_STATUS_LINE_(unsupported_media_type, 415, "Unsupported Media Type");
+      POSEIDON_HTTP_STATUS_LINE_(range_not_satisfiable, 416, "Range Not Satisfiable");
+      POSEIDON_HTTP_STATUS_LINE_(expectation_failed, 417, "Expectation Failed");
+      POSEIDON_HTTP_STATUS_LINE_(misdirected_request, 421, "Misdirected Request");
+      POSEIDON_HTTP_STATUS_LINE_(unprocessable_entity, 422, "Unprocessable Entity");
+      POSEIDON_HTTP_STATUS_LINE_(locked, 423, "Locked");
+      POSEIDON_HTTP_STATUS_LINE_(failed_dependency, 424, "Failed Dependency");
+      POSEIDON_HTTP_STATUS_LINE_(too_early, 425, "Too Early");
+      POSEIDON_HTTP_STATUS_LINE_(upgrade_required, 426, "Upgrade Required");
+      POSEIDON_HTTP_STATUS_LINE_(precondition_required, 428, "Precondition Required");
+      POSEIDON_HTTP_STATUS_LINE_(too_many_requests, 429, "Too Many Requests");
+      POSEIDON_HTTP_STATUS_LINE_(headers_too_large, 431, "Request Header Fields Too Large");
+      POSEIDON_HTTP_STATUS_LINE_(internal_server_error, 500, "Internal Server Error");
+      POSEIDON_HTTP_STATUS_LINE_(not_implemented, 501, "Not Implemented");
+      POSEIDON_HTTP_STATUS_LINE_(bad_gateway, 502, "Bad Gateway");
+      POSEIDON_HTTP_STATUS_LINE_(service_unavailable, 503, "Service Unavailable");
+      POSEIDON_HTTP_STATUS_LINE_(gateway_timeout, 504, "Gateway Timeout");
+      POSEIDON_HTTP_STATUS_LINE_(version_not_supported, 505, "HTTP Version Not Supported");
+      POSEIDON_HTTP_STATUS_LINE_(insufficient_storage, 507, "Insufficient Storage");
+      POSEIDON_HTTP_STATUS_LINE_(loop_detected, 508, "Loop Detected");
+      POSEIDON_HTTP_STATUS_LINE_(not_extended, 510, "Not Extended");
+      POSEIDON_HTTP_STATUS_LINE_(network_unauthorized, 511, "Network Authentication Required");
+
+      default:
+        return nullptr;
+    }
+
+#undef POSEIDON_HTTP_STATUS_LINE_
+  }
+
 }  // namespace poseidon
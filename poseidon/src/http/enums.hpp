@@ -9,12 +9,14 @@
 namespace poseidon {
 
 // These are HTTP version numbers.
-// At the moment only 1.0 and 1.1 are supported.
+// HTTP/1.0 and HTTP/1.1 are supported by HTTP encoders and decoders. HTTP/2 is
+// supported by `Abstract_HTTP2_Server`.
 enum HTTP_Version : uint16_t
   {
     http_version_0_0  =      0,
     http_version_1_0  = 0x0100,  // HTTP/1.0
     http_version_1_1  = 0x0101,  // HTTP/1.1
+    http_version_2_0  = 0x0200,  // HTTP/2
   };
 
 // Converts an HTTP version to a string such as `HTTP/1.1`.
@@ -131,6 +133,15 @@ const char*
 describe_http_status(HTTP_Status stat)
   noexcept;
 
+// Gets the status line of a response such as `HTTP/1.1 400 Bad Request`, followed
+// by a CRLF pair. The result is a string literal. As with HTTP encoders, the status
+// code `http_status_connection_established` is sent as 200.
+// If either the version or the status code is unknown, a null pointer is returned.
+ROCKET_CONST_FUNCTION
+const char*
+format_http_status_line(HTTP_Version ver, HTTP_Status stat)
+  noexcept;
+
 // These are internal states of HTTP and WebSocket encoders.
 enum HTTP_Encoder_State : uint8_t
   {
@@ -193,6 +204,26 @@ enum WebSocket_Status : uint16_t
     websocket_status_tls_error           = 1015,  // reserved
   };
 
+// These are HTTP/2 error codes.
+// This list is exhaustive according to RFC 7540.
+enum HTTP2_Error : uint32_t
+  {
+    http2_error_no_error             =  0,
+    http2_error_protocol_error       =  1,
+    http2_error_internal_error       =  2,
+    http2_error_flow_control_error   =  3,
+    http2_error_settings_timeout     =  4,
+    http2_error_stream_closed        =  5,
+    http2_error_frame_size_error     =  6,
+    http2_error_refused_stream       =  7,
+    http2_error_cancel               =  8,
+    http2_error_compression_error    =  9,
+    http2_error_connect_error        = 10,
+    http2_error_enhance_your_calm    = 11,
+    http2_error_inadequate_security  = 12,
+    http2_error_http_1_1_required    = 13,
+  };
+
 }  // namespace poseidon
 
 #endif
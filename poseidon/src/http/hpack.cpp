@@ -0,0 +1,589 @@
+// This file is part of Poseidon.
+// Copyleft 2020, LH_Mouse. All wrongs reserved.
+
+#include "../precompiled.hpp"
+#include "hpack.hpp"
+#include "../utils.hpp"
+
+namespace poseidon {
+namespace {
+
+struct Static_Field
+  {
+    const char* name;
+    const char* value;
+  };
+
+// This is the static table, as defined in
+//   https://tools.ietf.org/html/rfc7541#appendix-A
+// Indices of fields in the static table start from 1.
+constexpr Static_Field s_static_table[] =
+  {
+    { ":authority",                  ""               },
+    { ":method",                     "GET"            },
+    { ":method",                     "POST"           },
+    { ":path",                       "/"              },
+    { ":path",                       "/index.html"    },
+    { ":scheme",                     "http"           },
+    { ":scheme",                     "https"          },
+    { ":status",                     "200"            },
+    { ":status",                     "204"            },
+    { ":status",                     "206"            },
+    { ":status",                     "304"            },
+    { ":status",                     "400"            },
+    { ":status",                     "404"            },
+    { ":status",                     "500"            },
+    { "accept-charset",              ""               },
+    { "accept-encoding",             "gzip, deflate"  },
+    { "accept-language",             ""               },
+    { "accept-ranges",               ""               },
+    { "accept",                      ""               },
+    { "access-control-allow-origin", ""               },
+    { "age",                         ""               },
+    { "allow",                       ""               },
+    { "authorization",               ""               },
+    { "cache-control",               ""               },
+    { "content-disposition",         ""               },
+    { "content-encoding",            ""               },
+    { "content-language",            ""               },
+    { "content-length",              ""               },
+    { "content-location",            ""               },
+    { "content-range",               ""               },
+    { "content-type",                ""               },
+    { "cookie",                      ""               },
+    { "date",                        ""               },
+    { "etag",                        ""               },
+    { "expect",                      ""               },
+    { "expires",                     ""               },
+    { "from",                        ""               },
+    { "host",                        ""               },
+    { "if-match",                    ""               },
+    { "if-modified-since",           ""               },
+    { "if-none-match",               ""               },
+    { "if-range",                    ""               },
+    { "if-unmodified-since",         ""               },
+    { "last-modified",               ""               },
+    { "link",                        ""               },
+    { "location",                    ""               },
+    { "max-forwards",                ""               },
+    { "proxy-authenticate",          ""               },
+    { "proxy-authorization",         ""               },
+    { "range",                       ""               },
+    { "referer",                     ""               },
+    { "refresh",                     ""               },
+    { "retry-after",                 ""               },
+    { "server",                      ""               },
+    { "set-cookie",                  ""               },
+    { "strict-transport-security",   ""               },
+    { "transfer-encoding",           ""               },
+    { "user-agent",                  ""               },
+    { "vary",                        ""               },
+    { "via",                         ""               },
+    { "www-authenticate",            ""               },
+  };
+
+constexpr size_t s_static_size = size(s_static_table);
+
+// The encoder never uses more memory than the default.
+constexpr size_t s_max_encoder_table_size = 4096;
+
+struct Huffman_Code
+  {
+    uint32_t code;
+    uint8_t len;
+  };
+
+// This is the Huffman code, as defined in
+//   https://tools.ietf.org/html/rfc7541#appendix-B
+// The last code is `EOS`.
+constexpr Huffman_Code s_huffman_codes[257] =
+  {
+    { 0x00001FF8, 13 },  { 0x007FFFD8, 23 },  { 0x0FFFFFE2, 28 },  { 0x0FFFFFE3, 28 },
+    { 0x0FFFFFE4, 28 },  { 0x0FFFFFE5, 28 },  { 0x0FFFFFE6, 28 },  { 0x0FFFFFE7, 28 },
+    { 0x0FFFFFE8, 28 },  { 0x00FFFFEA, 24 },  { 0x3FFFFFFC, 30 },  { 0x0FFFFFE9, 28 },
+    { 0x0FFFFFEA, 28 },  { 0x3FFFFFFD, 30 },  { 0x0FFFFFEB, 28 },  { 0x0FFFFFEC, 28 },
+    { 0x0FFFFFED, 28 },  { 0x0FFFFFEE, 28 },  { 0x0FFFFFEF, 28 },  { 0x0FFFFFF0, 28 },
+    { 0x0FFFFFF1, 28 },  { 0x0FFFFFF2, 28 },  { 0x3FFFFFFE, 30 },  { 0x0FFFFFF3, 28 },
+    { 0x0FFFFFF4, 28 },  { 0x0FFFFFF5, 28 },  { 0x0FFFFFF6, 28 },  { 0x0FFFFFF7, 28 },
+    { 0x0FFFFFF8, 28 },  { 0x0FFFFFF9, 28 },  { 0x0FFFFFFA, 28 },  { 0x0FFFFFFB, 28 },
+    { 0x00000014,  6 },  { 0x000003F8, 10 },  { 0x000003F9, 10 },  { 0x00000FFA, 12 },
+    { 0x00001FF9, 13 },  { 0x00000015,  6 },  { 0x000000F8,  8 },  { 0x000007FA, 11 },
+    { 0x000003FA, 10 },  { 0x000003FB, 10 },  { 0x000000F9,  8 },  { 0x000007FB, 11 },
+    { 0x000000FA,  8 },  { 0x00000016,  6 },  { 0x00000017,  6 },  { 0x00000018,  6 },
+    { 0x00000000,  5 },  { 0x00000001,  5 },  { 0x00000002,  5 },  { 0x00000019,  6 },
+    { 0x0000001A,  6 },  { 0x0000001B,  6 },  { 0x0000001C,  6 },  { 0x0000001D,  6 },
+    { 0x0000001E,  6 },  { 0x0000001F,  6 },  { 0x0000005C,  7 },  { 0x000000FB,  8 },
+    { 0x00007FFC, 15 },  { 0x00000020,  6 },  { 0x00000FFB, 12 },  { 0x000003FC, 10 },
+    { 0x00001FFA, 13 },  { 0x00000021,  6 },  { 0x0000005D,  7 },  { 0x0000005E,  7 },
+    { 0x0000005F,  7 },  { 0x00000060,  7 },  { 0x00000061,  7 },  { 0x00000062,  7 },
+    { 0x00000063,  7 },  { 0x00000064,  7 },  { 0x00000065,  7 },  { 0x00000066,  7 },
+    { 0x00000067,  7 },  { 0x00000068,  7 },  { 0x00000069,  7 },  { 0x0000006A,  7 },
+    { 0x0000006B,  7 },  { 0x0000006C,  7 },  { 0x0000006D,  7 },  { 0x0000006E,  7 },
+    { 0x0000006F,  7 },  { 0x00000070,  7 },  { 0x00000071,  7 },  { 0x00000072,  7 },
+    { 0x000000FC,  8 },  { 0x00000073,  7 },  { 0x000000FD,  8 },  { 0x00001FFB, 13 },
+    { 0x0007FFF0, 19 },  { 0x00001FFC, 13 },  { 0x00003FFC, 14 },  { 0x00000022,  6 },
+    { 0x00007FFD, 15 },  { 0x00000003,  5 },  { 0x00000023,  6 },  { 0x00000004,  5 },
+    { 0x00000024,  6 },  { 0x00000005,  5 },  { 0x00000025,  6 },  { 0x00000026,  6 },
+    { 0x00000027,  6 },  { 0x00000006,  5 },  { 0x00000074,  7 },  { 0x00000075,  7 },
+    { 0x00000028,  6 },  { 0x00000029,  6 },  { 0x0000002A,  6 },  { 0x00000007,  5 },
+    { 0x0000002B,  6 },  { 0x00000076,  7 },  { 0x0000002C,  6 },  { 0x00000008,  5 },
+    { 0x00000009,  5 },  { 0x0000002D,  6 },  { 0x00000077,  7 },  { 0x00000078,  7 },
+    { 0x00000079,  7 },  { 0x0000007A,  7 },  { 0x0000007B,  7 },  { 0x00007FFE, 15 },
+    { 0x000007FC, 11 },  { 0x00003FFD, 14 },  { 0x00001FFD, 13 },  { 0x0FFFFFFC, 28 },
+    { 0x000FFFE6, 20 },  { 0x003FFFD2, 22 },  { 0x000FFFE7, 20 },  { 0x000FFFE8, 20 },
+    { 0x003FFFD3, 22 },  { 0x003FFFD4, 22 },  { 0x003FFFD5, 22 },  { 0x007FFFD9, 23 },
+    { 0x003FFFD6, 22 },  { 0x007FFFDA, 23 },  { 0x007FFFDB, 23 },  { 0x007FFFDC, 23 },
+    { 0x007FFFDD, 23 },  { 0x007FFFDE, 23 },  { 0x00FFFFEB, 24 },  { 0x007FFFDF, 23 },
+    { 0x00FFFFEC, 24 },  { 0x00FFFFED, 24 },  { 0x003FFFD7, 22 },  { 0x007FFFE0, 23 },
+    { 0x00FFFFEE, 24 },  { 0x007FFFE1, 23 },  { 0x007FFFE2, 23 },  { 0x007FFFE3, 23 },
+    { 0x007FFFE4, 23 },  { 0x001FFFDC, 21 },  { 0x003FFFD8, 22 },  { 0x007FFFE5, 23 },
+    { 0x003FFFD9, 22 },  { 0x007FFFE6, 23 },  { 0x007FFFE7, 23 },  { 0x00FFFFEF, 24 },
+    { 0x003FFFDA, 22 },  { 0x001FFFDD, 21 },  { 0x000FFFE9, 20 },  { 0x003FFFDB, 22 },
+    { 0x003FFFDC, 22 },  { 0x007FFFE8, 23 },  { 0x007FFFE9, 23 },  { 0x001FFFDE, 21 },
+    { 0x007FFFEA, 23 },  { 0x003FFFDD, 22 },  { 0x003FFFDE, 22 },  { 0x00FFFFF0, 24 },
+    { 0x001FFFDF, 21 },  { 0x003FFFDF, 22 },  { 0x007FFFEB, 23 },  { 0x007FFFEC, 23 },
+    { 0x001FFFE0, 21 },  { 0x001FFFE1, 21 },  { 0x003FFFE0, 22 },  { 0x001FFFE2, 21 },
+    { 0x007FFFED, 23 },  { 0x003FFFE1, 22 },  { 0x007FFFEE, 23 },  { 0x007FFFEF, 23 },
+    { 0x000FFFEA, 20 },  { 0x003FFFE2, 22 },  { 0x003FFFE3, 22 },  { 0x003FFFE4, 22 },
+    { 0x007FFFF0, 23 },  { 0x003FFFE5, 22 },  { 0x003FFFE6, 22 },  { 0x007FFFF1, 23 },
+    { 0x03FFFFE0, 26 },  { 0x03FFFFE1, 26 },  { 0x000FFFEB, 20 },  { 0x0007FFF1, 19 },
+    { 0x003FFFE7, 22 },  { 0x007FFFF2, 23 },  { 0x003FFFE8, 22 },  { 0x01FFFFEC, 25 },
+    { 0x03FFFFE2, 26 },  { 0x03FFFFE3, 26 },  { 0x03FFFFE4, 26 },  { 0x07FFFFDE, 27 },
+    { 0x07FFFFDF, 27 },  { 0x03FFFFE5, 26 },  { 0x00FFFFF1, 24 },  { 0x01FFFFED, 25 },
+    { 0x0007FFF2, 19 },  { 0x001FFFE3, 21 },  { 0x03FFFFE6, 26 },  { 0x07FFFFE0, 27 },
+    { 0x07FFFFE1, 27 },  { 0x03FFFFE7, 26 },  { 0x07FFFFE2, 27 },  { 0x00FFFFF2, 24 },
+    { 0x001FFFE4, 21 },  { 0x001FFFE5, 21 },  { 0x03FFFFE8, 26 },  { 0x03FFFFE9, 26 },
+    { 0x0FFFFFFD, 28 },  { 0x07FFFFE3, 27 },  { 0x07FFFFE4, 27 },  { 0x07FFFFE5, 27 },
+    { 0x000FFFEC, 20 },  { 0x00FFFFF3, 24 },  { 0x000FFFED, 20 },  { 0x001FFFE6, 21 },
+    { 0x003FFFE9, 22 },  { 0x001FFFE7, 21 },  { 0x001FFFE8, 21 },  { 0x007FFFF3, 23 },
+    { 0x003FFFEA, 22 },  { 0x003FFFEB, 22 },  { 0x01FFFFEE, 25 },  { 0x01FFFFEF, 25 },
+    { 0x00FFFFF4, 24 },  { 0x00FFFFF5, 24 },  { 0x03FFFFEA, 26 },  { 0x007FFFF4, 23 },
+    { 0x03FFFFEB, 26 },  { 0x07FFFFE6, 27 },  { 0x03FFFFEC, 26 },  { 0x03FFFFED, 26 },
+    { 0x07FFFFE7, 27 },  { 0x07FFFFE8, 27 },  { 0x07FFFFE9, 27 },  { 0x07FFFFEA, 27 },
+    { 0x07FFFFEB, 27 },  { 0x0FFFFFFE, 28 },  { 0x07FFFFEC, 27 },  { 0x07FFFFED, 27 },
+    { 0x07FFFFEE, 27 },  { 0x07FFFFEF, 27 },  { 0x07FFFFF0, 27 },  { 0x03FFFFEE, 26 },
+    { 0x3FFFFFFF, 30 },
+  };
+
+// The Huffman code is canonical, so it can be decoded with the number of codes
+// of each length, and all symbols sorted by their codes. For symbols whose
+// codes have the same length, the order of codes is the order of symbols.
+struct Huffman_Decode_Table
+  {
+    uint32_t first[31];  // the first code of each length
+    uint16_t count[31];  // number of codes of each length
+    uint16_t offset[31];  // index of the first symbol of each length
+    uint16_t symbols[257];
+
+    Huffman_Decode_Table()
+      noexcept
+      {
+        ::std::memset(this->count, 0, sizeof(this->count));
+        for(const auto& r : s_huffman_codes)
+          this->count[r.len] ++;
+
+        uint32_t code = 0;
+        uint16_t index = 0;
+        for(uint8_t len = 1;  len != 31;  ++len) {
+          this->first[len] = code;
+          this->offset[len] = index;
+
+          for(uint16_t sym = 0;  sym != 257;  ++sym)
+            if(s_huffman_codes[sym].len == len)
+              this->symbols[index++] = sym;
+
+          code = (code + this->count[len]) << 1;
+        }
+      }
+  };
+
+const Huffman_Decode_Table s_huffman_decode;
+
+void
+do_huffman_decode(cow_string& str, const char* data, size_t size)
+  {
+    uint32_t code = 0;
+    uint8_t len = 0;
+
+    for(size_t k = 0;  k != size;  ++k) {
+      uint32_t byte = static_cast<uint8_t>(data[k]);
+      for(uint32_t bit = 0x80;  bit != 0;  bit >>= 1) {
+        code = code << 1 | ((byte & bit) != 0);
+        len ++;
+
+        // Symbols are decoded bit by bit. Note that `index` wraps around if
+        // `code` is less than the first code of this length.
+        uint32_t index = code - s_huffman_decode.first[len];
+        if(index < s_huffman_decode.count[len]) {
+          uint16_t sym = s_huffman_decode.symbols[s_huffman_decode.offset[len] + index];
+          if(sym == 256)
+            POSEIDON_THROW("HPACK Huffman-coded string contains `EOS`");
+
+          str.push_back(static_cast<char>(sym));
+          code = 0;
+          len = 0;
+        }
+        else if(len == 30)
+          POSEIDON_THROW("Invalid HPACK Huffman code");
+      }
+    }
+
+    // The string shall be padded with the most significant bits of `EOS`,
+    // which are all ones, to an octet boundary.
+    if((len > 7) || (code != (1U << len) - 1))
+      POSEIDON_THROW("Invalid padding of HPACK Huffman-coded string");
+  }
+
+size_t
+do_huffman_length(const char* data, size_t size)
+  noexcept
+  {
+    size_t nbits = 0;
+    for(size_t k = 0;  k != size;  ++k)
+      nbits += s_huffman_codes[static_cast<uint8_t>(data[k])].len;
+    return (nbits + 7) / 8;
+  }
+
+void
+do_huffman_encode(linear_buffer& out, const char* data, size_t size)
+  {
+    // Bits are accumulated in `acc`, whose lowest `nbits` bits are pending.
+    // Higher bits may overflow, which is harmless.
+    uint64_t acc = 0;
+    uint32_t nbits = 0;
+
+    for(size_t k = 0;  k != size;  ++k) {
+      const auto& r = s_huffman_codes[static_cast<uint8_t>(data[k])];
+      acc = acc << r.len | r.code;
+      nbits += r.len;
+
+      while(nbits >= 8) {
+        nbits -= 8;
+        out.putc(static_cast<char>(acc >> nbits));
+      }
+    }
+
+    // Pad the last octet with ones.
+    if(nbits != 0)
+      out.putc(static_cast<char>(acc << (8 - nbits) | 0xFFU >> nbits));
+  }
+
+void
+do_decode_integer(size_t& value, const char*& sp, const char* ep, uint32_t nbits)
+  {
+    if(sp == ep)
+      POSEIDON_THROW("HPACK integer truncated");
+
+    uint32_t mask = (1U << nbits) - 1;
+    value = static_cast<uint8_t>(*(sp++)) & mask;
+    if(value != mask)
+      return;
+
+    // Get continuation octets. Values that are too large are rejected, which
+    // also protects against overflows.
+    uint32_t shift = 0;
+    uint32_t byte;
+    do {
+      if(sp == ep)
+        POSEIDON_THROW("HPACK integer truncated");
+
+      if(shift > 21)
+        POSEIDON_THROW("HPACK integer too large");
+
+      byte = static_cast<uint8_t>(*(sp++));
+      value += static_cast<size_t>(byte & 0x7F) << shift;
+      shift += 7;
+    }
+    while(byte & 0x80);
+  }
+
+void
+do_encode_integer(linear_buffer& out, uint32_t flags, uint32_t nbits, size_t value)
+  {
+    uint32_t mask = (1U << nbits) - 1;
+    if(value < mask) {
+      out.putc(static_cast<char>(flags | value));
+      return;
+    }
+
+    out.putc(static_cast<char>(flags | mask));
+    value -= mask;
+    while(value >= 0x80) {
+      out.putc(static_cast<char>(value | 0x80));
+      value >>= 7;
+    }
+    out.putc(static_cast<char>(value));
+  }
+
+void
+do_decode_string(cow_string& str, const char*& sp, const char* ep)
+  {
+    if(sp == ep)
+      POSEIDON_THROW("HPACK string truncated");
+
+    bool huffman = *sp & 0x80;
+    size_t len;
+    do_decode_integer(len, sp, ep, 7);
+    if(len > static_cast<size_t>(ep - sp))
+      POSEIDON_THROW("HPACK string truncated");
+
+    str.clear();
+    if(huffman)
+      do_huffman_decode(str, sp, len);
+    else
+      str.assign(sp, len);
+    sp += len;
+  }
+
+void
+do_encode_string(linear_buffer& out, const cow_string& str)
+  {
+    // Use Huffman coding only if it makes the string shorter.
+    size_t hlen = do_huffman_length(str.data(), str.size());
+    if(hlen < str.size()) {
+      do_encode_integer(out, 0x80, 7, hlen);
+      do_huffman_encode(out, str.data(), str.size());
+    }
+    else {
+      do_encode_integer(out, 0x00, 7, str.size());
+      out.putn(str.data(), str.size());
+    }
+  }
+
+inline
+size_t
+do_entry_size(const HPACK_Field& field)
+  noexcept
+  {
+    // See RFC 7541 section 4.1.
+    return field.first.size() + field.second.size() + 32;
+  }
+
+void
+do_evict(::std::deque<HPACK_Field>& table, size_t& tsize, size_t cap)
+  noexcept
+  {
+    while(tsize > cap) {
+      tsize -= do_entry_size(table.back());
+      table.pop_back();
+    }
+  }
+
+void
+do_insert_entry(::std::deque<HPACK_Field>& table, size_t& tsize, size_t cap,
+                const cow_string& name, const cow_string& value)
+  {
+    // An entry that is larger than the table empties the table, and is not
+    // inserted. See RFC 7541 section 4.4.
+    size_t esize = name.size() + value.size() + 32;
+    if(esize > cap) {
+      table.clear();
+      tsize = 0;
+      return;
+    }
+
+    do_evict(table, tsize, cap - esize);
+    table.emplace_front(name, value);
+    tsize += esize;
+  }
+
+void
+do_get_indexed(HPACK_Field& field, bool with_value, const ::std::deque<HPACK_Field>& table,
+               size_t index)
+  {
+    if(index == 0)
+      POSEIDON_THROW("HPACK index must not be zero");
+
+    if(index <= s_static_size) {
+      const auto& r = s_static_table[index - 1];
+      field.first = sref(r.name);
+      if(with_value)
+        field.second = sref(r.value);
+      return;
+    }
+
+    size_t k = index - s_static_size - 1;
+    if(k >= table.size())
+      POSEIDON_THROW("HPACK index out of range: $1", index);
+
+    field.first = table[k].first;
+    if(with_value)
+      field.second = table[k].second;
+  }
+
+}  // namespace
+
+HPACK_Decoder::
+~HPACK_Decoder()
+  {
+  }
+
+HPACK_Decoder&
+HPACK_Decoder::
+set_max_table_size(size_t limit)
+  {
+    this->m_table_limit = limit;
+
+    // If the limit is reduced, the encoder will send an update, which can't be
+    // larger than the limit. Entries are evicted now anyway.
+    if(this->m_table_cap > limit) {
+      this->m_table_cap = limit;
+      do_evict(this->m_table, this->m_table_size, limit);
+    }
+    return *this;
+  }
+
+bool
+HPACK_Decoder::
+decode(::std::vector<HPACK_Field>& fields, const char* data, size_t size)
+  {
+    const char* sp = data;
+    const char* ep = data + size;
+    bool updatable = true;
+
+    // As indexed fields can be expanded into much longer strings, the size of
+    // the decoded list is limited, instead of the size of the block.
+    size_t list_size = 0;
+    bool complete = true;
+    HPACK_Field field;
+
+    while(sp != ep) {
+      uint32_t byte = static_cast<uint8_t>(*sp);
+      size_t index;
+
+      if((byte & 0xE0) == 0x20) {
+        // Dynamic table size update. See RFC 7541 section 6.3.
+        if(!updatable)
+          POSEIDON_THROW("HPACK dynamic table size update after header fields");
+
+        do_decode_integer(index, sp, ep, 5);
+        if(index > this->m_table_limit)
+          POSEIDON_THROW("HPACK dynamic table size too large: $1 > $2",
+                         index, this->m_table_limit);
+
+        this->m_table_cap = index;
+        do_evict(this->m_table, this->m_table_size, index);
+        continue;
+      }
+
+      updatable = false;
+      field.first.clear();
+      field.second.clear();
+
+      if(byte & 0x80) {
+        // Indexed header field. See RFC 7541 section 6.1.
+        do_decode_integer(index, sp, ep, 7);
+        do_get_indexed(field, true, this->m_table, index);
+      }
+      else {
+        // Literal header field. See RFC 7541 section 6.2.
+        bool indexing = (byte & 0xC0) == 0x40;
+        do_decode_integer(index, sp, ep, indexing ? 6 : 4);
+        if(index != 0)
+          do_get_indexed(field, false, this->m_table, index);
+        else
+          do_decode_string(field.first, sp, ep);
+        do_decode_string(field.second, sp, ep);
+
+        if(indexing)
+          do_insert_entry(this->m_table, this->m_table_size, this->m_table_cap,
+                          field.first, field.second);
+      }
+
+      // Each field takes 32 bytes of overhead. See RFC 7541 section 4.1.
+      list_size += field.first.size() + field.second.size() + 32;
+      complete &= list_size <= this->m_list_limit;
+      if(complete)
+        fields.emplace_back(::std::move(field));
+    }
+    return complete;
+  }
+
+HPACK_Encoder::
+~HPACK_Encoder()
+  {
+  }
+
+HPACK_Encoder&
+HPACK_Encoder::
+set_max_table_size(size_t limit)
+  {
+    size_t cap = ::rocket::min(limit, s_max_encoder_table_size);
+    this->m_update_min = ::rocket::min(this->m_update_min, cap);
+    this->m_update_pending = true;
+
+    this->m_table_cap = cap;
+    do_evict(this->m_table, this->m_table_size, cap);
+    return *this;
+  }
+
+void
+HPACK_Encoder::
+begin_block(linear_buffer& out)
+  {
+    if(!this->m_update_pending)
+      return;
+
+    // If the size has been reduced and then increased, the smallest size must
+    // be signaled first. See RFC 7541 section 4.2.
+    if(this->m_update_min < this->m_table_cap)
+      do_encode_integer(out, 0x20, 5, this->m_update_min);
+    do_encode_integer(out, 0x20, 5, this->m_table_cap);
+
+    this->m_update_min = SIZE_MAX;
+    this->m_update_pending = false;
+  }
+
+void
+HPACK_Encoder::
+encode_field(linear_buffer& out, const cow_string& name, const cow_string& value,
+             bool sensitive)
+  {
+    auto lname = ascii_lowercase(name);
+
+    // Search for a field with the same name and value, or at least the same
+    // name, in the static table, then in the dynamic table.
+    size_t full = 0;
+    size_t partial = 0;
+
+    for(size_t k = 0;  (k != s_static_size) && !full;  ++k)
+      if(lname == s_static_table[k].name) {
+        if(partial == 0)
+          partial = k + 1;
+        if(value == s_static_table[k].value)
+          full = k + 1;
+      }
+
+    for(size_t k = 0;  (k != this->m_table.size()) && !full;  ++k)
+      if(lname == this->m_table[k].first) {
+        if(partial == 0)
+          partial = k + s_static_size + 1;
+        if(value == this->m_table[k].second)
+          full = k + s_static_size + 1;
+      }
+
+    if(full && !sensitive) {
+      // Indexed header field.
+      do_encode_integer(out, 0x80, 7, full);
+      return;
+    }
+
+    // Sensitive fields are never indexed. Large fields are not indexed, so they
+    // don't evict too many others.
+    bool indexing = !sensitive
+                    && (lname.size() + value.size() + 32 <= this->m_table_cap / 2);
+    if(indexing)
+      do_encode_integer(out, 0x40, 6, partial);
+    else
+      do_encode_integer(out, sensitive ? 0x10 : 0x00, 4, partial);
+
+    if(partial == 0)
+      do_encode_string(out, lname);
+    do_encode_string(out, value);
+
+    if(indexing)
+      do_insert_entry(this->m_table, this->m_table_size, this->m_table_cap,
+                      lname, value);
+  }
+
+}  // namespace poseidon
@@ -0,0 +1,125 @@
+// This file is part of Poseidon.
+// Copyleft 2020, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_HTTP_HPACK_HPP_
+#define POSEIDON_HTTP_HPACK_HPP_
+
+#include "../fwd.hpp"
+
+namespace poseidon {
+
+// This is a decoded header field, as a pair of a name and a value.
+using HPACK_Field = pair<cow_string, cow_string>;
+
+// This class decodes header blocks of HTTP/2, according to RFC 7541.
+// A decoder maintains a dynamic table, so all header blocks of a connection
+// shall be decoded with the same decoder, in the order in which they arrive.
+class HPACK_Decoder
+  {
+  private:
+    ::std::deque<HPACK_Field> m_table;  // newest first
+    size_t m_table_size = 0;  // sum of entry sizes
+    size_t m_table_cap = 4096;  // set by the encoder
+    size_t m_table_limit = 4096;  // `SETTINGS_HEADER_TABLE_SIZE`
+    size_t m_list_limit = SIZE_MAX;  // `SETTINGS_MAX_HEADER_LIST_SIZE`
+
+  public:
+    explicit
+    HPACK_Decoder()
+      noexcept
+      { }
+
+  public:
+    ASTERIA_NONCOPYABLE_DESTRUCTOR(HPACK_Decoder);
+
+    // Gets the maximum size of the dynamic table that the encoder may use.
+    size_t
+    max_table_size()
+      const noexcept
+      { return this->m_table_limit;  }
+
+    // Sets the maximum size of the dynamic table that the encoder may use. The
+    // new value shall have been sent to the encoder as `SETTINGS_HEADER_TABLE_SIZE`
+    // and acknowledged.
+    HPACK_Decoder&
+    set_max_table_size(size_t limit);
+
+    // Gets the maximum size of a decoded header list.
+    size_t
+    max_header_list_size()
+      const noexcept
+      { return this->m_list_limit;  }
+
+    // Sets the maximum size of a decoded header list, which is the sum of the
+    // sizes of all fields, as defined in RFC 7541 section 4.1. This shall be
+    // sent to the encoder as `SETTINGS_MAX_HEADER_LIST_SIZE`.
+    HPACK_Decoder&
+    set_max_header_list_size(size_t limit)
+      noexcept
+      {
+        this->m_list_limit = limit;
+        return *this;
+      }
+
+    // Decodes a complete header block, and appends fields to `fields`, in the
+    // order in which they appear. Names of pseudo-header fields start with a
+    // colon.
+    // If the decoded header list would exceed the maximum size, the rest of the
+    // block is still decoded to keep the dynamic table in sync, but no more
+    // fields are appended, and `false` is returned.
+    // An exception is thrown if the block is invalid, after which the decoder
+    // is in an unspecified state, and the connection shall be closed with a
+    // `COMPRESSION_ERROR`.
+    bool
+    decode(::std::vector<HPACK_Field>& fields, const char* data, size_t size);
+  };
+
+// This class encodes header blocks of HTTP/2, according to RFC 7541.
+// An encoder maintains a dynamic table, so all header blocks of a connection
+// shall be encoded with the same encoder, in the order in which they are sent.
+class HPACK_Encoder
+  {
+  private:
+    ::std::deque<HPACK_Field> m_table;  // newest first
+    size_t m_table_size = 0;  // sum of entry sizes
+    size_t m_table_cap = 4096;
+    size_t m_update_min = SIZE_MAX;  // minimum size since the last block
+    bool m_update_pending = false;
+
+  public:
+    explicit
+    HPACK_Encoder()
+      noexcept
+      { }
+
+  public:
+    ASTERIA_NONCOPYABLE_DESTRUCTOR(HPACK_Encoder);
+
+    // Gets the size of the dynamic table.
+    size_t
+    max_table_size()
+      const noexcept
+      { return this->m_table_cap;  }
+
+    // Sets the size of the dynamic table. This shall be called when the decoder
+    // sends `SETTINGS_HEADER_TABLE_SIZE`. The table never exceeds 4096 bytes,
+    // which is the default, regardless of how large the limit is.
+    // The change is signaled in the next header block.
+    HPACK_Encoder&
+    set_max_table_size(size_t limit);
+
+    // Starts a header block. Pending updates of the table size are written.
+    void
+    begin_block(linear_buffer& out);
+
+    // Puts a header field. Names are converted to lowercase. Fields are added to
+    // the dynamic table, unless `sensitive` is set or they are too large. String
+    // literals are Huffman-coded if that makes them shorter.
+    void
+    encode_field(linear_buffer& out, const cow_string& name, const cow_string& value,
+                 bool sensitive = false);
+  };
+
+}  // namespace poseidon
+
+#endif
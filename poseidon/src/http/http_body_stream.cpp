@@ -0,0 +1,163 @@
+// This file is part of Poseidon.
+// Copyleft 2020, LH_Mouse. All wrongs reserved.
+
+#include "../precompiled.hpp"
+#include "http_body_stream.hpp"
+#include "../socket/abstract_socket.hpp"
+#include "../utils.hpp"
+
+namespace poseidon {
+
+HTTP_Body_Stream::
+HTTP_Body_Stream(const rcptr<Abstract_Socket>& sock, size_t window_size)
+  : m_sock(sock), m_window(::rocket::max(window_size, size_t(1)))
+  {
+  }
+
+HTTP_Body_Stream::
+~HTTP_Body_Stream()
+  {
+    // Don't leave the socket paused if the reader has gone away.
+    if(this->m_paused)
+      this->m_sock->set_read_paused(false);
+  }
+
+bool
+HTTP_Body_Stream::
+do_take_chunk(cow_string& chunk, size_t max)
+  {
+    // This function shall be called with the mutex locked.
+    size_t nread = ::rocket::min(this->m_queue.size(), max);
+    chunk.assign(this->m_queue.data(), nread);
+    this->m_queue.discard(nread);
+
+    // Resume the socket if the window is no longer full. The caller shall call
+    // `set_read_paused(false)` after unlocking the mutex.
+    if(!this->m_paused || (this->m_queue.size() >= this->m_window))
+      return false;
+
+    this->m_paused = false;
+    return true;
+  }
+
+void
+HTTP_Body_Stream::
+do_complete_read(simple_mutex::unique_lock& lock)
+  {
+    if(!this->m_reading)
+      return;
+
+    if((this->m_queue.size() == 0) && !this->m_finished && !this->m_except)
+      return;
+
+    // Take the pending promise, so it can be satisfied without the mutex.
+    auto rprom = ::std::move(this->m_read_prom);
+    this->m_reading = false;
+
+    if((this->m_queue.size() == 0) && this->m_except) {
+      auto eptr = this->m_except;
+      lock.unlock();
+      rprom.set_exception(eptr);
+      return;
+    }
+
+    cow_string chunk;
+    bool resume = this->do_take_chunk(chunk, this->m_read_max);
+    lock.unlock();
+
+    if(resume)
+      this->m_sock->set_read_paused(false);
+
+    rprom.set_value(::std::move(chunk));
+  }
+
+size_t
+HTTP_Body_Stream::
+buffered_size()
+  const
+  {
+    simple_mutex::unique_lock lock(this->m_mutex);
+    return this->m_queue.size();
+  }
+
+bool
+HTTP_Body_Stream::
+finished()
+  const
+  {
+    simple_mutex::unique_lock lock(this->m_mutex);
+    return this->m_finished;
+  }
+
+void
+HTTP_Body_Stream::
+push(const char* data, size_t size)
+  {
+    simple_mutex::unique_lock lock(this->m_mutex);
+    if(this->m_finished || this->m_except)
+      POSEIDON_THROW("HTTP body stream finished or aborted");
+
+    if(size == 0)
+      return;
+
+    this->m_queue.putn(data, size);
+
+    // Stop reading from the socket if the window is full.
+    if(this->m_sock && !this->m_paused && (this->m_queue.size() >= this->m_window)) {
+      this->m_sock->set_read_paused(true);
+      this->m_paused = true;
+    }
+
+    this->do_complete_read(lock);
+  }
+
+void
+HTTP_Body_Stream::
+finish()
+  {
+    simple_mutex::unique_lock lock(this->m_mutex);
+    if(this->m_except)
+      POSEIDON_THROW("HTTP body stream aborted");
+
+    this->m_finished = true;
+    this->do_complete_read(lock);
+  }
+
+void
+HTTP_Body_Stream::
+abort(const ::std::exception_ptr& eptr)
+  {
+    if(!eptr)
+      POSEIDON_THROW("Null exception pointer not valid");
+
+    simple_mutex::unique_lock lock(this->m_mutex);
+    if(this->m_finished || this->m_except)
+      return;
+
+    // Data that have been pushed are discarded.
+    this->m_except = eptr;
+    this->m_queue.clear();
+    this->do_complete_read(lock);
+  }
+
+futp<cow_string>
+HTTP_Body_Stream::
+read(size_t max)
+  {
+    if(max == 0)
+      POSEIDON_THROW("Zero read size not valid");
+
+    simple_mutex::unique_lock lock(this->m_mutex);
+    if(this->m_reading)
+      POSEIDON_THROW("Another read operation pending on HTTP body stream");
+
+    // If data are available, the future is satisfied before it is returned.
+    this->m_read_prom = prom<cow_string>();
+    auto futr = this->m_read_prom.future();
+    this->m_reading = true;
+    this->m_read_max = max;
+    this->do_complete_read(lock);
+    return futr;
+  }
+
+}  // namespace poseidon
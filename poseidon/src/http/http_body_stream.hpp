@@ -0,0 +1,91 @@
+// This file is part of Poseidon.
+// Copyleft 2020, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_HTTP_HTTP_BODY_STREAM_HPP_
+#define POSEIDON_HTTP_HTTP_BODY_STREAM_HPP_
+
+#include "../fwd.hpp"
+#include "../core/promise.hpp"
+
+namespace poseidon {
+
+// This class delivers a request body from the network thread to a fiber, chunk
+// by chunk, so the body is never buffered in full.
+// The network thread pushes data that it decodes. A fiber reads them with
+// `read()`, which returns a future. When `window_size` bytes are buffered, the
+// socket stops reading until the fiber consumes some data, so memory usage is
+// bounded by the window plus the I/O buffer of the network driver, regardless
+// of the length of the body.
+// All functions are thread-safe.
+class HTTP_Body_Stream
+  : public ::asteria::Rcfwd<HTTP_Body_Stream>
+  {
+  private:
+    rcptr<Abstract_Socket> m_sock;  // may be null
+    size_t m_window;
+
+    mutable simple_mutex m_mutex;
+    linear_buffer m_queue;
+    bool m_paused = false;  // the socket has been paused by us
+    bool m_finished = false;
+    ::std::exception_ptr m_except;  // set if aborted
+
+    bool m_reading = false;  // a read is pending
+    size_t m_read_max = 0;
+    prom<cow_string> m_read_prom;
+
+  public:
+    // Creates a stream whose data are received from `sock`. If `sock` is null,
+    // nothing is paused, and the producer shall apply flow control itself.
+    explicit
+    HTTP_Body_Stream(const rcptr<Abstract_Socket>& sock, size_t window_size = 65536);
+
+  private:
+    bool
+    do_take_chunk(cow_string& chunk, size_t max);
+
+    void
+    do_complete_read(simple_mutex::unique_lock& lock);
+
+  public:
+    ASTERIA_NONCOPYABLE_DESTRUCTOR(HTTP_Body_Stream);
+
+    // Gets the number of bytes that have been pushed but not read.
+    size_t
+    buffered_size()
+      const;
+
+    // Checks whether all data have been pushed.
+    bool
+    finished()
+      const;
+
+    // Pushes a chunk of the body. The socket is paused if the window is full.
+    // This function shall be called by the producer, usually in the network
+    // thread. An exception is thrown if the stream has been finished or aborted.
+    void
+    push(const char* data, size_t size);
+
+    // Marks the end of the body. After all data have been read, further reads
+    // return empty strings.
+    void
+    finish();
+
+    // Aborts the stream, for example, because the connection has been lost
+    // before the end of the body. The exception is rethrown by further reads.
+    // If the stream has been finished, there is no effect.
+    void
+    abort(const ::std::exception_ptr& eptr);
+
+    // Reads at most `max` bytes. The returned future becomes ready when some
+    // data are available, or an empty string at the end of the body. A fiber
+    // may wait for it with `Fiber_Scheduler::yield()`. The socket is resumed
+    // if the window is no longer full.
+    // An exception is thrown if there is another pending read.
+    futp<cow_string>
+    read(size_t max = SIZE_MAX);
+  };
+
+}  // namespace poseidon
+
+#endif
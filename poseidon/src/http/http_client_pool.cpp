@@ -0,0 +1,1002 @@
+// This file is part of Poseidon.
+// Copyleft 2020, LH_Mouse. All wrongs reserved.
+
+#include "../precompiled.hpp"
+#include "http_client_pool.hpp"
+#include "abstract_http_client_encoder.hpp"
+#include "url.hpp"
+#include "../core/promise.hpp"
+#include "../socket/abstract_tcp_client_socket.hpp"
+#include "../socket/abstract_tls_client_socket.hpp"
+#include "../socket/openssl_context.hpp"
+#include "../static/network_driver.hpp"
+#include "../utils.hpp"
+#include <netdb.h>
+#include <arpa/inet.h>
+
+namespace poseidon {
+namespace details_http_client_pool {
+
+class Session;
+
+struct Pending_Request
+  {
+    HTTP_Method meth;
+    cow_string target;
+    Option_Map headers;
+    cow_string entity;
+    bool retried = false;  // retried after a connection was lost
+    prom<HTTP_Client_Response> promise;
+  };
+
+struct Origin
+  : public ::asteria::Rcfwd<Origin>
+  {
+    cow_string host;  // decoded, without brackets
+    cow_string host_header;
+    uint16_t port = 0;
+    bool numeric = false;  // `host` is an IP address
+    const OpenSSL_Context* ctx = nullptr;  // null for `http`
+    size_t max_conns = 0;
+    size_t depth = 0;
+    size_t max_entity = 0;
+
+    simple_mutex mutex;
+    ::std::deque<Pending_Request> queue;  // requests not sent
+    ::std::vector<pair<rcptr<Abstract_Socket>, Session*>> sessions;
+    bool closed = false;  // the pool has been destroyed
+
+    // These are also protected by the mutex. Addresses are kept after they
+    // expire, until the host name has been resolved again.
+    ::std::vector<Socket_Address> addrs;
+    size_t next_addr = 0;  // index of the address for new connections
+    size_t connect_failures = 0;  // consecutive failures to connect
+    int64_t resolve_expiry = 0;  // time to resolve the host name again
+    bool resolving = false;
+    size_t prewarm = 0;  // connections to open once addresses are available
+  };
+
+namespace {
+
+constexpr size_t s_max_header_size = 65536;
+constexpr int64_t s_resolve_ttl = 60000;  // milliseconds
+
+int64_t
+do_get_monotonic_milliseconds()
+  noexcept
+  {
+    ::timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+  }
+
+inline
+bool
+do_is_idempotent(HTTP_Method meth)
+  noexcept
+  {
+    // Refer to RFC 7231 section 4.2.2.
+    return ::rocket::is_any_of(meth, { http_method_get, http_method_head, http_method_put,
+                                       http_method_delete, http_method_options,
+                                       http_method_trace });
+  }
+
+const char*
+do_find_crlf(const char* bp, const char* ep)
+  noexcept
+  {
+    static constexpr char crlf[] = "\r\n";
+    return ::std::search(bp, ep, crlf, crlf + 2);
+  }
+
+void
+do_dispatch(const rcptr<Origin>& origin);
+
+}  // namespace
+
+// This is the HTTP part of a pooled connection. All functions are called with
+// the origin mutex locked, except the socket callbacks, which lock it.
+class Session
+  : public Abstract_HTTP_Client_Encoder
+  {
+  private:
+    enum Parser_State : uint8_t
+      {
+        parser_state_headers      = 0,
+        parser_state_length       = 1,
+        parser_state_chunk_size   = 2,
+        parser_state_chunk_data   = 3,
+        parser_state_chunk_crlf   = 4,
+        parser_state_trailers     = 5,
+        parser_state_until_close  = 6,
+      };
+
+    rcptr<Origin> m_origin;
+    size_t m_addr_index;
+
+    // These are protected by the origin mutex.
+    bool m_established = false;
+    ::std::deque<Pending_Request> m_inflight;  // sent but not responded
+
+    // These are accessed only by the network thread.
+    linear_buffer m_rbuf;
+    Parser_State m_pstate = parser_state_headers;
+    uint64_t m_remaining = 0;
+    HTTP_Client_Response m_resp;
+
+  public:
+    explicit
+    Session(const rcptr<Origin>& origin, size_t addr_index)
+      : m_origin(origin), m_addr_index(addr_index)
+      { }
+
+  private:
+    void
+    do_parse_headers(const char* bp, const char* ep);
+
+    void
+    do_append_entity(const char* data, size_t size);
+
+    void
+    do_begin_entity();
+
+    void
+    do_complete_response();
+
+  public:
+    ASTERIA_NONCOPYABLE_DESTRUCTOR(Session);
+
+    bool
+    established()
+      const noexcept
+      { return this->m_established;  }
+
+    size_t
+    inflight_count()
+      const noexcept
+      { return this->m_inflight.size();  }
+
+    // Checks whether a request can be sent now. Only idempotent requests are
+    // pipelined.
+    bool
+    can_accept(HTTP_Method meth)
+      const noexcept;
+
+    void
+    send_request(Pending_Request&& req);
+
+    void
+    shut_down()
+      { this->do_http_client_close();  }
+
+    void
+    on_establish();
+
+    void
+    on_receive(const char* data, size_t size);
+
+    void
+    on_close(int err);
+  };
+
+template<typename SocketT>
+class Pooled_Socket final
+  : public SocketT,
+    public Session
+  {
+  public:
+    template<typename... ParamsT>
+    explicit
+    Pooled_Socket(const rcptr<Origin>& origin, size_t addr_index, const ParamsT&... params)
+      : SocketT(origin->addrs[addr_index], params...),
+        Session(origin, addr_index)
+      { }
+
+  private:
+    bool
+    do_http_client_send(const char* data, size_t size)
+      override
+      { return this->do_socket_send(data, size);  }
+
+    bool
+    do_http_client_sendv(const ::iovec* iov, size_t count)
+      override
+      { return this->do_socket_sendv(iov, count);  }
+
+    bool
+    do_http_client_close()
+      override
+      { return this->close();  }
+
+    void
+    do_socket_on_establish()
+      override
+      {
+        SocketT::do_socket_on_establish();
+        this->on_establish();
+      }
+
+    void
+    do_socket_on_receive(char* data, size_t size)
+      override
+      { this->on_receive(data, size);  }
+
+    void
+    do_socket_on_close(int err)
+      override
+      {
+        SocketT::do_socket_on_close(err);
+        this->on_close(err);
+      }
+
+  public:
+    ASTERIA_NONCOPYABLE_DESTRUCTOR(Pooled_Socket);
+  };
+
+template<typename SocketT>
+Pooled_Socket<SocketT>::
+~Pooled_Socket()
+  {
+  }
+
+Session::
+~Session()
+  {
+  }
+
+void
+Session::
+do_parse_headers(const char* bp, const char* ep)
+  {
+    // Parse the status line, such as `HTTP/1.1 200 OK`.
+    const char* lp = do_find_crlf(bp, ep);
+    if((lp - bp < 12) || (bp[8] != ' '))
+      POSEIDON_THROW("Invalid HTTP status line: $1", cow_string(bp, lp));
+
+    auto ver = parse_http_version(bp, bp + 8);
+    if(ver == http_version_0_0)
+      POSEIDON_THROW("Invalid HTTP version: $1", cow_string(bp, lp));
+
+    ::rocket::ascii_numget numg;
+    const char* sp = bp + 9;
+    uint64_t stat;
+    if(!numg.parse_U(sp, bp + 12, 10) || (sp != bp + 12) || !numg.cast_U(stat, 100, 999))
+      POSEIDON_THROW("Invalid HTTP status code: $1", cow_string(bp, lp));
+
+    this->m_resp.status = static_cast<HTTP_Status>(stat);
+    this->m_resp.headers.clear();
+    bp = lp + 2;
+
+    // Parse headers. Obsolete line folding is not supported.
+    while(bp != ep) {
+      lp = do_find_crlf(bp, ep);
+      const char* cp = ::std::find(bp, lp, ':');
+      if((cp == lp) || (cp == bp))
+        POSEIDON_THROW("Invalid HTTP header: $1", cow_string(bp, lp));
+
+      const char* vp = cp + 1;
+      while((vp != lp) && ((*vp == ' ') || (*vp == '\t')))
+        vp++;
+
+      const char* vq = lp;
+      while((vq != vp) && ((vq[-1] == ' ') || (vq[-1] == '\t')))
+        vq--;
+
+      this->m_resp.headers.append(cow_string(bp, cp), cow_string(vp, vq));
+      bp = lp + 2;
+    }
+  }
+
+void
+Session::
+do_append_entity(const char* data, size_t size)
+  {
+    const auto& origin = *(this->m_origin);
+    if(size <= origin.max_entity - this->m_resp.entity.size()) {
+      this->m_resp.entity.append(data, size);
+      return;
+    }
+
+    // Fail the request, which is not retried, as the response would be too large
+    // again. The exception closes the connection, so requests that have been
+    // pipelined after it are retried.
+    Pending_Request req;
+    {
+      simple_mutex::unique_lock lock(this->m_origin->mutex);
+      if(this->m_inflight.empty())
+        POSEIDON_THROW("HTTP response received without a matching request");
+
+      req = ::std::move(this->m_inflight.front());
+      this->m_inflight.pop_front();
+    }
+
+    this->m_pstate = parser_state_headers;
+    try {
+      POSEIDON_THROW("HTTP response entity too large (limit `$1`)\n"
+                     "[request `$2 $3` to `$4`]",
+                     origin.max_entity, format_http_method(req.meth), req.target,
+                     origin.host_header);
+    }
+    catch(exception&) {
+      req.promise.set_current_exception();
+      throw;
+    }
+  }
+
+void
+Session::
+do_begin_entity()
+  {
+    HTTP_Method meth;
+    {
+      simple_mutex::unique_lock lock(this->m_origin->mutex);
+      if(this->m_inflight.empty())
+        POSEIDON_THROW("HTTP response received without a matching request");
+
+      meth = this->m_inflight.front().meth;
+    }
+
+    auto stat = this->m_resp.status;
+    if(stat == http_status_switching_protocol)
+      POSEIDON_THROW("Protocol upgrades not supported by HTTP client pool");
+
+    // Discard interim responses.
+    if(stat < 200) {
+      this->m_pstate = parser_state_headers;
+      return;
+    }
+
+    // Some responses never have an entity. Refer to RFC 7230 section 3.3.3.
+    if((meth == http_method_head) || (stat == http_status_no_content) ||
+       (stat == http_status_not_modified))
+      return this->do_complete_response();
+
+    // If both `Transfer-Encoding:` and `Content-Length:` are present, the former
+    // takes precedence.
+    auto qstr = this->m_resp.headers.find_opt(sref("Transfer-Encoding"));
+    if(qstr) {
+      if(ascii_ci_has_token(*qstr, sref("chunked")))
+        this->m_pstate = parser_state_chunk_size;
+      else
+        this->m_pstate = parser_state_until_close;
+      return;
+    }
+
+    qstr = this->m_resp.headers.find_opt(sref("Content-Length"));
+    if(!qstr) {
+      this->m_pstate = parser_state_until_close;
+      return;
+    }
+
+    ::rocket::ascii_numget numg;
+    const char* sp = qstr->data();
+    if(!numg.parse_U(sp, sp + qstr->size(), 10) || (sp != qstr->data() + qstr->size()))
+      POSEIDON_THROW("Invalid `Content-Length` value: $1", *qstr);
+
+    if(!numg.cast_U(this->m_remaining, 0, INT64_MAX))
+      POSEIDON_THROW("`Content-Length` value out of range: $1", *qstr);
+
+    if(this->m_remaining == 0)
+      return this->do_complete_response();
+
+    this->m_pstate = parser_state_length;
+  }
+
+void
+Session::
+do_complete_response()
+  {
+    simple_mutex::unique_lock lock(this->m_origin->mutex);
+    if(this->m_inflight.empty())
+      POSEIDON_THROW("HTTP response received without a matching request");
+
+    auto req = ::std::move(this->m_inflight.front());
+    this->m_inflight.pop_front();
+
+    // This may close the connection. Requests that have been pipelined will be
+    // retried when it is closed.
+    this->http_on_response_headers(this->m_resp.status, this->m_resp.headers);
+    if(this->http_encoder_state() == http_encoder_state_closed)
+      this->do_http_client_close();
+
+    do_dispatch(this->m_origin);
+    lock.unlock();
+
+    // Don't set the value with the mutex locked, as it may resume fibers.
+    req.promise.set_value(::std::move(this->m_resp));
+    this->m_resp = HTTP_Client_Response();
+    this->m_pstate = parser_state_headers;
+  }
+
+bool
+Session::
+can_accept(HTTP_Method meth)
+  const noexcept
+  {
+    if(!this->m_established)
+      return false;
+
+    if(this->http_encoder_state() != http_encoder_state_headers)
+      return false;
+
+    if(this->m_inflight.empty())
+      return true;
+
+    return (this->m_inflight.size() < this->m_origin->depth) && do_is_idempotent(meth)
+           && do_is_idempotent(this->m_inflight.back().meth);
+  }
+
+void
+Session::
+send_request(Pending_Request&& req)
+  {
+    this->m_inflight.emplace_back(::std::move(req));
+    auto& r = this->m_inflight.back();
+
+    try {
+      // Headers are copied, as the request may be sent again.
+      Option_Map headers = r.headers;
+      this->http_encode_headers(r.meth, r.target, http_version_1_1, ::std::move(headers));
+      if(this->http_encoder_state() == http_encoder_state_entity) {
+        this->http_encode_entity(r.entity.data(), r.entity.size());
+        this->http_encode_end_of_entity();
+      }
+    }
+    catch(exception& stdex) {
+      // The connection is in an unknown state, so abandon it. The request is
+      // not retried.
+      POSEIDON_LOG_WARN("HTTP request could not be sent: $1\n"
+                        "[request `$2 $3` to `$4`]",
+                        stdex, format_http_method(r.meth), r.target,
+                        this->m_origin->host_header);
+
+      r.retried = true;
+      r.promise.set_current_exception();
+      this->do_http_client_close();
+    }
+  }
+
+void
+Session::
+on_establish()
+  {
+    simple_mutex::unique_lock lock(this->m_origin->mutex);
+    this->m_established = true;
+    this->m_origin->connect_failures = 0;
+    do_dispatch(this->m_origin);
+  }
+
+void
+Session::
+on_receive(const char* data, size_t size)
+  {
+    this->m_rbuf.putn(data, size);
+
+    for(;;) {
+      const char* bp = this->m_rbuf.data();
+      const char* ep = bp + this->m_rbuf.size();
+
+      switch(this->m_pstate) {
+        case parser_state_headers: {
+          // Wait for the blank line that terminates headers.
+          static constexpr char term[] = "\r\n\r\n";
+          const char* hp = ::std::search(bp, ep, term, term + 4);
+          if(hp == ep) {
+            if(this->m_rbuf.size() > s_max_header_size)
+              POSEIDON_THROW("HTTP response headers too large");
+            return;
+          }
+
+          this->do_parse_headers(bp, hp + 2);
+          this->m_rbuf.discard(static_cast<size_t>(hp + 4 - bp));
+          this->do_begin_entity();
+          break;
+        }
+
+        case parser_state_length:
+        case parser_state_chunk_data: {
+          if(bp == ep)
+            return;
+
+          size_t navail = ::rocket::min(this->m_rbuf.size(),
+                                        static_cast<size_t>(::rocket::min(this->m_remaining,
+                                                                          SIZE_MAX)));
+          this->do_append_entity(bp, navail);
+          this->m_rbuf.discard(navail);
+          this->m_remaining -= navail;
+          if(this->m_remaining != 0)
+            return;
+
+          if(this->m_pstate == parser_state_length)
+            this->do_complete_response();
+          else
+            this->m_pstate = parser_state_chunk_crlf;
+          break;
+        }
+
+        case parser_state_chunk_size: {
+          // Parse the chunk size, ignoring chunk extensions.
+          const char* lp = do_find_crlf(bp, ep);
+          if(lp == ep) {
+            if(this->m_rbuf.size() > s_max_header_size)
+              POSEIDON_THROW("HTTP chunk header too large");
+            return;
+          }
+
+          ::rocket::ascii_numget numg;
+          const char* sp = bp;
+          if(!numg.parse_U(sp, lp, 16) || !numg.cast_U(this->m_remaining, 0, INT64_MAX))
+            POSEIDON_THROW("Invalid HTTP chunk size: $1", cow_string(bp, lp));
+
+          if((sp != lp) && (*sp != ';') && (*sp != ' ') && (*sp != '\t'))
+            POSEIDON_THROW("Invalid HTTP chunk size: $1", cow_string(bp, lp));
+
+          this->m_rbuf.discard(static_cast<size_t>(lp + 2 - bp));
+          if(this->m_remaining == 0)
+            this->m_pstate = parser_state_trailers;
+          else
+            this->m_pstate = parser_state_chunk_data;
+          break;
+        }
+
+        case parser_state_chunk_crlf: {
+          if(ep - bp < 2)
+            return;
+
+          if((bp[0] != '\r') || (bp[1] != '\n'))
+            POSEIDON_THROW("Missing CR LF after HTTP chunk");
+
+          this->m_rbuf.discard(2);
+          this->m_pstate = parser_state_chunk_size;
+          break;
+        }
+
+        case parser_state_trailers: {
+          // Trailers are discarded, until a blank line.
+          const char* lp = do_find_crlf(bp, ep);
+          if(lp == ep) {
+            if(this->m_rbuf.size() > s_max_header_size)
+              POSEIDON_THROW("HTTP trailer too large");
+            return;
+          }
+
+          this->m_rbuf.discard(static_cast<size_t>(lp + 2 - bp));
+          if(lp == bp)
+            this->do_complete_response();
+          break;
+        }
+
+        case parser_state_until_close: {
+          // The entity is terminated by closure of the connection.
+          this->do_append_entity(bp, this->m_rbuf.size());
+          this->m_rbuf.clear();
+          return;
+        }
+
+        default:
+          ROCKET_ASSERT(false);
+      }
+    }
+  }
+
+void
+Session::
+on_close(int err)
+  {
+    // If the entity is terminated by closure of the connection, it is complete.
+    if(this->m_pstate == parser_state_until_close)
+      try {
+        this->do_complete_response();
+      }
+      catch(exception& stdex) {
+        POSEIDON_LOG_WARN("HTTP response could not be completed: $1\n"
+                          "[response from `$2`]",
+                          stdex, this->m_origin->host_header);
+      }
+
+    simple_mutex::unique_lock lock(this->m_origin->mutex);
+    auto& origin = *(this->m_origin);
+
+    // Detach this connection. The driver still holds a reference to it.
+    auto it = ::std::find_if(origin.sessions.begin(), origin.sessions.end(),
+                    [&](const pair<rcptr<Abstract_Socket>, Session*>& p) {
+                      return p.second == this;  });
+    if(it != origin.sessions.end())
+      origin.sessions.erase(it);
+
+    // Retry idempotent requests once. Others can't be retried, as they might
+    // have been processed by the server.
+    ::std::vector<Pending_Request> failed;
+    ::std::deque<Pending_Request> retry;
+    while(!this->m_inflight.empty()) {
+      auto req = ::std::move(this->m_inflight.front());
+      this->m_inflight.pop_front();
+
+      if(!origin.closed && !req.retried && do_is_idempotent(req.meth)) {
+        req.retried = true;
+        retry.emplace_back(::std::move(req));
+      }
+      else
+        failed.emplace_back(::std::move(req));
+    }
+    origin.queue.insert(origin.queue.begin(), ::std::make_move_iterator(retry.begin()),
+                        ::std::make_move_iterator(retry.end()));
+
+    // If the connection could not be established, try the next address. If
+    // all addresses have failed, and there are no other connections, the server
+    // is unreachable, so fail all requests, and resolve the host name again for
+    // later ones.
+    if(!this->m_established) {
+      origin.next_addr = this->m_addr_index + 1;
+      origin.connect_failures ++;
+    }
+
+    bool reachable = this->m_established ||
+                     (origin.connect_failures < origin.addrs.size()) ||
+                     ::std::any_of(origin.sessions.begin(), origin.sessions.end(),
+                         [&](const pair<rcptr<Abstract_Socket>, Session*>& p) {
+                           return p.second->established();  });
+    if(!reachable) {
+      origin.connect_failures = 0;
+      origin.resolve_expiry = 0;
+
+      while(!origin.queue.empty()) {
+        failed.emplace_back(::std::move(origin.queue.front()));
+        origin.queue.pop_front();
+      }
+    }
+
+    if(!origin.closed)
+      do_dispatch(this->m_origin);
+    lock.unlock();
+
+    for(auto& req : failed)
+      try {
+        POSEIDON_THROW("HTTP connection to `$1` closed without a response\n"
+                       "[request `$2 $3`]\n"
+                       "[socket error: $4]",
+                       origin.host_header, format_http_method(req.meth), req.target,
+                       format_errno(err));
+      }
+      catch(exception&) {
+        req.promise.set_current_exception();
+      }
+  }
+
+namespace {
+
+::std::vector<Socket_Address>
+do_resolve(const cow_string& host, uint16_t port)
+  {
+    ::rocket::ascii_numput nump;
+    nump.put_DU(port);
+    cow_string serv(nump.data(), nump.size());
+
+    ::addrinfo hints = { };
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICSERV | AI_ADDRCONFIG;
+
+    ::addrinfo* res;
+    int err = ::getaddrinfo(host.c_str(), serv.c_str(), &hints, &res);
+    if(err != 0)
+      POSEIDON_THROW("Could not resolve host name '$1'\n"
+                     "[`getaddrinfo()` failed: $2]",
+                     host, ::gai_strerror(err));
+
+    // Take all addresses, in the order in which they are preferred.
+    ::std::vector<Socket_Address> addrs;
+    for(auto ai = res;  ai;  ai = ai->ai_next) {
+      Socket_Address::storage stor;
+      size_t size = ::rocket::min(static_cast<size_t>(ai->ai_addrlen), sizeof(stor));
+      ::std::memcpy(&stor, ai->ai_addr, size);
+      addrs.emplace_back(stor, size);
+    }
+    ::freeaddrinfo(res);
+    return addrs;
+  }
+
+void
+do_start_resolve(const rcptr<Origin>& origin)
+  {
+    if(origin->resolving)
+      return;
+
+    // `getaddrinfo()` may block, so it is called by a worker. Addresses are
+    // stored into the origin, and requests that are waiting for them are
+    // dispatched, when it completes.
+    origin->resolving = true;
+    enqueue_async_job(reinterpret_cast<uintptr_t>(origin.get()),
+      [origin] {
+        ::std::vector<Socket_Address> addrs;
+        ::std::exception_ptr eptr;
+        try {
+          addrs = do_resolve(origin->host, origin->port);
+        }
+        catch(exception& stdex) {
+          POSEIDON_LOG_WARN("$1", stdex);
+          eptr = ::std::current_exception();
+        }
+
+        ::std::deque<Pending_Request> failed;
+        simple_mutex::unique_lock lock(origin->mutex);
+        origin->resolving = false;
+        if(!addrs.empty()) {
+          origin->addrs = ::std::move(addrs);
+          origin->next_addr = 0;
+          origin->connect_failures = 0;
+          origin->resolve_expiry = do_get_monotonic_milliseconds() + s_resolve_ttl;
+        }
+        else if(origin->addrs.empty()) {
+          // There are no old addresses to fall back on.
+          failed.swap(origin->queue);
+          origin->prewarm = 0;
+        }
+
+        if(!origin->closed)
+          do_dispatch(origin);
+        lock.unlock();
+
+        for(auto& req : failed)
+          req.promise.set_exception(eptr);
+        return !eptr;
+      });
+  }
+
+void
+do_open_session(const rcptr<Origin>& origin)
+  {
+    uptr<Abstract_Socket> usock;
+    Session* sess;
+
+    // New connections go to the same address, until it fails.
+    size_t index = origin->next_addr % origin->addrs.size();
+    origin->next_addr = index;
+
+    if(origin->ctx) {
+      auto tsock = ::rocket::make_unique<Pooled_Socket<Abstract_TLS_Client_Socket>>(
+                                                           origin, index, *(origin->ctx));
+
+      // Send the host name for SNI. IP addresses are not allowed by RFC 6066.
+      if(!origin->numeric && !::SSL_set_tlsext_host_name(tsock->open_ssl(),
+                                                         origin->host.c_str()))
+        POSEIDON_SSL_THROW("Could not set TLS server name '$1'\n"
+                           "[`SSL_set_tlsext_host_name()` failed]",
+                           origin->host);
+
+      sess = tsock.get();
+      usock = ::std::move(tsock);
+    }
+    else {
+      auto tsock = ::rocket::make_unique<Pooled_Socket<Abstract_TCP_Client_Socket>>(
+                                                           origin, index);
+      sess = tsock.get();
+      usock = ::std::move(tsock);
+    }
+
+    // Callbacks will block on the origin mutex until this connection is added.
+    auto sock = Network_Driver::insert(::std::move(usock));
+    origin->sessions.emplace_back(::std::move(sock), sess);
+  }
+
+void
+do_dispatch(const rcptr<Origin>& origin)
+  {
+    // Resolve the host name when it is needed for the first time, and again
+    // when its addresses expire. Until new addresses arrive, old ones are used.
+    if((!origin->queue.empty() || origin->prewarm) &&
+       (origin->addrs.empty() || (do_get_monotonic_milliseconds() >= origin->resolve_expiry)))
+      do_start_resolve(origin);
+
+    if(origin->addrs.empty())
+      return;
+
+    while(origin->sessions.size() < ::rocket::min(origin->prewarm, origin->max_conns))
+      do_open_session(origin);
+    origin->prewarm = 0;
+
+    // Assign requests to the least busy connections.
+    while(!origin->queue.empty()) {
+      Session* best = nullptr;
+      for(const auto& p : origin->sessions)
+        if(p.second->can_accept(origin->queue.front().meth) &&
+           (!best || (p.second->inflight_count() < best->inflight_count())))
+          best = p.second;
+
+      if(!best)
+        break;
+
+      auto req = ::std::move(origin->queue.front());
+      origin->queue.pop_front();
+      best->send_request(::std::move(req));
+    }
+
+    // Open new connections for requests that are still waiting, unless there are
+    // enough connections being established.
+    size_t nconnecting = static_cast<size_t>(::std::count_if(
+                             origin->sessions.begin(), origin->sessions.end(),
+                             [&](const pair<rcptr<Abstract_Socket>, Session*>& p) {
+                               return !p.second->established();  }));
+
+    while((origin->queue.size() > nconnecting) &&
+          (origin->sessions.size() < origin->max_conns)) {
+      do_open_session(origin);
+      nconnecting++;
+    }
+  }
+
+}  // namespace
+}  // namespace details_http_client_pool
+
+HTTP_Client_Pool::
+HTTP_Client_Pool(size_t max_conns, size_t pipeline_depth, size_t max_response_size)
+  : HTTP_Client_Pool(OpenSSL_Context::static_verify_peer(), max_conns, pipeline_depth,
+                     max_response_size)
+  {
+  }
+
+HTTP_Client_Pool::
+HTTP_Client_Pool(const OpenSSL_Context& ctx, size_t max_conns, size_t pipeline_depth,
+                 size_t max_response_size)
+  : m_ctx(&ctx),
+    m_max_conns(::rocket::max(max_conns, size_t(1))),
+    m_depth(::rocket::max(pipeline_depth, size_t(1))),
+    m_max_entity(max_response_size)
+  {
+  }
+
+HTTP_Client_Pool::
+~HTTP_Client_Pool()
+  {
+    for(const auto& p : this->m_origins) {
+      auto& origin = *(p.second);
+      simple_mutex::unique_lock lock(origin.mutex);
+      origin.closed = true;
+
+      // Close all connections. Requests that have been sent fail when their
+      // connections are closed. Requests in the queue are dropped, so their
+      // futures are marked broken.
+      for(const auto& q : origin.sessions)
+        q.second->shut_down();
+      origin.queue.clear();
+    }
+  }
+
+rcptr<details_http_client_pool::Origin>
+HTTP_Client_Pool::
+do_get_origin(const URL_View& url)
+  {
+    auto sch = url.raw_scheme();
+    cow_string scheme = ascii_lowercase(cow_string(sch.first, sch.second));
+    if((scheme != sref("http")) && (scheme != sref("https")))
+      POSEIDON_THROW("URL scheme not supported by HTTP client pool: $1", scheme);
+
+    cow_string host;
+    url.decode_host(host);
+    if(host.empty())
+      POSEIDON_THROW("No host name in URL");
+
+    // Remove brackets around IPv6 addresses.
+    if(host[0] == '[') {
+      host.erase(host.size() - 1);
+      host.erase(0, 1);
+    }
+
+    uint16_t port = url.port();
+    if(port == 0)
+      POSEIDON_THROW("No port in URL");
+
+    // Origins are compared case-insensitively.
+    ::rocket::ascii_numput nump;
+    nump.put_DU(port);
+    cow_string key = scheme;
+    key += "://";
+    key += ascii_lowercase(host);
+    key += ':';
+    key.append(nump.data(), nump.size());
+
+    simple_mutex::unique_lock lock(this->m_mutex);
+    auto it = this->m_origins.find(key);
+    if(it != this->m_origins.end())
+      return it->second;
+    lock.unlock();
+
+    // The host name is resolved when the first request is dispatched.
+    auto origin = ::rocket::make_refcnt<details_http_client_pool::Origin>();
+    origin->host = host;
+    origin->port = port;
+    origin->max_conns = this->m_max_conns;
+    origin->depth = this->m_depth;
+    origin->max_entity = this->m_max_entity;
+
+    ::in6_addr ip;
+    origin->numeric = (::inet_pton(AF_INET, host.c_str(), &ip) == 1) ||
+                      (::inet_pton(AF_INET6, host.c_str(), &ip) == 1);
+
+    if(scheme == sref("https"))
+      origin->ctx = this->m_ctx;
+
+    auto rhost = url.raw_host();
+    origin->host_header.assign(rhost.first, rhost.second);
+    if(url.has_port()) {
+      origin->host_header.push_back(':');
+      origin->host_header.append(nump.data(), nump.size());
+    }
+
+    // Another thread might have created the same origin.
+    lock.lock(this->m_mutex);
+    return this->m_origins.emplace(::std::move(key), ::std::move(origin)).first->second;
+  }
+
+size_t
+HTTP_Client_Pool::
+connection_count()
+  const
+  {
+    simple_mutex::unique_lock lock(this->m_mutex);
+    size_t count = 0;
+    for(const auto& p : this->m_origins) {
+      simple_mutex::unique_lock olock(p.second->mutex);
+      count += p.second->sessions.size();
+    }
+    return count;
+  }
+
+void
+HTTP_Client_Pool::
+prewarm(const cow_string& url, size_t count)
+  {
+    auto origin = this->do_get_origin(URL_View(url));
+
+    simple_mutex::unique_lock lock(origin->mutex);
+    origin->prewarm = ::rocket::max(origin->prewarm, count);
+    details_http_client_pool::do_dispatch(origin);
+  }
+
+futp<HTTP_Client_Response>
+HTTP_Client_Pool::
+request(HTTP_Method meth, const cow_string& url, Option_Map&& headers,
+        const cow_string& entity)
+  {
+    if(meth == http_method_connect)
+      POSEIDON_THROW("CONNECT requests not supported by HTTP client pool");
+
+    URL_View view(url);
+    auto origin = this->do_get_origin(view);
+
+    // Compose the request target from the path and the query string.
+    details_http_client_pool::Pending_Request req;
+    req.meth = meth;
+
+    auto path = view.raw_path();
+    req.target.push_back('/');
+    req.target.append(path.first, path.second);
+
+    auto query = view.raw_query();
+    if(query.second != 0) {
+      req.target.push_back('?');
+      req.target.append(query.first, query.second);
+    }
+
+    if(!headers.count(sref("Host")))
+      headers.set(sref("Host"), origin->host_header);
+
+    // The entity is always sent verbatim.
+    headers.erase(sref("Transfer-Encoding"));
+    headers.erase(sref("Content-Length"));
+    if(!entity.empty() || (meth == http_method_post) || (meth == http_method_put)) {
+      ::rocket::ascii_numput nump;
+      nump.put_DU(entity.size());
+      headers.set(sref("Content-Length"), cow_string(nump.data(), nump.size()));
+    }
+
+    req.headers = ::std::move(headers);
+    req.entity = entity;
+    auto futr = req.promise.future();
+
+    simple_mutex::unique_lock lock(origin->mutex);
+    origin->queue.emplace_back(::std::move(req));
+    details_http_client_pool::do_dispatch(origin);
+    return futr;
+  }
+
+}  // namespace poseidon
@@ -0,0 +1,102 @@
+// This file is part of Poseidon.
+// Copyleft 2020, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_HTTP_HTTP_CLIENT_POOL_HPP_
+#define POSEIDON_HTTP_HTTP_CLIENT_POOL_HPP_
+
+#include "../fwd.hpp"
+#include "enums.hpp"
+#include "option_map.hpp"
+#include <map>
+
+namespace poseidon {
+namespace details_http_client_pool {
+
+struct Origin;
+
+}  // namespace details_http_client_pool
+
+// This is a response that has been received by `HTTP_Client_Pool`.
+// Interim (1xx) responses are discarded. The entity has been decoded from the
+// `chunked` transfer encoding, if any, but not from any content encoding.
+struct HTTP_Client_Response
+  {
+    HTTP_Status status = http_status_null;
+    Option_Map headers;
+    cow_string entity;
+  };
+
+// This class sends HTTP/1.1 requests over persistent connections, which are
+// shared by requests to the same origin (scheme, host and port).
+// Each origin has at most `max_conns` connections. A connection may carry up to
+// `pipeline_depth` requests that have not been responded, if all of them are
+// idempotent. Requests are queued if all connections are busy. Connections are
+// kept open after responses have been received, until the server closes them.
+// If a connection is lost before a response to an idempotent request has been
+// received, the request is retried once.
+// Host names are resolved by workers, so requests never block. Addresses are
+// resolved again after a minute, or after connections to all of them have failed.
+// If a connection can't be established, the next address is tried.
+// All functions are thread-safe.
+class HTTP_Client_Pool
+  {
+  private:
+    const OpenSSL_Context* m_ctx;
+    size_t m_max_conns;
+    size_t m_depth;
+    size_t m_max_entity;
+
+    mutable simple_mutex m_mutex;
+    ::std::map<cow_string, rcptr<details_http_client_pool::Origin>> m_origins;
+
+  public:
+    // Creates a pool. If no SSL context is specified, the standard peer
+    // verification context is used for `https` origins. Requests whose response
+    // entities are larger than `max_response_size` bytes fail.
+    explicit
+    HTTP_Client_Pool(size_t max_conns = 8, size_t pipeline_depth = 1,
+                     size_t max_response_size = 0x1000000);
+
+    explicit
+    HTTP_Client_Pool(const OpenSSL_Context& ctx, size_t max_conns = 8,
+                     size_t pipeline_depth = 1, size_t max_response_size = 0x1000000);
+
+  private:
+    rcptr<details_http_client_pool::Origin>
+    do_get_origin(const URL_View& url);
+
+  public:
+    // Closes all connections. Requests that have not been responded fail.
+    ASTERIA_NONCOPYABLE_DESTRUCTOR(HTTP_Client_Pool);
+
+    // Gets the number of connections of all origins, including those that are
+    // still being established.
+    size_t
+    connection_count()
+      const;
+
+    // Opens connections to the origin of `url` in advance, until it has `count`
+    // connections, or the maximum number of connections per origin. This should
+    // be called at startup, so host name resolution, connections and TLS
+    // handshakes are not on the path of the first requests. Connections are
+    // opened after the host name has been resolved.
+    // An exception is thrown if `url` is invalid.
+    void
+    prewarm(const cow_string& url, size_t count);
+
+    // Sends a request. `url` shall be an absolute URL whose scheme is `http` or
+    // `https`. `Host:` is set from `url` if it is absent, and `Content-Length:` is
+    // set from `entity`. The request may be deferred until a connection is
+    // available.
+    // A future is returned, which a fiber may wait for with `Fiber_Scheduler::
+    // yield()`. If the request fails, for example because the host name can't be
+    // resolved or the response is too large, an exception is set into the future.
+    // An exception is thrown if `url` is invalid.
+    futp<HTTP_Client_Response>
+    request(HTTP_Method meth, const cow_string& url, Option_Map&& headers,
+            const cow_string& entity = { });
+  };
+
+}  // namespace poseidon
+
+#endif
@@ -0,0 +1,185 @@
+// This file is part of Poseidon.
+// Copyleft 2020, LH_Mouse. All wrongs reserved.
+
+#include "../precompiled.hpp"
+#include "http_date.hpp"
+#include "../utils.hpp"
+#include <time.h>
+
+namespace poseidon {
+namespace {
+
+constexpr char s_weekdays[][4] =
+  {
+    "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat",
+  };
+
+constexpr char s_months[][4] =
+  {
+    "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+    "Jul", "Aug", "Sep", "Oct", "Nov", "Dec",
+  };
+
+inline
+void
+do_put_digits(char*& wptr, uint32_t value, size_t count)
+  noexcept
+  {
+    // Write digits backwards.
+    size_t k = count;
+    while(k != 0) {
+      wptr[--k] = static_cast<char>('0' + value % 10);
+      value /= 10;
+    }
+    wptr += count;
+  }
+
+inline
+bool
+do_get_digits(uint32_t& value, const char*& rptr, size_t count)
+  noexcept
+  {
+    value = 0;
+    for(size_t k = 0;  k != count;  ++k) {
+      uint32_t dval = static_cast<uint32_t>(static_cast<unsigned char>(rptr[k]) - '0');
+      if(dval > 9)
+        return false;
+      value = value * 10 + dval;
+    }
+    rptr += count;
+    return true;
+  }
+
+}  // namespace
+
+size_t
+format_http_date(char* buf, int64_t secs)
+  noexcept
+  {
+    // Break the timestamp down. If it is out of range, use the epoch.
+    ::time_t tp = static_cast<::time_t>(secs);
+    ::tm tr;
+    if(!::gmtime_r(&tp, &tr)) {
+      tp = 0;
+      ::gmtime_r(&tp, &tr);
+    }
+
+    // Compose the string by hand, as `strftime()` is locale-dependent.
+    char* wptr = buf;
+    ::std::memcpy(wptr, s_weekdays[tr.tm_wday % 7], 3);
+    wptr += 3;
+    *(wptr++) = ',';
+    *(wptr++) = ' ';
+    do_put_digits(wptr, static_cast<uint32_t>(tr.tm_mday), 2);
+    *(wptr++) = ' ';
+    ::std::memcpy(wptr, s_months[tr.tm_mon % 12], 3);
+    wptr += 3;
+    *(wptr++) = ' ';
+    do_put_digits(wptr, clamp_cast<uint32_t>(tr.tm_year + 1900, 0, 9999), 4);
+    *(wptr++) = ' ';
+    do_put_digits(wptr, static_cast<uint32_t>(tr.tm_hour), 2);
+    *(wptr++) = ':';
+    do_put_digits(wptr, static_cast<uint32_t>(tr.tm_min), 2);
+    *(wptr++) = ':';
+    do_put_digits(wptr, static_cast<uint32_t>(tr.tm_sec), 2);
+    ::std::memcpy(wptr, " GMT", 5);
+    wptr += 4;
+
+    ROCKET_ASSERT(wptr - buf == 29);
+    return static_cast<size_t>(wptr - buf);
+  }
+
+bool
+parse_http_date(int64_t& secs, const char* str, size_t len)
+  noexcept
+  {
+    // An IMF-fixdate has a fixed length.
+    if(len != 29)
+      return false;
+
+    const char* rptr = str;
+    auto wday = ::std::find_if(::std::begin(s_weekdays), ::std::end(s_weekdays),
+                       [&](const char* name) { return ::std::memcmp(rptr, name, 3) == 0;  });
+    if(wday == ::std::end(s_weekdays))
+      return false;
+    rptr += 3;
+
+    if(::std::memcmp(rptr, ", ", 2) != 0)
+      return false;
+    rptr += 2;
+
+    ::tm tr = { };
+    uint32_t value;
+    if(!do_get_digits(value, rptr, 2))
+      return false;
+    tr.tm_mday = static_cast<int>(value);
+
+    if(*(rptr++) != ' ')
+      return false;
+
+    auto mon = ::std::find_if(::std::begin(s_months), ::std::end(s_months),
+                       [&](const char* name) { return ::std::memcmp(rptr, name, 3) == 0;  });
+    if(mon == ::std::end(s_months))
+      return false;
+    tr.tm_mon = static_cast<int>(mon - ::std::begin(s_months));
+    rptr += 3;
+
+    if(*(rptr++) != ' ')
+      return false;
+
+    if(!do_get_digits(value, rptr, 4))
+      return false;
+    tr.tm_year = static_cast<int>(value) - 1900;
+
+    if(*(rptr++) != ' ')
+      return false;
+
+    if(!do_get_digits(value, rptr, 2) || (value > 23))
+      return false;
+    tr.tm_hour = static_cast<int>(value);
+
+    if(*(rptr++) != ':')
+      return false;
+
+    if(!do_get_digits(value, rptr, 2) || (value > 59))
+      return false;
+    tr.tm_min = static_cast<int>(value);
+
+    if(*(rptr++) != ':')
+      return false;
+
+    // Allow leap seconds, which `timegm()` normalizes.
+    if(!do_get_digits(value, rptr, 2) || (value > 60))
+      return false;
+    tr.tm_sec = static_cast<int>(value);
+
+    if(::std::memcmp(rptr, " GMT", 4) != 0)
+      return false;
+
+    if((tr.tm_mday < 1) || (tr.tm_mday > 31))
+      return false;
+
+    // The day of week is redundant, so it is not validated.
+    secs = static_cast<int64_t>(::timegm(&tr));
+    return true;
+  }
+
+const char*
+current_http_date()
+  noexcept
+  {
+    // Each thread has its own copy, so no synchronization is required.
+    static thread_local int64_t s_secs = INT64_MIN;
+    static thread_local char s_str[32];
+
+    // The coarse clock suffices, as the result has a precision of one second.
+    ::timespec ts;
+    ::clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    if(ROCKET_UNEXPECT(ts.tv_sec != s_secs)) {
+      s_secs = ts.tv_sec;
+      format_http_date(s_str, s_secs);
+    }
+    return s_str;
+  }
+
+}  // namespace poseidon
@@ -0,0 +1,35 @@
+// This file is part of Poseidon.
+// Copyleft 2020, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_HTTP_HTTP_DATE_HPP_
+#define POSEIDON_HTTP_HTTP_DATE_HPP_
+
+#include "../fwd.hpp"
+
+namespace poseidon {
+
+// Formats a timestamp as an IMF-fixdate such as `Sun, 06 Nov 1994 08:49:37 GMT`.
+// `secs` is the number of seconds since the Unix epoch. `buf` shall have room for
+// at least 30 characters. The result is null-terminated, and its length, which is
+// always 29, is returned.
+size_t
+format_http_date(char* buf, int64_t secs)
+  noexcept;
+
+// Parses an IMF-fixdate such as `Sun, 06 Nov 1994 08:49:37 GMT`.
+// The obsolete RFC 850 and asctime formats are not accepted. If the string is
+// valid, the number of seconds since the Unix epoch is stored into `secs` and
+// `true` is returned; otherwise `false` is returned.
+bool
+parse_http_date(int64_t& secs, const char* str, size_t len)
+  noexcept;
+
+// Gets the current time as an IMF-fixdate, for use in `Date:` headers.
+// The result is cached per thread, and is updated at most once per second.
+const char*
+current_http_date()
+  noexcept;
+
+}  // namespace poseidon
+
+#endif
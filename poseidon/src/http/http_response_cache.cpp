@@ -0,0 +1,291 @@
+// This file is part of Poseidon.
+// Copyleft 2020, LH_Mouse. All wrongs reserved.
+
+#include "../precompiled.hpp"
+#include "http_response_cache.hpp"
+#include "option_map.hpp"
+#include "../core/zlib_deflator.hpp"
+#include "../utils.hpp"
+
+namespace poseidon {
+namespace {
+
+// Bodies smaller than this are not worth compressing.
+constexpr size_t s_gzip_threshold = 256;
+
+// These headers are generated for each response, or serialized separately.
+bool
+do_is_excluded_header(const cow_string& name)
+  noexcept
+  {
+    return ascii_ci_equal(name, sref("Content-Length")) ||
+           ascii_ci_equal(name, sref("Transfer-Encoding")) ||
+           ascii_ci_equal(name, sref("Content-Encoding")) ||
+           ascii_ci_equal(name, sref("Connection")) ||
+           ascii_ci_equal(name, sref("Date")) ||
+           ascii_ci_equal(name, sref("ETag")) ||
+           ascii_ci_equal(name, sref("Vary"));
+  }
+
+void
+do_append_header(cow_string& head, const char* name, size_t nlen, const cow_string& value)
+  {
+    head.append(name, nlen);
+    head.append(": ", 2);
+    head.append(value.data(), value.size());
+    head.append("\r\n", 2);
+  }
+
+void
+do_append_content_length(cow_string& head, size_t size)
+  {
+    ::rocket::ascii_numput nump;
+    nump.put_DU(size);
+    head.append("Content-Length: ", 16);
+    head.append(nump.data(), nump.size());
+    head.append("\r\n", 2);
+  }
+
+}  // namespace
+
+bool
+etag_list_matches(const cow_string& list, const cow_string& etag)
+  {
+    // `*` matches any entity tag.
+    if(list == "*")
+      return true;
+
+    // Use weak comparison, which ignores the `W/` prefix. See RFC 7232 section
+    // 2.3.2.
+    auto do_strip_weak = [](const char*& bp) { if((bp[0] == 'W') && (bp[1] == '/')) bp += 2;  };
+
+    const char* eb = etag.c_str();
+    do_strip_weak(eb);
+    size_t elen = static_cast<size_t>(etag.c_str() + etag.size() - eb);
+
+    const char* bp = list.c_str();
+    const char* ep = bp + list.size();
+    while(bp != ep) {
+      // Skip separators and get a tag.
+      bp = ::std::find_if(bp, ep, [&](char ch) { return !::rocket::is_any_of(ch, {' ', '\t', ','});  });
+      const char* mp = ::std::find(bp, ep, ',');
+      const char* tp = mp;
+      while((tp != bp) && ::rocket::is_any_of(tp[-1], {' ', '\t'}))
+        tp--;
+
+      do_strip_weak(bp);
+      if((bp < tp) && (static_cast<size_t>(tp - bp) == elen) && (::std::memcmp(bp, eb, elen) == 0))
+        return true;
+
+      bp = mp;
+    }
+    return false;
+  }
+
+HTTP_Cached_Response::
+HTTP_Cached_Response(HTTP_Status stat, const Option_Map& headers, const cow_string& body)
+  : m_stat(stat), m_identity_body(body)
+  {
+    // Compress the body. Keep the result only if it is smaller.
+    if(body.size() >= s_gzip_threshold) {
+      zlib_Deflator defl(zlib_Deflator::format_gzip);
+      defl.write(body.data(), body.size());
+      defl.finish();
+
+      const auto& obuf = defl.output_buffer();
+      if(obuf.size() < body.size())
+        this->m_gzip_body.append(obuf.data(), obuf.size());
+    }
+
+    // Get the entity tag. If none has been specified, generate one from the
+    // length and checksum of the body.
+    auto qetag = headers.find_opt(sref("ETag"));
+    if(qetag) {
+      this->m_etag = *qetag;
+    }
+    else {
+      ::rocket::ascii_numput nump;
+      this->m_etag.push_back('\"');
+      nump.put_XU(body.size());
+      this->m_etag.append(nump.data() + 2, nump.size() - 2);
+      this->m_etag.push_back('-');
+      nump.put_XU(::crc32_z(0, reinterpret_cast<const uint8_t*>(body.data()),
+                            body.size()));
+      this->m_etag.append(nump.data() + 2, nump.size() - 2);
+      this->m_etag.push_back('\"');
+    }
+
+    // Serialize common headers.
+    cow_string common;
+    do_append_header(common, "ETag", 4, this->m_etag);
+
+    // If the body can be compressed, the response varies with `Accept-Encoding`.
+    // If the user has supplied a `Vary:` header, the field name is merged into
+    // it, unless it is listed already or the header is `*`.
+    auto vary = headers.range(sref("Vary"));
+    bool vary_gzip = this->has_gzip() &&
+        ::std::none_of(vary.first, vary.second,
+            [](const cow_string& str) { return ascii_ci_has_token(str, sref("*")) ||
+                                               ascii_ci_has_token(str, sref("Accept-Encoding"));  });
+
+    if(vary_gzip && (vary.first == vary.second))
+      common.append("Vary: Accept-Encoding\r\n");
+
+    for(auto p = vary.first;  p != vary.second;  ++p)
+      if(vary_gzip && (p == vary.second - 1))
+        do_append_header(common, "Vary", 4, *p + ", Accept-Encoding");
+      else
+        do_append_header(common, "Vary", 4, *p);
+
+    for(const auto& pair : headers)
+      if(!do_is_excluded_header(pair.first))
+        do_append_header(common, pair.first.data(), pair.first.size(), pair.second);
+
+    // Compose heads for both bodies.
+    do_append_content_length(this->m_identity_head, this->m_identity_body.size());
+    this->m_identity_head.append(common);
+
+    if(this->has_gzip()) {
+      this->m_gzip_head.append("Content-Encoding: gzip\r\n");
+      do_append_content_length(this->m_gzip_head, this->m_gzip_body.size());
+      this->m_gzip_head.append(common);
+    }
+  }
+
+HTTP_Cached_Response::
+~HTTP_Cached_Response()
+  {
+  }
+
+HTTP_Response_Cache::
+~HTTP_Response_Cache()
+  {
+  }
+
+void
+HTTP_Response_Cache::
+do_lru_unlink(HTTP_Cached_Response* resp)
+  noexcept
+  {
+    auto prev = ::std::exchange(resp->m_lru_prev, nullptr);
+    auto next = ::std::exchange(resp->m_lru_next, nullptr);
+    (prev ? prev->m_lru_next : this->m_lru_head) = next;
+    (next ? next->m_lru_prev : this->m_lru_tail) = prev;
+  }
+
+void
+HTTP_Response_Cache::
+do_lru_push_front(HTTP_Cached_Response* resp)
+  noexcept
+  {
+    resp->m_lru_prev = nullptr;
+    resp->m_lru_next = this->m_lru_head;
+    (this->m_lru_head ? this->m_lru_head->m_lru_prev : this->m_lru_tail) = resp;
+    this->m_lru_head = resp;
+  }
+
+cow_string
+HTTP_Response_Cache::
+make_key(const cow_string& target, const Option_Map& req_headers,
+         ::std::initializer_list<cow_string::shallow_type> vary)
+  {
+    // Values are separated by line feeds, which cannot appear in either
+    // request targets or header values.
+    cow_string key = target;
+    for(const auto& name : vary) {
+      key.push_back('\n');
+      req_headers.for_each(name,
+          [&](const cow_string& value) {
+            key.append(value);
+            key.push_back(',');
+          });
+    }
+    return key;
+  }
+
+rcptr<const HTTP_Cached_Response>
+HTTP_Response_Cache::
+find_opt(const cow_string& key)
+  {
+    simple_mutex::unique_lock lock(this->m_mutex);
+    auto it = this->m_map.find(key);
+    if(it == this->m_map.end())
+      return nullptr;
+
+    // Mark this response most recently used.
+    auto resp = it->second.get();
+    this->do_lru_unlink(resp);
+    this->do_lru_push_front(resp);
+    return it->second;
+  }
+
+rcptr<const HTTP_Cached_Response>
+HTTP_Response_Cache::
+insert(const cow_string& key, HTTP_Status stat, const Option_Map& headers,
+       const cow_string& body)
+  {
+    // Compression is done without locking.
+    auto resp = ::rocket::make_refcnt<HTTP_Cached_Response>(stat, headers, body);
+    resp->m_key = key;
+    size_t nbytes = resp->size_in_bytes();
+    if(nbytes > this->m_capacity)
+      return resp;
+
+    simple_mutex::unique_lock lock(this->m_mutex);
+
+    // Replace the existent response, if any.
+    auto it = this->m_map.find(key);
+    if(it != this->m_map.end()) {
+      this->do_lru_unlink(it->second.get());
+      this->m_size -= it->second->size_in_bytes();
+      it->second = resp;
+    }
+    else
+      this->m_map.emplace(key, resp);
+
+    this->do_lru_push_front(resp.get());
+    this->m_size += nbytes;
+
+    // Evict least recently used responses.
+    while(this->m_size > this->m_capacity) {
+      auto tail = this->m_lru_tail;
+      ROCKET_ASSERT(tail != resp.get());
+      this->do_lru_unlink(tail);
+      this->m_size -= tail->size_in_bytes();
+      this->m_map.erase(this->m_map.find(tail->m_key));
+    }
+    return resp;
+  }
+
+bool
+HTTP_Response_Cache::
+erase(const cow_string& key)
+  {
+    simple_mutex::unique_lock lock(this->m_mutex);
+    auto it = this->m_map.find(key);
+    if(it == this->m_map.end())
+      return false;
+
+    this->do_lru_unlink(it->second.get());
+    this->m_size -= it->second->size_in_bytes();
+    this->m_map.erase(it);
+    return true;
+  }
+
+void
+HTTP_Response_Cache::
+clear()
+  noexcept
+  {
+    simple_mutex::unique_lock lock(this->m_mutex);
+    for(const auto& pair : this->m_map) {
+      pair.second->m_lru_prev = nullptr;
+      pair.second->m_lru_next = nullptr;
+    }
+    this->m_map.clear();
+    this->m_lru_head = nullptr;
+    this->m_lru_tail = nullptr;
+    this->m_size = 0;
+  }
+
+}  // namespace poseidon
@@ -0,0 +1,166 @@
+// This file is part of Poseidon.
+// Copyleft 2020, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_HTTP_HTTP_RESPONSE_CACHE_HPP_
+#define POSEIDON_HTTP_HTTP_RESPONSE_CACHE_HPP_
+
+#include "../fwd.hpp"
+#include <map>
+
+namespace poseidon {
+
+// This is an immutable response which can be sent to multiple clients.
+// All headers are serialized when the response is created, except the status
+// line, `Date:` and `Connection:`, which are composed by the encoder.
+class HTTP_Cached_Response
+  : public ::asteria::Rcfwd<HTTP_Cached_Response>
+  {
+    friend HTTP_Response_Cache;
+
+  private:
+    HTTP_Status m_stat;
+    cow_string m_etag;
+
+    // Each head comprises header lines, each of which is terminated by a CRLF,
+    // but not the empty line that terminates the header.
+    cow_string m_identity_head;
+    cow_string m_identity_body;
+    cow_string m_gzip_head;
+    cow_string m_gzip_body;  // empty if not compressed
+
+    // These are protected by the mutex of the cache.
+    cow_string m_key;
+    HTTP_Cached_Response* m_lru_prev = nullptr;
+    HTTP_Cached_Response* m_lru_next = nullptr;
+
+  public:
+    // Serializes `headers` and compresses `body` with gzip, unless it is too
+    // small or compression doesn't make it smaller. If `headers` contains no
+    // `ETag:`, a strong entity tag is generated from the body.
+    // `Content-Length`, `Transfer-Encoding`, `Content-Encoding`, `Connection`
+    // and `Date` are ignored.
+    explicit
+    HTTP_Cached_Response(HTTP_Status stat, const Option_Map& headers, const cow_string& body);
+
+  public:
+    ASTERIA_NONCOPYABLE_DESTRUCTOR(HTTP_Cached_Response);
+
+    HTTP_Status
+    status()
+      const noexcept
+      { return this->m_stat;  }
+
+    const cow_string&
+    etag()
+      const noexcept
+      { return this->m_etag;  }
+
+    bool
+    has_gzip()
+      const noexcept
+      { return !this->m_gzip_body.empty();  }
+
+    const cow_string&
+    head(bool gzip)
+      const noexcept
+      { return gzip ? this->m_gzip_head : this->m_identity_head;  }
+
+    const cow_string&
+    body(bool gzip)
+      const noexcept
+      { return gzip ? this->m_gzip_body : this->m_identity_body;  }
+
+    // Gets the number of bytes that this response occupies.
+    size_t
+    size_in_bytes()
+      const noexcept
+      {
+        return this->m_identity_head.size() + this->m_identity_body.size()
+               + this->m_gzip_head.size() + this->m_gzip_body.size()
+               + this->m_etag.size() + this->m_key.size();
+      }
+  };
+
+// This is a cache of responses with least-recently-used eviction.
+// All functions are thread-safe.
+class HTTP_Response_Cache
+  {
+  private:
+    mutable simple_mutex m_mutex;
+    ::std::map<cow_string, rcptr<HTTP_Cached_Response>> m_map;
+    HTTP_Cached_Response* m_lru_head = nullptr;  // most recently used
+    HTTP_Cached_Response* m_lru_tail = nullptr;  // least recently used
+    size_t m_capacity;
+    size_t m_size = 0;
+
+  public:
+    // `capacity` is the maximum number of bytes of all responses.
+    explicit
+    HTTP_Response_Cache(size_t capacity)
+      noexcept
+      : m_capacity(capacity)
+      { }
+
+  private:
+    inline
+    void
+    do_lru_unlink(HTTP_Cached_Response* resp)
+      noexcept;
+
+    inline
+    void
+    do_lru_push_front(HTTP_Cached_Response* resp)
+      noexcept;
+
+  public:
+    ASTERIA_NONCOPYABLE_DESTRUCTOR(HTTP_Response_Cache);
+
+    // Composes a key from a request target and values of request headers that
+    // the response varies with. `Accept-Encoding` need not be specified, as
+    // both identity and gzip bodies are stored.
+    static
+    cow_string
+    make_key(const cow_string& target, const Option_Map& req_headers,
+             ::std::initializer_list<cow_string::shallow_type> vary = { });
+
+    // Gets the number of bytes of all responses.
+    size_t
+    size_in_bytes()
+      const noexcept
+      {
+        simple_mutex::unique_lock lock(this->m_mutex);
+        return this->m_size;
+      }
+
+    // Gets a response. The response is marked most recently used.
+    // If no response has been cached with `key`, a null pointer is returned.
+    rcptr<const HTTP_Cached_Response>
+    find_opt(const cow_string& key);
+
+    // Creates a response and inserts it into the cache, replacing any existent
+    // one with the same key. Least recently used responses are evicted, if the
+    // total size exceeds the capacity. The new response is returned, which may
+    // be sent even if it is too large to be cached.
+    rcptr<const HTTP_Cached_Response>
+    insert(const cow_string& key, HTTP_Status stat, const Option_Map& headers,
+           const cow_string& body);
+
+    // Removes a response.
+    bool
+    erase(const cow_string& key);
+
+    // Removes all responses.
+    void
+    clear()
+      noexcept;
+  };
+
+// Checks whether an entity tag matches a list of entity tags, which is the value
+// of an `If-None-Match:` header. The weak comparison function is used, as
+// described in RFC 7232 section 2.3.2. `*` matches any entity tag.
+bool
+etag_list_matches(const cow_string& list, const cow_string& etag);
+
+}  // namespace poseidon
+
+#endif
@@ -0,0 +1,275 @@
+// This file is part of Poseidon.
+// Copyleft 2020, LH_Mouse. All wrongs reserved.
+
+#include "../precompiled.hpp"
+#include "http_router.hpp"
+#include "enums.hpp"
+#include "../utils.hpp"
+
+namespace poseidon {
+namespace {
+
+inline
+bool
+do_is_special(const char* bp, const char* sp)
+  noexcept
+  {
+    // `:` and `*` are special only at the beginning of a segment.
+    return ((sp[0] == ':') || (sp[0] == '*')) && (sp != bp) && (sp[-1] == '/');
+  }
+
+inline
+uint32_t
+do_method_bit(HTTP_Method meth)
+  noexcept
+  {
+    return 1U << (meth & 31);
+  }
+
+}  // namespace
+
+HTTP_Route_Match::
+~HTTP_Route_Match()
+  {
+  }
+
+const HTTP_Route_Param*
+HTTP_Route_Match::
+find_param(cow_string::shallow_type name)
+  const noexcept
+  {
+    for(size_t k = 0;  k != this->m_nparams;  ++k)
+      if(*(this->m_params[k].name) == name)
+        return this->m_params + k;
+    return nullptr;
+  }
+
+HTTP_Router::
+HTTP_Router()
+  {
+    this->m_nodes.emplace_back();
+  }
+
+HTTP_Router::
+~HTTP_Router()
+  {
+  }
+
+uint32_t
+HTTP_Router::
+do_insert_static(uint32_t index, const char* text, size_t size)
+  {
+    while(size != 0) {
+      // Find a child that shares the first character.
+      auto& firsts = this->m_nodes[index].firsts;
+      const void* pos = ::std::memchr(firsts.data(), text[0], firsts.size());
+      if(!pos) {
+        // Create a new child for the remaining text.
+        uint32_t child = static_cast<uint32_t>(this->m_nodes.size());
+        this->m_nodes.emplace_back();
+        this->m_nodes[child].label.assign(text, size);
+        this->m_nodes[index].firsts.push_back(text[0]);
+        this->m_nodes[index].statics.push_back(child);
+        return child;
+      }
+
+      size_t slot = static_cast<size_t>(static_cast<const char*>(pos) - firsts.data());
+      uint32_t child = this->m_nodes[index].statics[slot];
+
+      // Get the length of the common prefix.
+      const auto& label = this->m_nodes[child].label;
+      size_t nmatch = static_cast<size_t>(::std::mismatch(label.begin(),
+                          label.begin() + static_cast<ptrdiff_t>(::rocket::min(label.size(), size)),
+                          text).first - label.begin());
+
+      if(nmatch != label.size()) {
+        // Split the child. The common prefix is moved into a new node, which
+        // replaces the child.
+        uint32_t mid = static_cast<uint32_t>(this->m_nodes.size());
+        this->m_nodes.emplace_back();
+        auto& mnode = this->m_nodes[mid];
+        auto& cnode = this->m_nodes[child];
+        mnode.label.assign(cnode.label.data(), nmatch);
+        cnode.label.erase(0, nmatch);
+        mnode.firsts.push_back(cnode.label[0]);
+        mnode.statics.push_back(child);
+        this->m_nodes[index].statics[slot] = mid;
+        child = mid;
+      }
+
+      index = child;
+      text += nmatch;
+      size -= nmatch;
+    }
+    return index;
+  }
+
+uint32_t
+HTTP_Router::
+do_insert_special(uint32_t index, uint32_t Node::* child, const char* name, size_t size)
+  {
+    if(size == 0)
+      POSEIDON_THROW("Parameter name must not be empty");
+
+    uint32_t next = this->m_nodes[index].*child;
+    if(next == 0) {
+      // Create a new child.
+      next = static_cast<uint32_t>(this->m_nodes.size());
+      this->m_nodes.emplace_back();
+      this->m_nodes[next].label.assign(name, size);
+      this->m_nodes[index].*child = next;
+      return next;
+    }
+
+    // As parameters are captured by position, their names can't differ.
+    const auto& label = this->m_nodes[next].label;
+    if((label.size() != size) || (::std::memcmp(label.data(), name, size) != 0))
+      POSEIDON_THROW("Conflicting parameter names: `$1` and `$2`",
+                     label, cow_string(name, size));
+    return next;
+  }
+
+bool
+HTTP_Router::
+do_match(HTTP_Route_Match& match, uint32_t index, HTTP_Method meth, const char* sp,
+         const char* ep)
+  const noexcept
+  {
+    const auto& node = this->m_nodes[index];
+
+    if(sp == ep) {
+      // The path ends here. Check for a handler.
+      const void* handler = node.handlers[meth];
+      if(!handler && (meth == http_method_head))
+        handler = node.handlers[http_method_get];
+
+      match.m_methods |= node.methods;
+      if(handler) {
+        match.m_handler = handler;
+        return true;
+      }
+    }
+    else {
+      // Try static children first.
+      const void* pos = ::std::memchr(node.firsts.data(), *sp, node.firsts.size());
+      if(pos) {
+        size_t slot = static_cast<size_t>(static_cast<const char*>(pos) - node.firsts.data());
+        uint32_t child = node.statics[slot];
+        const auto& label = this->m_nodes[child].label;
+        if((label.size() <= static_cast<size_t>(ep - sp))
+             && (::std::memcmp(label.data(), sp, label.size()) == 0)
+             && this->do_match(match, child, meth, sp + label.size(), ep))
+          return true;
+      }
+
+      // Try capturing a segment.
+      const char* tp = ::std::find(sp, ep, '/');
+      if(node.param && (tp != sp) && (match.m_nparams != HTTP_Route_Match::max_params)) {
+        auto& param = match.m_params[match.m_nparams++];
+        param.name = &(this->m_nodes[node.param].label);
+        param.data = sp;
+        param.size = static_cast<size_t>(tp - sp);
+        if(this->do_match(match, node.param, meth, tp, ep))
+          return true;
+
+        match.m_nparams--;
+      }
+    }
+
+    // Try capturing the rest of the path.
+    if(node.wildcard && (match.m_nparams != HTTP_Route_Match::max_params)) {
+      const auto& wnode = this->m_nodes[node.wildcard];
+      const void* handler = wnode.handlers[meth];
+      if(!handler && (meth == http_method_head))
+        handler = wnode.handlers[http_method_get];
+
+      match.m_methods |= wnode.methods;
+      if(handler) {
+        auto& param = match.m_params[match.m_nparams++];
+        param.name = &(wnode.label);
+        param.data = sp;
+        param.size = static_cast<size_t>(ep - sp);
+        match.m_handler = handler;
+        return true;
+      }
+    }
+    return false;
+  }
+
+HTTP_Router&
+HTTP_Router::
+insert(HTTP_Method meth, const cow_string& route, const void* handler)
+  {
+    if(static_cast<size_t>(meth) >= size(this->m_nodes[0].handlers))
+      POSEIDON_THROW("Invalid HTTP method: $1", static_cast<int>(meth));
+
+    if(!handler)
+      POSEIDON_THROW("Null route handler");
+
+    if(route.empty() || (route[0] != '/'))
+      POSEIDON_THROW("Route must start with a slash: $1", route);
+
+    const char* bp = route.data();
+    const char* ep = bp + route.size();
+    const char* sp = bp;
+    uint32_t index = 0;
+    size_t nparams = 0;
+
+    while(sp != ep) {
+      if(!do_is_special(bp, sp)) {
+        // Get static text until the next special segment.
+        const char* tp = sp + 1;
+        while((tp != ep) && !do_is_special(bp, tp))
+          tp++;
+
+        index = this->do_insert_static(index, sp, static_cast<size_t>(tp - sp));
+        sp = tp;
+        continue;
+      }
+
+      if(++nparams > HTTP_Route_Match::max_params)
+        POSEIDON_THROW("Too many parameters in route: $1", route);
+
+      const char* tp = ::std::find(sp, ep, '/');
+      if(sp[0] == ':') {
+        // Capture a segment.
+        index = this->do_insert_special(index, &Node::param, sp + 1,
+                                        static_cast<size_t>(tp - sp - 1));
+        sp = tp;
+        continue;
+      }
+
+      // Capture the rest of the path.
+      if(tp != ep)
+        POSEIDON_THROW("Wildcard must be the last segment: $1", route);
+
+      index = this->do_insert_special(index, &Node::wildcard, sp + 1,
+                                      static_cast<size_t>(tp - sp - 1));
+      sp = tp;
+    }
+
+    auto& node = this->m_nodes[index];
+    if(node.handlers[meth])
+      POSEIDON_THROW("Duplicate route: $1 $2", format_http_method(meth), route);
+
+    node.handlers[meth] = handler;
+    node.methods |= do_method_bit(meth);
+    return *this;
+  }
+
+bool
+HTTP_Router::
+match(HTTP_Route_Match& match, HTTP_Method meth, const cow_string& path)
+  const noexcept
+  {
+    match.m_handler = nullptr;
+    match.m_methods = 0;
+    match.m_nparams = 0;
+
+    if(static_cast<size_t>(meth) >= size(this->m_nodes[0].handlers))
+      return false;
+
+    return this->do_match(match, 0, meth, path.data(), path.data() + path.size());
+  }
+
+}  // namespace poseidon
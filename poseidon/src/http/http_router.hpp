@@ -0,0 +1,151 @@
+// This file is part of Poseidon.
+// Copyleft 2020, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_HTTP_HTTP_ROUTER_HPP_
+#define POSEIDON_HTTP_HTTP_ROUTER_HPP_
+
+#include "../fwd.hpp"
+
+namespace poseidon {
+
+// This is a parameter that has been captured from a request path.
+// `name` points to a string in the router, and `data` points into the path.
+struct HTTP_Route_Param
+  {
+    const cow_string* name;
+    const char* data;
+    size_t size;
+  };
+
+// This is the result of a lookup.
+// It has a fixed capacity, so no memory is allocated during a lookup.
+class HTTP_Route_Match
+  {
+    friend HTTP_Router;
+
+  public:
+    static constexpr size_t max_params = 16;
+
+  private:
+    const void* m_handler = nullptr;
+    uint32_t m_methods = 0;
+    size_t m_nparams = 0;
+    HTTP_Route_Param m_params[max_params];
+
+  public:
+    explicit
+    HTTP_Route_Match()
+      noexcept
+      { }
+
+  public:
+    ASTERIA_COPYABLE_DESTRUCTOR(HTTP_Route_Match);
+
+    // Gets the handler of the matching route, or a null pointer if no route
+    // matches.
+    const void*
+    handler()
+      const noexcept
+      { return this->m_handler;  }
+
+    // Gets methods that are allowed for the path, as a bit mask where bit `1 << M`
+    // denotes `M`. If no route matches, but this is non-zero, a `405 Method Not
+    // Allowed` response should be sent.
+    uint32_t
+    allowed_methods()
+      const noexcept
+      { return this->m_methods;  }
+
+    // Gets captured parameters, in the order in which they appear in the route.
+    size_t
+    param_count()
+      const noexcept
+      { return this->m_nparams;  }
+
+    const HTTP_Route_Param&
+    param(size_t index)
+      const noexcept
+      {
+        ROCKET_ASSERT(index < this->m_nparams);
+        return this->m_params[index];
+      }
+
+    // Gets a parameter by name. If no such parameter exists, a null pointer is
+    // returned.
+    const HTTP_Route_Param*
+    find_param(cow_string::shallow_type name)
+      const noexcept;
+  };
+
+// This is a compressed radix tree that maps methods and paths to handlers.
+// A route is a path that may contain these special segments:
+//   `:name` matches a non-empty segment, which is captured as `name`;
+//   `*name` matches the rest of the path, which may be empty, and is captured
+//           as `name`. It must be the last segment.
+// When multiple routes match a path, static segments are preferred to named
+// segments, which are preferred to wildcards. `HEAD` requests are dispatched to
+// handlers for `GET` if there are no handlers for `HEAD`.
+// Routes shall not be added while lookups are in progress. Lookups may be
+// performed concurrently.
+class HTTP_Router
+  {
+  private:
+    struct Node
+      {
+        cow_string label;  // static text, or the name of the parameter
+        cow_string firsts;  // the first character of each static child
+        ::std::vector<uint32_t> statics;  // static children
+        uint32_t param = 0;  // `:` child
+        uint32_t wildcard = 0;  // `*` child
+        uint32_t methods = 0;
+        const void* handlers[9] = { };
+      };
+
+    // The root node is `m_nodes[0]`. As it is never a child of other nodes,
+    // zero denotes no child.
+    ::std::vector<Node> m_nodes;
+
+  public:
+    explicit
+    HTTP_Router();
+
+  private:
+    uint32_t
+    do_insert_static(uint32_t index, const char* text, size_t size);
+
+    uint32_t
+    do_insert_special(uint32_t index, uint32_t Node::* child, const char* name, size_t size);
+
+    bool
+    do_match(HTTP_Route_Match& match, uint32_t index, HTTP_Method meth, const char* sp,
+             const char* ep)
+      const noexcept;
+
+  public:
+    ASTERIA_NONCOPYABLE_DESTRUCTOR(HTTP_Router);
+
+    // Gets the number of nodes in the tree.
+    size_t
+    node_count()
+      const noexcept
+      { return this->m_nodes.size();  }
+
+    // Adds a route. The router does not take ownership of `handler`, which shall
+    // not be null.
+    // An exception is thrown if the route is invalid, or if there is already a
+    // handler for the same method and route.
+    HTTP_Router&
+    insert(HTTP_Method meth, const cow_string& route, const void* handler);
+
+    // Looks a path up.
+    // If a route matches, its handler is stored in `match`, along with captured
+    // parameters, and `true` is returned. Otherwise, `false` is returned.
+    // This function does not allocate memory.
+    bool
+    match(HTTP_Route_Match& match, HTTP_Method meth, const cow_string& path)
+      const noexcept;
+  };
+
+}  // namespace poseidon
+
+#endif
@@ -0,0 +1,398 @@
+// This file is part of Poseidon.
+// Copyleft 2020, LH_Mouse. All wrongs reserved.
+
+#include "../precompiled.hpp"
+#include "http_static_file_handler.hpp"
+#include "abstract_http_server_encoder.hpp"
+#include "option_map.hpp"
+#include "enums.hpp"
+#include "http_date.hpp"
+#include "http_exception.hpp"
+#include "http_response_cache.hpp"
+#include "url.hpp"
+#include "../utils.hpp"
+#include <fcntl.h>
+#include <sys/stat.h>
+
+namespace poseidon {
+namespace {
+
+struct Content_Type
+  {
+    const char* ext;
+    const char* type;
+  };
+
+constexpr Content_Type s_content_types[] =
+  {
+    { "css",    "text/css; charset=utf-8"         },
+    { "gif",    "image/gif"                       },
+    { "htm",    "text/html; charset=utf-8"        },
+    { "html",   "text/html; charset=utf-8"        },
+    { "ico",    "image/x-icon"                    },
+    { "jpeg",   "image/jpeg"                      },
+    { "jpg",    "image/jpeg"                      },
+    { "js",     "text/javascript; charset=utf-8"  },
+    { "json",   "application/json"                },
+    { "mp3",    "audio/mpeg"                      },
+    { "mp4",    "video/mp4"                       },
+    { "pdf",    "application/pdf"                 },
+    { "png",    "image/png"                       },
+    { "svg",    "image/svg+xml"                   },
+    { "txt",    "text/plain; charset=utf-8"       },
+    { "wasm",   "application/wasm"                },
+    { "webm",   "video/webm"                      },
+    { "webp",   "image/webp"                      },
+    { "woff",   "font/woff"                       },
+    { "woff2",  "font/woff2"                      },
+    { "xml",    "application/xml"                 },
+    { "zip",    "application/zip"                 },
+  };
+
+const char*
+do_get_content_type(const cow_string& fpath)
+  {
+    // Get the extension of the file name.
+    size_t dpos = fpath.rfind('.');
+    if((dpos == cow_string::npos) || (fpath.find('/', dpos) != cow_string::npos))
+      return "application/octet-stream";
+
+    const char* ext = fpath.c_str() + dpos + 1;
+    for(const auto& r : s_content_types)
+      if(ascii_ci_equal(sref(ext), sref(r.ext)))
+        return r.type;
+    return "application/octet-stream";
+  }
+
+void
+do_append_hex(cow_string& str, uint64_t value)
+  {
+    ::rocket::ascii_numput nump;
+    nump.put_XU(value);
+    str.append(nump.data() + 2, nump.size() - 2);
+  }
+
+void
+do_append_decimal(cow_string& str, uint64_t value)
+  {
+    ::rocket::ascii_numput nump;
+    nump.put_DU(value);
+    str.append(nump.data(), nump.size());
+  }
+
+bool
+do_parse_offset(int64_t& value, const char*& sp, const char* ep)
+  {
+    ::rocket::ascii_numget numg;
+    uint64_t val;
+    if(!numg.parse_U(sp, ep, 10) || !numg.cast_U(val, 0, INT64_MAX))
+      return false;
+
+    value = static_cast<int64_t>(val);
+    return true;
+  }
+
+enum Range_Result : uint8_t
+  {
+    range_result_ignored        = 0,
+    range_result_satisfiable    = 1,
+    range_result_unsatisfiable  = 2,
+  };
+
+Range_Result
+do_parse_byte_range(int64_t& first, int64_t& last, const cow_string& str, int64_t size)
+  {
+    // Only a single range is supported. Requests for multiple ranges are
+    // served as a whole, which is allowed by RFC 7233.
+    if((str.size() < 6) || (::std::memcmp(str.data(), "bytes=", 6) != 0))
+      return range_result_ignored;
+
+    const char* sp = str.data() + 6;
+    const char* ep = str.data() + str.size();
+    if(::std::find(sp, ep, ',') != ep)
+      return range_result_ignored;
+
+    if(*sp == '-') {
+      // This is a suffix range, such as `bytes=-500`.
+      int64_t count;
+      if(!do_parse_offset(count, ++sp, ep) || (sp != ep))
+        return range_result_ignored;
+
+      if((count == 0) || (size == 0))
+        return range_result_unsatisfiable;
+
+      first = size - ::rocket::min(count, size);
+      last = size - 1;
+      return range_result_satisfiable;
+    }
+
+    // This is a range with an explicit start, such as `bytes=500-` or
+    // `bytes=500-999`.
+    if(!do_parse_offset(first, sp, ep) || (sp == ep) || (*sp != '-'))
+      return range_result_ignored;
+
+    last = INT64_MAX;
+    if((++sp != ep) && (!do_parse_offset(last, sp, ep) || (sp != ep) || (last < first)))
+      return range_result_ignored;
+
+    if(first >= size)
+      return range_result_unsatisfiable;
+
+    last = ::rocket::min(last, size - 1);
+    return range_result_satisfiable;
+  }
+
+void
+do_open_file(unique_FD& fd, struct ::stat& st, const cow_string& root, const cow_string& fpath,
+             const cow_string& path)
+  {
+    // Resolve symbolic links, which must not point outside the root directory.
+    // The resolved path is opened with `O_NOFOLLOW`, so its last component can't
+    // be replaced with a symbolic link in the meantime.
+    fd.reset();
+    auto rpath = ::rocket::make_unique_handle(::realpath(fpath.c_str(), nullptr), ::free);
+    if(rpath) {
+      if((::std::strncmp(rpath.get(), root.c_str(), root.size()) != 0)
+         || ((rpath.get()[root.size()] != '/') && (rpath.get()[root.size()] != 0)))
+        POSEIDON_HTTP_THROW(http_status_forbidden, "Access denied: $1", path);
+
+      fd.reset(::open(rpath.get(), O_RDONLY | O_CLOEXEC | O_NONBLOCK | O_NOFOLLOW));
+    }
+
+    if(!fd) {
+      int err = errno;
+      if((err == EACCES) || (err == ELOOP))
+        POSEIDON_HTTP_THROW(http_status_forbidden, "Access denied: $1", path);
+
+      POSEIDON_HTTP_THROW(http_status_not_found, "File not found: $1\n"
+                          "[`open()` failed: $2]",
+                          path, format_errno(err));
+    }
+
+    if(::fstat(fd.get(), &st) != 0)
+      POSEIDON_THROW("Could not get file status of '$2'\n"
+                     "[`fstat()` failed: $1]",
+                     format_errno(errno), fpath);
+  }
+
+}  // namespace
+
+HTTP_Static_File_Handler::
+HTTP_Static_File_Handler(const cow_string& root)
+  {
+    // Resolve the root directory, so it need not be resolved again.
+    auto rpath = ::rocket::make_unique_handle(::realpath(root.c_str(), nullptr), ::free);
+    if(!rpath)
+      POSEIDON_THROW("Could not resolve path '$2'\n"
+                     "[`realpath()` failed: $1]",
+                     format_errno(errno), root);
+
+    struct ::stat st;
+    if((::stat(rpath.get(), &st) != 0) || !S_ISDIR(st.st_mode))
+      POSEIDON_THROW("Static file root '$1' is not a directory", root);
+
+    this->m_root.assign(rpath.get());
+    if(this->m_root == "/")
+      this->m_root.clear();
+  }
+
+HTTP_Static_File_Handler::
+~HTTP_Static_File_Handler()
+  {
+  }
+
+cow_string
+HTTP_Static_File_Handler::
+resolve_path(const cow_string& path)
+  const
+  {
+    if(path.empty() || (path[0] != '/'))
+      return { };
+
+    if(path.find('\0') != cow_string::npos)
+      return { };
+
+    cow_string fpath = this->m_root;
+    const char* bp = path.data();
+    const char* ep = bp + path.size();
+    while(bp != ep) {
+      // Get a segment.
+      bp = ::std::find_if(bp, ep, [](char ch) { return ch != '/';  });
+      const char* sp = ::std::find(bp, ep, '/');
+      size_t len = static_cast<size_t>(sp - bp);
+
+      // Paths must not escape from the root directory.
+      if((len == 2) && (::std::memcmp(bp, "..", 2) == 0))
+        return { };
+
+      if((len != 0) && !((len == 1) && (*bp == '.'))) {
+        fpath.push_back('/');
+        fpath.append(bp, len);
+      }
+      bp = sp;
+    }
+
+    if(fpath.empty())
+      fpath.push_back('/');
+    return fpath;
+  }
+
+bool
+HTTP_Static_File_Handler::
+serve(Abstract_HTTP_Server_Encoder& enc, HTTP_Version ver, HTTP_Method meth,
+      const cow_string& path, const Option_Map& req_headers)
+  const
+  {
+    if(!::rocket::is_any_of(meth, {http_method_get, http_method_head}))
+      POSEIDON_HTTP_THROW(http_status_method_not_allowed,
+                          "Method not allowed for static files: $1",
+                          format_http_method(meth));
+
+    auto fpath = this->resolve_path(path);
+    if(fpath.empty())
+      POSEIDON_HTTP_THROW(http_status_bad_request, "Invalid path: $1", path);
+
+    // Open the file. For directories, try `index.html` in it.
+    unique_FD fd;
+    struct ::stat st;
+    do_open_file(fd, st, this->m_root, fpath, path);
+
+    if(S_ISDIR(st.st_mode) && (path[path.size() - 1] != '/')) {
+      // Redirect to the directory with a trailing slash, so relative links in
+      // its `index.html` work. Leading slashes are collapsed, otherwise the
+      // location could be taken as a network-path reference to another host.
+      size_t pos = path.find_first_not_of('/');
+      URL url;
+      url.set_path(path.substr(pos));
+
+      ::rocket::tinyfmt_str fmt;
+      fmt << '/' << url << '/';
+
+      Option_Map headers;
+      headers.set(sref("Location"), fmt.get_string());
+      headers.set(sref("Content-Length"), sref("0"));
+
+      if(!enc.http_encode_headers(ver, http_status_moved_permanently,
+                                  ::std::move(headers), meth, path))
+        return false;
+
+      return (enc.http_encoder_state() != http_encoder_state_entity)
+             || enc.http_encode_end_of_entity();
+    }
+
+    if(S_ISDIR(st.st_mode)) {
+      fpath.append("/index.html");
+      do_open_file(fd, st, this->m_root, fpath, path);
+    }
+
+    if(!S_ISREG(st.st_mode))
+      POSEIDON_HTTP_THROW(http_status_not_found, "Not a regular file: $1", path);
+
+    // Make the entity tag from the size and the modification time, so it is not
+    // necessary to read the file.
+    int64_t size = static_cast<int64_t>(st.st_size);
+    int64_t mtime = static_cast<int64_t>(st.st_mtim.tv_sec);
+
+    cow_string etag;
+    etag.push_back('\"');
+    do_append_hex(etag, static_cast<uint64_t>(size));
+    etag.push_back('-');
+    do_append_hex(etag, static_cast<uint64_t>(mtime) * 1000000000
+                        + static_cast<uint64_t>(st.st_mtim.tv_nsec));
+    etag.push_back('\"');
+
+    char last_modified[32];
+    format_http_date(last_modified, mtime);
+
+    Option_Map headers;
+    headers.set(sref("ETag"), etag);
+    headers.set(sref("Last-Modified"), sref(last_modified));
+
+    // Check for conditional requests. `If-Modified-Since:` is ignored if
+    // `If-None-Match:` is present. See RFC 7232 section 6.
+    bool not_modified = false;
+    if(req_headers.count(sref("If-None-Match")))
+      req_headers.for_each(sref("If-None-Match"),
+          [&](const cow_string& str) {
+            if(etag_list_matches(str, etag))
+              not_modified = true;
+          });
+    else {
+      auto qstr = req_headers.find_opt(sref("If-Modified-Since"));
+      int64_t since;
+      if(qstr && parse_http_date(since, qstr->data(), qstr->size()) && (mtime <= since))
+        not_modified = true;
+    }
+
+    if(not_modified)
+      return enc.http_encode_headers(ver, http_status_not_modified, ::std::move(headers),
+                                     meth, path);
+
+    // Check for range requests. If `If-Range:` is present, the range is served
+    // only if the file has not been modified. Weak entity tags never match.
+    HTTP_Status stat = http_status_ok;
+    int64_t first = 0;
+    int64_t last = size - 1;
+
+    auto qrange = req_headers.find_opt(sref("Range"));
+    if(qrange) {
+      auto qif = req_headers.find_opt(sref("If-Range"));
+      if(qif && (*qif != etag) && (*qif != last_modified))
+        qrange = nullptr;
+    }
+
+    switch(qrange ? do_parse_byte_range(first, last, *qrange, size) : range_result_ignored) {
+      case range_result_ignored:
+        first = 0;
+        last = size - 1;
+        break;
+
+      case range_result_satisfiable: {
+        stat = http_status_partial_content;
+        auto& crange = headers.open(sref("Content-Range"));
+        crange = sref("bytes ");
+        do_append_decimal(crange, static_cast<uint64_t>(first));
+        crange.push_back('-');
+        do_append_decimal(crange, static_cast<uint64_t>(last));
+        crange.push_back('/');
+        do_append_decimal(crange, static_cast<uint64_t>(size));
+        break;
+      }
+
+      case range_result_unsatisfiable: {
+        auto& crange = headers.open(sref("Content-Range"));
+        crange = sref("bytes */");
+        do_append_decimal(crange, static_cast<uint64_t>(size));
+        headers.set(sref("Content-Length"), sref("0"));
+
+        if(!enc.http_encode_headers(ver, http_status_range_not_satisfiable,
+                                    ::std::move(headers), meth, path))
+          return false;
+
+        return (enc.http_encoder_state() != http_encoder_state_entity)
+               || enc.http_encode_end_of_entity();
+      }
+
+      default:
+        ROCKET_ASSERT(false);
+    }
+
+    // Send the file.
+    cow_string clen;
+    do_append_decimal(clen, static_cast<uint64_t>(last + 1 - first));
+    headers.set(sref("Content-Length"), ::std::move(clen));
+    headers.set(sref("Content-Type"), sref(do_get_content_type(fpath)));
+    headers.set(sref("Accept-Ranges"), sref("bytes"));
+
+    if(!enc.http_encode_headers(ver, stat, ::std::move(headers), meth, path))
+      return false;
+
+    // No entity is expected for HEAD requests.
+    if(enc.http_encoder_state() != http_encoder_state_entity)
+      return true;
+
+    enc.http_encode_entity_file(fd.get(), first, last + 1 - first);
+    return enc.http_encode_end_of_entity();
+  }
+
+}  // namespace poseidon
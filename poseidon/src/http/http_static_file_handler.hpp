@@ -0,0 +1,62 @@
+// This file is part of Poseidon.
+// Copyleft 2020, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_HTTP_HTTP_STATIC_FILE_HANDLER_HPP_
+#define POSEIDON_HTTP_HTTP_STATIC_FILE_HANDLER_HPP_
+
+#include "../fwd.hpp"
+
+namespace poseidon {
+
+// This class serves regular files under a root directory.
+// Conditional requests (`If-None-Match:` and `If-Modified-Since:`) and single
+// byte ranges (`Range:` and `If-Range:`) are supported. Files are sent with
+// `Abstract_HTTP_Server_Encoder::http_encode_entity_file()`, so they are never
+// read into memory as a whole.
+// All functions are thread-safe.
+class HTTP_Static_File_Handler
+  {
+  private:
+    cow_string m_root;  // without a trailing slash
+
+  public:
+    // `root` shall designate an existent directory.
+    explicit
+    HTTP_Static_File_Handler(const cow_string& root);
+
+  public:
+    ASTERIA_NONCOPYABLE_DESTRUCTOR(HTTP_Static_File_Handler);
+
+    // Gets the absolute path to the root directory.
+    const cow_string&
+    root()
+      const noexcept
+      { return this->m_root;  }
+
+    // Maps a decoded request path to a path on the file system.
+    // Empty segments and `.` are ignored. If the path does not start with a slash,
+    // or contains `..` or null characters, an empty string is returned.
+    cow_string
+    resolve_path(const cow_string& path)
+      const;
+
+    // Serves a file.
+    // `http_encoder_state()` of `enc` must be 'closed' or 'headers'.
+    // `meth` and `req_headers` shall be copied from a previous request. `path` shall
+    // be the decoded path of its target. If the path refers to a directory and ends
+    // with a slash, `index.html` in that directory is served; otherwise, a 301
+    // response redirects to the path with a trailing slash. Symbolic links are
+    // followed only if they resolve to paths within the root directory.
+    // An `HTTP_Exception` is thrown if the file cannot be served, with one of these
+    // status codes: 400 (invalid path), 403 (access denied or a symbolic link out of
+    // the root directory), 404 (not found or not a regular file) or 405 (method other
+    // than GET or HEAD).
+    bool
+    serve(Abstract_HTTP_Server_Encoder& enc, HTTP_Version ver, HTTP_Method meth,
+          const cow_string& path, const Option_Map& req_headers)
+      const;
+  };
+
+}  // namespace poseidon
+
+#endif
@@ -4,10 +4,14 @@
 #include "../precompiled.hpp"
 #include "option_map.hpp"
 #include "../utils.hpp"
+#include "../details/option_map_ctype.ipp"
+#include <array>
 
 namespace poseidon {
 namespace {
 
+using namespace details_option_map;
+
 template<typename BucketT>
 BucketT&
 do_linear_probe(BucketT* bptr, BucketT* eptr, cow_string::shallow_type key, size_t hval)
@@ -15,9 +19,11 @@ do_linear_probe(BucketT* bptr, BucketT* eptr, cow_string::shallow_type key, size
     // Find a bucket using linear probing.
     // We keep the load factor below 1.0 so there will always be some empty
     // buckets in the table.
+    // Hashes are compared first, so keys are only compared on collisions.
     auto mptr = ::rocket::get_probing_origin(bptr, eptr, hval);
     auto qbkt = ::rocket::linear_probe(bptr, mptr, mptr, eptr,
-            [&](const details_option_map::Bucket& r) { return r.key_equals(key);  });
+            [&](const details_option_map::Bucket& r) {
+              return (r.hash() == hval) && r.key_equals(key);  });
     ROCKET_ASSERT(qbkt);
     return *qbkt;
   }
@@ -32,46 +38,168 @@ do_bucket_index(const ::rocket::cow_vector<details_option_map::Bucket>& stor,
     return static_cast<size_t>(&r - bptr);
   }
 
-enum : uint8_t
+size_t
+do_small_index(const details_option_map::Inline_Table& small,
+               cow_string::shallow_type key, size_t hval)
+  noexcept
   {
-    opt_ctype_control     = 0x01,  // control characters other than TAB
-    opt_ctype_query_safe  = 0x02,  // usable in URL queries unquoted
-    opt_ctype_http_tchar  = 0x04,  // token characters in HTTP headers
-  };
+    // Buckets in the inline table are contiguous and unordered, so search
+    // them one by one. `SIZE_MAX` is returned if the key is not found.
+    auto bptr = small.data();
+    for(size_t k = 0;  k != small.size();  ++k)
+      if(bptr[k] && (bptr[k].hash() == hval) && bptr[k].key_equals(key))
+        return k;
+    return SIZE_MAX;
+  }
 
-constexpr uint8_t s_opt_ctype_table[128] =
+struct Well_Known_Key
   {
-    0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
-    0x01, 0x00, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
-    0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
-    0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
-    0x00, 0x06, 0x00, 0x04, 0x06, 0x04, 0x04, 0x06,
-    0x02, 0x02, 0x06, 0x04, 0x02, 0x06, 0x06, 0x02,
-    0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06,
-    0x06, 0x06, 0x02, 0x02, 0x00, 0x00, 0x00, 0x02,
-    0x02, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06,
-    0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06,
-    0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06,
-    0x06, 0x06, 0x06, 0x00, 0x00, 0x00, 0x04, 0x06,
-    0x04, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06,
-    0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06,
-    0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06,
-    0x06, 0x06, 0x06, 0x00, 0x04, 0x00, 0x06, 0x01,
+    const char* str;
+    size_t len;
   };
 
-constexpr
-uint8_t
-do_get_opt_ctype(char c)
-  noexcept
-  { return (uint8_t(c) < 128) ? s_opt_ctype_table[uint8_t(c)] : 0;  }
+// These are well-known HTTP header names, indexed by `do_well_known_slot()`.
+// This table is generated such that there are no collisions.
+constexpr Well_Known_Key s_well_known_keys[128] =
+  {
+    { nullptr,                          0 },  // 0
+    { "Expires",                        7 },  // 1
+    { nullptr,                          0 },  // 2
+    { "Last-Modified",                 13 },  // 3
+    { "Content-Type",                  12 },  // 4
+    { "Content-Length",                14 },  // 5
+    { nullptr,                          0 },  // 6
+    { nullptr,                          0 },  // 7
+    { nullptr,                          0 },  // 8
+    { "Retry-After",                   11 },  // 9
+    { nullptr,                          0 },  // 10
+    { "Date",                           4 },  // 11
+    { nullptr,                          0 },  // 12
+    { nullptr,                          0 },  // 13
+    { "Proxy-Connection",              16 },  // 14
+    { nullptr,                          0 },  // 15
+    { nullptr,                          0 },  // 16
+    { "Accept-Encoding",               15 },  // 17
+    { "Sec-WebSocket-Version",         21 },  // 18
+    { "Pragma",                         6 },  // 19
+    { nullptr,                          0 },  // 20
+    { nullptr,                          0 },  // 21
+    { nullptr,                          0 },  // 22
+    { "Content-Location",              16 },  // 23
+    { nullptr,                          0 },  // 24
+    { nullptr,                          0 },  // 25
+    { nullptr,                          0 },  // 26
+    { nullptr,                          0 },  // 27
+    { nullptr,                          0 },  // 28
+    { nullptr,                          0 },  // 29
+    { nullptr,                          0 },  // 30
+    { "Expect",                         6 },  // 31
+    { nullptr,                          0 },  // 32
+    { nullptr,                          0 },  // 33
+    { "Sec-WebSocket-Extensions",      24 },  // 34
+    { "Sec-WebSocket-Key",             17 },  // 35
+    { nullptr,                          0 },  // 36
+    { "Content-Range",                 13 },  // 37
+    { nullptr,                          0 },  // 38
+    { nullptr,                          0 },  // 39
+    { nullptr,                          0 },  // 40
+    { nullptr,                          0 },  // 41
+    { nullptr,                          0 },  // 42
+    { "User-Agent",                    10 },  // 43
+    { "Content-Disposition",           19 },  // 44
+    { nullptr,                          0 },  // 45
+    { "WWW-Authenticate",              16 },  // 46
+    { nullptr,                          0 },  // 47
+    { "Set-Cookie",                    10 },  // 48
+    { nullptr,                          0 },  // 49
+    { nullptr,                          0 },  // 50
+    { nullptr,                          0 },  // 51
+    { nullptr,                          0 },  // 52
+    { "Referer",                        7 },  // 53
+    { nullptr,                          0 },  // 54
+    { "Accept-Charset",                14 },  // 55
+    { "Content-Language",              16 },  // 56
+    { "Upgrade",                        7 },  // 57
+    { nullptr,                          0 },  // 58
+    { nullptr,                          0 },  // 59
+    { nullptr,                          0 },  // 60
+    { nullptr,                          0 },  // 61
+    { "Via",                            3 },  // 62
+    { nullptr,                          0 },  // 63
+    { "Transfer-Encoding",             17 },  // 64
+    { nullptr,                          0 },  // 65
+    { nullptr,                          0 },  // 66
+    { nullptr,                          0 },  // 67
+    { nullptr,                          0 },  // 68
+    { nullptr,                          0 },  // 69
+    { nullptr,                          0 },  // 70
+    { nullptr,                          0 },  // 71
+    { "Authorization",                 13 },  // 72
+    { "Sec-WebSocket-Protocol",        22 },  // 73
+    { nullptr,                          0 },  // 74
+    { nullptr,                          0 },  // 75
+    { "Keep-Alive",                    10 },  // 76
+    { nullptr,                          0 },  // 77
+    { nullptr,                          0 },  // 78
+    { nullptr,                          0 },  // 79
+    { "Content-Encoding",              16 },  // 80
+    { nullptr,                          0 },  // 81
+    { nullptr,                          0 },  // 82
+    { nullptr,                          0 },  // 83
+    { "Cookie",                         6 },  // 84
+    { "Proxy-Authorization",           19 },  // 85
+    { nullptr,                          0 },  // 86
+    { nullptr,                          0 },  // 87
+    { nullptr,                          0 },  // 88
+    { "If-Unmodified-Since",           19 },  // 89
+    { nullptr,                          0 },  // 90
+    { "Sec-WebSocket-Accept",          20 },  // 91
+    { nullptr,                          0 },  // 92
+    { "Server",                         6 },  // 93
+    { nullptr,                          0 },  // 94
+    { nullptr,                          0 },  // 95
+    { nullptr,                          0 },  // 96
+    { "If-Match",                       8 },  // 97
+    { "Range",                          5 },  // 98
+    { "Accept",                         6 },  // 99
+    { "Access-Control-Allow-Origin",   27 },  // 100
+    { "If-Modified-Since",             17 },  // 101
+    { "Location",                       8 },  // 102
+    { "Connection",                    10 },  // 103
+    { nullptr,                          0 },  // 104
+    { "X-Forwarded-For",               15 },  // 105
+    { nullptr,                          0 },  // 106
+    { "Age",                            3 },  // 107
+    { "If-Range",                       8 },  // 108
+    { "Allow",                          5 },  // 109
+    { "If-None-Match",                 13 },  // 110
+    { nullptr,                          0 },  // 111
+    { nullptr,                          0 },  // 112
+    { "Vary",                           4 },  // 113
+    { nullptr,                          0 },  // 114
+    { "Accept-Ranges",                 13 },  // 115
+    { nullptr,                          0 },  // 116
+    { nullptr,                          0 },  // 117
+    { "Host",                           4 },  // 118
+    { nullptr,                          0 },  // 119
+    { nullptr,                          0 },  // 120
+    { "Accept-Language",               15 },  // 121
+    { "ETag",                           4 },  // 122
+    { nullptr,                          0 },  // 123
+    { "Cache-Control",                 13 },  // 124
+    { nullptr,                          0 },  // 125
+    { nullptr,                          0 },  // 126
+    { "Origin",                         6 },  // 127
+  };
 
 constexpr
-bool
-do_is_opt_ctype(char c, uint8_t mask)
+size_t
+do_well_known_slot(const char* str, size_t len)
   noexcept
-  { return do_get_opt_ctype(c) & mask;  }
-
-constexpr char s_xdigits[] = "00112233445566778899AaBbCcDdEeFf";
+  {
+    return (len * 33 + (uint8_t(str[0]) | 0x20U) * 15 + (uint8_t(str[len-1]) | 0x20U) * 39
+            + (uint8_t(str[len/2]) | 0x20U) * 26) % 128;
+  }
 
 tinyfmt&
 do_encode_query(tinyfmt& fmt, const cow_string& str)
@@ -80,8 +208,7 @@ do_encode_query(tinyfmt& fmt, const cow_string& str)
     const char* ep = bp + str.size();
     for(;;) {
       // Get the first sequence of safe characters.
-      const char* mp = ::std::find_if(bp, ep,
-             [&](char ch) { return !do_is_opt_ctype(ch, opt_ctype_query_safe);  });
+      const char* mp = do_find_query_unsafe(bp, ep);
       if(mp != bp)
         fmt.putn(bp, static_cast<size_t>(mp - bp));
 
@@ -108,17 +235,25 @@ do_encode_query(tinyfmt& fmt, const cow_string& str)
 cow_string&
 do_decode_query(cow_string& str, const char* bptr, const char* eptr)
   {
+    // Decoding never makes a string longer, so the result is written in place,
+    // and the string is truncated afterwards.
     str.clear();
+    str.append(static_cast<size_t>(eptr - bptr), '\0');
+    char* wp = str.mut_data();
+
     const char* bp = bptr;
-    while(bp != eptr) {
-      // Process non-percent sequences.
+    for(;;) {
+      // Copy the sequence of characters that need no decoding.
+      const char* mp = do_find_query_escape(bp, eptr);
+      ::std::memcpy(wp, bp, static_cast<size_t>(mp - bp));
+      wp += mp - bp;
+      bp = mp;
+      if(bp == eptr)
+        break;
+
       uint32_t val = static_cast<uint8_t>(*(bp++));
       if(val == '+') {
-        str += ' ';
-        continue;
-      }
-      else if(val != '%') {
-        str += static_cast<char>(val);
+        *(wp++) = ' ';
         continue;
       }
 
@@ -132,13 +267,45 @@ do_decode_query(cow_string& str, const char* bptr, const char* eptr)
 
         val = val << 4 | static_cast<uint32_t>(dp - s_xdigits) >> 1;
       }
-      str += static_cast<char>(val);
+      *(wp++) = static_cast<char>(val);
     }
+
+    str.erase(static_cast<size_t>(wp - str.data()));
     return str;
   }
 
 } // namespace
 
+size_t
+details_option_map::
+key_hash(cow_string::shallow_type key)
+  noexcept
+  {
+    static const auto s_hashes = []{
+        ::std::array<size_t, 128> hashes = { };
+        for(size_t k = 0;  k != hashes.size();  ++k)
+          if(s_well_known_keys[k].str)
+            hashes[k] = ::rocket::ascii_ci_hash(s_well_known_keys[k].str,
+                                                s_well_known_keys[k].len);
+        return hashes;
+      }();
+
+    const char* str = key.c_str();
+    size_t len = key.length();
+    if((len == 0) || (len > 32))
+      return ::rocket::ascii_ci_hash(str, len);
+
+    // Check whether this is a well-known key. Most keys are spelt in their
+    // canonical forms, so try an exact comparison first.
+    size_t slot = do_well_known_slot(str, len);
+    const auto& wk = s_well_known_keys[slot];
+    if((wk.len == len) && ((::std::memcmp(wk.str, str, len) == 0) ||
+                           ::rocket::ascii_ci_equal(wk.str, len, str, len)))
+      return s_hashes[slot];
+
+    return ::rocket::ascii_ci_hash(str, len);
+  }
+
 Option_Map::
 ~Option_Map()
   {
@@ -149,8 +316,13 @@ Option_Map::
 do_range_hint(cow_string::shallow_type key, size_t hval)
   const noexcept
   {
-    if(this->m_stor.empty())
-      return { };
+    if(this->m_stor.empty()) {
+      size_t index = do_small_index(this->m_small, key, hval);
+      if(index == SIZE_MAX)
+        return { };
+
+      return this->m_small.data()[index].range();
+    }
 
     size_t index = do_bucket_index(this->m_stor, key, hval);
     return this->m_stor[index].range();
@@ -160,8 +332,13 @@ pair<cow_string*, cow_string*>
 Option_Map::
 do_mut_range_hint(cow_string::shallow_type key, size_t hval)
   {
-    if(this->m_stor.empty())
-      return { };
+    if(this->m_stor.empty()) {
+      size_t index = do_small_index(this->m_small, key, hval);
+      if(index == SIZE_MAX)
+        return { };
+
+      return this->m_small.mut_data()[index].mut_range();
+    }
 
     size_t index = do_bucket_index(this->m_stor, key, hval);
     if(this->m_stor[index].count() == 0)
@@ -174,8 +351,16 @@ size_t
 Option_Map::
 do_erase_hint(cow_string::shallow_type key, size_t hval)
   {
-    if(this->m_stor.empty())
-      return 0;
+    if(this->m_stor.empty()) {
+      size_t index = do_small_index(this->m_small, key, hval);
+      if(index == SIZE_MAX)
+        return 0;
+
+      size_t count = this->m_small.data()[index].count();
+      this->m_small.erase(index);
+      this->m_nbkt -= 1;
+      return count;
+    }
 
     size_t index = do_bucket_index(this->m_stor, key, hval);
     size_t count = this->m_stor[index].count();
@@ -204,7 +389,7 @@ do_erase_hint(cow_string::shallow_type key, size_t hval)
         // Find a new bucket for the name using linear probing.
         // Uniqueness has already been implied for all elements, so there is no
         // need to check for collisions.
-        auto mptr = ::rocket::get_probing_origin(bptr, eptr, r.hash());
+        auto mptr = ::rocket::get_probing_origin(bptr, eptr, temp.hash());
         auto qbkt = ::rocket::linear_probe(bptr, mptr, mptr, eptr,
                       [&](const details_option_map::Bucket&) { return false;  });
         ROCKET_ASSERT(qbkt);
@@ -222,10 +407,20 @@ details_option_map::Bucket&
 Option_Map::
 do_reserve(const cow_string& key, size_t hval)
   {
-    auto bptr = this->m_stor.mut_data();
-    auto eptr = bptr + this->m_stor.size();
+    if(this->m_stor.empty()) {
+      // Use any existent bucket if an equivalent key has been found.
+      size_t index = do_small_index(this->m_small, sref(key), hval);
+      if(index != SIZE_MAX)
+        return this->m_small.mut_data()[index];
+
+      // If the inline table is not full, append an empty bucket.
+      if(this->m_small.size() < this->m_small.capacity())
+        return this->m_small.emplace_back();
+    }
+    else {
+      auto bptr = this->m_stor.mut_data();
+      auto eptr = bptr + this->m_stor.size();
 
-    if(bptr != eptr) {
       // Use any existent bucket if an equivalent key has been found.
       auto& bkt = do_linear_probe(bptr, eptr, sref(key), hval);
       if(bkt)
@@ -238,18 +433,21 @@ do_reserve(const cow_string& key, size_t hval)
 
     // Allocate a new table.
     ::rocket::cow_vector<details_option_map::Bucket> stor(this->m_nbkt * 3 | 17);
-    bptr = stor.mut_data();
-    eptr = bptr + stor.size();
+    auto bptr = stor.mut_data();
+    auto eptr = bptr + stor.size();
 
     // Move-assign buckets into the new table.
-    ::std::for_each(this->m_stor.mut_begin(), this->m_stor.mut_end(),
+    auto qptr = this->do_mut_table_data();
+    ::std::for_each(qptr, qptr + this->do_table_size(),
       [&](details_option_map::Bucket& r) {
         if(r.count())
           do_linear_probe(bptr, eptr, sref(r.key()), r.hash()) = ::std::move(r);
       });
 
-    // Set up the new table.
+    // Set up the new table. If buckets have been moved out of the inline
+    // table, clear it, as it will not be used any further.
     this->m_stor.swap(stor);
+    this->m_small.clear();
 
     // Find a bucket for the given key.
     return do_linear_probe(bptr, eptr, sref(key), hval);
@@ -293,7 +491,10 @@ print(tinyfmt& fmt)
   const
   {
     fmt << "{";
-    for(const auto& bkt : this->m_stor) {
+    auto bptr = this->do_table_data();
+    auto eptr = bptr + this->do_table_size();
+    while(bptr != eptr) {
+      const auto& bkt = *(bptr++);
       for(auto r = bkt.range();  r.first != r.second;  r.first++) {
         // Indent each line a bit.
         fmt << "\n  ";
@@ -314,7 +515,10 @@ print_url_query(tinyfmt& fmt)
   const
   {
     size_t count = SIZE_MAX;
-    for(const auto& bkt : this->m_stor) {
+    auto bptr = this->do_table_data();
+    auto eptr = bptr + this->do_table_size();
+    while(bptr != eptr) {
+      const auto& bkt = *(bptr++);
       for(auto r = bkt.range();  r.first != r.second;  r.first++) {
         // Separate elements with ampersands.
         if(++count)
@@ -402,7 +606,10 @@ print_http_header(tinyfmt& fmt)
     }
 
     // Write options.
-    for(const auto& bkt : this->m_stor) {
+    auto bptr = this->do_table_data();
+    auto eptr = bptr + this->do_table_size();
+    while(bptr != eptr) {
+      const auto& bkt = *(bptr++);
       if(bkt.key().empty())
         continue;
 
@@ -493,11 +700,16 @@ parse_http_header(size_t* comma_opt, const cow_string& str, size_t nonopts)
       bp = ::std::addressof(str.at(*comma_opt));
 
     // Skip leading blank characters and commas.
-    // Note that leading commas are always skipped despite `comma_opt`.
+    // Note that leading commas are always skipped despite `comma_opt`. Empty
+    // list elements are allowed by RFC 7230, so if nothing else follows, the
+    // end of input is reported, lest the caller loop forever.
     bp = ::std::find_if(bp, ep,
               [&](char ch) { return ::rocket::is_none_of(ch, {' ', '\t', ','});  });
-    if(bp == ep)
+    if(bp == ep) {
+      if(comma_opt)
+        *comma_opt = str.size();
       return *this;
+    }
 
     size_t count = SIZE_MAX;
     cow_string key;
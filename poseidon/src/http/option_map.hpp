@@ -18,16 +18,33 @@ class Option_Map
     using reverse_iterator        = ::std::reverse_iterator<iterator>;
 
   private:
+    // Keys are stored in `m_small` until it is full, after which they are
+    // moved into `m_stor`. `m_small` is not used if `m_stor` is non-empty.
+    details_option_map::Inline_Table m_small;
     ::rocket::cow_vector<details_option_map::Bucket> m_stor;
     size_t m_nbkt = 0;
 
   public:
-    explicit constexpr
+    explicit
     Option_Map()
       noexcept
       = default;
 
   private:
+    const details_option_map::Bucket*
+    do_table_data()
+      const noexcept
+      { return this->m_stor.empty() ? this->m_small.data() : this->m_stor.data();  }
+
+    details_option_map::Bucket*
+    do_mut_table_data()
+      { return this->m_stor.empty() ? this->m_small.mut_data() : this->m_stor.mut_data();  }
+
+    size_t
+    do_table_size()
+      const noexcept
+      { return this->m_stor.empty() ? this->m_small.size() : this->m_stor.size();  }
+
     ROCKET_PURE_FUNCTION
     pair<const cow_string*, const cow_string*>
     do_range_hint(cow_string::shallow_type key, size_t hval)
@@ -56,13 +73,13 @@ class Option_Map
     const_iterator
     begin()
       const noexcept
-      { return const_iterator(this->m_stor.data(), 0, this->m_stor.size());  }
+      { return const_iterator(this->do_table_data(), 0, this->do_table_size());  }
 
     const_iterator
     end()
       const noexcept
-      { return const_iterator(this->m_stor.data(),
-                              this->m_stor.size(), this->m_stor.size());  }
+      { return const_iterator(this->do_table_data(),
+                              this->do_table_size(), this->do_table_size());  }
 
     const_reverse_iterator
     rbegin()
@@ -76,12 +93,12 @@ class Option_Map
 
     iterator
     mut_begin()
-      { return iterator(this->m_stor.mut_data(), 0, this->m_stor.size());  }
+      { return iterator(this->do_mut_table_data(), 0, this->do_table_size());  }
 
     iterator
     mut_end()
-      { return iterator(this->m_stor.mut_data(),
-                        this->m_stor.size(), this->m_stor.size());  }
+      { return iterator(this->do_mut_table_data(),
+                        this->do_table_size(), this->do_table_size());  }
 
     reverse_iterator
     mut_rbegin()
@@ -96,6 +113,7 @@ class Option_Map
     clear()
       noexcept
       {
+        this->m_small.clear();
         this->m_stor.clear();
         this->m_nbkt = 0;
         return *this;
@@ -105,6 +123,7 @@ class Option_Map
     swap(Option_Map& other)
       noexcept
       {
+        this->m_small.swap(other.m_small);
         this->m_stor.swap(other.m_stor);
         ::std::swap(this->m_nbkt, other.m_nbkt);
         return *this;
@@ -117,7 +136,7 @@ class Option_Map
     pair<const cow_string*, const cow_string*>
     range(cow_string::shallow_type key)
       const noexcept
-      { return this->do_range_hint(key, details_option_map::ci_hash()(key));  }
+      { return this->do_range_hint(key, details_option_map::key_hash(key));  }
 
     pair<const cow_string*, const cow_string*>
     range(const cow_string& key)
@@ -142,7 +161,7 @@ class Option_Map
 
     pair<cow_string*, cow_string*>
     mut_range(cow_string::shallow_type key)
-      { return this->do_mut_range_hint(key, details_option_map::ci_hash()(key));  }
+      { return this->do_mut_range_hint(key, details_option_map::key_hash(key));  }
 
     pair<cow_string*, cow_string*>
     mut_range(const cow_string& key)
@@ -153,7 +172,7 @@ class Option_Map
     // N.B. These functions might throw `std::bad_alloc`.
     size_t
     erase(cow_string::shallow_type key)
-      { return this->do_erase_hint(key, details_option_map::ci_hash()(key));  }
+      { return this->do_erase_hint(key, details_option_map::key_hash(key));  }
 
     size_t
     erase(const cow_string& key)
@@ -200,7 +219,7 @@ class Option_Map
     // Set a scalar value.
     cow_string&
     open(const cow_string& key)
-      { return this->do_open_hint(key, details_option_map::ci_hash()(key));  }
+      { return this->do_open_hint(key, details_option_map::key_hash(sref(key)));  }
 
     template<typename StringT>
     cow_string&
@@ -221,7 +240,7 @@ class Option_Map
     // Append a value to an array.
     cow_string&
     append(const cow_string& key)
-      { return this->do_append_hint(key, details_option_map::ci_hash()(key));  }
+      { return this->do_append_hint(key, details_option_map::key_hash(sref(key)));  }
 
     template<typename StringT>
     cow_string&
@@ -4,6 +4,9 @@
 #include "../precompiled.hpp"
 #include "url.hpp"
 #include "../utils.hpp"
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
 
 namespace poseidon {
 namespace {
@@ -84,11 +87,86 @@ do_xdigit_value(char ch)
     POSEIDON_THROW("Invalid hexadecimal digit after `%`: $1", ch);
   }
 
+const char*
+do_find_non_path_char(const char* bptr, const char* eptr)
+  noexcept
+  {
+    // Path characters are `pchar`, `/` and `%`. Non-path characters in ASCII
+    // are controls, space, and `"#<>?[\]^`{|}` and DEL. They are detected
+    // 16 bytes at a time as ranges, which must match `s_url_ctype_table`.
+    const char* p = bptr;
+#ifdef __SSE2__
+    auto do_between = [](__m128i x, char lo, char hi) {
+      return _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8(static_cast<char>(lo - 1))),
+                           _mm_cmplt_epi8(x, _mm_set1_epi8(static_cast<char>(hi + 1))));  };
+
+    while(eptr - p >= 16) {
+      __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+      // Bytes that are negative as signed integers are not ASCII.
+      __m128i bad = _mm_cmplt_epi8(x, _mm_set1_epi8(0x21));
+      bad = _mm_or_si128(bad, do_between(x, 0x22, 0x23));
+      bad = _mm_or_si128(bad, _mm_cmpeq_epi8(x, _mm_set1_epi8(0x3C)));
+      bad = _mm_or_si128(bad, do_between(x, 0x3E, 0x3F));
+      bad = _mm_or_si128(bad, do_between(x, 0x5B, 0x5E));
+      bad = _mm_or_si128(bad, _mm_cmpeq_epi8(x, _mm_set1_epi8(0x60)));
+      bad = _mm_or_si128(bad, _mm_cmpgt_epi8(x, _mm_set1_epi8(0x7A)));
+      bad = _mm_andnot_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(0x7E)), bad);
+
+      uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(bad));
+      if(mask != 0)
+        return p + __builtin_ctz(mask);
+      p += 16;
+    }
+#endif
+    return ::std::find_if(p, eptr,
+        [&](char ch) { return !do_is_url_ctype(ch, url_ctype_pchar) &&
+                              (ch != '%') && (ch != '/');  });
+  }
+
+uint16_t
+do_get_default_port(const char* str, size_t len)
+  noexcept
+  {
+    // Compare the scheme case-insensitively. All characters that are allowed
+    // in a scheme are converted to lowercase by setting bit 5.
+    auto do_scheme_equal = [&](const char* other, size_t olen) {
+      if(len != olen)
+        return false;
+      for(size_t k = 0;  k != len;  ++k)
+        if((str[k] | 0x20) != other[k])
+          return false;
+      return true;
+    };
+
+    // Look up the well-known port for the scheme.
+    if(do_scheme_equal("http", 4))
+      return 80;
+
+    if(do_scheme_equal("https", 5))
+      return 443;
+
+    if(do_scheme_equal("ws", 2))
+      return 80;
+
+    if(do_scheme_equal("wss", 3))
+      return 443;
+
+    if(do_scheme_equal("ftp", 3))
+      return 21;
+
+    // Return zero to indicate an unknown port.
+    return 0;
+  }
+
 cow_string&
 do_percent_decode(cow_string& str, const char* bptr, const char* eptr)
   {
     str.clear();
 
+    // Copy the string as a whole if it contains no escape sequences.
+    if(!::std::memchr(bptr, '%', static_cast<size_t>(eptr - bptr)))
+      return str.append(bptr, eptr);
+
     for(auto p = bptr;  p != eptr;  ++p) {
       uint32_t uch = static_cast<uint8_t>(*p);
       if(uch == '%') {
@@ -188,25 +266,7 @@ URL::
 default_port()
   const noexcept
   {
-    // Look up the well-known port for the current scheme.
-    // Note the scheme string is always in lowercase.
-    if(this->m_scheme == ::rocket::sref("http"))
-      return 80;
-
-    if(this->m_scheme == ::rocket::sref("https"))
-      return 443;
-
-    if(this->m_scheme == ::rocket::sref("ws"))
-      return 80;
-
-    if(this->m_scheme == ::rocket::sref("wss"))
-      return 443;
-
-    if(this->m_scheme == ::rocket::sref("ftp"))
-      return 21;
-
-    // Return zero to indicate an unknown port.
-    return 0;
+    return do_get_default_port(this->m_scheme.data(), this->m_scheme.size());
   }
 
 URL&
@@ -445,9 +505,7 @@ parse(const cow_string& str)
 
     // Check for a path.
     if(bptr[0] == '/') {
-      mptr = ::std::find_if(bptr + 1, eptr,
-          [&](char ch) { return !do_is_url_ctype(ch, url_ctype_pchar) &&
-                                (ch != '%') && (ch != '/');  });
+      mptr = do_find_non_path_char(bptr + 1, eptr);
 
       // Accept the path without the leading slash.
       do_percent_decode(this->m_path, bptr + 1, mptr);
@@ -484,4 +542,164 @@ parse(const cow_string& str)
     return *this;
   }
 
+URL_View::
+~URL_View()
+  {
+  }
+
+cow_string&
+URL_View::
+do_decode(cow_string& str, Range r)
+  const
+  {
+    const char* bptr = this->m_str + r.off;
+    return do_percent_decode(str, bptr, bptr + r.len);
+  }
+
+uint16_t
+URL_View::
+default_port()
+  const noexcept
+  {
+    return do_get_default_port(this->m_str + this->m_scheme.off, this->m_scheme.len);
+  }
+
+URL_View&
+URL_View::
+parse(const cow_string& str)
+  {
+    if(str.size() > UINT32_MAX)
+      POSEIDON_THROW("URL string too long (size `$1`)", str.size());
+
+    // This function follows `URL::parse()`, but records ranges instead of
+    // copying components. As with `URL::parse()`, the string is assumed to
+    // be terminated by a null character.
+    const char* const sptr = str.c_str();
+    const char* bptr = sptr;
+    const char* const eptr = bptr + str.size();
+    const char* mptr;
+
+    this->m_str = sptr;
+    this->m_scheme = { };
+    this->m_userinfo = { };
+    this->m_host = { };
+    this->m_path = { };
+    this->m_raw_query = { };
+    this->m_raw_fragment = { };
+    this->m_port = 0;
+    this->m_has_port = false;
+
+    auto do_range = [&](const char* rb, const char* re) {
+      return Range{ static_cast<uint32_t>(rb - sptr), static_cast<uint32_t>(re - rb) };  };
+
+    // Request targets usually start with a slash. In this case, there is no
+    // scheme, userinfo or host name, so skip them.
+    if(bptr[0] != '/') {
+      // Check for a scheme.
+      mptr = ::std::find_if(bptr, eptr,
+          [&](char ch) { return !do_is_url_ctype(ch,
+                                   url_ctype_alpha | url_ctype_digit);  });
+
+      if((eptr - mptr >= 3) && ::asteria::mem_equal(mptr, "://", 3)) {
+        this->m_scheme = do_range(bptr, mptr);
+        bptr = mptr + 3;
+      }
+
+      // Check for a userinfo.
+      mptr = ::std::find_if(bptr, eptr,
+          [&](char ch) { return !do_is_url_ctype(ch,
+                                    url_ctype_unreserved | url_ctype_sub_delim) &&
+                                (ch != ':') && (ch != '%');  });
+
+      if(mptr[0] == '@') {
+        this->m_userinfo = do_range(bptr, mptr);
+        bptr = mptr + 1;
+      }
+
+      // Check for a host name.
+      if(bptr[0] == '[') {
+        mptr = ::std::find_if(bptr + 1, eptr,
+            [&](char ch) { return !do_is_url_ctype(ch,
+                                      url_ctype_unreserved | url_ctype_sub_delim) &&
+                                  (ch != ':');  });
+
+        if(*mptr != ']')
+          POSEIDON_THROW("Missing ']' after IP address: $1", str);
+
+        if(mptr - bptr == 1)
+          POSEIDON_THROW("Empty IP address: $1", str);
+
+        mptr += 1;
+      }
+      else
+        mptr = ::std::find_if(bptr, eptr,
+            [&](char ch) { return !do_is_url_ctype(ch,
+                                      url_ctype_unreserved | url_ctype_sub_delim) &&
+                                  (ch != '%');  });
+
+      if(bptr != mptr) {
+        this->m_host = do_range(bptr, mptr);
+        bptr = mptr;
+
+        // Check for a port number.
+        if(mptr[0] == ':') {
+          mptr = ::std::find_if(bptr + 1, eptr,
+              [&](char ch) { return !do_is_url_ctype(ch, url_ctype_digit);  });
+
+          if(mptr - bptr == 1)
+            POSEIDON_THROW("Missing port number after `:`: $1", str);
+
+          ::rocket::ascii_numget numg;
+          if(!numg.parse_U(++bptr, mptr, 10))
+            POSEIDON_THROW("Invalid port number: $1", str);
+
+          if(bptr != mptr)
+            POSEIDON_THROW("Port number out of range: $1", str);
+
+          uint64_t val;
+          if(!numg.cast_U(val, 0, 65535))
+            POSEIDON_THROW("Port number out of range: $1", str);
+
+          this->m_port = static_cast<uint16_t>(val);
+          this->m_has_port = true;
+        }
+      }
+    }
+
+    // Check for a path.
+    if(bptr[0] == '/') {
+      mptr = do_find_non_path_char(bptr + 1, eptr);
+      this->m_path = do_range(bptr + 1, mptr);
+      bptr = mptr;
+    }
+
+    // Check for a query string. Question marks are allowed in it.
+    if(bptr[0] == '?') {
+      mptr = bptr + 1;
+      do
+        mptr = do_find_non_path_char(mptr + (mptr[0] == '?'), eptr);
+      while(mptr[0] == '?');
+
+      this->m_raw_query = do_range(bptr + 1, mptr);
+      bptr = mptr;
+    }
+
+    // Check for a fragment.
+    if(bptr[0] == '#') {
+      mptr = bptr + 1;
+      do
+        mptr = do_find_non_path_char(mptr + (mptr[0] == '?'), eptr);
+      while(mptr[0] == '?');
+
+      this->m_raw_fragment = do_range(bptr + 1, mptr);
+      bptr = mptr;
+    }
+
+    // All characters shall have been consumed so far.
+    if(bptr != eptr)
+      POSEIDON_THROW("Invalid URL string: $1", str);
+
+    return *this;
+  }
+
 }  // namespace poseidon
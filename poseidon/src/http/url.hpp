@@ -214,6 +214,143 @@ class URL
     parse(const cow_string& str);
   };
 
+// This is a read-only view of a URL string, such as a request target.
+// Components are recorded as offsets into the string, which are decoded when
+// requested, so parsing does not allocate memory. The string must outlive the
+// view, and shall not be modified.
+// Components are defined the same way as in `URL`.
+class URL_View
+  {
+  private:
+    struct Range
+      {
+        uint32_t off;
+        uint32_t len;
+      };
+
+    const char* m_str = "";
+    Range m_scheme = { };
+    Range m_userinfo = { };
+    Range m_host = { };
+    Range m_path = { };
+    Range m_raw_query = { };
+    Range m_raw_fragment = { };
+    uint16_t m_port = 0;
+    bool m_has_port = false;
+
+  public:
+    constexpr
+    URL_View()
+      noexcept
+      = default;
+
+    explicit
+    URL_View(const cow_string& str)
+      { this->parse(str);  }
+
+    // A view of a temporary string would dangle.
+    explicit
+    URL_View(cow_string&& str)
+      = delete;
+
+  private:
+    pair<const char*, size_t>
+    do_get(Range r)
+      const noexcept
+      { return { this->m_str + r.off, r.len };  }
+
+    cow_string&
+    do_decode(cow_string& str, Range r)
+      const;
+
+  public:
+    ASTERIA_COPYABLE_DESTRUCTOR(URL_View);
+
+    // Get raw components. Letters in the scheme are not converted to lowercase,
+    // and no components are percent-decoded.
+    pair<const char*, size_t>
+    raw_scheme()
+      const noexcept
+      { return this->do_get(this->m_scheme);  }
+
+    pair<const char*, size_t>
+    raw_userinfo()
+      const noexcept
+      { return this->do_get(this->m_userinfo);  }
+
+    pair<const char*, size_t>
+    raw_host()
+      const noexcept
+      { return this->do_get(this->m_host);  }
+
+    // The slash initiator is not included.
+    pair<const char*, size_t>
+    raw_path()
+      const noexcept
+      { return this->do_get(this->m_path);  }
+
+    pair<const char*, size_t>
+    raw_query()
+      const noexcept
+      { return this->do_get(this->m_raw_query);  }
+
+    pair<const char*, size_t>
+    raw_fragment()
+      const noexcept
+      { return this->do_get(this->m_raw_fragment);  }
+
+    // Gets the port.
+    // If the port field is absent, a default one is chosen according to
+    // the scheme. If no default port is available, zero is returned.
+    ROCKET_PURE_FUNCTION
+    uint16_t
+    default_port()
+      const noexcept;
+
+    bool
+    has_port()
+      const noexcept
+      { return this->m_has_port;  }
+
+    uint16_t
+    port()
+      const noexcept
+      { return this->m_has_port ? this->m_port : this->default_port();  }
+
+    // Decode components into `str`, replacing its contents. If `str` is reused,
+    // no memory is allocated once it is large enough.
+    // An exception is thrown if a component contains an invalid escape sequence.
+    cow_string&
+    decode_userinfo(cow_string& str)
+      const
+      { return this->do_decode(str, this->m_userinfo);  }
+
+    cow_string&
+    decode_host(cow_string& str)
+      const
+      { return this->do_decode(str, this->m_host);  }
+
+    cow_string&
+    decode_path(cow_string& str)
+      const
+      { return this->do_decode(str, this->m_path);  }
+
+    cow_string&
+    decode_fragment(cow_string& str)
+      const
+      { return this->do_decode(str, this->m_raw_fragment);  }
+
+    // Parses a URL string. `str` is not copied.
+    // Unlike `URL::parse()`, percent-encoded octets are allowed in the query
+    // string. An exception is thrown if the URL is invalid.
+    URL_View&
+    parse(const cow_string& str);
+
+    URL_View&
+    parse(cow_string&& str)
+      = delete;
+  };
+
 inline
 void
 swap(URL& lhs, URL& rhs)
@@ -0,0 +1,475 @@
+// This file is part of Poseidon.
+// Copyleft 2020, LH_Mouse. All wrongs reserved.
+
+// This program checks HTTP/2 support:
+//   1. The examples in RFC 7541 appendices C.3, C.4, C.5 and C.6 are decoded
+//      by `HPACK_Decoder`, and their header lists are encoded by `HPACK_Encoder`.
+//   2. A recorded client connection preface and frame stream is passed to
+//      `http2_decode()`, both at once and byte by byte, and requests and frames
+//      that are sent back are checked.
+// It is run by `make check`.
+
+#include "precompiled.hpp"
+#include "http/hpack.hpp"
+#include "http/abstract_http2_server.hpp"
+#include "http/option_map.hpp"
+#include "http/enums.hpp"
+#include "utils.hpp"
+
+namespace {
+
+using namespace ::poseidon;
+
+struct Field
+  {
+    const char* name;
+    const char* value;
+  };
+
+// These are header lists of RFC 7541 appendices C.3 and C.4. Each list ends
+// with a null name.
+constexpr Field s_request_lists[3][7] =
+  {
+    {
+      { ":method",        "GET"                   },
+      { ":scheme",        "http"                  },
+      { ":path",          "/"                     },
+      { ":authority",     "www.example.com"       },
+      { nullptr,          nullptr                 },
+    },
+    {
+      { ":method",        "GET"                   },
+      { ":scheme",        "http"                  },
+      { ":path",          "/"                     },
+      { ":authority",     "www.example.com"       },
+      { "cache-control",  "no-cache"              },
+      { nullptr,          nullptr                 },
+    },
+    {
+      { ":method",        "GET"                   },
+      { ":scheme",        "https"                 },
+      { ":path",          "/index.html"           },
+      { ":authority",     "www.example.com"       },
+      { "custom-key",     "custom-value"          },
+      { nullptr,          nullptr                 },
+    },
+  };
+
+// These are header lists of RFC 7541 appendices C.5 and C.6.
+constexpr Field s_response_lists[3][7] =
+  {
+    {
+      { ":status",           "302"                                                    },
+      { "cache-control",     "private"                                                },
+      { "date",              "Mon, 21 Oct 2013 20:13:21 GMT"                          },
+      { "location",          "https://www.example.com"                                },
+      { nullptr,             nullptr                                                  },
+    },
+    {
+      { ":status",           "307"                                                    },
+      { "cache-control",     "private"                                                },
+      { "date",              "Mon, 21 Oct 2013 20:13:21 GMT"                          },
+      { "location",          "https://www.example.com"                                },
+      { nullptr,             nullptr                                                  },
+    },
+    {
+      { ":status",           "200"                                                    },
+      { "cache-control",     "private"                                                },
+      { "date",              "Mon, 21 Oct 2013 20:13:22 GMT"                          },
+      { "location",          "https://www.example.com"                                },
+      { "content-encoding",  "gzip"                                                   },
+      { "set-cookie",        "foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1" },
+      { nullptr,             nullptr                                                  },
+    },
+  };
+
+// These are header blocks of RFC 7541 appendices C.3 to C.6, in hexadecimal.
+constexpr const char* s_rfc7541_c3[3] =
+  {
+    "828684410f7777772e6578616d706c652e636f6d",
+    "828684be58086e6f2d6361636865",
+    "828785bf400a637573746f6d2d6b65790c637573746f6d2d76616c7565",
+  };
+
+constexpr const char* s_rfc7541_c4[3] =
+  {
+    "828684418cf1e3c2e5f23a6ba0ab90f4ff",
+    "828684be5886a8eb10649cbf",
+    "828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf",
+  };
+
+constexpr const char* s_rfc7541_c5[3] =
+  {
+    "4803333032580770726976617465611d4d6f6e2c203231204f637420323031332032303a31"
+    "333a323120474d546e1768747470733a2f2f7777772e6578616d706c652e636f6d",
+    "4803333037c1c0bf",
+    "88c1611d4d6f6e2c203231204f637420323031332032303a31333a323220474d54c05a0467"
+    "7a69707738666f6f3d4153444a4b48514b425a584f5157454f50495541585157454f49553b"
+    "206d61782d6167653d333630303b2076657273696f6e3d31",
+  };
+
+constexpr const char* s_rfc7541_c6[3] =
+  {
+    "488264025885aec3771a4b6196d07abe941054d444a8200595040b8166e082a62d1bff6e91"
+    "9d29ad171863c78f0b97c8e9ae82ae43d3",
+    "4883640effc1c0bf",
+    "88c16196d07abe941054d444a8200595040b8166e084a62d1bffc05a839bd9ab77ad94e782"
+    "1dd7f2e6c7b335dfdfcd5b3960d5af27087f3672c1ab270fb5291f9587316065c003ed4ee5"
+    "b1063d5007",
+  };
+
+// These are the header blocks that `HPACK_Encoder` produces for the responses,
+// with a table size of 256. They differ from C.6 in two ways: the first block
+// starts with a dynamic table size update, and `307` is not Huffman-coded, as
+// it would not be shorter.
+constexpr const char* s_encoded_responses[3] =
+  {
+    "3fe101488264025885aec3771a4b6196d07abe941054d444a8200595040b8166e082a62d1b"
+    "ff6e919d29ad171863c78f0b97c8e9ae82ae43d3",
+    "4803333037c1c0bf",
+    "88c16196d07abe941054d444a8200595040b8166e084a62d1bffc05a839bd9ab77ad94e782"
+    "1dd7f2e6c7b335dfdfcd5b3960d5af27087f3672c1ab270fb5291f9587316065c003ed4ee5"
+    "b1063d5007",
+  };
+
+// This is what a client sends, in frames.
+constexpr char s_client_stream[] =
+  {
+    // client connection preface
+    "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+    // SETTINGS: HEADER_TABLE_SIZE = 65536, ENABLE_PUSH = 0,
+    //           INITIAL_WINDOW_SIZE = 6291456, MAX_HEADER_LIST_SIZE = 262144
+    "\x00\x00\x18\x04\x00\x00\x00\x00\x00\x00\x01\x00\x01\x00\x00\x00"
+    "\x02\x00\x00\x00\x00\x00\x04\x00\x60\x00\x00\x00\x06\x00\x04\x00"
+    "\x00"
+    // WINDOW_UPDATE: stream 0, 15663105
+    "\x00\x00\x04\x08\x00\x00\x00\x00\x00\x00\xEF\x00\x01"
+    // HEADERS: stream 1, END_STREAM | END_HEADERS, RFC 7541 C.4.1
+    "\x00\x00\x11\x01\x05\x00\x00\x00\x01\x82\x86\x84\x41\x8C\xF1\xE3"
+    "\xC2\xE5\xF2\x3A\x6B\xA0\xAB\x90\xF4\xFF"
+    // HEADERS: stream 3, END_STREAM, RFC 7541 C.4.2 (first 5 bytes)
+    "\x00\x00\x05\x01\x01\x00\x00\x00\x03\x82\x86\x84\xBE\x58"
+    // CONTINUATION: stream 3, END_HEADERS, RFC 7541 C.4.2 (the rest)
+    "\x00\x00\x07\x09\x04\x00\x00\x00\x03\x86\xA8\xEB\x10\x64\x9C\xBF"
+    // HEADERS: stream 5, END_HEADERS | PRIORITY, RFC 7541 C.4.3
+    "\x00\x00\x1D\x01\x24\x00\x00\x00\x05\x00\x00\x00\x03\x10\x82\x87"
+    "\x85\xBF\x40\x88\x25\xA8\x49\xE9\x5B\xA9\x7D\x7F\x89\x25\xA8\x49"
+    "\xE9\x5B\xB8\xE8\xB4\xBF"
+    // DATA: stream 5, PADDED, `hello` and 3 bytes of padding
+    "\x00\x00\x09\x00\x08\x00\x00\x00\x05\x03\x68\x65\x6C\x6C\x6F\x00"
+    "\x00\x00"
+    // DATA: stream 5, END_STREAM, ` world`
+    "\x00\x00\x06\x00\x01\x00\x00\x00\x05\x20\x77\x6F\x72\x6C\x64"
+    // PING: `01234567`
+    "\x00\x00\x08\x06\x00\x00\x00\x00\x00\x30\x31\x32\x33\x34\x35\x36"
+    "\x37"
+    // SETTINGS: ACK
+    "\x00\x00\x00\x04\x01\x00\x00\x00\x00"
+  };
+
+// This is what the server sends back.
+constexpr char s_server_stream[] =
+  {
+    // SETTINGS: MAX_CONCURRENT_STREAMS = 100, MAX_HEADER_LIST_SIZE = 65536
+    "\x00\x00\x0C\x04\x00\x00\x00\x00\x00\x00\x03\x00\x00\x00\x64\x00"
+    "\x06\x00\x01\x00\x00"
+    // SETTINGS: ACK
+    "\x00\x00\x00\x04\x01\x00\x00\x00\x00"
+    // PING: ACK, `01234567`
+    "\x00\x00\x08\x06\x01\x00\x00\x00\x00\x30\x31\x32\x33\x34\x35\x36"
+    "\x37"
+  };
+
+// These are the requests in `s_client_stream`. Headers are sorted by name.
+constexpr char s_client_requests[] =
+  "headers 1 GET / host=www.example.com\n"
+  "end 1\n"
+  "headers 3 GET / cache-control=no-cache host=www.example.com\n"
+  "end 3\n"
+  "headers 5 GET /index.html custom-key=custom-value host=www.example.com\n"
+  "entity 5 hello\n"
+  "entity 5  world\n"
+  "end 5\n";
+
+class Test_Server
+  : public Abstract_HTTP2_Server
+  {
+  public:
+    cow_string sent;
+    cow_string events;
+    bool closed = false;
+
+  private:
+    bool
+    do_http2_server_send(const char* data, size_t size)
+      override
+      {
+        this->sent.append(data, size);
+        return true;
+      }
+
+    bool
+    do_http2_server_close()
+      override
+      {
+        this->closed = true;
+        return true;
+      }
+
+    void
+    do_http2_server_on_request_headers(uint32_t stream, HTTP_Method meth,
+                                       cow_string&& target, Option_Map&& headers)
+      override
+      {
+        // Option maps are unordered, so headers are sorted for comparison.
+        ::std::vector<cow_string> lines;
+        for(const auto& pair : headers)
+          lines.emplace_back(format_string("$1=$2", pair.first, pair.second));
+        ::std::sort(lines.begin(), lines.end());
+
+        this->events += format_string("headers $1 $2 $3", stream, format_http_method(meth),
+                                      target);
+        for(const auto& line : lines)
+          this->events += format_string(" $1", line);
+        this->events += '\n';
+      }
+
+    void
+    do_http2_server_on_request_entity(uint32_t stream, const char* data, size_t size)
+      override
+      {
+        this->events += format_string("entity $1 $2\n", stream, cow_string(data, size));
+      }
+
+    void
+    do_http2_server_on_request_end(uint32_t stream)
+      override
+      {
+        this->events += format_string("end $1\n", stream);
+      }
+  };
+
+cow_string
+do_unhex(const char* hex)
+  {
+    cow_string str;
+    for(const char* p = hex;  p[0] && p[1];  p += 2) {
+      uint32_t val = 0;
+      for(size_t k = 0;  k != 2;  ++k) {
+        uint32_t ch = static_cast<uint8_t>(p[k]);
+        val = val << 4 | ((ch <= '9') ? (ch - '0') : ((ch | 0x20) - 'a' + 10));
+      }
+      str.push_back(static_cast<char>(val));
+    }
+    return str;
+  }
+
+bool
+do_check_fields(const char* name, size_t index, const ::std::vector<HPACK_Field>& fields,
+                const Field* expect)
+  {
+    size_t k = 0;
+    while(expect[k].name && (k < fields.size()) && (fields[k].first == expect[k].name)
+          && (fields[k].second == expect[k].value))
+      k ++;
+
+    if(!expect[k].name && (k == fields.size()))
+      return true;
+
+    ::fprintf(stderr, "%s.%zu: header field %zu mismatch\n", name, index + 1, k);
+    return false;
+  }
+
+bool
+do_check_decoder(const char* name, const char* const (&blocks)[3], const Field (*lists)[7],
+                 size_t table_size)
+  {
+    // All blocks of an example are decoded with the same decoder, as they
+    // share the dynamic table.
+    HPACK_Decoder dec;
+    dec.set_max_table_size(table_size);
+
+    for(size_t k = 0;  k != 3;  ++k) {
+      cow_string block = do_unhex(blocks[k]);
+      ::std::vector<HPACK_Field> fields;
+      try {
+        if(!dec.decode(fields, block.data(), block.size())) {
+          ::fprintf(stderr, "%s.%zu: header list too large\n", name, k + 1);
+          return false;
+        }
+      }
+      catch(exception& stdex) {
+        ::fprintf(stderr, "%s.%zu: %s\n", name, k + 1, stdex.what());
+        return false;
+      }
+
+      if(!do_check_fields(name, k, fields, lists[k]))
+        return false;
+    }
+    return true;
+  }
+
+bool
+do_check_encoder(const char* name, const char* const (&blocks)[3], const Field (*lists)[7],
+                 size_t table_size)
+  {
+    HPACK_Encoder enc;
+    if(table_size != 4096)
+      enc.set_max_table_size(table_size);
+
+    for(size_t k = 0;  k != 3;  ++k) {
+      linear_buffer out;
+      enc.begin_block(out);
+      for(const Field* p = lists[k];  p->name;  ++p)
+        enc.encode_field(out, sref(p->name), sref(p->value));
+
+      cow_string block = do_unhex(blocks[k]);
+      if((out.size() != block.size()) || (::std::memcmp(out.data(), block.data(), out.size()) != 0)) {
+        ::fprintf(stderr, "%s.%zu: encoded header block mismatch\n", name, k + 1);
+        return false;
+      }
+    }
+    return true;
+  }
+
+bool
+do_check_hpack()
+  {
+    return do_check_decoder("C.3", s_rfc7541_c3, s_request_lists, 4096)
+           && do_check_decoder("C.4", s_rfc7541_c4, s_request_lists, 4096)
+           && do_check_decoder("C.5", s_rfc7541_c5, s_response_lists, 256)
+           && do_check_decoder("C.6", s_rfc7541_c6, s_response_lists, 256)
+           && do_check_encoder("C.4 (encoder)", s_rfc7541_c4, s_request_lists, 4096)
+           && do_check_encoder("C.6 (encoder)", s_encoded_responses, s_response_lists, 256);
+  }
+
+struct Frame
+  {
+    uint8_t type;
+    uint8_t flags;
+    uint32_t stream;
+    cow_string data;
+  };
+
+::std::vector<Frame>
+do_split_frames(const cow_string& bytes)
+  {
+    ::std::vector<Frame> frames;
+    size_t off = 0;
+    while(bytes.size() - off >= 9) {
+      auto head = reinterpret_cast<const uint8_t*>(bytes.data() + off);
+      size_t len = static_cast<size_t>(head[0]) << 16 | static_cast<size_t>(head[1]) << 8 | head[2];
+      if(bytes.size() - off - 9 < len)
+        break;
+
+      Frame frame;
+      frame.type = head[3];
+      frame.flags = head[4];
+      frame.stream = static_cast<uint32_t>(head[5] & 0x7F) << 24 | static_cast<uint32_t>(head[6]) << 16
+                     | static_cast<uint32_t>(head[7]) << 8 | head[8];
+      frame.data.assign(bytes.data() + off + 9, len);
+      frames.emplace_back(::std::move(frame));
+      off += 9 + len;
+    }
+    return frames;
+  }
+
+bool
+do_check_client_stream(Test_Server& server, const char* how)
+  {
+    cow_string expect_sent(s_server_stream, sizeof(s_server_stream) - 1);
+    if(server.closed || (server.sent != expect_sent)) {
+      ::fprintf(stderr, "HTTP/2 server sent unexpected frames (%s)\n", how);
+      return false;
+    }
+
+    if(server.events != s_client_requests) {
+      ::fprintf(stderr, "HTTP/2 requests mismatch (%s):\n%s", how, server.events.c_str());
+      return false;
+    }
+    return true;
+  }
+
+bool
+do_check_http2()
+  {
+    // Pass the client stream at once.
+    auto server = ::rocket::make_refcnt<Test_Server>();
+    if(!server->http2_decode(s_client_stream, sizeof(s_client_stream) - 1))
+      return false;
+
+    if(!do_check_client_stream(*server, "at once"))
+      return false;
+
+    // Pass the client stream byte by byte. The results shall be the same.
+    auto other = ::rocket::make_refcnt<Test_Server>();
+    for(size_t k = 0;  k != sizeof(s_client_stream) - 1;  ++k)
+      if(!other->http2_decode(s_client_stream + k, 1))
+        return false;
+
+    if(!do_check_client_stream(*other, "byte by byte"))
+      return false;
+
+    // Respond to stream 1. Streams 3 and 5 are left open, as they have not
+    // been responded.
+    server->sent.clear();
+    Option_Map headers;
+    headers.set(sref("Content-Type"), sref("text/plain"));
+    server->http2_encode_headers(1, http_status_ok, ::std::move(headers), false);
+    server->http2_encode_entity(1, "hi", 2);
+    server->http2_encode_end_of_entity(1);
+
+    auto frames = do_split_frames(server->sent);
+    if((frames.size() != 3) || (server->http2_stream_count() != 2)
+       || (frames[0].type != 0x1) || (frames[0].flags != 0x4) || (frames[0].stream != 1)
+       || (frames[1].type != 0x0) || (frames[1].flags != 0x0) || (frames[1].stream != 1)
+       || (frames[1].data != "hi")
+       || (frames[2].type != 0x0) || (frames[2].flags != 0x1) || (frames[2].stream != 1)
+       || !frames[2].data.empty()) {
+      ::fprintf(stderr, "HTTP/2 response frames mismatch\n");
+      return false;
+    }
+
+    // The client has asked for a larger table, but the encoder uses 4096
+    // bytes, which is signaled in the first header block.
+    HPACK_Decoder dec;
+    ::std::vector<HPACK_Field> fields;
+    dec.decode(fields, frames[0].data.data(), frames[0].data.size());
+    if((fields.size() != 3) || (fields[0].first != ":status") || (fields[0].second != "200")
+       || (fields[1].first != "date") || (fields[1].second.size() != 29)
+       || (fields[2].first != "content-type") || (fields[2].second != "text/plain")) {
+      ::fprintf(stderr, "HTTP/2 response headers mismatch\n");
+      return false;
+    }
+
+    // A client that doesn't speak HTTP/2 gets `GOAWAY` with `PROTOCOL_ERROR`.
+    auto bad = ::rocket::make_refcnt<Test_Server>();
+    static constexpr char s_http11[] = "GET / HTTP/1.1\r\n\r\n";
+    static constexpr char s_goaway[] = "\x00\x00\x08\x07\x00\x00\x00\x00\x00"
+                                       "\x00\x00\x00\x00\x00\x00\x00\x01";
+    if(bad->http2_decode(s_http11, sizeof(s_http11) - 1) || !bad->closed
+       || (bad->sent != cow_string(s_goaway, sizeof(s_goaway) - 1))) {
+      ::fprintf(stderr, "HTTP/2 server accepted an HTTP/1.1 request\n");
+      return false;
+    }
+    return true;
+  }
+
+}  // namespace
+
+int
+main()
+  try {
+    if(!do_check_hpack())
+      return 1;
+
+    if(!do_check_http2()) {
+      ::fprintf(stderr, "HTTP/2 frame stream check failed!\n");
+      return 1;
+    }
+    return 0;
+  }
+  catch(exception& stdex) {
+    ::fprintf(stderr, "%s\n", stdex.what());
+    return 1;
+  }
@@ -0,0 +1,141 @@
+// This file is part of Poseidon.
+// Copyleft 2020, LH_Mouse. All wrongs reserved.
+
+// This program measures `Option_Map` with different numbers of keys. Maps with
+// up to 8 keys are held in the inline table, and larger maps are held in the
+// dynamic table, so the two can be compared. It also checks that all keys can
+// be found after each operation, so it is run by `make check`.
+
+#include "precompiled.hpp"
+#include "http/option_map.hpp"
+#include <time.h>
+
+namespace {
+
+using namespace ::poseidon;
+
+constexpr size_t s_rounds = 200000;
+
+double
+do_get_seconds()
+  noexcept
+  {
+    ::timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec) * 1e-9;
+  }
+
+void
+do_report(const char* name, size_t nkeys, size_t nops, double secs)
+  noexcept
+  {
+    ::printf("%-24s %3zu keys  %10.1f ns/op\n",
+             name, nkeys, secs * 1e9 / static_cast<double>(nops));
+  }
+
+bool
+do_check_map(const Option_Map& map, const ::std::vector<cow_string>& keys,
+             const ::std::vector<cow_string>& values)
+  {
+    size_t count = 0;
+    for(auto it = map.begin();  it != map.end();  ++it)
+      count ++;
+    if(count != keys.size())
+      return false;
+
+    for(size_t k = 0;  k != keys.size();  ++k) {
+      auto qval = map.find_opt(keys[k]);
+      if(!qval || (*qval != values[k]))
+        return false;
+    }
+    return true;
+  }
+
+bool
+do_benchmark(size_t nkeys)
+  {
+    // Use header options like those in `Content-Type` and `Cache-Control`.
+    static constexpr const char* s_names[] = { "charset", "boundary", "q", "max-age",
+                                               "filename", "name", "level", "private" };
+    ::std::vector<cow_string> keys, values;
+    for(size_t k = 0;  k != nkeys;  ++k) {
+      char temp[64];
+      ::sprintf(temp, "%s%zu", s_names[k % 8], k / 8);
+      keys.emplace_back(temp);
+      ::sprintf(temp, "value-%zu", k);
+      values.emplace_back(temp);
+    }
+
+    // Create maps from scratch. This includes allocation and deallocation.
+    double start = do_get_seconds();
+    for(size_t r = 0;  r != s_rounds;  ++r) {
+      Option_Map map;
+      for(size_t k = 0;  k != nkeys;  ++k)
+        map.set(keys[k], values[k]);
+      if(map.count(keys[0]) != 1)
+        return false;
+    }
+    do_report("set() on a new map", nkeys, s_rounds * nkeys, do_get_seconds() - start);
+
+    Option_Map map;
+    for(size_t k = 0;  k != nkeys;  ++k)
+      map.set(keys[k], values[k]);
+    if(!do_check_map(map, keys, values))
+      return false;
+
+    // Look up existent keys.
+    size_t nfound = 0;
+    start = do_get_seconds();
+    for(size_t r = 0;  r != s_rounds;  ++r)
+      for(size_t k = 0;  k != nkeys;  ++k)
+        nfound += !!map.find_opt(keys[k]);
+    do_report("find_opt()", nkeys, s_rounds * nkeys, do_get_seconds() - start);
+    if(nfound != s_rounds * nkeys)
+      return false;
+
+    // Format the map as a header value.
+    ::rocket::tinyfmt_str fmt;
+    start = do_get_seconds();
+    for(size_t r = 0;  r != s_rounds;  ++r) {
+      fmt.clear_string();
+      map.print_http_header(fmt);
+    }
+    do_report("print_http_header()", nkeys, s_rounds, do_get_seconds() - start);
+
+    // Parse it back.
+    Option_Map parsed;
+    parsed.parse_http_header(nullptr, fmt.get_string(), 0);
+    if(!do_check_map(parsed, keys, values))
+      return false;
+
+    // Move the map back and forth.
+    Option_Map other;
+    start = do_get_seconds();
+    for(size_t r = 0;  r != s_rounds;  ++r) {
+      other = ::std::move(map);
+      map = ::std::move(other);
+    }
+    do_report("move assignment", nkeys, s_rounds * 2, do_get_seconds() - start);
+    if(!do_check_map(map, keys, values))
+      return false;
+
+    // Erase all keys but the last one.
+    for(size_t k = 0;  k + 1 < nkeys;  ++k)
+      if(map.erase(keys[k]) != 1)
+        return false;
+    return do_check_map(map, { keys.back() }, { values.back() });
+  }
+
+}  // namespace
+
+int
+main()
+  {
+    static constexpr size_t s_key_counts[] = { 2, 4, 8, 9, 16, 32 };
+    for(size_t nkeys : s_key_counts)
+      if(!do_benchmark(nkeys)) {
+        ::fprintf(stderr, "Option_Map check failed with %zu keys!\n", nkeys);
+        return 1;
+      }
+    return 0;
+  }
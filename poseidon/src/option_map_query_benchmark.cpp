@@ -0,0 +1,266 @@
+// This file is part of Poseidon.
+// Copyleft 2020, LH_Mouse. All wrongs reserved.
+
+// This program measures how URL queries are encoded and decoded by `Option_Map`,
+// by comparing the character table scans that were used before with
+// `do_find_query_unsafe()` and `do_find_query_escape()` on 2KiB and 4KiB
+// queries:
+//   1. Encoding: runs of safe characters are found with a table lookup per
+//      character, or 16 bytes at a time, then written with a single `putn()`.
+//   2. Decoding: characters are appended one by one, or runs without `+` and
+//      `%` are found 16 bytes at a time and copied with `memcpy()`.
+// It also checks that the vector scans agree with the table for every byte
+// value at every position, and that all results can be decoded back, so it is
+// run by `make check`. It depends only on the standard library.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "details/option_map_ctype.ipp"
+#include <string>
+
+namespace {
+
+using namespace ::poseidon::details_option_map;
+
+constexpr size_t s_bytes_per_test = 64 << 20;
+
+double
+do_get_seconds()
+  noexcept
+  {
+    ::timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec) * 1e-9;
+  }
+
+const char*
+do_find_query_unsafe_table(const char* bp, const char* ep)
+  noexcept
+  {
+    return ::std::find_if(bp, ep,
+             [&](char ch) { return !do_is_opt_ctype(ch, opt_ctype_query_safe);  });
+  }
+
+const char*
+do_find_query_escape_table(const char* bp, const char* ep)
+  noexcept
+  {
+    return ::std::find_if(bp, ep, [&](char ch) { return (ch == '+') || (ch == '%');  });
+  }
+
+template<typename FindT>
+void
+do_encode_query(::std::string& out, const ::std::string& str, FindT&& find)
+  {
+    // This is `do_encode_query()` from 'option_map.cpp'.
+    out.clear();
+    const char* bp = str.c_str();
+    const char* ep = bp + str.size();
+    for(;;) {
+      const char* mp = find(bp, ep);
+      if(mp != bp)
+        out.append(bp, static_cast<size_t>(mp - bp));
+
+      bp = mp;
+      if(bp == ep)
+        break;
+
+      uint32_t val = static_cast<uint8_t>(*(bp++));
+      if(val == ' ') {
+        out += '+';
+        continue;
+      }
+
+      char seq[3];
+      seq[0] = '%';
+      seq[1] = s_xdigits[(val >> 3) & 0x1E];
+      seq[2] = s_xdigits[(val << 1) & 0x1E];
+      out.append(seq, sizeof(seq));
+    }
+  }
+
+bool
+do_decode_percent(uint32_t& val, const char*& bp, const char* ep)
+  noexcept
+  {
+    for(uint32_t k = 0;  k != 2;  ++k) {
+      if(bp == ep)
+        return false;
+
+      auto dp = static_cast<const char*>(::memchr(s_xdigits, *(bp++), 32));
+      if(!dp)
+        return false;
+
+      val = val << 4 | static_cast<uint32_t>(dp - s_xdigits) >> 1;
+    }
+    return true;
+  }
+
+bool
+do_decode_query_old(::std::string& str, const char* bptr, const char* eptr)
+  {
+    // This is `do_decode_query()` from 'option_map.cpp' before it was
+    // vectorized.
+    str.clear();
+    const char* bp = bptr;
+    while(bp != eptr) {
+      uint32_t val = static_cast<uint8_t>(*(bp++));
+      if(val == '+') {
+        str += ' ';
+        continue;
+      }
+      else if(val != '%') {
+        str += static_cast<char>(val);
+        continue;
+      }
+
+      val = 0;
+      if(!do_decode_percent(val, bp, eptr))
+        return false;
+      str += static_cast<char>(val);
+    }
+    return true;
+  }
+
+bool
+do_decode_query_new(::std::string& str, const char* bptr, const char* eptr)
+  {
+    // This is `do_decode_query()` from 'option_map.cpp'.
+    str.assign(static_cast<size_t>(eptr - bptr), '\0');
+    char* wp = &(str[0]);
+
+    const char* bp = bptr;
+    for(;;) {
+      const char* mp = do_find_query_escape(bp, eptr);
+      ::memcpy(wp, bp, static_cast<size_t>(mp - bp));
+      wp += mp - bp;
+      bp = mp;
+      if(bp == eptr)
+        break;
+
+      uint32_t val = static_cast<uint8_t>(*(bp++));
+      if(val == '+') {
+        *(wp++) = ' ';
+        continue;
+      }
+
+      val = 0;
+      if(!do_decode_percent(val, bp, eptr))
+        return false;
+      *(wp++) = static_cast<char>(val);
+    }
+
+    str.erase(static_cast<size_t>(wp - str.data()));
+    return true;
+  }
+
+bool
+do_check_scans()
+  {
+    // Put each byte value at each position of a run of safe characters, so
+    // both the vector loop and the tail are tested.
+    char buf[48];
+    for(uint32_t ch = 0;  ch != 256;  ++ch)
+      for(size_t pos = 0;  pos != sizeof(buf);  ++pos) {
+        ::memset(buf, 'a', sizeof(buf));
+        buf[pos] = static_cast<char>(ch);
+        const char* ep = buf + sizeof(buf);
+
+        if(do_find_query_unsafe(buf, ep) != do_find_query_unsafe_table(buf, ep)) {
+          ::fprintf(stderr, "`do_find_query_unsafe()` mismatch: %02X at %zu\n", ch, pos);
+          return false;
+        }
+        if(do_find_query_escape(buf, ep) != do_find_query_escape_table(buf, ep)) {
+          ::fprintf(stderr, "`do_find_query_escape()` mismatch: %02X at %zu\n", ch, pos);
+          return false;
+        }
+      }
+    return true;
+  }
+
+::std::string
+do_make_text(size_t size, uint32_t escape_ratio)
+  {
+    // Make text of words and numbers, like values in a query. About one in
+    // `escape_ratio` characters needs escaping.
+    static constexpr char s_alnum[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789-_.";
+    static constexpr char s_unsafe[] = " &=/:?#%+\xE4\xB8\xAD";
+    ::std::string text;
+    uint32_t seed = 1;
+    while(text.size() < size) {
+      seed = seed * 1103515245 + 12345;
+      if((seed >> 8) % escape_ratio == 0)
+        text += s_unsafe[(seed >> 16) % (sizeof(s_unsafe) - 1)];
+      else
+        text += s_alnum[(seed >> 16) % (sizeof(s_alnum) - 1)];
+    }
+    return text;
+  }
+
+template<typename FuncT>
+double
+do_measure(size_t size, FuncT&& func)
+  {
+    size_t nrounds = s_bytes_per_test / size;
+    double start = do_get_seconds();
+    for(size_t r = 0;  r != nrounds;  ++r)
+      func();
+    double secs = do_get_seconds() - start;
+    return static_cast<double>(nrounds * size) / 1048576.0 / secs;
+  }
+
+bool
+do_benchmark(size_t size, uint32_t escape_ratio)
+  {
+    ::std::string text = do_make_text(size, escape_ratio);
+    ::std::string enc_old, enc_new, dec_old, dec_new;
+
+    double mibps_enc_old = do_measure(size,
+        [&] { do_encode_query(enc_old, text, do_find_query_unsafe_table);  });
+    double mibps_enc_new = do_measure(size,
+        [&] { do_encode_query(enc_new, text, do_find_query_unsafe);  });
+
+    // Decoding is measured on the encoded query.
+    const char* bp = enc_new.data();
+    const char* ep = bp + enc_new.size();
+    bool dec_ok = true;
+    double mibps_dec_old = do_measure(enc_new.size(),
+        [&] { dec_ok &= do_decode_query_old(dec_old, bp, ep);  });
+    double mibps_dec_new = do_measure(enc_new.size(),
+        [&] { dec_ok &= do_decode_query_new(dec_new, bp, ep);  });
+
+    if((enc_old != enc_new) || !dec_ok || (dec_old != text) || (dec_new != text)) {
+      ::fprintf(stderr, "URL query check failed: %zu bytes, 1/%u escaped\n",
+                size, escape_ratio);
+      return false;
+    }
+
+    ::printf("%4zu bytes  1/%-4u escaped  encode %7.1f -> %7.1f MiB/s (%5.2fx)"
+             "  decode %7.1f -> %7.1f MiB/s (%5.2fx)\n",
+             size, escape_ratio,
+             mibps_enc_old, mibps_enc_new, mibps_enc_new / mibps_enc_old,
+             mibps_dec_old, mibps_dec_new, mibps_dec_new / mibps_dec_old);
+    return true;
+  }
+
+}  // namespace
+
+int
+main()
+  {
+#ifndef __SSE2__
+    ::printf("SSE2 not available on this target; both scans use the table\n");
+#endif
+    if(!do_check_scans())
+      return 1;
+
+    static constexpr size_t s_sizes[] = { 2048, 4096 };
+    static constexpr uint32_t s_escape_ratios[] = { 1000, 64, 8 };
+    for(size_t size : s_sizes)
+      for(uint32_t escape_ratio : s_escape_ratios)
+        if(!do_benchmark(size, escape_ratio))
+          return 1;
+    return 0;
+  }
@@ -3,6 +3,7 @@
 
 #include "../precompiled.hpp"
 #include "abstract_socket.hpp"
+#include "../static/network_driver.hpp"
 #include "../utils.hpp"
 #include <sys/socket.h>
 
@@ -52,6 +53,20 @@ kill()
     ::shutdown(this->get_fd(), SHUT_RDWR);
   }
 
+bool
+Abstract_Socket::
+set_read_paused(bool value)
+  noexcept
+  {
+    bool old = this->m_read_paused.exchange(value);
+
+    // As `EPOLLIN` is edge-triggered, the driver has to be told to read this
+    // socket again.
+    if(old && !value)
+      Network_Driver::notify_readable_internal(*this);
+    return old;
+  }
+
 const Socket_Address&
 Abstract_Socket::
 get_local_address()
@@ -18,6 +18,7 @@ class Abstract_Socket
   private:
     unique_FD m_fd;
     atomic_relaxed<bool> m_resident = { false };  // don't delete if orphaned
+    atomic_relaxed<bool> m_read_paused = { false };  // don't read incoming data
 
     // These are used by network driver.
     uint64_t m_epoll_data = UINT64_MAX;
@@ -82,6 +83,15 @@ class Abstract_Socket
       noexcept
       { return this->m_resident.exchange(value);  }
 
+    // Stops or resumes reading from this socket. While reading is paused, incoming
+    // data are left in the kernel, which will eventually make the other peer
+    // stop sending. The old value is returned.
+    // Data that have been read before this call may still be delivered.
+    // This function is thread-safe.
+    bool
+    set_read_paused(bool value = true)
+      noexcept;
+
     // Returns the stream descriptor.
     // This is used to query and adjust stream flags. You shall not perform I/O
     // operations on it.
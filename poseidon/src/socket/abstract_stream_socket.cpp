@@ -6,6 +6,8 @@
 #include "../static/network_driver.hpp"
 #include "../utils.hpp"
 #include <netinet/tcp.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 namespace poseidon {
 
@@ -47,7 +49,7 @@ do_socket_close_unlocked()
 
         // Fallthrough
       case connection_state_closing:
-        if(this->m_wqueue.size()) {
+        if(this->m_wqueue.size() || this->m_wfiles.size() || this->m_relay_size.load()) {
           POSEIDON_LOG_TRACE("Marked socket `$1` as CLOSING (data pending)", this);
           return io_result_partial_work;
         }
@@ -80,6 +82,38 @@ do_socket_on_poll_read(simple_mutex::unique_lock& lock, char* hint, size_t size)
     if(this->m_cstate == connection_state_closed)
       return io_result_end_of_stream;
 
+    if(this->m_link) {
+      // Move incoming data into the pipe to the linked socket.
+      auto peer = this->m_link;
+      size_t nmoved = 0;
+      auto io_res = this->do_socket_stream_splice_in_unlocked(this->m_relay_wr, nmoved, size);
+      if(io_res == io_result_end_of_stream) {
+        // Only this direction has ended. The connection is closed after the
+        // opposite direction has ended, too.
+        POSEIDON_LOG_TRACE("End of stream encountered: $1", this);
+        this->m_read_eof = true;
+        if(this->m_relay_shut)
+          this->do_socket_close_unlocked();
+        peer->m_relay_eof.store(true);
+      }
+
+      // If the pipe is not empty, it might be full. In this case, reading is
+      // resumed when the linked socket drains the pipe, as no more `EPOLLIN`
+      // events will arrive for data that are pending.
+      if((io_res == io_result_would_block) && peer->m_relay_size.load())
+        this->m_relay_throttled.store(true);
+
+      peer->m_relay_size.fetch_add(nmoved);
+      lock.unlock();
+
+      // The linked socket shuts down its sending side after it drains the pipe.
+      if((nmoved != 0) || (io_res == io_result_end_of_stream))
+        Network_Driver::notify_writable_internal(*peer);
+
+      lock.lock(this->m_io_mutex);
+      return io_res;
+    }
+
     // Try reading some bytes.
     char* eptr = hint;
     auto io_res = this->do_socket_stream_read_unlocked(eptr, size);
@@ -106,7 +140,9 @@ do_write_queue_size(simple_mutex::unique_lock& lock)
     lock.lock(this->m_io_mutex);
 
     // Get the size of pending data.
-    size_t navail = this->m_wqueue.size();
+    size_t navail = this->m_wqueue.size() + this->m_relay_size.load();
+    for(const auto& seg : this->m_wfiles)
+      navail += static_cast<size_t>(::rocket::min(seg.remaining, INT32_MAX));
     if(navail != 0)
       return navail;
 
@@ -116,7 +152,7 @@ do_write_queue_size(simple_mutex::unique_lock& lock)
 
 IO_Result
 Abstract_Stream_Socket::
-do_socket_on_poll_write(simple_mutex::unique_lock& lock, char* /*hint*/, size_t size)
+do_socket_on_poll_write(simple_mutex::unique_lock& lock, char* hint, size_t size)
   {
     ROCKET_ASSERT(size != 0);
     lock.lock(this->m_io_mutex);
@@ -136,8 +172,60 @@ do_socket_on_poll_write(simple_mutex::unique_lock& lock, char* /*hint*/, size_t
     }
     lock.lock(this->m_io_mutex);
 
+    // Only bytes that precede the first file segment can be written.
+    size_t navail = this->m_wqueue.size();
+    if(this->m_wfiles.size())
+      navail = this->m_wfiles.front().nprefix;
+
+    if((navail == 0) && this->m_wfiles.size()) {
+      // Try sending some bytes from the file.
+      auto& seg = this->m_wfiles.front();
+      int64_t offset = seg.offset;
+      auto io_res = this->do_socket_stream_sendfile_unlocked(seg.fd, offset, seg.remaining,
+                                                             hint, size);
+      ROCKET_ASSERT(offset - seg.offset <= seg.remaining);
+      seg.remaining -= offset - seg.offset;
+      seg.offset = offset;
+
+      // Close the file as soon as possible.
+      if(seg.remaining == 0)
+        this->m_wfiles.pop_front();
+      return io_res;
+    }
+
+    if((navail == 0) && this->m_relay_size.load()) {
+      // Try sending some bytes from the pipe from the linked socket.
+      auto peer = this->m_link;
+      size_t nmoved = 0;
+      auto io_res = this->do_socket_stream_splice_out_unlocked(this->m_relay_rd, nmoved,
+                                                               this->m_relay_size.load());
+      this->m_relay_size.fetch_sub(nmoved);
+
+      // Resume reading from the linked socket if it has filled the pipe.
+      if(peer && (nmoved != 0) && peer->m_relay_throttled.exchange(false)) {
+        lock.unlock();
+        Network_Driver::notify_readable_internal(*peer);
+        lock.lock(this->m_io_mutex);
+      }
+      return io_res;
+    }
+
+    if((navail == 0) && this->m_wfiles.empty() && this->m_relay_eof.load()
+       && !this->m_relay_shut && (this->m_cstate == connection_state_established)) {
+      // The linked socket has read end of stream, and the pipe has been drained,
+      // so forward the end of stream. If the other direction has also ended, close
+      // the connection.
+      POSEIDON_LOG_TRACE("Forwarding end of stream: $1", this);
+      this->m_relay_shut = true;
+      if(this->m_read_eof)
+        return this->do_socket_close_unlocked();
+
+      ::shutdown(this->get_fd(), SHUT_WR);
+      return io_result_end_of_stream;
+    }
+
     // Try writing some bytes.
-    size_t navail = ::std::min(this->m_wqueue.size(), size);
+    navail = ::std::min(navail, size);
     if((navail == 0) && (this->m_cstate > connection_state_established))
       return this->do_socket_close_unlocked();
 
@@ -146,18 +234,67 @@ do_socket_on_poll_write(simple_mutex::unique_lock& lock, char* /*hint*/, size_t
 
     const char* eptr = this->m_wqueue.data();
     auto io_res = this->do_socket_stream_write_unlocked(eptr, navail);
-    this->m_wqueue.discard(static_cast<size_t>(eptr - this->m_wqueue.data()));
+    size_t nwritten = static_cast<size_t>(eptr - this->m_wqueue.data());
+    this->m_wqueue.discard(nwritten);
+
+    if(this->m_wfiles.size()) {
+      this->m_wfiles.front().nprefix -= nwritten;
+      this->m_wprefix -= nwritten;
+    }
     return io_res;
   }
 
+IO_Result
+Abstract_Stream_Socket::
+do_socket_stream_sendfile_unlocked(int fd, int64_t& offset, int64_t limit,
+                                   char* hint, size_t size)
+  {
+    // Read some bytes from the file.
+    size_t nreq = static_cast<size_t>(::rocket::min(limit, static_cast<int64_t>(size)));
+    ::ssize_t nread = ::pread(fd, hint, nreq, offset);
+    if(nread < 0)
+      POSEIDON_THROW("Error reading file\n"
+                     "[`pread()` failed: $1]",
+                     format_errno(errno));
+
+    if(nread == 0)
+      POSEIDON_THROW("File truncated while being sent (offset `$1`)", offset);
+
+    // Bytes that are not written will be read again next time.
+    const char* eptr = hint;
+    auto io_res = this->do_socket_stream_write_unlocked(eptr, static_cast<size_t>(nread));
+    offset += eptr - hint;
+    return io_res;
+  }
+
+IO_Result
+Abstract_Stream_Socket::
+do_socket_stream_splice_in_unlocked(int /*pfd*/, size_t& /*count*/, size_t /*limit*/)
+  {
+    POSEIDON_THROW("Splicing not supported by socket class `$1`", typeid(*this));
+  }
+
+IO_Result
+Abstract_Stream_Socket::
+do_socket_stream_splice_out_unlocked(int /*pfd*/, size_t& /*count*/, size_t /*limit*/)
+  {
+    POSEIDON_THROW("Splicing not supported by socket class `$1`", typeid(*this));
+  }
+
 void
 Abstract_Stream_Socket::
 do_socket_on_poll_close(int err)
   {
     simple_mutex::unique_lock lock(this->m_io_mutex);
     this->m_cstate = connection_state_closed;
+    auto peer = ::std::move(this->m_link);
     lock.unlock();
 
+    // Close the linked socket after it sends all data that have been forwarded.
+    // This also breaks the reference cycle.
+    if(peer)
+      peer->close();
+
     this->do_socket_on_close(err);
   }
 
@@ -199,6 +336,124 @@ do_socket_send(const char* data, size_t size)
     return true;
   }
 
+bool
+Abstract_Stream_Socket::
+do_socket_sendv(const ::iovec* iov, size_t count)
+  {
+    simple_mutex::unique_lock lock(this->m_io_mutex);
+    if(this->m_cstate > connection_state_established)
+      return false;
+
+    // Append all data to the write queue.
+    size_t total = 0;
+    for(size_t k = 0;  k != count;  ++k)
+      total += iov[k].iov_len;
+    this->m_wqueue.reserve(total);
+
+    for(size_t k = 0;  k != count;  ++k)
+      this->m_wqueue.putn(static_cast<const char*>(iov[k].iov_base), iov[k].iov_len);
+    lock.unlock();
+
+    // Notify the driver about availability of outgoing data.
+    Network_Driver::notify_writable_internal(*this);
+    return true;
+  }
+
+bool
+Abstract_Stream_Socket::
+do_socket_send_file(int fd, int64_t offset, int64_t size)
+  {
+    if(offset < 0)
+      POSEIDON_THROW("Negative file offset (offset `$1`)", offset);
+
+    if(size < 0)
+      POSEIDON_THROW("Negative file segment size (size `$1`)", size);
+
+    if(size == 0) {
+      simple_mutex::unique_lock lock(this->m_io_mutex);
+      return this->m_cstate <= connection_state_established;
+    }
+
+    // Duplicate the file descriptor, as the segment may outlive it.
+    unique_FD dfd(::fcntl(fd, F_DUPFD_CLOEXEC, 0));
+    if(!dfd)
+      POSEIDON_THROW("Could not duplicate file descriptor\n"
+                     "[`fcntl()` failed: $1]",
+                     format_errno(errno));
+
+    simple_mutex::unique_lock lock(this->m_io_mutex);
+    if(this->m_cstate > connection_state_established)
+      return false;
+
+    // Append the segment after all data that have been queued so far.
+    File_Segment seg;
+    seg.nprefix = this->m_wqueue.size() - this->m_wprefix;
+    seg.fd = ::std::move(dfd);
+    seg.offset = offset;
+    seg.remaining = size;
+    this->m_wfiles.emplace_back(::std::move(seg));
+    this->m_wprefix += this->m_wfiles.back().nprefix;
+    lock.unlock();
+
+    // Notify the driver about availability of outgoing data.
+    Network_Driver::notify_writable_internal(*this);
+    return true;
+  }
+
+void
+Abstract_Stream_Socket::
+do_socket_link(const rcptr<Abstract_Stream_Socket>& first,
+               const rcptr<Abstract_Stream_Socket>& second)
+  {
+    if(!first || !second)
+      POSEIDON_THROW("Null socket pointer not valid");
+
+    if(first == second)
+      POSEIDON_THROW("Socket cannot be linked with itself");
+
+    // Create a pipe for each direction.
+    int fds[2];
+    if(::pipe2(fds, O_NONBLOCK | O_CLOEXEC) != 0)
+      POSEIDON_THROW("Could not create pipe\n"
+                     "[`pipe2()` failed: $1]",
+                     format_errno(errno));
+
+    unique_FD rd_12(fds[0]);
+    unique_FD wr_12(fds[1]);
+
+    if(::pipe2(fds, O_NONBLOCK | O_CLOEXEC) != 0)
+      POSEIDON_THROW("Could not create pipe\n"
+                     "[`pipe2()` failed: $1]",
+                     format_errno(errno));
+
+    unique_FD rd_21(fds[0]);
+    unique_FD wr_21(fds[1]);
+
+    // Lock both sockets in a consistent order to avoid deadlocks.
+    auto mtx_1 = &(first->m_io_mutex);
+    auto mtx_2 = &(second->m_io_mutex);
+    if(::std::less<const simple_mutex*>()(mtx_2, mtx_1))
+      ::std::swap(mtx_1, mtx_2);
+
+    simple_mutex::unique_lock lock_1(*mtx_1);
+    simple_mutex::unique_lock lock_2(*mtx_2);
+
+    if((first->m_cstate > connection_state_established) ||
+       (second->m_cstate > connection_state_established))
+      POSEIDON_THROW("Socket closed or closing");
+
+    if(first->m_link || second->m_link)
+      POSEIDON_THROW("Socket already linked");
+
+    first->m_link = second;
+    first->m_relay_wr = ::std::move(wr_12);
+    first->m_relay_rd = ::std::move(rd_21);
+
+    second->m_link = first;
+    second->m_relay_wr = ::std::move(wr_21);
+    second->m_relay_rd = ::std::move(rd_12);
+  }
+
 const Socket_Address&
 Abstract_Stream_Socket::
 get_remote_address()
@@ -13,10 +13,35 @@ class Abstract_Stream_Socket
     public Abstract_Socket
   {
   private:
+    // This is a segment of a file that is to be sent after `nprefix` bytes from
+    // the write queue.
+    struct File_Segment
+      {
+        size_t nprefix;
+        unique_FD fd;
+        int64_t offset;
+        int64_t remaining;
+      };
+
     // These are I/O components.
     mutable simple_mutex m_io_mutex;
     Connection_State m_cstate = connection_state_empty;
     linear_buffer m_wqueue;  // write queue
+    ::std::deque<File_Segment> m_wfiles;  // file segments pending
+    size_t m_wprefix = 0;  // sum of all `nprefix`
+
+    // These are used by linked sockets. Incoming data are spliced into the pipe
+    // to `m_link`, and outgoing data are spliced from the pipe from `m_link`.
+    // `m_relay_size` is updated by `m_link`, and `m_relay_throttled` is cleared
+    // and `m_relay_eof` is set by `m_link`, all on the network thread.
+    rcptr<Abstract_Stream_Socket> m_link;
+    unique_FD m_relay_wr;  // write end of the pipe to `m_link`
+    unique_FD m_relay_rd;  // read end of the pipe from `m_link`
+    atomic_relaxed<size_t> m_relay_size = { 0 };  // bytes in the pipe from `m_link`
+    atomic_relaxed<bool> m_relay_throttled = { false };  // the pipe to `m_link` is full
+    atomic_relaxed<bool> m_relay_eof = { false };  // `m_link` has read end of stream
+    bool m_relay_shut = false;  // sending side shut down after the pipe ended
+    bool m_read_eof = false;  // end of stream read from this socket
 
     // This the remote address. It is initialized upon the first request.
     mutable once_flag m_remote_addr_once;
@@ -82,6 +107,39 @@ class Abstract_Stream_Socket
     do_socket_stream_write_unlocked(const char*& data, size_t size)
       = 0;
 
+    // Sends some data from a file. Overridden functions shall update `offset` to
+    // denote the end of bytes that have been sent. `limit` is the number of bytes
+    // remaining in this segment, which is always positive. `hint` points to a
+    // temporary buffer of `size` bytes that may be used for any purpose.
+    // The default implementation reads the file into `hint`, then calls
+    // `do_socket_stream_write_unlocked()`.
+    // This function is called by the network thread. The current socket will have
+    // been locked by its caller. No synchronization is required.
+    virtual
+    IO_Result
+    do_socket_stream_sendfile_unlocked(int fd, int64_t& offset, int64_t limit,
+                                       char* hint, size_t size);
+
+    // Moves incoming data into the pipe `pfd`. Overridden functions shall add the
+    // number of bytes that have been moved to `count`. `limit` is the maximum
+    // number of bytes to move.
+    // The default implementation throws an exception.
+    // This function is called by the network thread. The current socket will have
+    // been locked by its caller. No synchronization is required.
+    virtual
+    IO_Result
+    do_socket_stream_splice_in_unlocked(int pfd, size_t& count, size_t limit);
+
+    // Moves outgoing data from the pipe `pfd`. Overridden functions shall add the
+    // number of bytes that have been moved to `count`. `limit` is the number of
+    // bytes in the pipe, which is always positive.
+    // The default implementation throws an exception.
+    // This function is called by the network thread. The current socket will have
+    // been locked by its caller. No synchronization is required.
+    virtual
+    IO_Result
+    do_socket_stream_splice_out_unlocked(int pfd, size_t& count, size_t limit);
+
     // Performs some shutdown preparation.
     // This function is called by the network thread. The current socket will have
     // been locked by its caller. No synchronization is required.
@@ -124,6 +182,42 @@ class Abstract_Stream_Socket
     bool
     do_socket_send(const char* data, size_t size);
 
+    // Enqueues multiple blocks of data for writing, as if they were concatenated.
+    // All blocks are queued with a single lock and a single notification.
+    // This function returns `true` if the data have been queued, or `false` if a
+    // shutdown request has been initiated.
+    // This function is thread-safe.
+    bool
+    do_socket_sendv(const ::iovec* iov, size_t count);
+
+    // Enqueues a segment of a file for writing, after all data that have been
+    // queued so far. `fd` is duplicated, so the caller may close it afterwards.
+    // The file shall not be truncated before all bytes have been sent, otherwise
+    // the connection is aborted.
+    // This function returns `true` if the segment has been queued, or `false` if
+    // a shutdown request has been initiated.
+    // This function is thread-safe.
+    bool
+    do_socket_send_file(int fd, int64_t offset, int64_t size);
+
+    // Links two sockets, so data that are received by either socket are forwarded
+    // to the other one through a kernel pipe, without being copied into userspace.
+    // Data that have been queued are sent before forwarded data. After this call,
+    // `do_socket_on_receive()` is no longer called, and no more data shall be sent
+    // through either socket. When either socket reads end of stream, the other one
+    // shuts down its sending side after all forwarded data have been sent, so the
+    // end of stream is forwarded, and the opposite direction keeps working. Each
+    // socket is closed after both directions have ended. If either socket is
+    // closed otherwise, the other one is closed after all forwarded data have been
+    // sent. If a pipe is full, the socket that fills it is not read until the other
+    // one has drained it.
+    // Both sockets shall support splicing.
+    // This function is thread-safe.
+    static
+    void
+    do_socket_link(const rcptr<Abstract_Stream_Socket>& first,
+                   const rcptr<Abstract_Stream_Socket>& second);
+
   public:
     ASTERIA_NONCOPYABLE_DESTRUCTOR(Abstract_Stream_Socket);
 
@@ -4,6 +4,8 @@
 #include "../precompiled.hpp"
 #include "abstract_tcp_socket.hpp"
 #include "../utils.hpp"
+#include <sys/sendfile.h>
+#include <fcntl.h>
 
 namespace poseidon {
 
@@ -51,6 +53,55 @@ do_socket_stream_write_unlocked(const char*& data, size_t size)
     return io_result_partial_work;
   }
 
+IO_Result
+Abstract_TCP_Socket::
+do_socket_stream_sendfile_unlocked(int fd, int64_t& offset, int64_t limit,
+                                   char* /*hint*/, size_t /*size*/)
+  {
+    // The kernel limits the number of bytes by the size of the send buffer, so
+    // there is no need to impose another limit.
+    ::off_t off = static_cast<::off_t>(offset);
+    size_t nreq = static_cast<size_t>(::rocket::min(limit, 0x7FFFF000));
+    ::ssize_t nsent = ::sendfile(this->get_fd(), fd, &off, nreq);
+    if(nsent < 0)
+      return get_io_result_from_errno("sendfile", errno);
+
+    if(nsent == 0)
+      POSEIDON_THROW("File truncated while being sent (offset `$1`)", offset);
+
+    offset = static_cast<int64_t>(off);
+    return io_result_partial_work;
+  }
+
+IO_Result
+Abstract_TCP_Socket::
+do_socket_stream_splice_in_unlocked(int pfd, size_t& count, size_t limit)
+  {
+    ::ssize_t nmoved = ::splice(this->get_fd(), nullptr, pfd, nullptr, limit,
+                                SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if(nmoved < 0)
+      return get_io_result_from_errno("splice", errno);
+
+    if(nmoved == 0)
+      return io_result_end_of_stream;
+
+    count += static_cast<size_t>(nmoved);
+    return io_result_partial_work;
+  }
+
+IO_Result
+Abstract_TCP_Socket::
+do_socket_stream_splice_out_unlocked(int pfd, size_t& count, size_t limit)
+  {
+    ::ssize_t nmoved = ::splice(pfd, nullptr, this->get_fd(), nullptr, limit,
+                                SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if(nmoved < 0)
+      return get_io_result_from_errno("splice", errno);
+
+    count += static_cast<size_t>(nmoved);
+    return io_result_partial_work;
+  }
+
 void
 Abstract_TCP_Socket::
 do_socket_stream_preclose_unclocked()
@@ -32,6 +32,22 @@ class Abstract_TCP_Socket
     do_socket_stream_write_unlocked(const char*& data, size_t size)
       final;
 
+    // Calls `::sendfile()`, so file data are not copied into userspace.
+    IO_Result
+    do_socket_stream_sendfile_unlocked(int fd, int64_t& offset, int64_t limit,
+                                       char* hint, size_t size)
+      final;
+
+    // Calls `::splice()` to move incoming data into a pipe.
+    IO_Result
+    do_socket_stream_splice_in_unlocked(int pfd, size_t& count, size_t limit)
+      final;
+
+    // Calls `::splice()` to move outgoing data from a pipe.
+    IO_Result
+    do_socket_stream_splice_out_unlocked(int pfd, size_t& count, size_t limit)
+      final;
+
     // Does nothing.
     void
     do_socket_stream_preclose_unclocked()
@@ -68,6 +84,16 @@ class Abstract_TCP_Socket
 
     using Abstract_Stream_Socket::get_remote_address;
     using Abstract_Stream_Socket::close;
+
+    // Links two TCP sockets, so data are forwarded between them in the kernel,
+    // for example, to relay a tunnel that has been established with `CONNECT`.
+    // Data that have been received but not consumed shall be sent to the other
+    // socket before this call. See `do_socket_link()` for details.
+    // This function is thread-safe.
+    static
+    void
+    link(const rcptr<Abstract_TCP_Socket>& first, const rcptr<Abstract_TCP_Socket>& second)
+      { Abstract_Stream_Socket::do_socket_link(first, second);  }
   };
 
 }  // namespace poseidon
@@ -4,6 +4,12 @@
 #include "../precompiled.hpp"
 #include "abstract_tls_socket.hpp"
 #include "../utils.hpp"
+#include <atomic>
+#include <map>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 
 namespace poseidon {
 namespace {
@@ -34,6 +40,192 @@ do_translate_ssl_error(const char* func, const ::SSL* ssl, int ret)
     }
   }
 
+// Hot files are mapped into memory and shared by all TLS sockets, so their
+// data can be encrypted without being copied into the I/O buffer first.
+constexpr int64_t s_mmap_max_file_size = 16 << 20;
+constexpr int64_t s_mmap_capacity = 256 << 20;
+
+}  // namespace
+
+struct details_abstract_tls_socket::File_Mapping
+  : public ::asteria::Rcfwd<File_Mapping>
+  {
+    const char* data;
+    int64_t size;
+    ::dev_t dev;
+    ::ino_t ino;
+    int64_t mtime_ns;
+    atomic_relaxed<bool> truncated;  // a `SIGBUS` has been caught
+
+    // These are links of the LRU list, which are protected by the mutex.
+    File_Mapping* lru_prev = nullptr;
+    File_Mapping* lru_next = nullptr;
+
+    explicit
+    File_Mapping(const char* xdata, const struct ::stat& st, int64_t xmtime_ns)
+      noexcept
+      : data(xdata), size(st.st_size), dev(st.st_dev), ino(st.st_ino), mtime_ns(xmtime_ns)
+      { }
+
+    ~File_Mapping()
+      {
+        ::munmap(const_cast<char*>(this->data), static_cast<size_t>(this->size));
+      }
+  };
+
+namespace {
+
+using details_abstract_tls_socket::File_Mapping;
+
+simple_mutex s_mmap_mutex;
+::std::map<pair<::dev_t, ::ino_t>, rcptr<File_Mapping>> s_mmap_files;
+int64_t s_mmap_size;
+File_Mapping* s_mmap_lru_head;  // most recently used
+File_Mapping* s_mmap_lru_tail;  // least recently used
+
+void
+do_lru_unlink(File_Mapping* map)
+  noexcept
+  {
+    (map->lru_prev ? map->lru_prev->lru_next : s_mmap_lru_head) = map->lru_next;
+    (map->lru_next ? map->lru_next->lru_prev : s_mmap_lru_tail) = map->lru_prev;
+    map->lru_prev = nullptr;
+    map->lru_next = nullptr;
+  }
+
+void
+do_lru_push_front(File_Mapping* map)
+  noexcept
+  {
+    map->lru_prev = nullptr;
+    map->lru_next = s_mmap_lru_head;
+    (s_mmap_lru_head ? s_mmap_lru_head->lru_prev : s_mmap_lru_tail) = map;
+    s_mmap_lru_head = map;
+  }
+
+void
+do_erase_file_mapping_unlocked(File_Mapping* map)
+  noexcept
+  {
+    // Mappings that are still in use are unmapped when they are released.
+    do_lru_unlink(map);
+    s_mmap_size -= map->size;
+    s_mmap_files.erase(::std::make_pair(map->dev, map->ino));
+  }
+
+// If a mapped file is truncated, access to pages beyond its end raises
+// `SIGBUS`. While a TLS socket is encrypting data from a mapping, the mapping
+// is guarded by the handler below, which replaces the faulting page with zeroes
+// and sets a flag, so the operation can be failed after `SSL_write()` returns.
+// Faults outside a guarded mapping are passed to the previous handler. Files
+// are not mapped until the handler has been installed.
+size_t s_sigbus_page_size;
+struct ::sigaction s_sigbus_prev;
+atomic_acq_rel<bool> s_sigbus_installed;
+thread_local const char* s_sigbus_base;
+thread_local size_t s_sigbus_size;
+thread_local bool s_sigbus_hit;
+
+void
+do_sigbus_handler(int sig, ::siginfo_t* info, void* uctx)
+  {
+    auto addr = static_cast<const char*>(info->si_addr);
+    if(!s_sigbus_base || (addr < s_sigbus_base) || (addr >= s_sigbus_base + s_sigbus_size)) {
+      // This fault is not ours.
+      if(s_sigbus_prev.sa_flags & SA_SIGINFO)
+        return s_sigbus_prev.sa_sigaction(sig, info, uctx);
+
+      if((s_sigbus_prev.sa_handler != SIG_DFL) && (s_sigbus_prev.sa_handler != SIG_IGN))
+        return s_sigbus_prev.sa_handler(sig);
+
+      // Restore the default action. Returning from the handler retries the
+      // instruction, which raises the signal again. A fault can't be ignored.
+      struct ::sigaction sigx = { };
+      sigx.sa_handler = SIG_DFL;
+      ::sigaction(sig, &sigx, nullptr);
+      return;
+    }
+
+    // `mmap()` is not async-signal-safe, so make the system call directly,
+    // which touches no state of the C library.
+    auto page = reinterpret_cast<uintptr_t>(addr) & ~(s_sigbus_page_size - 1);
+    ::syscall(SYS_mmap, page, s_sigbus_page_size, PROT_READ,
+              MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+    s_sigbus_hit = true;
+  }
+
+rcptr<File_Mapping>
+do_get_file_mapping(int fd)
+  {
+    // Files can't be mapped safely without the handler.
+    if(!s_sigbus_installed.load())
+      return nullptr;
+
+    struct ::stat st;
+    if(::fstat(fd, &st) != 0)
+      return nullptr;
+
+    if(!S_ISREG(st.st_mode) || (st.st_size <= 0) || (st.st_size > s_mmap_max_file_size))
+      return nullptr;
+
+    // A file that has been modified since it was mapped is mapped again.
+    int64_t mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000
+                       + st.st_mtim.tv_nsec;
+
+    simple_mutex::unique_lock lock(s_mmap_mutex);
+    auto it = s_mmap_files.find(::std::make_pair(st.st_dev, st.st_ino));
+    if(it != s_mmap_files.end()) {
+      auto map = it->second;
+      if((map->mtime_ns == mtime_ns) && (map->size == st.st_size)) {
+        do_lru_unlink(map.get());
+        do_lru_push_front(map.get());
+        return map;
+      }
+
+      do_erase_file_mapping_unlocked(map.get());
+    }
+    lock.unlock();
+
+    // Map the file. Mapping is cheap, as no data are read until the first access.
+    void* addr = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED,
+                        fd, 0);
+    if(addr == MAP_FAILED) {
+      POSEIDON_LOG_WARN("Could not map file into memory\n"
+                        "[`mmap()` failed: $1]",
+                        format_errno(errno));
+      return nullptr;
+    }
+
+    auto map = ::rocket::make_refcnt<File_Mapping>(static_cast<const char*>(addr),
+                                                   st, mtime_ns);
+
+    // Another thread may have mapped the same file in the meantime, in which
+    // case the newer mapping replaces it.
+    lock.lock(s_mmap_mutex);
+    it = s_mmap_files.find(::std::make_pair(st.st_dev, st.st_ino));
+    if(it != s_mmap_files.end())
+      do_erase_file_mapping_unlocked(it->second.get());
+
+    s_mmap_files.emplace(::std::make_pair(st.st_dev, st.st_ino), map);
+    do_lru_push_front(map.get());
+    s_mmap_size += map->size;
+
+    // Evict least recently used files.
+    while((s_mmap_size > s_mmap_capacity) && (s_mmap_lru_tail != map.get()))
+      do_erase_file_mapping_unlocked(s_mmap_lru_tail);
+    return map;
+  }
+
+void
+do_discard_file_mapping(File_Mapping* map)
+  noexcept
+  {
+    simple_mutex::unique_lock lock(s_mmap_mutex);
+    auto it = s_mmap_files.find(::std::make_pair(map->dev, map->ino));
+    if((it != s_mmap_files.end()) && (it->second.get() == map))
+      do_erase_file_mapping_unlocked(map);
+  }
+
 }  // namespace
 
 Abstract_TLS_Socket::
@@ -86,6 +278,86 @@ do_socket_stream_write_unlocked(const char*& data, size_t size)
     return io_result_partial_work;
   }
 
+IO_Result
+Abstract_TLS_Socket::
+do_socket_stream_sendfile_unlocked(int fd, int64_t& offset, int64_t limit,
+                                   char* hint, size_t size)
+  {
+    // Look the file up when a segment starts. As the descriptor of a segment
+    // is not closed until all of its bytes have been sent, it can't refer to
+    // another file before then.
+    if(this->m_sendfile_fd != fd) {
+      this->m_sendfile_map = do_get_file_mapping(fd);
+      this->m_sendfile_fd = fd;
+    }
+
+    int64_t old_offset = offset;
+    IO_Result io_res;
+    const auto map = unerase_pointer_cast<File_Mapping>(this->m_sendfile_map);
+    if(map && map->truncated.load())
+      POSEIDON_THROW("File truncated while being sent (offset `$1`)", offset);
+
+    if(!map || (offset > map->size - limit)) {
+      io_res = Abstract_Stream_Socket::do_socket_stream_sendfile_unlocked(fd, offset, limit,
+                                                                          hint, size);
+    }
+    else {
+      // Encrypt data in the mapping directly. As the mapping is kept until
+      // the end of this segment, the same range is passed again if the
+      // operation would block, as required by OpenSSL.
+      const char* data = map->data + offset;
+      const char* eptr = data;
+      s_sigbus_base = map->data;
+      s_sigbus_size = static_cast<size_t>(map->size);
+      s_sigbus_hit = false;
+      ::std::atomic_signal_fence(::std::memory_order_seq_cst);
+
+      io_res = this->do_socket_stream_write_unlocked(eptr,
+                       static_cast<size_t>(::rocket::min(limit, static_cast<int64_t>(size))));
+
+      ::std::atomic_signal_fence(::std::memory_order_seq_cst);
+      s_sigbus_base = nullptr;
+      if(s_sigbus_hit) {
+        // The file has been truncated. Some zeroes may have been sent, so the
+        // connection can't be used any further. Other sockets that are sending
+        // the same file will fail, too, as the faulting page now reads zeroes.
+        map->truncated.store(true);
+        do_discard_file_mapping(map.get());
+        this->m_sendfile_fd = -1;
+        this->m_sendfile_map = nullptr;
+        POSEIDON_THROW("File truncated while being sent (offset `$1`)", offset);
+      }
+      offset += eptr - data;
+    }
+
+    // Release the file at the end of this segment.
+    if(offset - old_offset == limit) {
+      this->m_sendfile_fd = -1;
+      this->m_sendfile_map = nullptr;
+    }
+    return io_res;
+  }
+
+void
+Abstract_TLS_Socket::
+install_sigbus_guard()
+  {
+    if(s_sigbus_installed.load())
+      return;
+
+    s_sigbus_page_size = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+
+    struct ::sigaction sigx = { };
+    sigx.sa_sigaction = do_sigbus_handler;
+    sigx.sa_flags = SA_SIGINFO;
+    if(::sigaction(SIGBUS, &sigx, &s_sigbus_prev) != 0)
+      POSEIDON_THROW("Could not install `SIGBUS` handler\n"
+                     "[`sigaction()` failed: $1]",
+                     format_errno(errno));
+
+    s_sigbus_installed.store(true);
+  }
+
 void
 Abstract_TLS_Socket::
 do_socket_stream_preclose_unclocked()
@@ -8,12 +8,22 @@
 #include "openssl_stream.hpp"
 
 namespace poseidon {
+namespace details_abstract_tls_socket {
+
+struct File_Mapping;
+
+}  // namespace details_abstract_tls_socket
 
 class Abstract_TLS_Socket
   : public ::asteria::Rcfwd<Abstract_TLS_Socket>,
     public Abstract_Stream_Socket,
     public OpenSSL_Stream
   {
+  private:
+    // These are used by the network thread only.
+    int m_sendfile_fd = -1;
+    rcfwdp<details_abstract_tls_socket::File_Mapping> m_sendfile_map;
+
   protected:
     // Adopts a foreign or accepted socket.
     explicit
@@ -34,6 +44,17 @@ class Abstract_TLS_Socket
     do_socket_stream_write_unlocked(const char*& data, size_t size)
       final;
 
+    // Calls `::SSL_write()` with data from a memory-mapped file, which is cached
+    // and shared by all TLS sockets. Files that are too large to be mapped are
+    // read into `hint`.
+    // A file is looked up when its segment starts, and is mapped again if its
+    // size or modification time has changed. If it is truncated while being
+    // sent, an exception is thrown and the connection is closed.
+    IO_Result
+    do_socket_stream_sendfile_unlocked(int fd, int64_t& offset, int64_t limit,
+                                       char* hint, size_t size)
+      final;
+
     // Calls `::SSL_shutdown()`.
     void
     do_socket_stream_preclose_unclocked()
@@ -70,6 +91,16 @@ class Abstract_TLS_Socket
 
     using Abstract_Stream_Socket::get_remote_address;
     using Abstract_Stream_Socket::close;
+
+    // Installs a `SIGBUS` handler, which allows files to be encrypted from
+    // memory mappings, even if they are truncated by other processes. Faults
+    // elsewhere are passed to the previous handler. Without the handler, files
+    // are read with `pread()` instead. This is called by the network driver
+    // when it starts.
+    // If this function fails, an exception is thrown, and there is no effect.
+    static
+    void
+    install_sigbus_guard();
   };
 
 }  // namespace poseidon
@@ -8,6 +8,27 @@
 #include "../utils.hpp"
 
 namespace poseidon {
+namespace {
+
+int
+do_alpn_select(::SSL* /*ssl*/, const unsigned char** out, unsigned char* outlen,
+               const unsigned char* in, unsigned int inlen, void* arg)
+  {
+    const auto& protos = static_cast<const OpenSSL_Context*>(arg)->alpn_protocols();
+
+    // Select the first protocol of ours that is also offered by the client.
+    unsigned char* sel;
+    int res = ::SSL_select_next_proto(&sel, outlen,
+                          reinterpret_cast<const unsigned char*>(protos.data()),
+                          static_cast<unsigned>(protos.size()), in, inlen);
+    if(res != OPENSSL_NPN_NEGOTIATED)
+      return SSL_TLSEXT_ERR_NOACK;
+
+    *out = sel;
+    return SSL_TLSEXT_ERR_OK;
+  }
+
+}  // namespace
 
 const OpenSSL_Context&
 OpenSSL_Context::
@@ -84,4 +105,33 @@ OpenSSL_Context::
   {
   }
 
+OpenSSL_Context&
+OpenSSL_Context::
+set_alpn_protocols(::std::initializer_list<const char*> protos)
+  {
+    // Compose the list in wire format, where each name is prefixed by its
+    // length in a single byte.
+    cow_string wire;
+    for(const char* name : protos) {
+      size_t len = ::std::strlen(name);
+      if((len == 0) || (len > 255))
+        POSEIDON_THROW("Invalid ALPN protocol name: $1", name);
+
+      wire.push_back(static_cast<char>(len));
+      wire.append(name, len);
+    }
+    this->m_alpn_protos = ::std::move(wire);
+
+    // This is used by clients. Note this function returns zero on success.
+    if(::SSL_CTX_set_alpn_protos(this->m_ctx,
+                   reinterpret_cast<const unsigned char*>(this->m_alpn_protos.data()),
+                   static_cast<unsigned>(this->m_alpn_protos.size())) != 0)
+      POSEIDON_SSL_THROW("Could not set ALPN protocols\n"
+                         "[`SSL_CTX_set_alpn_protos()` failed]");
+
+    // This is used by servers.
+    ::SSL_CTX_set_alpn_select_cb(this->m_ctx, do_alpn_select, this);
+    return *this;
+  }
+
 }  // namespace poseidon
@@ -29,6 +29,7 @@ class OpenSSL_Context
 
   private:
     details_openssl_common::unique_CTX m_ctx;
+    cow_string m_alpn_protos;  // in wire format
 
   public:
     // Creates a new SSL context.
@@ -48,6 +49,21 @@ class OpenSSL_Context
     open_ssl_ctx()
       noexcept
       { return this->m_ctx;  }
+
+    // Gets ALPN protocols in wire format.
+    const cow_string&
+    alpn_protocols()
+      const noexcept
+      { return this->m_alpn_protos;  }
+
+    // Sets protocols for Application-Layer Protocol Negotiation (ALPN), in the
+    // order of preference, such as `{ "h2", "http/1.1" }`.
+    // Clients offer these protocols. Servers select the first one that is also
+    // offered by the client. If there is none, no protocol is selected, and
+    // the connection proceeds as if ALPN were not in use.
+    // An exception is thrown if a protocol name is empty or too long.
+    OpenSSL_Context&
+    set_alpn_protocols(::std::initializer_list<const char*> protos);
   };
 
 }  // namespace poseidon
@@ -30,4 +30,18 @@ OpenSSL_Stream::
   {
   }
 
+cow_string
+OpenSSL_Stream::
+alpn_protocol()
+  const
+  {
+    const unsigned char* data;
+    unsigned len;
+    ::SSL_get0_alpn_selected(this->m_ssl, &data, &len);
+    if(!data)
+      return { };
+
+    return cow_string(reinterpret_cast<const char*>(data), len);
+  }
+
 }  // namespace poseidon
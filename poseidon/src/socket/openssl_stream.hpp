@@ -33,6 +33,13 @@ class OpenSSL_Stream
     open_ssl()
       noexcept
       { return this->m_ssl;  }
+
+    // Gets the protocol that has been selected by ALPN, such as `h2`.
+    // If no protocol has been selected, or the handshake has not completed, an
+    // empty string is returned.
+    cow_string
+    alpn_protocol()
+      const;
   };
 
 }  // namespace poseidon
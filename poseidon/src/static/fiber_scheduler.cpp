@@ -9,8 +9,10 @@
 #include "../utils.hpp"
 #include <sys/resource.h>
 #include <sys/mman.h>
-#include <semaphore.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
 #include <signal.h>
+#include <atomic>
 
 #ifdef POSEIDON_ENABLE_ADDRESS_SANITIZER
 extern "C" {
@@ -23,32 +25,51 @@ void
 __sanitizer_finish_switch_fiber(void* save, const void** sp_base, size_t* st_size)
   noexcept;
 
-#define POSEIDON_ASAN_START_SWITCH_FIBER(myctx, uctx)  \
-    (::__sanitizer_start_switch_fiber(&((myctx)->asan_fiber_save),  \
-                               (uctx)->uc_stack.ss_sp, (uctx)->uc_stack.ss_size))
+#define POSEIDON_ASAN_START_SWITCH_FIBER(myctx, sp_base, st_size)  \
+    (::__sanitizer_start_switch_fiber(&((myctx)->asan_fiber_save), sp_base, st_size))
 
 #define POSEIDON_ASAN_FINISH_SWITCH_FIBER(myctx)  \
     (::__sanitizer_finish_switch_fiber((myctx)->asan_fiber_save, nullptr, nullptr))
 
+// This is called on a fiber stack, and records the stack of the thread, which
+// is required when switching back.
+#define POSEIDON_ASAN_FINISH_SWITCH_INTO_FIBER(myctx)  \
+    (::__sanitizer_finish_switch_fiber((myctx)->asan_fiber_save,  \
+                        &((myctx)->asan_thread_base), &((myctx)->asan_thread_size)))
+
 }  // extern "C"
 
 #else  // POSEIDON_ENABLE_ADDRESS_SANITIZER
 
-#define POSEIDON_ASAN_START_SWITCH_FIBER(myctx, uctx)   ((void)0)
-#define POSEIDON_ASAN_FINISH_SWITCH_FIBER(myctx)        ((void)0)
+#define POSEIDON_ASAN_START_SWITCH_FIBER(myctx, sp_base, st_size)   ((void)0)
+#define POSEIDON_ASAN_FINISH_SWITCH_FIBER(myctx)                    ((void)0)
+#define POSEIDON_ASAN_FINISH_SWITCH_INTO_FIBER(myctx)               ((void)0)
 
 #endif  // POSEIDON_ENABLE_ADDRESS_SANITIZER
 
+#ifndef POSEIDON_FIBER_UCONTEXT_
+#  include "../details/fiber_switch.ipp"
+#endif
+
 namespace poseidon {
 namespace {
 
 int64_t
-do_get_monotonic_seconds()
+do_get_monotonic_milliseconds()
   noexcept
   {
     ::timespec ts;
     ::clock_gettime(CLOCK_MONOTONIC, &ts);
-    return ts.tv_sec;
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+  }
+
+int64_t
+do_saturating_add(int64_t lhs, int64_t rhs)
+  noexcept
+  {
+    // Both operands shall be non-negative.
+    ROCKET_ASSERT((lhs >= 0) && (rhs >= 0));
+    return (rhs > INT64_MAX - lhs) ? INT64_MAX : (lhs + rhs);
   }
 
 struct Stack_pointer
@@ -90,8 +111,34 @@ struct Stack_pointer
   };
 
 const size_t s_page_size = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+
+// Stacks are allocated in size classes, which are powers of two from 64KiB to
+// 256MiB, including guard pages. A requested size is rounded up to a class.
+constexpr size_t stack_class_count = 13;
+
+// These are set by `Fiber_Scheduler::reload()`.
+atomic_relaxed<size_t> s_stack_cache_max;  // per thread, for each class
+atomic_relaxed<size_t> s_stack_pool_max;  // globally, for each class
+atomic_relaxed<size_t> s_stack_keep_size;  // resident bytes of a free stack
+atomic_relaxed<bool> s_stack_lazy_free;
+atomic_relaxed<bool> s_stack_huge_pages;
+
+// Free stacks are chained by pointers at their tops, which stay resident.
+// Each scheduler thread has a cache, which is accessed without locking. If a
+// cache is full or empty, the global pool is consulted.
+struct Stack_Cache
+  {
+    Stack_pointer heads[stack_class_count];
+    size_t counts[stack_class_count] = { };
+  };
+
+thread_local Stack_Cache s_stack_cache;
+
+// This is set while the current thread is running a fiber. Unlike the thread
+// context, it is valid on every thread, even before the scheduler starts.
+thread_local bool s_in_fiber;
 simple_mutex s_stack_pool_mutex;
-Stack_pointer s_stack_pool_head;
+Stack_Cache s_stack_pool;
 
 size_t
 do_validate_stack_vm_size(size_t stack_vm_size)
@@ -109,6 +156,57 @@ do_validate_stack_vm_size(size_t stack_vm_size)
     return stack_vm_size;
   }
 
+uint32_t
+do_get_stack_class(size_t vm_size)
+  noexcept
+  {
+    // Get the smallest class that `vm_size` fits in.
+    ROCKET_ASSERT(vm_size >= 0x1'0000);
+    uint32_t cls = 0;
+    while((size_t(0x1'0000) << cls) < vm_size)
+      ++cls;
+
+    ROCKET_ASSERT(cls < stack_class_count);
+    return cls;
+  }
+
+Stack_pointer&
+do_stack_next(Stack_pointer sp)
+  noexcept
+  {
+    return reinterpret_cast<Stack_pointer*>(static_cast<char*>(sp.base) + sp.size)[-1];
+  }
+
+bool
+do_push_stack(Stack_Cache& cache, uint32_t cls, Stack_pointer sp, size_t max)
+  noexcept
+  {
+    if(cache.counts[cls] >= max)
+      return false;
+
+    // Insert the region at the beginning.
+    ::rocket::construct_at(&do_stack_next(sp), cache.heads[cls]);
+    cache.heads[cls] = sp;
+    ++(cache.counts[cls]);
+    return true;
+  }
+
+Stack_pointer
+do_pop_stack(Stack_Cache& cache, uint32_t cls)
+  noexcept
+  {
+    Stack_pointer sp = cache.heads[cls];
+    if(!sp)
+      return sp;
+
+    // Remove the region from the beginning.
+    auto& next = do_stack_next(sp);
+    cache.heads[cls] = next;
+    --(cache.counts[cls]);
+    ::rocket::destroy_at(&next);
+    return sp;
+  }
+
 void
 do_unmap_stack_aux(Stack_pointer sp)
   noexcept
@@ -124,6 +222,28 @@ do_unmap_stack_aux(Stack_pointer sp)
                          format_errno(errno), vm_base, vm_size);
   }
 
+void
+do_release_stack_pages(Stack_pointer sp)
+  noexcept
+  {
+    // Return pages below the watermark to the system. As stacks grow downwards,
+    // those at the top are the most likely to be used again, so they are kept.
+    size_t keep = ::rocket::min(s_stack_keep_size.load(), sp.size);
+    keep = (keep + sizeof(Stack_pointer) + s_page_size - 1) / s_page_size * s_page_size;
+    if(keep >= sp.size)
+      return;
+
+    int advice = MADV_DONTNEED;
+#ifdef MADV_FREE
+    if(s_stack_lazy_free.load())
+      advice = MADV_FREE;
+#endif
+    if(::madvise(sp.base, sp.size - keep, advice) != 0)
+      POSEIDON_LOG_WARN("Could not release stack memory (base `$2`, size `$3`)\n"
+                        "[`madvise()` failed: $1]",
+                        format_errno(errno), sp.base, sp.size - keep);
+  }
+
 struct Stack_delete
   {
     constexpr
@@ -142,12 +262,20 @@ struct Stack_delete
     close(Stack_pointer sp)
       noexcept
       {
+        uint32_t cls = do_get_stack_class(sp.size + s_page_size * 2);
+        do_release_stack_pages(sp);
+
+        // Put the region into the cache of the current thread, then the global
+        // pool. If both are full, unmap it.
+        if(do_push_stack(s_stack_cache, cls, sp, s_stack_cache_max.load()))
+          return;
+
         simple_mutex::unique_lock lock(s_stack_pool_mutex);
+        if(do_push_stack(s_stack_pool, cls, sp, s_stack_pool_max.load()))
+          return;
+        lock.unlock();
 
-        // Insert the region at the beginning.
-        auto qnext = static_cast<Stack_pointer*>(sp.base);
-        qnext = ::rocket::construct_at(qnext, s_stack_pool_head);
-        s_stack_pool_head = sp;
+        do_unmap_stack_aux(sp);
       }
   };
 
@@ -158,28 +286,20 @@ do_allocate_stack(size_t stack_vm_size)
   {
     Stack_pointer sp;
     char* vm_base;
-    size_t vm_size = do_validate_stack_vm_size(stack_vm_size);
-
-    // Check whether we can get a region from the pool.
-    for(;;) {
-      simple_mutex::unique_lock lock(s_stack_pool_mutex);
-      sp = s_stack_pool_head;
-      if(ROCKET_UNEXPECT(!sp))
-        break;
-
-      // Remove this region from the pool.
-      auto qnext = static_cast<Stack_pointer*>(sp.base);
-      s_stack_pool_head = *qnext;
-      ::rocket::destroy_at(qnext);
-      lock.unlock();
-
-      // Use this region if it is large enough.
-      if(ROCKET_EXPECT(sp.size + s_page_size * 2 >= vm_size))
-        return unique_stack(sp);
-
-      // Unmap this region and try the next one.
-      do_unmap_stack_aux(sp);
-    }
+    uint32_t cls = do_get_stack_class(do_validate_stack_vm_size(stack_vm_size));
+    size_t vm_size = size_t(0x1'0000) << cls;
+
+    // Check whether we can get a region from the cache of the current thread,
+    // then the global pool.
+    sp = do_pop_stack(s_stack_cache, cls);
+    if(ROCKET_EXPECT(sp))
+      return unique_stack(sp);
+
+    simple_mutex::unique_lock lock(s_stack_pool_mutex);
+    sp = do_pop_stack(s_stack_pool, cls);
+    lock.unlock();
+    if(sp)
+      return unique_stack(sp);
 
     // Allocate a new region with guard pages, if the pool has been exhausted.
     // Note `mmap()` returns `MAP_FAILED` upon failure, which is not a null pointer.
@@ -200,15 +320,60 @@ do_allocate_stack(size_t stack_vm_size)
                      "[`mprotect()` failed: $1]",
                      format_errno(errno), sp.base, sp.size);
 
+    // Pages are committed lazily. Transparent huge pages reduce TLB misses of
+    // large stacks, at the cost of committing memory in 2MiB units, so they are
+    // only used if enabled explicitly. Failure to do so is ignored.
+#ifdef MADV_HUGEPAGE
+    if(s_stack_huge_pages.load())
+      ::madvise(sp.base, sp.size, MADV_HUGEPAGE);
+#endif
+
     // The stack need not be unmapped once all permissions have been set.
     return unique_stack(sp_guard.release());
   }
 
+void
+do_reset_stack_usage(Stack_pointer sp)
+  noexcept
+  {
+    // Discard all pages, so those that are touched afterwards can be told by
+    // `mincore()`. A transparent huge page would make the whole stack resident
+    // upon the first touch, so they are disabled for this stack, which splits
+    // existing ones. Failure to do so is ignored.
+#ifdef MADV_NOHUGEPAGE
+    ::madvise(sp.base, sp.size, MADV_NOHUGEPAGE);
+#endif
+    ::madvise(sp.base, sp.size, MADV_DONTNEED);
+  }
+
+size_t
+do_measure_stack_usage(Stack_pointer sp)
+  {
+    // As stacks grow downwards, the lowest resident page marks the peak usage,
+    // which is rounded up to whole pages. Pages that have been swapped out are
+    // not counted, so the result may be an underestimate.
+    ::std::vector<unsigned char> bits(sp.size / s_page_size);
+    if(::mincore(sp.base, sp.size, bits.data()) != 0)
+      POSEIDON_THROW("Could not get stack memory residency (base `$2`, size `$3`)\n"
+                     "[`mincore()` failed: $1]",
+                     format_errno(errno), sp.base, sp.size);
+
+    auto bpos = ::std::find_if(bits.begin(), bits.end(), [](unsigned char b) { return b & 1;  });
+    return static_cast<size_t>(bits.end() - bpos) * s_page_size;
+  }
+
 struct Config_Scalars
   {
+    uint32_t thread_count = 1;
     size_t stack_vm_size = 0x2'00000;  // 2MiB
-    int64_t warn_timeout = 15;  // 15sec
-    int64_t fail_timeout = 300;  // 5min
+    size_t stack_cache_size = 16;
+    size_t stack_pool_size = 256;
+    size_t stack_keep_size = 0x1'0000;  // 64KiB
+    bool stack_lazy_free = false;
+    bool stack_huge_pages = false;
+    bool stack_profiling = false;
+    int64_t warn_timeout = 15'000;  // 15sec
+    int64_t fail_timeout = 300'000;  // 5min
   };
 
 struct PQ_Element
@@ -240,13 +405,134 @@ struct PQ_Compare
   }
   constexpr pq_compare;
 
+class Run_Queue
+  {
+    // This is a Chase-Lev deque of fibers that are ready to run. Fibers are
+    // pushed at the bottom by the owner thread only, and are taken from the top
+    // by any thread, including the owner, so they run in FIFO order. Each
+    // pointer in the queue owns a reference.
+
+  private:
+    struct Ring
+      {
+        size_t mask;
+        ::std::unique_ptr<::std::atomic<Abstract_Fiber*>[]> slots;
+        uptr<Ring> prev;  // retired, but may still be read by thieves
+      };
+
+    ::std::atomic<int64_t> m_top;
+    ::std::atomic<int64_t> m_bottom;
+    ::std::atomic<Ring*> m_ring;
+    uptr<Ring> m_ring_owner;
+
+  public:
+    explicit
+    Run_Queue()
+      noexcept
+      : m_top(0), m_bottom(0), m_ring(nullptr)
+      { }
+
+    ASTERIA_NONCOPYABLE_DESTRUCTOR(Run_Queue)
+      {
+        // Thread contexts are never destroyed, so there are no fibers to release.
+        ROCKET_ASSERT(this->m_top.load() == this->m_bottom.load());
+      }
+
+  private:
+    Ring*
+    do_grow(Ring* ring, int64_t top, int64_t bottom)
+      noexcept
+      {
+        // Allocate a ring twice as large, and copy all fibers into it.
+        size_t size = ring ? ((ring->mask + 1) * 2) : 256;
+        uptr<Ring> qring(new(::std::nothrow) Ring);
+        if(!qring)
+          return nullptr;
+
+        qring->slots.reset(new(::std::nothrow) ::std::atomic<Abstract_Fiber*>[size]);
+        if(!qring->slots)
+          return nullptr;
+
+        qring->mask = size - 1;
+        for(int64_t k = top;  k != bottom;  ++k) {
+          auto fiber = ring->slots[static_cast<size_t>(k) & ring->mask].load(::std::memory_order_relaxed);
+          qring->slots[static_cast<size_t>(k) & qring->mask].store(fiber, ::std::memory_order_relaxed);
+        }
+
+        // Publish the new ring.
+        qring->prev = ::std::move(this->m_ring_owner);
+        this->m_ring_owner = ::std::move(qring);
+        this->m_ring.store(this->m_ring_owner.get(), ::std::memory_order_release);
+        return this->m_ring_owner.get();
+      }
+
+  public:
+    // Pushes a fiber at the bottom. This function shall only be called by the
+    // owner thread. If memory is exhausted, `false` is returned.
+    bool
+    push(Abstract_Fiber* fiber)
+      noexcept
+      {
+        int64_t b = this->m_bottom.load(::std::memory_order_relaxed);
+        int64_t t = this->m_top.load(::std::memory_order_acquire);
+        auto ring = this->m_ring.load(::std::memory_order_relaxed);
+        if(!ring || (static_cast<size_t>(b - t) > ring->mask)) {
+          ring = this->do_grow(ring, t, b);
+          if(!ring)
+            return false;
+        }
+
+        ring->slots[static_cast<size_t>(b) & ring->mask].store(fiber, ::std::memory_order_relaxed);
+        ::std::atomic_thread_fence(::std::memory_order_release);
+        this->m_bottom.store(b + 1, ::std::memory_order_relaxed);
+        return true;
+      }
+
+    // Takes a fiber from the top. This function may be called by any thread.
+    // If the queue is empty, a null pointer is returned.
+    Abstract_Fiber*
+    steal()
+      noexcept
+      {
+        for(;;) {
+          int64_t t = this->m_top.load(::std::memory_order_acquire);
+          ::std::atomic_thread_fence(::std::memory_order_seq_cst);
+          int64_t b = this->m_bottom.load(::std::memory_order_acquire);
+          if(t >= b)
+            return nullptr;
+
+          // Read the slot before claiming it, as it may be reused afterwards.
+          auto ring = this->m_ring.load(::std::memory_order_acquire);
+          auto fiber = ring->slots[static_cast<size_t>(t) & ring->mask].load(::std::memory_order_relaxed);
+          if(this->m_top.compare_exchange_strong(t, t + 1, ::std::memory_order_seq_cst,
+                                                           ::std::memory_order_relaxed))
+            return fiber;
+        }
+      }
+  };
+
+// This is the maximum number of scheduler threads.
+constexpr size_t thread_table_size = 128;
+
 struct Thread_Context
   {
     Abstract_Fiber* current = nullptr;
+    bool current_waiting = false;  // `current` is waiting for a future
     void* asan_fiber_save;  // used by address sanitizer
+    const void* asan_thread_base = nullptr;
+    size_t asan_thread_size = 0;
+
+#ifdef POSEIDON_FIBER_UCONTEXT_
     ::ucontext_t return_uctx[1];
+#else
+    void* return_sp;
+#endif
+
+    size_t index = 0;  // in the thread table
+    Run_Queue run_queue;
   };
 
+#ifdef POSEIDON_FIBER_UCONTEXT_
 union Fancy_Fiber_Pointer
   {
     Abstract_Fiber* fiber;
@@ -269,77 +555,73 @@ union Fancy_Fiber_Pointer
       const noexcept
       { return this->fiber;  }
   };
+#endif  // POSEIDON_FIBER_UCONTEXT_
 
 class Queue_Semaphore
   {
   private:
-    ::sem_t m_sem[1];
+    // This is the number of tokens, which is also a futex word.
+    ::std::atomic<uint32_t> m_count;
 
   public:
     explicit
     Queue_Semaphore()
-      {
-        int r = ::sem_init(this->m_sem, 0, 0);
-        if(r != 0)
-          POSEIDON_THROW("Failed to initialize semaphore\n"
-                         "[`sem_init()` failed: $1]",
-                         format_errno(errno));
-      }
+      noexcept
+      : m_count(0)
+      { }
 
     ASTERIA_NONCOPYABLE_DESTRUCTOR(Queue_Semaphore)
       {
-        int r = ::sem_destroy(this->m_sem);
-        ROCKET_ASSERT(r == 0);
       }
 
-  public:
+  private:
     bool
-    wait_for(long secs)
+    do_try_take()
       noexcept
       {
-        int r;
-        if(secs <= 0) {
-          // Deal with immediate timeouts.
-          r = ::sem_trywait(this->m_sem);
-        }
-        else {
-          // Get the current time.
-          ::timespec ts;
-          r = ::clock_gettime(CLOCK_REALTIME, &ts);
-          ROCKET_ASSERT(r == 0);
-
-          // Ensure we don't cause overflows.
-          if(secs <= ::std::numeric_limits<::time_t>::max() - ts.tv_sec) {
-            ts.tv_sec += static_cast<::time_t>(secs);
-            r = ::sem_timedwait(this->m_sem, &ts);
-          }
-          else
-            r = ::sem_wait(this->m_sem);
-        }
-        ROCKET_ASSERT(r != EINVAL);
-        return r == 0;
+        uint32_t count = this->m_count.load(::std::memory_order_relaxed);
+        while(count != 0)
+          if(this->m_count.compare_exchange_weak(count, count - 1, ::std::memory_order_acquire,
+                                                                   ::std::memory_order_relaxed))
+            return true;
+        return false;
       }
 
+  public:
+    // Takes a token, waiting for at most `msecs` milliseconds. As the timeout
+    // of `FUTEX_WAIT` is measured against `CLOCK_MONOTONIC`, it is not affected
+    // by changes of the system time. This function may return `false` before
+    // the timeout expires, for example if it is interrupted by a signal.
     bool
-    wait()
+    wait_for(int64_t msecs)
       noexcept
       {
-        // Note `semwait()` may fail with `EINTR`.
-        int r = ::sem_wait(this->m_sem);
-        ROCKET_ASSERT(r != EINVAL);
-        return r == 0;
+        if(this->do_try_take())
+          return true;
+
+        // Deal with immediate timeouts.
+        if(msecs <= 0)
+          return false;
+
+        ::timespec ts;
+        ts.tv_sec = static_cast<::time_t>(msecs / 1000);
+        ts.tv_nsec = static_cast<long>(msecs % 1000 * 1000000);
+
+        // Sleep until a token is posted. A null timeout means infinity.
+        ::syscall(SYS_futex, &(this->m_count), FUTEX_WAIT_PRIVATE, 0,
+                  (msecs == INT64_MAX) ? nullptr : &ts, nullptr, 0);
+        return this->do_try_take();
       }
 
     bool
     signal()
       noexcept
       {
-        // Note `sem_post()` may fail with `EOVERFLOW`.
-        // The semaphore only indicates whether the queue is non-empty,
-        // so we may ignore this error.
-        int r = ::sem_post(this->m_sem);
-        ROCKET_ASSERT(r != EINVAL);
-        return r == 0;
+        // The count only indicates whether there is work to do, so overflows
+        // are harmless.
+        this->m_count.fetch_add(1, ::std::memory_order_release);
+        ::syscall(SYS_futex, &(this->m_count), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+        return true;
       }
   };
 
@@ -355,16 +637,33 @@ POSEIDON_STATIC_CLASS_DEFINE(Fiber_Scheduler)
     mutable simple_mutex m_conf_mutex;
     Config_Scalars m_conf;
 
+    // scheduler threads
+    // Contexts are appended to the table, and are never removed.
+    Thread_Context* m_thr_table[thread_table_size] = { };
+    atomic_seq_cst<size_t> m_thr_count;
+    atomic_seq_cst<size_t> m_thr_idle;  // number of threads awaiting fibers
+    Queue_Semaphore m_sched_avail;
+
+    // stack profiling
+    mutable simple_mutex m_stack_mutex;
+    ::std::vector<Fiber_Stack_Usage> m_stack_usage;
+
     // dynamic data
+    // Fibers that are ready are held in run queues of scheduler threads. Only
+    // fibers that are made ready by other threads go through the global ready
+    // queue, and only fibers that are waiting for futures go into the timer
+    // queue, both of which are protected by the global mutex.
+    atomic_seq_cst<size_t> m_sched_count;  // number of fibers in total
+    atomic_seq_cst<bool> m_sched_ready_avail;  // ready queue non-empty
+    atomic_seq_cst<int64_t> m_sched_pq_next;  // time of the first timer
     mutable simple_mutex m_sched_mutex;
-    Queue_Semaphore m_sched_avail;
     ::std::vector<PQ_Element> m_sched_pq;
-    Abstract_Fiber* m_sched_sleep_head = nullptr;
     Abstract_Fiber* m_sched_ready_head = nullptr;
+    Abstract_Fiber** m_sched_ready_tail = &(this->m_sched_ready_head);
 
     static
     void
-    do_start()
+    do_start(const atomic_signal& exit_sig)
       {
         self->m_init_once.call(
           [&] {
@@ -382,6 +681,20 @@ POSEIDON_STATIC_CLASS_DEFINE(Fiber_Scheduler)
             // Set up initialized data.
             simple_mutex::unique_lock lock(self->m_sched_mutex);
             self->m_sched_key = key_guard.release();
+            self->m_sched_pq_next.store(INT64_MAX);
+            lock.unlock();
+
+            // Create additional scheduler threads. The calling thread is the
+            // first one.
+            lock.lock(self->m_conf_mutex);
+            uint32_t thread_count = self->m_conf.thread_count;
+            lock.unlock();
+
+            for(uint32_t k = 1;  k < thread_count;  ++k) {
+              auto name = format_string("fiber $1", k);
+              POSEIDON_LOG_INFO("Creating new fiber scheduler thread: $1", name);
+              create_daemon_thread<do_thread_loop>(name.c_str(), (void*)&exit_sig);
+            }
           });
       }
 
@@ -408,27 +721,33 @@ POSEIDON_STATIC_CLASS_DEFINE(Fiber_Scheduler)
         // Allocate it if one hasn't been allocated yet.
         auto qctx = ::rocket::make_unique<Thread_Context>();
 
+        simple_mutex::unique_lock lock(self->m_sched_mutex);
+        size_t index = self->m_thr_count.load();
+        if(index >= thread_table_size)
+          POSEIDON_THROW("Too many fiber scheduler threads (limit `$1`)", thread_table_size);
+
         int err = ::pthread_setspecific(self->m_sched_key, qctx);
         if(err != 0)
           POSEIDON_THROW("Could not set fiber scheduler thread context\n"
                          "[`pthread_setspecific()` failed: $1]",
                          format_errno(err));
 
+        // Register it, so other threads can steal fibers from it.
+        qctx->index = index;
+        self->m_thr_table[index] = qctx;
+        self->m_thr_count.store(index + 1);
+
         POSEIDON_LOG_TRACE("Created new fiber scheduler thread context `$1`", qctx);
         return qctx.release();
       }
 
     [[noreturn]] static
     void
-    do_execute_fiber(int word_0, int word_1)
+    do_execute_fiber(Abstract_Fiber* fiber)
       noexcept
       {
         auto myctx = self->open_thread_context();
-        POSEIDON_ASAN_FINISH_SWITCH_FIBER(myctx);
-
-        // Get the fiber pointer back.
-        Fancy_Fiber_Pointer fcptr(word_0, word_1);
-        Abstract_Fiber* fiber = fcptr;
+        POSEIDON_ASAN_FINISH_SWITCH_INTO_FIBER(myctx);
 
         // Execute the fiber.
         ROCKET_ASSERT(fiber->state() == async_state_suspended);
@@ -450,27 +769,298 @@ POSEIDON_STATIC_CLASS_DEFINE(Fiber_Scheduler)
 
         // Note the scheduler thread may have changed.
         myctx = self->open_thread_context();
-        POSEIDON_ASAN_START_SWITCH_FIBER(myctx, myctx->return_uctx);
+        POSEIDON_ASAN_START_SWITCH_FIBER(myctx, myctx->asan_thread_base, myctx->asan_thread_size);
+#ifdef POSEIDON_FIBER_UCONTEXT_
         ::setcontext(myctx->return_uctx);
+#else
+        ::poseidon_fiber_switch(&(fiber->m_sched_sp), myctx->return_sp);
+#endif
         ::std::terminate();
       }
 
+#ifdef POSEIDON_FIBER_UCONTEXT_
+    [[noreturn]] static
+    void
+    do_execute_fiber_uctx(int word_0, int word_1)
+      noexcept
+      {
+        // Get the fiber pointer back.
+        Fancy_Fiber_Pointer fcptr(word_0, word_1);
+        self->do_execute_fiber(fcptr);
+      }
+#endif  // POSEIDON_FIBER_UCONTEXT_
+
     static
     void
     do_initialize_context(Abstract_Fiber* fiber, unique_stack&& stack)
       noexcept
       {
+        fiber->m_sched_stack = stack.release();
+
+#ifdef POSEIDON_FIBER_UCONTEXT_
         // Initialize the user-context.
         int r = ::getcontext(fiber->m_sched_uctx);
         ROCKET_ASSERT(r == 0);
 
         fiber->m_sched_uctx->uc_link = reinterpret_cast<::ucontext_t*>(-0x21520FF3);
-        fiber->m_sched_uctx->uc_stack = stack.release();
+        fiber->m_sched_uctx->uc_stack = fiber->m_sched_stack;
 
         // Fill in the executor function, whose argument is a copy of `fiber`.
         Fancy_Fiber_Pointer fcptr(fiber);
-        ::makecontext(fiber->m_sched_uctx, reinterpret_cast<void (*)()>(do_execute_fiber),
+        ::makecontext(fiber->m_sched_uctx, reinterpret_cast<void (*)()>(do_execute_fiber_uctx),
                                            2, fcptr.words[0], fcptr.words[1]);
+#else
+        // The fiber starts from `do_execute_fiber(fiber)`.
+        fiber->m_sched_sp = details_fiber_switch::make_initial_frame(
+                  static_cast<char*>(fiber->m_sched_stack.ss_sp) + fiber->m_sched_stack.ss_size,
+                  reinterpret_cast<uintptr_t>(do_execute_fiber), fiber);
+#endif  // POSEIDON_FIBER_UCONTEXT_
+      }
+
+    static
+    void
+    do_record_stack_usage(Abstract_Fiber* fiber)
+      noexcept
+      {
+        // Get the peak usage of a fiber that has finished.
+        size_t peak;
+        try {
+          peak = do_measure_stack_usage(fiber->m_sched_stack);
+        }
+        catch(exception& stdex) {
+          POSEIDON_LOG_WARN("Failed to measure stack usage: $1\n"
+                            "[fiber class `$2`]",
+                            stdex, typeid(*fiber));
+          return;
+        }
+
+        size_t bucket = 0;
+        while((bucket < Fiber_Stack_Usage::histogram_size - 1) &&
+              ((size_t(0x1000) << bucket) < peak))
+          ++bucket;
+
+        // Aggregate it by fiber class.
+        simple_mutex::unique_lock lock(self->m_stack_mutex);
+        auto qusage = ::std::find_if(self->m_stack_usage.begin(), self->m_stack_usage.end(),
+                           [&](const Fiber_Stack_Usage& r) { return *(r.type) == typeid(*fiber);  });
+        if(qusage == self->m_stack_usage.end()) {
+          // Note this shall guarantee strong exception safety.
+          try {
+            self->m_stack_usage.emplace_back();
+          }
+          catch(exception& stdex) {
+            POSEIDON_LOG_WARN("Failed to record stack usage: $1\n"
+                              "[fiber class `$2`]",
+                              stdex, typeid(*fiber));
+            return;
+          }
+          qusage = self->m_stack_usage.end() - 1;
+          qusage->type = &typeid(*fiber);
+        }
+
+        qusage->count += 1;
+        qusage->total_size += peak;
+        qusage->max_size = ::rocket::max(qusage->max_size, peak);
+        qusage->histogram[bucket] += 1;
+      }
+
+    static
+    void
+    do_wake_idle_thread()
+      noexcept
+      {
+        // The fence orders the preceding push before the load of the counter,
+        // which pairs with the fence in `do_thread_loop()`.
+        ::std::atomic_thread_fence(::std::memory_order_seq_cst);
+        if(self->m_thr_idle.load() != 0)
+          self->m_sched_avail.signal();
+      }
+
+    static
+    void
+    do_push_ready_unlocked(Abstract_Fiber* fiber)
+      noexcept
+      {
+        // Append a fiber to the global ready queue. The reference is transferred.
+        // The scheduler mutex shall be locked.
+        fiber->m_sched_ready_next = nullptr;
+        *(self->m_sched_ready_tail) = fiber;
+        self->m_sched_ready_tail = &(fiber->m_sched_ready_next);
+        self->m_sched_ready_avail.store(true);
+      }
+
+    static
+    void
+    do_push_local(Thread_Context* myctx, Abstract_Fiber* fiber)
+      noexcept
+      {
+        // Push a fiber into the run queue of the current thread, where it may be
+        // stolen by other threads. The reference is transferred.
+        // If memory is exhausted, it goes into the global ready queue instead.
+        if(ROCKET_UNEXPECT(!myctx->run_queue.push(fiber))) {
+          simple_mutex::unique_lock lock(self->m_sched_mutex);
+          self->do_push_ready_unlocked(fiber);
+        }
+        self->do_wake_idle_thread();
+      }
+
+    static
+    Abstract_Fiber*
+    do_steal_fiber(Thread_Context* myctx)
+      noexcept
+      {
+        // Take a fiber from the current thread first.
+        auto fiber = myctx->run_queue.steal();
+        if(fiber)
+          return fiber;
+
+        // Steal one from other threads, starting from the next one.
+        size_t count = self->m_thr_count.load();
+        for(size_t k = 1;  k < count;  ++k) {
+          auto other = self->m_thr_table[(myctx->index + k) % count];
+          fiber = other->run_queue.steal();
+          if(fiber)
+            return fiber;
+        }
+        return nullptr;
+      }
+
+    static
+    void
+    do_detach_unlocked(Abstract_Fiber* fiber)
+      noexcept
+      {
+        // Remove `fiber` from the wait queue of its future, if it is still there.
+        // The scheduler mutex shall be locked.
+        auto mref = ::std::ref(fiber->m_sched_futp->m_sched_waiting_head);
+        while(mref && (mref != fiber))
+          mref = ::std::ref(mref.get()->m_sched_ready_next);
+
+        if(mref)
+          mref.get() = fiber->m_sched_ready_next,
+            fiber->drop_reference();
+
+        fiber->m_sched_futp = nullptr;
+      }
+
+    static
+    void
+    do_collect_unlocked(Thread_Context* myctx, const Config_Scalars& conf, int64_t now,
+                        int sig)
+      {
+        // Move fibers from the global ready queue into the run queue of the
+        // current thread. Other threads will steal them if they are idle.
+        // The scheduler mutex shall be locked.
+        while(self->m_sched_ready_head) {
+          auto fiber = self->m_sched_ready_head;
+          if(!myctx->run_queue.push(fiber))
+            break;
+
+          POSEIDON_LOG_TRACE("Collected fiber `$1` from ready queue", fiber);
+          self->m_sched_ready_head = fiber->m_sched_ready_next;
+        }
+
+        if(!self->m_sched_ready_head)
+          self->m_sched_ready_tail = &(self->m_sched_ready_head);
+        self->m_sched_ready_avail.store(self->m_sched_ready_head != nullptr);
+
+        // Check fibers whose timers have expired. If a termination signal has
+        // been received, all of them are resumed.
+        rcptr<Abstract_Fiber> fiber;
+        while(!self->m_sched_pq.empty() && (sig || (now >= self->m_sched_pq.front().time))) {
+          ::std::pop_heap(self->m_sched_pq.begin(), self->m_sched_pq.end(), pq_compare);
+          auto& elem = self->m_sched_pq.back();
+          fiber = ::std::move(elem.fiber);
+
+          // Discard elements that have been invalidated by `signal()`.
+          if(!fiber->m_sched_parked || (fiber->m_sched_version != elem.version)) {
+            self->m_sched_pq.pop_back();
+            continue;
+          }
+
+          // Check wait duration.
+          // Note that `Promise::set_value()` first attempts to lock the future, then
+          // constructs the value. Only after the construction succeeds, does it call
+          // `Fiber_Scheduler::signal()`.
+          int64_t delta = now - fiber->m_sched_yield_since;
+          int64_t timeout = ::rocket::min(fiber->m_sched_yield_timeout, conf.fail_timeout);
+          if(!sig && fiber->m_sched_futp->do_is_empty() && (delta < timeout)) {
+            // Print a warning message if the fiber has been suspended for too long.
+            if(delta >= conf.warn_timeout)
+              POSEIDON_LOG_WARN("Fiber `$1` has been suspended for `$2` milliseconds.\n",
+                                "[fiber class `$3`]",
+                                fiber, delta, typeid(*fiber));
+
+            // Put the fiber back into the queue.
+            elem.time = ::rocket::min(do_saturating_add(now, conf.warn_timeout),
+                                      do_saturating_add(fiber->m_sched_yield_since, timeout));
+            elem.fiber = ::std::move(fiber);
+            ::std::push_heap(self->m_sched_pq.begin(), self->m_sched_pq.end(), pq_compare);
+            continue;
+          }
+
+          // Proceed anyway.
+          if(delta >= conf.fail_timeout)
+            POSEIDON_LOG_ERROR("Suspension of fiber `$1` has exceeded `$2` milliseconds.\n"
+                      "This circumstance looks permanent. Please check for deadlocks.\n",
+                      "[fiber class `$3`]",
+                      fiber, conf.fail_timeout, typeid(*fiber));
+
+          self->m_sched_pq.pop_back();
+          self->do_detach_unlocked(fiber);
+          fiber->m_sched_parked = false;
+
+          auto ptr = fiber.release();
+          if(!myctx->run_queue.push(ptr))
+            self->do_push_ready_unlocked(ptr);
+        }
+
+        int64_t next = INT64_MAX;
+        if(!self->m_sched_pq.empty())
+          next = self->m_sched_pq.front().time;
+        self->m_sched_pq_next.store(next);
+      }
+
+    static
+    void
+    do_park_unlocked(Thread_Context* myctx, rcptr<Abstract_Fiber>&& fiber,
+                     const Config_Scalars& conf)
+      {
+        // Put a fiber that is waiting for a future into the timer queue.
+        // The scheduler mutex shall be locked.
+        try {
+          self->m_sched_pq.emplace_back();
+        }
+        catch(exception& stdex) {
+          // Resume the fiber as if it had timed out.
+          POSEIDON_LOG_ERROR("Failed to park fiber: $1\n"
+                             "[fiber class `$2`]",
+                             stdex, typeid(*fiber));
+
+          self->do_detach_unlocked(fiber);
+          auto ptr = fiber.release();
+          if(!myctx->run_queue.push(ptr))
+            self->do_push_ready_unlocked(ptr);
+          return;
+        }
+
+        int64_t now = do_get_monotonic_milliseconds();
+        int64_t timeout = ::rocket::min(fiber->m_sched_yield_timeout, conf.fail_timeout);
+        fiber->m_sched_version += 1;
+        fiber->m_sched_parked = true;
+
+        auto& elem = self->m_sched_pq.back();
+        elem.time = ::rocket::min(do_saturating_add(now, conf.warn_timeout),
+                                  do_saturating_add(fiber->m_sched_yield_since, timeout));
+        elem.version = fiber->m_sched_version;
+        elem.fiber = ::std::move(fiber);
+        ::std::push_heap(self->m_sched_pq.begin(), self->m_sched_pq.end(), pq_compare);
+
+        // If this is the first timer, idle threads shall recalculate their
+        // timeouts.
+        int64_t next = self->m_sched_pq.front().time;
+        if(next < self->m_sched_pq_next.exchange(next))
+          self->do_wake_idle_thread();
       }
 
     static
@@ -490,91 +1080,56 @@ POSEIDON_STATIC_CLASS_DEFINE(Fiber_Scheduler)
         lock.unlock();
 
         // Await a fiber and pop it.
-        lock.lock(self->m_sched_mutex);
         for(;;) {
           fiber.reset();
-          now = do_get_monotonic_seconds();
+          now = do_get_monotonic_milliseconds();
           int sig = exit_sig.load();
 
-          while(self->m_sched_sleep_head) {
-            // Move a fiber from the sleep queue into the scheduler queue.
-            // Note this shall guarantee strong exception safety.
-            self->m_sched_pq.emplace_back();
-            fiber.reset(self->m_sched_sleep_head);
-            self->m_sched_sleep_head = fiber->m_sched_sleep_next;
-
-            // An odd version number indicates the fiber is being scheduled.
-            if(fiber->m_sched_version % 2) {
-              self->m_sched_pq.pop_back();
-              continue;
-            }
-            POSEIDON_LOG_TRACE("Collected fiber `$1` from sleep queue", fiber);
-            fiber->m_sched_version += 2;
-
-            auto& elem = self->m_sched_pq.back();
-            int64_t timeout = ::rocket::min(fiber->m_sched_yield_timeout, conf.fail_timeout);
-            elem.time = ::rocket::min(now + conf.warn_timeout,
-                                      fiber->m_sched_yield_since + timeout);
-            elem.version = fiber->m_sched_version;
-            elem.fiber = ::std::move(fiber);
-            ::std::push_heap(self->m_sched_pq.begin(), self->m_sched_pq.end(), pq_compare);
-          }
-
-          while(self->m_sched_ready_head) {
-            // Move a fiber from the ready queue into the scheduler queue.
-            // Note this shall guarantee strong exception safety.
-            self->m_sched_pq.emplace_back();
-            fiber.reset(self->m_sched_ready_head);
-            self->m_sched_ready_head = fiber->m_sched_ready_next;
-
-            // An odd version number indicates the fiber is being scheduled.
-            if(fiber->m_sched_version % 2) {
-              self->m_sched_pq.pop_back();
-              continue;
-            }
-            POSEIDON_LOG_TRACE("Collected fiber `$1` from ready queue", fiber);
-            fiber->m_sched_version += 2;
-
-            auto& elem = self->m_sched_pq.back();
-            elem.time = now;
-            elem.version = fiber->m_sched_version;
-            elem.fiber = ::std::move(fiber);
-            ::std::push_heap(self->m_sched_pq.begin(), self->m_sched_pq.end(), pq_compare);
-          }
-
-          if(sig && self->m_sched_pq.empty()) {
+          if(sig && (self->m_sched_count.load() == 0)) {
             // Exit if a signal has been received and there are no more fibers.
             // Note the scheduler mutex is locked so it is safe to call `strsignal()`.
+            lock.lock(self->m_sched_mutex);
             POSEIDON_LOG_INFO("Shutting down due to signal $1: $2", sig, ::strsignal(sig));
+
+            simple_mutex::unique_lock stack_lock(self->m_stack_mutex);
+            for(const auto& usage : self->m_stack_usage)
+              POSEIDON_LOG_INFO("Stack usage of fiber class `$1`: $2 fibers, max `$3`, mean `$4`",
+                                *(usage.type), usage.count, usage.max_size,
+                                usage.total_size / usage.count);
             Async_Logger::synchronize(1000);
             ::std::quick_exit(0);
           }
 
-          // Calculate the time to sleep.
-          long time_wait;
-          if(sig)
-            time_wait = 0;  // don't wait at all
-          else if(self->m_sched_pq.empty())
-            time_wait = LONG_MAX;  // wait infinitely
-          else
-            time_wait = self->m_sched_pq.front().time - now;
-
-          if(time_wait > 0) {
-            lock.unlock();
-            self->m_sched_avail.wait_for(time_wait);
+          // Collect fibers from the global queues. The global mutex is only
+          // locked if there is something to collect.
+          if(sig || self->m_sched_ready_avail.load() || (now >= self->m_sched_pq_next.load())) {
             lock.lock(self->m_sched_mutex);
-            continue;
+            self->do_collect_unlocked(myctx, conf, now, sig);
+            lock.unlock();
           }
 
-          // Pop the first fiber.
-          ::std::pop_heap(self->m_sched_pq.begin(), self->m_sched_pq.end(), pq_compare);
-          auto& elem = self->m_sched_pq.back();
-          fiber = ::std::move(elem.fiber);
+          // Take a fiber from the current thread, or steal one from another.
+          fiber.reset(self->do_steal_fiber(myctx));
+          if(!fiber) {
+            if(sig)
+              continue;
 
-          ROCKET_ASSERT(elem.version % 2 == 0);
-          if(fiber->m_sched_version != elem.version) {
-            self->m_sched_pq.pop_back();  // invalidated
-            continue;
+            // Check all queues again after announcing we are idle, so a fiber
+            // that is pushed concurrently will not be missed.
+            self->m_thr_idle.fetch_add(1);
+            ::std::atomic_thread_fence(::std::memory_order_seq_cst);
+            if(!self->m_sched_ready_avail.load())
+              fiber.reset(self->do_steal_fiber(myctx));
+
+            // Calculate the time to sleep.
+            if(!fiber && !self->m_sched_ready_avail.load()) {
+              int64_t time_wait = self->m_sched_pq_next.load() - now;
+              self->m_sched_avail.wait_for(time_wait);
+            }
+            self->m_thr_idle.fetch_sub(1);
+
+            if(!fiber)
+              continue;
           }
 
           bool should_cancel = sig ||   // termination pending
@@ -586,67 +1141,29 @@ POSEIDON_STATIC_CLASS_DEFINE(Fiber_Scheduler)
             // If the fiber stack is in use, it cannot be deallocated without possibility
             // of resource leaks.
             POSEIDON_LOG_INFO("Killed fiber `$1`\n[fiber class `$2`]", fiber, typeid(*fiber));
-            self->m_sched_pq.pop_back();
+            self->m_sched_count.fetch_sub(1);
             continue;
           }
 
-          // Check for blocking conditions.
-          // Note that `Promise::set_value()` first attempts to lock the future, then
-          // constructs the value. Only after the construction succeeds, does it call
-          // `Fiber_Scheduler::signal()`.
-          if(!should_cancel && fiber->m_sched_futp && fiber->m_sched_futp->do_is_empty()) {
-            // Check wait duration.
-            int64_t delta = now - fiber->m_sched_yield_since;
-            int64_t timeout = ::rocket::min(fiber->m_sched_yield_timeout, conf.fail_timeout);
-            if(delta < timeout) {
-              // Print a warning message if the fiber has been suspended for too long.
-              if(delta >= conf.warn_timeout)
-                POSEIDON_LOG_WARN("Fiber `$1` has been suspended for `$2` seconds.\n",
-                                  "[fiber class `$3`]",
-                                  fiber, delta, typeid(*fiber));
-
-              // Put the fiber back into the queue.
-              elem.time = ::rocket::min(now + conf.warn_timeout,
-                                        fiber->m_sched_yield_since + timeout);
-              elem.fiber = ::std::move(fiber);
-              ::std::push_heap(self->m_sched_pq.begin(), self->m_sched_pq.end(), pq_compare);
-              continue;
-            }
-
-            // Proceed anyway.
-            if(delta >= conf.fail_timeout)
-              POSEIDON_LOG_ERROR("Suspension of fiber `$1` has exceeded `$2` seconds.\n"
-                        "This circumstance looks permanent. Please check for deadlocks.\n",
-                        "[fiber class `$3`]",
-                        fiber, conf.fail_timeout, typeid(*fiber));
-          }
-
           // Process this fiber!
-          // An odd version number indicates the fiber is being scheduled.
-          ROCKET_ASSERT(fiber->m_sched_version % 2 == 0);
-          fiber->m_sched_version += 1;
-          self->m_sched_pq.pop_back();
           break;
         }
-        lock.unlock();
 
         // Initialize the fiber stack as necessary.
         if(fiber->state() == async_state_pending) {
           // Perform some initialization that might throw exceptions here.
           try {
             stack = do_allocate_stack(conf.stack_vm_size);
+            if(conf.stack_profiling)
+              do_reset_stack_usage(stack.get());
           }
           catch(exception& stdex) {
             POSEIDON_LOG_ERROR("Failed to initialize fiber: $1\n"
                                "[fiber class `$2`]",
                                stdex, typeid(*fiber));
 
-            // Put the fiber back into the sleep queue.
-            lock.lock(self->m_sched_mutex);
-            ROCKET_ASSERT(fiber->m_sched_version % 2 != 0);
-            fiber->m_sched_version += 1;
-            fiber->m_sched_sleep_next = ::std::exchange(self->m_sched_sleep_head, fiber);
-            fiber.release();
+            // Put the fiber back into the run queue.
+            self->do_push_local(myctx, fiber.release());
             return;
           }
 
@@ -661,46 +1178,54 @@ POSEIDON_STATIC_CLASS_DEFINE(Fiber_Scheduler)
 
         ROCKET_ASSERT(fiber->state() == async_state_suspended);
         myctx->current = fiber;
+        s_in_fiber = true;
         POSEIDON_LOG_TRACE("Resuming execution of fiber `$1`", fiber);
 
         // Resume this fiber...
-        POSEIDON_ASAN_START_SWITCH_FIBER(myctx, fiber->m_sched_uctx);
+        POSEIDON_ASAN_START_SWITCH_FIBER(myctx, fiber->m_sched_stack.ss_sp,
+                                         fiber->m_sched_stack.ss_size);
+#ifdef POSEIDON_FIBER_UCONTEXT_
         int r = ::swapcontext(myctx->return_uctx, fiber->m_sched_uctx);
         ROCKET_ASSERT(r == 0);
+#else
+        ::poseidon_fiber_switch(&(myctx->return_sp), fiber->m_sched_sp);
+#endif
         POSEIDON_ASAN_FINISH_SWITCH_FIBER(myctx);
 
         // ... and return here.
         myctx->current = nullptr;
+        s_in_fiber = false;
         POSEIDON_LOG_TRACE("Suspended execution of fiber `$1`", fiber);
 
         if(fiber->state() == async_state_suspended) {
-          // Put the fiber back into the sleep queue.
+          // If the fiber has relinquished its time slice, put it back into the
+          // run queue. No locking is needed.
+          if(!::std::exchange(myctx->current_waiting, false)) {
+            self->do_push_local(myctx, fiber.release());
+            return;
+          }
+
+          // Otherwise, it has been attached to the wait queue of a future. Park
+          // it, unless the future has been signaled during the switch.
           lock.lock(self->m_sched_mutex);
-          ROCKET_ASSERT(fiber->m_sched_version % 2 != 0);
-          fiber->m_sched_version += 1;
-          fiber->m_sched_sleep_next = ::std::exchange(self->m_sched_sleep_head, fiber);
-          fiber.release();
+          if(fiber->m_sched_futp) {
+            self->do_park_unlocked(myctx, ::std::move(fiber), conf);
+            return;
+          }
+          lock.unlock();
+
+          self->do_push_local(myctx, fiber.release());
           return;
         }
 
         // Otherwise, the fiber shall have completed execution.
         // Free its stack. The fiber can be safely deleted thereafter.
         ROCKET_ASSERT(fiber->state() == async_state_finished);
-        stack.reset(fiber->m_sched_uctx->uc_stack);
-      }
+        if(conf.stack_profiling)
+          self->do_record_stack_usage(fiber);
 
-    static
-    void
-    do_signal_if_queues_empty()
-      noexcept
-      {
-        if(ROCKET_EXPECT(self->m_sched_sleep_head))
-          return;
-
-        if(ROCKET_EXPECT(self->m_sched_ready_head))
-          return;
-
-        self->m_sched_avail.signal();
+        stack.reset(fiber->m_sched_stack);
+        self->m_sched_count.fetch_sub(1);
       }
   };
 
@@ -708,7 +1233,7 @@ void
 Fiber_Scheduler::
 modal_loop(const atomic_signal& exit_sig)
   {
-    self->do_start();
+    self->do_start(exit_sig);
 
     // Schedule fibers and block until `exit_sig` becomes non-zero.
     for(;;)
@@ -723,7 +1248,11 @@ reload()
     const auto file = Main_Config::copy();
     Config_Scalars conf;
 
-    auto qint = file.get_int64_opt({"fiber","stack_vm_size"});
+    auto qint = file.get_int64_opt({"fiber","thread_count"});
+    if(qint)
+      conf.thread_count = clamp_cast<uint32_t>(*qint, 1, 127);
+
+    qint = file.get_int64_opt({"fiber","stack_vm_size"});
     if(qint) {
       // Clamp the stack size between 256KiB and 256MiB for safety.
       // The upper bound (256MiB) is a hard limit, because we encode the number of
@@ -749,20 +1278,61 @@ reload()
     }
     do_validate_stack_vm_size(conf.stack_vm_size);
 
+    qint = file.get_int64_opt({"fiber","stack_cache_size"});
+    if(qint)
+      conf.stack_cache_size = clamp_cast<size_t>(*qint, 0, 0x1'0000);
+
+    qint = file.get_int64_opt({"fiber","stack_pool_size"});
+    if(qint)
+      conf.stack_pool_size = clamp_cast<size_t>(*qint, 0, 0x100'0000);
+
+    qint = file.get_int64_opt({"fiber","stack_keep_size"});
+    if(qint)
+      conf.stack_keep_size = clamp_cast<size_t>(*qint, 0, 0x1000'0000);
+
+    auto qbool = file.get_bool_opt({"fiber","stack_lazy_free"});
+    if(qbool)
+      conf.stack_lazy_free = *qbool;
+
+    qbool = file.get_bool_opt({"fiber","stack_huge_pages"});
+    if(qbool)
+      conf.stack_huge_pages = *qbool;
+
+    qbool = file.get_bool_opt({"fiber","stack_profiling"});
+    if(qbool)
+      conf.stack_profiling = *qbool;
+
     // Note a negative value indicates an infinite timeout.
+    // Timeouts are specified in seconds, but are stored in milliseconds.
     qint = file.get_int64_opt({"fiber","warn_timeout"});
     if(qint)
-      conf.warn_timeout = (*qint | *qint >> 63) & INT64_MAX;
+      conf.warn_timeout = ((*qint < 0) || (*qint > INT64_MAX / 1000)) ? INT64_MAX : (*qint * 1000);
 
     qint = file.get_int64_opt({"fiber","fail_timeout"});
     if(qint)
-      conf.fail_timeout = (*qint | *qint >> 63) & INT64_MAX;
+      conf.fail_timeout = ((*qint < 0) || (*qint > INT64_MAX / 1000)) ? INT64_MAX : (*qint * 1000);
 
     // During destruction of temporary objects the mutex should have been unlocked.
     // The swap operation is presumed to be fast, so we don't hold the mutex
     // for too long.
     simple_mutex::unique_lock lock(self->m_conf_mutex);
     self->m_conf = conf;
+    lock.unlock();
+
+    // Stacks are freed outside the scheduler, so these are stored separately.
+    s_stack_cache_max.store(conf.stack_cache_size);
+    s_stack_pool_max.store(conf.stack_pool_size);
+    s_stack_keep_size.store(conf.stack_keep_size);
+    s_stack_lazy_free.store(conf.stack_lazy_free);
+    s_stack_huge_pages.store(conf.stack_huge_pages);
+  }
+
+::std::vector<Fiber_Stack_Usage>
+Fiber_Scheduler::
+stack_usage()
+  {
+    simple_mutex::unique_lock lock(self->m_stack_mutex);
+    return self->m_stack_usage;
   }
 
 Abstract_Fiber*
@@ -782,6 +1352,14 @@ current_opt()
     return fiber;
   }
 
+bool
+Fiber_Scheduler::
+is_in_fiber()
+  noexcept
+  {
+    return s_in_fiber;
+  }
+
 void
 Fiber_Scheduler::
 yield(rcptr<const Abstract_Future> futp_opt, int64_t msecs)
@@ -800,57 +1378,42 @@ yield(rcptr<const Abstract_Future> futp_opt, int64_t msecs)
     fiber->do_on_suspend();
     POSEIDON_LOG_TRACE("Suspending execution of fiber `$1`", fiber);
 
-    int64_t now = do_get_monotonic_seconds();
-    int64_t timeout = ::rocket::clamp(msecs, 0, INT64_MAX - 999) + 999;
-    timeout = static_cast<int64_t>(static_cast<uint64_t>(timeout) / 1000);
+    int64_t now = do_get_monotonic_milliseconds();
+    int64_t timeout = ::rocket::max(msecs, 0);
 
-    simple_mutex::unique_lock lock(self->m_sched_mutex);
     fiber->m_sched_yield_since = now;
     fiber->m_sched_yield_timeout = timeout;
-
-    if(futp_opt && futp_opt->do_is_empty()) {
-      // The value in the future object may be still under construction, but the lock
-      // here prevents the other thread from modifying the scheduler queue. We still
-      // attach the fiber to the future's wait queue, which may be moved into the
-      // ready queue once the other thread locks the scheduler mutex successfully.
-      fiber->m_sched_futp = futp_opt.get();
-      fiber->m_sched_ready_next = ::std::exchange(futp_opt->m_sched_waiting_head, fiber);
-    }
-    else {
-      // Attach the fiber to the ready queue of the current thread otherwise.
-      fiber->m_sched_futp = nullptr;
-      self->do_signal_if_queues_empty();
-      fiber->m_sched_ready_next = ::std::exchange(self->m_sched_ready_head, fiber);
+    ROCKET_ASSERT(!fiber->m_sched_futp);
+
+    if(futp_opt) {
+      simple_mutex::unique_lock lock(self->m_sched_mutex);
+      if(futp_opt->do_is_empty()) {
+        // The value in the future object may be still under construction, but the
+        // lock here prevents the other thread from modifying the wait queue. The
+        // fiber is parked by the scheduler thread after it is suspended, unless
+        // the future is signaled before that.
+        fiber->m_sched_futp = futp_opt.get();
+        fiber->m_sched_ready_next = ::std::exchange(futp_opt->m_sched_waiting_head, fiber);
+        fiber->add_reference();
+        myctx->current_waiting = true;
+      }
     }
-    fiber->add_reference();
-    lock.unlock();
 
     // Suspend this fiber...
-    POSEIDON_ASAN_START_SWITCH_FIBER(myctx, myctx->return_uctx);
+    POSEIDON_ASAN_START_SWITCH_FIBER(myctx, myctx->asan_thread_base, myctx->asan_thread_size);
+#ifdef POSEIDON_FIBER_UCONTEXT_
     int r = ::swapcontext(fiber->m_sched_uctx, myctx->return_uctx);
     ROCKET_ASSERT(r == 0);
+#else
+    ::poseidon_fiber_switch(&(fiber->m_sched_sp), myctx->return_sp);
+#endif
     myctx = self->open_thread_context();  // (scheduler thread may have changed)
-    POSEIDON_ASAN_FINISH_SWITCH_FIBER(myctx);
-
-    if(fiber->m_sched_futp) {
-      // If the fiber has been attached to the wait queue of `*futp_opt`, it shall
-      // be detached now, unless it has been detached by another thread of course.
-      lock.lock(self->m_sched_mutex);
-      ROCKET_ASSERT(fiber->m_sched_futp == futp_opt);
-      fiber->m_sched_futp = nullptr;
-
-      // Remove `fiber` from the wait queue.
-      auto mref = ::std::ref(futp_opt->m_sched_waiting_head);
-      while(mref && (mref != fiber))
-        mref = ::std::ref(mref.get()->m_sched_ready_next);
-
-      if(mref)
-        mref.get() = fiber->m_sched_ready_next,
-          fiber->drop_reference();
-    }
-    lock.unlock();
+    POSEIDON_ASAN_FINISH_SWITCH_INTO_FIBER(myctx);
 
     // ... and resume here.
+    // The fiber shall have been detached from the future, either by `signal()`,
+    // or because the wait has timed out.
+    ROCKET_ASSERT(!fiber->m_sched_futp);
     ROCKET_ASSERT(myctx->current == fiber);
     ROCKET_ASSERT(fiber->state() == async_state_suspended);
     fiber->m_state.store(async_state_running);
@@ -872,16 +1435,19 @@ insert(uptr<Abstract_Fiber>&& ufiber)
 
     // Perform some initialization. No locking is needed here.
     fiber->m_sched_version = 0;
+    fiber->m_sched_parked = false;
     fiber->m_sched_yield_since = 0;
     fiber->m_sched_futp = nullptr;
-    fiber->m_sched_sleep_next = nullptr;
     fiber->m_state.store(async_state_pending);
+    self->m_sched_count.fetch_add(1);
 
-    // Attach this fiber to the ready queue.
+    // Attach this fiber to the global ready queue.
     simple_mutex::unique_lock lock(self->m_sched_mutex);
-    self->do_signal_if_queues_empty();
-    fiber->m_sched_ready_next = ::std::exchange(self->m_sched_ready_head, fiber);
+    self->do_push_ready_unlocked(fiber);
     fiber->add_reference();
+    lock.unlock();
+
+    self->do_wake_idle_thread();
     return fiber;
   }
 
@@ -895,15 +1461,35 @@ signal(const Abstract_Future& futr)
     if(!futr.m_sched_waiting_head)
       return false;
 
-    // Splice the two queues.
+    // Parked fibers are appended to the global ready queue, which takes constant
+    // time for each fiber, so unrelated fibers are never scanned. Fibers that
+    // are still being suspended will be put into run queues by their scheduler
+    // threads, so their references from the wait queue are dropped.
     // Fibers are moved from one queue to the other, so there is no need to tamper
-    // with reference counts here.
-    auto mref = ::std::ref(self->m_sched_ready_head);
-    while(mref)
-      mref = ::std::ref(mref.get()->m_sched_ready_next);
+    // with reference counts otherwise.
+    bool woken = false;
+    auto next = ::std::exchange(futr.m_sched_waiting_head, nullptr);
+    while(next) {
+      auto fiber = next;
+      next = fiber->m_sched_ready_next;
+      fiber->m_sched_futp = nullptr;
+
+      if(!fiber->m_sched_parked) {
+        fiber->drop_reference();
+        continue;
+      }
+
+      fiber->m_sched_parked = false;
+      self->do_push_ready_unlocked(fiber);
+      woken = true;
+    }
+
+    if(!woken)
+      return true;
+
+    lock.unlock();
 
-    self->do_signal_if_queues_empty();
-    mref.get() = ::std::exchange(futr.m_sched_waiting_head, nullptr);
+    self->do_wake_idle_thread();
     return true;
   }
 
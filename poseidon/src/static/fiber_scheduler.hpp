@@ -5,17 +5,36 @@
 #define POSEIDON_STATIC_FIBER_SCHEDULER_HPP_
 
 #include "../fwd.hpp"
+#include <typeinfo>
 
 namespace poseidon {
 
+// This is the peak stack usage of finished fibers of the same class. Usage is
+// measured in pages, so it is a multiple of the page size.
+struct Fiber_Stack_Usage
+  {
+    static constexpr size_t histogram_size = 17;
+
+    const ::std::type_info* type = nullptr;
+    uint64_t count = 0;  // number of fibers
+    uint64_t total_size = 0;  // sum of peak usage, in bytes
+    size_t max_size = 0;  // maximum peak usage, in bytes
+
+    // `histogram[k]` is the number of fibers whose peak usage is at most
+    // `4096 << k` bytes, but more than that of the previous element. The last
+    // element also counts larger usage.
+    uint64_t histogram[histogram_size] = { };
+  };
+
 class Fiber_Scheduler
   {
     POSEIDON_STATIC_CLASS_DECLARE(Fiber_Scheduler);
 
   public:
     // Executes fibers and blocks until `exit_sig` becomes non-zero.
-    // This function is typically called by the main thread. Multiple worker
-    // threads are allowed.
+    // This function is typically called by the main thread. Additional scheduler
+    // threads are created according to `fiber.thread_count` in 'main.conf'. Each
+    // thread has its own run queue, and steals fibers from others when idle.
     // This function is thread-safe.
     [[noreturn]] static
     void
@@ -28,6 +47,14 @@ class Fiber_Scheduler
     void
     reload();
 
+    // Gets the peak stack usage of fibers that have finished, by fiber class.
+    // Usage is only measured if `fiber.stack_profiling` is enabled in
+    // 'main.conf'. Otherwise, an empty vector is returned.
+    // This function is thread-safe.
+    static
+    ::std::vector<Fiber_Stack_Usage>
+    stack_usage();
+
     // Gets a pointer to the current fiber on the current thread.
     // Its fiber state is `fiber_state_running`.
     // This function is thread-safe.
@@ -36,6 +63,15 @@ class Fiber_Scheduler
     current_opt()
       noexcept;
 
+    // Checks whether the current thread is running a fiber.
+    // Unlike `current_opt()`, this function may be called on any thread, and
+    // does not log errors on threads other than scheduler threads.
+    // This function is thread-safe.
+    static
+    bool
+    is_in_fiber()
+      noexcept;
+
     // Suspends the current fiber until a future becomes satisfied.
     // `current_opt()` must not return null when this function is called.
     // The pointer is taken by value because the future has to retain a reference
@@ -58,6 +94,7 @@ class Fiber_Scheduler
     insert(uptr<Abstract_Fiber>&& ufiber);
 
     // Wakes up fibers that are suspended on `futr`.
+    // This function takes time proportional to the number of such fibers.
     // This function is thread-safe.
     static
     bool
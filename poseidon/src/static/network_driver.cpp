@@ -6,6 +6,7 @@
 #include "main_config.hpp"
 #include "../core/config_file.hpp"
 #include "../socket/abstract_socket.hpp"
+#include "../socket/abstract_tls_socket.hpp"
 #include "../utils.hpp"
 #include <sys/epoll.h>
 #include <sys/socket.h>
@@ -124,6 +125,10 @@ POSEIDON_STATIC_CLASS_DEFINE(Network_Driver)
       {
         self->m_init_once.call(
           [&] {
+            // Guard files that are mapped by TLS sockets. This must be done
+            // before any socket is polled.
+            Abstract_TLS_Socket::install_sigbus_guard();
+
             // Create an epoll object.
             unique_FD epoll_fd(::epoll_create(100));
             if(!epoll_fd)
@@ -424,8 +429,9 @@ POSEIDON_STATIC_CLASS_DEFINE(Network_Driver)
           bool clear_status;
 
           try {
-            if(sock->do_write_queue_size(lock) > conf.throttle_size) {
-              // If the socket is throttled, remove it from read queue.
+            if(sock->m_read_paused.load() ||
+               (sock->do_write_queue_size(lock) > conf.throttle_size)) {
+              // If the socket is paused or throttled, remove it from read queue.
               detach = true;
               clear_status = false;
             }
@@ -635,4 +641,28 @@ notify_writable_internal(const Abstract_Socket& sock)
     return true;
   }
 
+bool
+Network_Driver::
+notify_readable_internal(Abstract_Socket& sock)
+  noexcept
+  {
+    // If the socket has been removed or closed, don't do anything.
+    simple_mutex::unique_lock lock(self->m_poll_mutex);
+    if(sock.m_epoll_events & (EPOLLERR | EPOLLHUP))
+      return false;
+
+    // Don't do anything if the socket does not exist in epoll.
+    uint32_t index = self->find_poll_socket(sock.m_epoll_data);
+    if(index == poll_index_nil)
+      return false;
+
+    // As `EPOLLIN` is edge-triggered, data that arrived while the socket was
+    // throttled will not be reported again, so restore the status. If there is
+    // nothing to read, it will be cleared after the next read operation.
+    self->do_signal_if_poll_lists_empty();
+    sock.m_epoll_events |= EPOLLIN;
+    self->poll_list_attach(self->m_poll_root_rd, index);
+    return true;
+  }
+
 }  // namespace poseidon
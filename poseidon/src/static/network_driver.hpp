@@ -41,6 +41,15 @@ class Network_Driver
     bool
     notify_writable_internal(const Abstract_Socket& sock)
       noexcept;
+
+    // Notifies the network thread that a socket may be read again, after it has
+    // been throttled by a linked socket or paused.
+    // This is an internal function. You will not want to call it.
+    // This function is thread-safe.
+    static
+    bool
+    notify_readable_internal(Abstract_Socket& sock)
+      noexcept;
   };
 
 }  // namespace poseidon
@@ -0,0 +1,255 @@
+// This file is part of Poseidon.
+// Copyleft 2020, LH_Mouse. All wrongs reserved.
+
+// This program measures how fast files are sent by `HTTP_Static_File_Handler`,
+// by sending 64KiB, 1MiB and 64MiB files over loopback TCP connections to a
+// thread that discards them, in the ways that stream sockets implement
+// `do_socket_stream_sendfile_unlocked()`:
+//   1. `Abstract_Stream_Socket`: the file is read into the 64KiB I/O buffer of
+//      the network driver with `pread()`, then written with `write()`.
+//   2. `Abstract_TCP_Socket`: the file is sent by `sendfile()`.
+//   3. `Abstract_TLS_Socket`: the file is mapped, and 64KiB pieces of the
+//      mapping are written directly. Encryption is not included.
+// Sockets are blocking, so this measures the mechanisms, not the network driver.
+// It also checks that every way delivers the same bytes as the file, so it is
+// run by `make check`. It depends only on the standard library.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr size_t s_io_buffer_size = 65536;
+constexpr int64_t s_bytes_per_test = int64_t(1) << 30;
+
+double
+do_get_seconds()
+  noexcept
+  {
+    ::timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec) * 1e-9;
+  }
+
+enum Method
+  {
+    method_pread_write,
+    method_sendfile,
+    method_mmap_write,
+  };
+
+struct Sender
+  {
+    int fd;
+    const char* map;
+    ::std::vector<char> buf;
+  };
+
+bool
+do_write_all(int sock, const char* data, size_t size)
+  {
+    while(size != 0) {
+      ::ssize_t nwritten = ::write(sock, data, size);
+      if(nwritten < 0)
+        return false;
+
+      data += nwritten;
+      size -= static_cast<size_t>(nwritten);
+    }
+    return true;
+  }
+
+bool
+do_send_file(Sender& sender, int sock, Method method, int64_t offset, int64_t limit)
+  {
+    // Each iteration corresponds to a call to `do_socket_stream_sendfile_unlocked()`.
+    while(limit != 0) {
+      int64_t old_offset = offset;
+      switch(method) {
+        case method_pread_write: {
+          size_t nreq = static_cast<size_t>(::std::min(limit, static_cast<int64_t>(s_io_buffer_size)));
+          ::ssize_t nread = ::pread(sender.fd, sender.buf.data(), nreq, offset);
+          if(nread <= 0)
+            return false;
+
+          if(!do_write_all(sock, sender.buf.data(), static_cast<size_t>(nread)))
+            return false;
+
+          offset += nread;
+          break;
+        }
+
+        case method_sendfile: {
+          ::off_t off = static_cast<::off_t>(offset);
+          size_t nreq = static_cast<size_t>(::std::min<int64_t>(limit, 0x7FFFF000));
+          if(::sendfile(sock, sender.fd, &off, nreq) <= 0)
+            return false;
+
+          offset = static_cast<int64_t>(off);
+          break;
+        }
+
+        case method_mmap_write: {
+          size_t nreq = static_cast<size_t>(::std::min(limit, static_cast<int64_t>(s_io_buffer_size)));
+          ::ssize_t nwritten = ::write(sock, sender.map + offset, nreq);
+          if(nwritten <= 0)
+            return false;
+
+          offset += nwritten;
+          break;
+        }
+      }
+      limit -= offset - old_offset;
+    }
+    return true;
+  }
+
+bool
+do_connect_loopback(int& client, int& server)
+  {
+    int listener = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(listener < 0)
+      return false;
+
+    ::sockaddr_in addr = { };
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ::socklen_t addrlen = sizeof(addr);
+
+    bool ok = (::bind(listener, reinterpret_cast<::sockaddr*>(&addr), addrlen) == 0)
+              && (::listen(listener, 1) == 0)
+              && (::getsockname(listener, reinterpret_cast<::sockaddr*>(&addr), &addrlen) == 0);
+
+    client = ok ? ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0) : -1;
+    ok = ok && (client >= 0)
+         && (::connect(client, reinterpret_cast<::sockaddr*>(&addr), addrlen) == 0);
+
+    server = ok ? ::accept4(listener, nullptr, nullptr, SOCK_CLOEXEC) : -1;
+    ::close(listener);
+    return server >= 0;
+  }
+
+bool
+do_transfer(Sender& sender, Method method, int64_t size, int64_t rounds, const char* expect)
+  {
+    // The server socket sends the file `rounds` times. The client socket reads
+    // until end of stream, and compares the data with `expect` if it is not null.
+    int client, server;
+    if(!do_connect_loopback(client, server))
+      return false;
+
+    int64_t nrecv = 0;
+    bool match = true;
+    ::std::thread reader(
+        [&] {
+          ::std::vector<char> rbuf(1048576);
+          for(;;) {
+            ::ssize_t nread = ::read(client, rbuf.data(), rbuf.size());
+            if(nread <= 0)
+              break;
+
+            for(size_t k = 0;  expect && (k != static_cast<size_t>(nread));  ) {
+              size_t pos = static_cast<size_t>((nrecv + static_cast<int64_t>(k)) % size);
+              size_t n = ::std::min(static_cast<size_t>(nread) - k,
+                                    static_cast<size_t>(size) - pos);
+              match &= ::memcmp(rbuf.data() + k, expect + pos, n) == 0;
+              k += n;
+            }
+            nrecv += nread;
+          }
+        });
+
+    bool sent = true;
+    for(int64_t r = 0;  sent && (r != rounds);  ++r)
+      sent = do_send_file(sender, server, method, 0, size);
+
+    ::shutdown(server, SHUT_WR);
+    reader.join();
+    ::close(server);
+    ::close(client);
+    return sent && match && (nrecv == size * rounds);
+  }
+
+}  // namespace
+
+int
+main()
+  {
+    static constexpr int64_t s_sizes[] = { 65536, 1048576, 67108864 };
+    static constexpr Method s_methods[] = { method_pread_write, method_sendfile,
+                                            method_mmap_write };
+    static constexpr const char* s_names[] = { "pread() + write()", "sendfile()",
+                                               "mmap() + write()" };
+    const int64_t max_size = s_sizes[2];
+
+    // Make a file of pseudo-random bytes. It is unlinked at once, so it is
+    // removed even if this program fails.
+    char path[] = "/tmp/poseidon-static-file-XXXXXX";
+    int fd = ::mkstemp(path);
+    if(fd < 0)
+      return 1;
+
+    ::unlink(path);
+    ::std::vector<char> data(static_cast<size_t>(max_size));
+    uint32_t seed = 1;
+    for(char& ch : data) {
+      seed = seed * 1103515245 + 12345;
+      ch = static_cast<char>(seed >> 24);
+    }
+    if(::pwrite(fd, data.data(), data.size(), 0) != static_cast<::ssize_t>(data.size()))
+      return 1;
+
+    Sender sender;
+    sender.fd = fd;
+    sender.buf.resize(s_io_buffer_size);
+    void* map = ::mmap(nullptr, data.size(), PROT_READ, MAP_SHARED, fd, 0);
+    if(map == MAP_FAILED)
+      return 1;
+
+    sender.map = static_cast<const char*>(map);
+
+    // Check that all ways deliver the file intact. The size is not a multiple
+    // of the buffer size, so partial pieces are sent, too.
+    for(size_t k = 0;  k != 3;  ++k)
+      if(!do_transfer(sender, s_methods[k], 1048576 + 12345, 3, data.data())) {
+        ::fprintf(stderr, "File transfer check failed: %s (errno %d)\n", s_names[k], errno);
+        return 1;
+      }
+
+    for(int64_t size : s_sizes) {
+      int64_t rounds = ::std::max<int64_t>(s_bytes_per_test / size, 1);
+      double base_secs = 0;
+      for(size_t k = 0;  k != 3;  ++k) {
+        double start = do_get_seconds();
+        if(!do_transfer(sender, s_methods[k], size, rounds, nullptr)) {
+          ::fprintf(stderr, "File transfer failed: %s (errno %d)\n", s_names[k], errno);
+          return 1;
+        }
+        double secs = do_get_seconds() - start;
+        if(k == 0)
+          base_secs = secs;
+
+        double bits = static_cast<double>(size * rounds) * 8;
+        ::printf("%8lld bytes  %-18s %7.2f Gbit/s  %5.2fx\n",
+                 static_cast<long long>(size), s_names[k], bits / secs * 1e-9,
+                 base_secs / secs);
+      }
+    }
+
+    ::munmap(map, data.size());
+    ::close(fd);
+    return 0;
+  }
@@ -0,0 +1,279 @@
+// This file is part of Poseidon.
+// Copyleft 2020, LH_Mouse. All wrongs reserved.
+
+// This program measures how the output buffer of a deflate stream is sized,
+// by compressing 1MiB bodies into gzip format with plain zlib:
+//   1. The old way: 64 bytes are reserved before each call to `deflate()`,
+//      and output is copied from the stream buffer into a socket queue.
+//   2. The new way: output is reserved according to `deflateBound()`, and
+//      is still copied into a socket queue (`write()` and `finish()`).
+//   3. The new way, but output is written into the socket queue directly
+//      (`write_into()` and `finish_into()`).
+// Each body is compressed into new buffers, like the first response of a new
+// connection. Buffers are grown either geometrically, or to the exact size that
+// is requested; the old way depends heavily on it. All outputs are checked by
+// decompressing them, so it is run by `make check`. It depends only on the
+// standard library and zlib.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#define ZLIB_CONST 1
+#include <zlib.h>
+#include <algorithm>
+#include <vector>
+
+namespace {
+
+constexpr size_t s_body_size = 1048576;
+constexpr int s_rounds = 20;
+
+double
+do_get_seconds()
+  noexcept
+  {
+    ::timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec) * 1e-9;
+  }
+
+// This is a simplified `linear_buffer`.
+class Buffer
+  {
+  private:
+    char* m_data = nullptr;
+    size_t m_size = 0;
+    size_t m_cap = 0;
+    bool m_exact;
+
+  public:
+    size_t nrealloc = 0;
+
+  public:
+    explicit
+    Buffer(bool exact)
+      : m_exact(exact)
+      { }
+
+    Buffer(const Buffer&)
+      = delete;
+
+    Buffer&
+    operator=(const Buffer&)
+      = delete;
+
+    ~Buffer()
+      { ::free(this->m_data);  }
+
+  public:
+    const char*
+    data()
+      const noexcept
+      { return this->m_data;  }
+
+    size_t
+    size()
+      const noexcept
+      { return this->m_size;  }
+
+    void
+    clear()
+      noexcept
+      { this->m_size = 0;  }
+
+    // Ensures at least `nadd` bytes are available, and returns the number
+    // of bytes that are available.
+    size_t
+    reserve(size_t nadd)
+      {
+        if(this->m_cap - this->m_size >= nadd)
+          return this->m_cap - this->m_size;
+
+        size_t cap = this->m_size + nadd;
+        if(!this->m_exact)
+          cap = ::std::max(cap, this->m_cap * 2);
+        auto ptr = static_cast<char*>(::realloc(this->m_data, cap));
+        if(!ptr)
+          ::abort();
+
+        this->m_data = ptr;
+        this->m_cap = cap;
+        this->nrealloc++;
+        return cap - this->m_size;
+      }
+
+    char*
+    mut_end()
+      noexcept
+      { return this->m_data + this->m_size;  }
+
+    void
+    accept(size_t nbytes)
+      noexcept
+      { this->m_size += nbytes;  }
+
+    void
+    putn(const char* data, size_t size)
+      {
+        this->reserve(size);
+        ::memcpy(this->mut_end(), data, size);
+        this->accept(size);
+      }
+  };
+
+enum Policy
+  {
+    policy_old_64,
+    policy_bound_copy,
+    policy_bound_direct,
+  };
+
+struct Result
+  {
+    double secs = 0;
+    uint64_t ncalls = 0;
+    uint64_t nrealloc = 0;
+    size_t out_size = 0;
+  };
+
+bool
+do_deflate_into(Buffer& obuf, ::z_stream* strm, int flush, Policy policy, uint64_t& ncalls)
+  {
+    int res;
+    do {
+      // Reserve output space like `zlib_Stream_Common` does.
+      size_t nres = 64;
+      if((policy != policy_old_64) && (flush == Z_NO_FLUSH))
+        nres = ::deflateBound(strm, strm->avail_in);
+      else if(policy != policy_old_64)
+        nres = ::deflateBound(strm, 0) + 1024;
+
+      size_t navail = obuf.reserve(nres);
+      strm->next_out = reinterpret_cast<uint8_t*>(obuf.mut_end());
+      strm->avail_out = static_cast<uint32_t>(::std::min<size_t>(navail, 0x7FFFFFFF));
+      res = ::deflate(strm, flush);
+      ncalls++;
+      obuf.accept(static_cast<size_t>(reinterpret_cast<char*>(strm->next_out) - obuf.mut_end()));
+
+      if((res != Z_OK) && (res != Z_STREAM_END) && (res != Z_BUF_ERROR))
+        return false;
+    }
+    while((flush == Z_NO_FLUSH) ? (strm->avail_in != 0) : (res == Z_OK));
+    return true;
+  }
+
+bool
+do_run(Result& result, const ::std::vector<char>& body, Policy policy, bool exact,
+       ::std::vector<char>& output)
+  {
+    ::z_stream strm = { };
+    if(::deflateInit2(&strm, 6, Z_DEFLATED, 31, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+      return false;
+
+    double start = do_get_seconds();
+    for(int r = 0;  r != s_rounds;  ++r) {
+      // Each round compresses a body into new buffers. The stream is reset,
+      // like a stream taken from the pool.
+      ::deflateReset(&strm);
+      Buffer queue(exact);
+      Buffer obuf(exact);
+
+      Buffer& out = (policy == policy_bound_direct) ? queue : obuf;
+      strm.next_in = reinterpret_cast<const uint8_t*>(body.data());
+      strm.avail_in = static_cast<uint32_t>(body.size());
+      if(!do_deflate_into(out, &strm, Z_NO_FLUSH, policy, result.ncalls))
+        return false;
+      if(!do_deflate_into(out, &strm, Z_FINISH, policy, result.ncalls))
+        return false;
+
+      if(policy != policy_bound_direct)
+        queue.putn(obuf.data(), obuf.size());
+
+      result.nrealloc += obuf.nrealloc + queue.nrealloc;
+      output.assign(queue.data(), queue.data() + queue.size());
+    }
+    result.secs = do_get_seconds() - start;
+    result.out_size = output.size();
+    ::deflateEnd(&strm);
+    return true;
+  }
+
+bool
+do_check(const ::std::vector<char>& output, const ::std::vector<char>& body)
+  {
+    ::std::vector<char> check(body.size() + 1);
+    ::z_stream strm = { };
+    if(::inflateInit2(&strm, 31) != Z_OK)
+      return false;
+
+    strm.next_in = reinterpret_cast<const uint8_t*>(output.data());
+    strm.avail_in = static_cast<uint32_t>(output.size());
+    strm.next_out = reinterpret_cast<uint8_t*>(check.data());
+    strm.avail_out = static_cast<uint32_t>(check.size());
+    int res = ::inflate(&strm, Z_FINISH);
+    size_t nout = check.size() - strm.avail_out;
+    ::inflateEnd(&strm);
+    return (res == Z_STREAM_END) && (nout == body.size()) &&
+           (::memcmp(check.data(), body.data(), nout) == 0);
+  }
+
+bool
+do_benchmark(const char* name, const ::std::vector<char>& body, bool exact)
+  {
+    static constexpr Policy s_policies[] = { policy_old_64, policy_bound_copy,
+                                             policy_bound_direct };
+    static constexpr const char* s_names[] = { "64 bytes, copied", "deflateBound(), copied",
+                                               "deflateBound(), direct" };
+    double base_secs = 0;
+    for(size_t k = 0;  k != 3;  ++k) {
+      Result result;
+      ::std::vector<char> output;
+      if(!do_run(result, body, s_policies[k], exact, output) || !do_check(output, body)) {
+        ::fprintf(stderr, "Compression check failed: %s, %s\n", name, s_names[k]);
+        return false;
+      }
+
+      if(k == 0)
+        base_secs = result.secs;
+
+      double mib = static_cast<double>(body.size()) * s_rounds / 1048576.0;
+      ::printf("%-12s %-9s %-24s %7.1f MiB/s %6.2fx %8.1f calls %7.1f reallocs %8zu bytes\n",
+               name, exact ? "exact" : "doubling", s_names[k], mib / result.secs, base_secs / result.secs,
+               static_cast<double>(result.ncalls) / s_rounds,
+               static_cast<double>(result.nrealloc) / s_rounds, result.out_size);
+    }
+    return true;
+  }
+
+}  // namespace
+
+int
+main()
+  {
+    // Make a body of JSON-like text, which compresses well.
+    ::std::vector<char> text;
+    uint32_t seed = 1;
+    while(text.size() < s_body_size) {
+      seed = seed * 1103515245 + 12345;
+      char line[128];
+      int n = ::sprintf(line, "{\"id\":%u,\"name\":\"user%u\",\"score\":%u,\"active\":%s},\n",
+                        seed >> 16, (seed >> 8) & 0xFFF, seed & 0xFFFF,
+                        (seed & 0x100) ? "true" : "false");
+      text.insert(text.end(), line, line + n);
+    }
+    text.resize(s_body_size);
+
+    // Make a body of pseudo-random bytes, which can't be compressed.
+    ::std::vector<char> random(s_body_size);
+    for(char& ch : random) {
+      seed = seed * 1103515245 + 12345;
+      ch = static_cast<char>(seed >> 24);
+    }
+
+    for(bool exact : { false, true })
+      if(!do_benchmark("1MiB text", text, exact) || !do_benchmark("1MiB random", random, exact))
+        return 1;
+    return 0;
+  }